@@ -29,6 +29,7 @@
 ConVar rr_debugresponses( "rr_debugresponses", "0", FCVAR_NONE, "Show verbose matching output (1 for simple, 2 for rule scoring). If set to 3, it will only show response success/failure for npc_selected NPCs." );
 ConVar rr_debugrule( "rr_debugrule", "", FCVAR_NONE, "If set to the name of the rule, that rule's score will be shown whenever a concept is passed into the response rules system.");
 ConVar rr_dumpresponses( "rr_dumpresponses", "0", FCVAR_NONE, "Dump all response_rules.txt and rules (requires restart)" );
+ConVar rr_ruleindex( "rr_ruleindex", "1", FCVAR_NONE, "Only score the rules that can match the query's value for the most commonly required criterion (usually concept)." );
 
 static CUtlSymbolTable g_RS;
 
@@ -59,6 +60,7 @@ public:
 		maxequals = false;
 		maxval = 0.0f;
 		minval = 0.0f;
+		tokenval = 0.0f;
 
 		token = UTL_INVAL_SYMBOL;
 		rawtoken = UTL_INVAL_SYMBOL;
@@ -110,6 +112,7 @@ public:
 
 	float	maxval;
 	float	minval;
+	float	tokenval;		// token as a number, for isnumeric matchers
 
 	bool	valid : 1;      //1
 	bool	isnumeric : 1;  //2
@@ -683,6 +686,16 @@ public:
 	float		LookupEnumeration( const char *name, bool& found );
 
 	int			FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose );
+	void		GatherBestMatchingRules( const AI_CriteriaSet& set, bool verbose, bool bUseIndex, CUtlVector< int > &bestrules );
+	void		ScoreRuleForBest( const AI_CriteriaSet& set, int irule, bool verbose, float &bestscore, CUtlVector< int > &bestrules );
+
+	void		BuildRuleIndex();
+	bool		GetIndexKeyCriterion( Rule *rule, Criteria **ppKey );
+	void		AppendSatisfyingCriteria( Criteria *c, AI_CriteriaSet &set );
+
+public:
+	void		Benchmark( int iterations );
+protected:
 
 	float		ScoreCriteriaAgainstRule( const AI_CriteriaSet& set, int irule, bool verbose = false );
 	float		RecursiveScoreSubcriteriaAgainstRule( const AI_CriteriaSet& set, Criteria *parent, bool& exclude, bool verbose /*=false*/ );
@@ -710,6 +723,15 @@ public:
 	CUtlDict< Rule, short >	m_Rules;
 	CUtlDict< Enumeration, short > m_Enumerations;
 
+	// Rules partitioned on the value they require for m_RuleIndexKey, the criterion that the most
+	// rules need an exact value for. A query only scores the partition for its own value plus the
+	// rules that don't require one.
+	bool		m_bRuleIndexDirty;
+	CUtlString	m_RuleIndexKey;
+	CUtlDict< int, int >	m_RuleIndex;				// key value -> m_RulePartitions index
+	CUtlVector< CUtlVector< unsigned short > >	m_RulePartitions;
+	CUtlVector< unsigned short >	m_UnindexedRules;
+
 	char		token[ 1204 ];
 
 	bool		m_bUnget;
@@ -762,6 +784,7 @@ CResponseSystem::CResponseSystem()
 	m_bUnget = false;
 	m_bPrecache = true;
 	m_bCustomManagable = false;
+	m_bRuleIndexDirty = true;
 }
 
 //-----------------------------------------------------------------------------
@@ -817,6 +840,11 @@ void CResponseSystem::Clear()
 	m_Criteria.RemoveAll();
 	m_Rules.RemoveAll();
 	m_Enumerations.RemoveAll();
+
+	m_RuleIndex.RemoveAll();
+	m_RulePartitions.RemoveAll();
+	m_UnindexedRules.RemoveAll();
+	m_bRuleIndexDirty = true;
 }
 
 //-----------------------------------------------------------------------------
@@ -988,6 +1016,7 @@ void CResponseSystem::ComputeMatcher( Criteria *c, Matcher& matcher )
 
 	matcher.SetToken( token );
 	matcher.SetRaw( rawtoken );
+	matcher.tokenval = (float)atof( token );
 	matcher.valid = true;
 }
 
@@ -996,11 +1025,16 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 	if ( !m.valid )
 		return false;
 
-	float v = (float)atof( setValue );
-	if ( setValue[0] == '[' )
+	// plain string matchers don't need the value as a number
+	float v = 0.0f;
+	if ( m.isnumeric || m.usemin || m.usemax )
 	{
-		bool found = false;
-		v = LookupEnumeration( setValue, found );
+		v = (float)atof( setValue );
+		if ( setValue[0] == '[' )
+		{
+			bool found = false;
+			v = LookupEnumeration( setValue, found );
+		}
 	}
 	
 	int minmaxcount = 0;
@@ -1047,7 +1081,7 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 	{
 		if ( m.isnumeric )
 		{
-			if ( v == (float)atof( m.GetToken() ) )
+			if ( v == m.tokenval )
 				return false;
 		}
 		else
@@ -1066,7 +1100,7 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 		if ( !setValue || !setValue[0] )
 			return false;
 
-		return v == (float)atof( m.GetToken() );
+		return v == m.tokenval;
 	}
 
 	return !Q_stricmp( setValue, m.GetToken() ) ? true : false;
@@ -1677,36 +1711,203 @@ bool CResponseSystem::GetBestResponse( ResponseSearchResult& searchResult, Rule
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: 
-// Input  : set - 
-//			verbose - 
-// Output : int
+// Purpose: A top level criterion that's required and matches a single string exactly.
+//			Any query with a different value scores the rule zero.
 //-----------------------------------------------------------------------------
-int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose )
+static bool IsRequiredExactCriterion( Criteria *c )
 {
-	CUtlVector< int >	bestrules;
-	float bestscore = 0.001f;
+	if ( c->IsSubCriteriaType() || !c->required || !c->name )
+		return false;
+
+	const Matcher &m = c->matcher;
+	return m.valid && !m.isnumeric && !m.notequal && !m.usemin && !m.usemax;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the rule's required exact criterion on m_RuleIndexKey, if it has one
+//-----------------------------------------------------------------------------
+bool CResponseSystem::GetIndexKeyCriterion( Rule *rule, Criteria **ppKey )
+{
+	for ( int i = 0; i < rule->m_Criteria.Count(); i++ )
+	{
+		Criteria *c = &m_Criteria[ rule->m_Criteria[ i ] ];
+		if ( !IsRequiredExactCriterion( c ) || Q_stricmp( c->name, m_RuleIndexKey.Get() ) )
+			continue;
+
+		*ppKey = c;
+		return true;
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Partitions the rules on the criterion name most of them require an
+//			exact value for
+//-----------------------------------------------------------------------------
+void CResponseSystem::BuildRuleIndex()
+{
+	m_RuleIndex.RemoveAll();
+	m_RulePartitions.RemoveAll();
+	m_UnindexedRules.RemoveAll();
+	m_RuleIndexKey.Clear();
+	m_bRuleIndexDirty = false;
 
 	int c = m_Rules.Count();
-	int i;
-	for ( i = 0; i < c; i++ )
+
+	// Count the rules each criterion name could index
+	CUtlDict< int, int > keyCounts;
+	for ( int i = 0; i < c; i++ )
 	{
-		float score = ScoreCriteriaAgainstRule( set, i, verbose );
-		// Check equals so that we keep track of all matching rules
-		if ( score >= bestscore )
+		Rule *rule = &m_Rules[ i ];
+
+		// a rule counts once per name, even if it tests the name more than once
+		CUtlDict< int, int > ruleKeys;
+		for ( int j = 0; j < rule->m_Criteria.Count(); j++ )
 		{
-			// Reset bucket
-			if( score != bestscore )
+			Criteria *crit = &m_Criteria[ rule->m_Criteria[ j ] ];
+			if ( !IsRequiredExactCriterion( crit ) )
+				continue;
+
+			if ( ruleKeys.Find( crit->name ) == ruleKeys.InvalidIndex() )
 			{
-				bestscore = score;
-				bestrules.RemoveAll();
+				ruleKeys.Insert( crit->name, 0 );
 			}
+		}
+
+		for ( int j = ruleKeys.First(); j != ruleKeys.InvalidIndex(); j = ruleKeys.Next( j ) )
+		{
+			int idx = keyCounts.Find( ruleKeys.GetElementName( j ) );
+			if ( idx == keyCounts.InvalidIndex() )
+			{
+				idx = keyCounts.Insert( ruleKeys.GetElementName( j ), 0 );
+			}
+			++keyCounts[ idx ];
+		}
+	}
+
+	int bestCount = 0;
+	for ( int i = keyCounts.First(); i != keyCounts.InvalidIndex(); i = keyCounts.Next( i ) )
+	{
+		if ( keyCounts[ i ] > bestCount )
+		{
+			bestCount = keyCounts[ i ];
+			m_RuleIndexKey = keyCounts.GetElementName( i );
+		}
+	}
+
+	// Rules are added in order, so each partition stays sorted by rule index
+	for ( int i = 0; i < c; i++ )
+	{
+		Criteria *key = NULL;
+		if ( m_RuleIndexKey.IsEmpty() || !GetIndexKeyCriterion( &m_Rules[ i ], &key ) )
+		{
+			m_UnindexedRules.AddToTail( i );
+			continue;
+		}
+
+		const char *pszValue = key->matcher.GetToken();
+		int idx = m_RuleIndex.Find( pszValue );
+		if ( idx == m_RuleIndex.InvalidIndex() )
+		{
+			idx = m_RuleIndex.Insert( pszValue, m_RulePartitions.AddToTail() );
+		}
+		m_RulePartitions[ m_RuleIndex[ idx ] ].AddToTail( i );
+	}
+
+	DevMsg( 2, "Response rules: %d rules, %d partitioned by '%s' into %d values, %d always scored\n",
+		c, c - m_UnindexedRules.Count(), m_RuleIndexKey.Get(), m_RuleIndex.Count(), m_UnindexedRules.Count() );
+}
+
+void CResponseSystem::ScoreRuleForBest( const AI_CriteriaSet& set, int irule, bool verbose, float &bestscore, CUtlVector< int > &bestrules )
+{
+	float score = ScoreCriteriaAgainstRule( set, irule, verbose );
+	// Check equals so that we keep track of all matching rules
+	if ( score >= bestscore )
+	{
+		// Reset bucket
+		if( score != bestscore )
+		{
+			bestscore = score;
+			bestrules.RemoveAll();
+		}
+
+		// Add to bucket
+		bestrules.AddToTail( irule );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Collects the rules tied for the best score, in rule order
+//-----------------------------------------------------------------------------
+void CResponseSystem::GatherBestMatchingRules( const AI_CriteriaSet& set, bool verbose, bool bUseIndex, CUtlVector< int > &bestrules )
+{
+	float bestscore = 0.001f;
 
-			// Add to bucket
-			bestrules.AddToTail( i );
+	// Debugging output wants to see every rule scored
+	const char *pszDebugRule = rr_debugrule.GetString();
+	if ( !bUseIndex || verbose || ( pszDebugRule && pszDebugRule[0] ) )
+	{
+		int c = m_Rules.Count();
+		for ( int i = 0; i < c; i++ )
+		{
+			ScoreRuleForBest( set, i, verbose, bestscore, bestrules );
 		}
+		return;
 	}
 
+	if ( m_bRuleIndexDirty )
+	{
+		BuildRuleIndex();
+	}
+
+	// A missing criterion compares as an empty string
+	const char *pszValue = "";
+	int found = m_RuleIndexKey.IsEmpty() ? -1 : set.FindCriterionIndex( m_RuleIndexKey.Get() );
+	if ( found != -1 )
+	{
+		pszValue = set.GetValue( found );
+		if ( !pszValue )
+		{
+			// scoring skips a criterion with no value rather than failing it
+			GatherBestMatchingRules( set, verbose, false, bestrules );
+			return;
+		}
+	}
+
+	static CUtlVector< unsigned short > s_EmptyPartition;
+	int idx = m_RuleIndex.Find( pszValue );
+	const CUtlVector< unsigned short > &partition = ( idx != m_RuleIndex.InvalidIndex() ) ? m_RulePartitions[ m_RuleIndex[ idx ] ] : s_EmptyPartition;
+
+	// Merge the two sorted lists so ties come out in the same order as a full scan
+	int i = 0, j = 0;
+	while ( i < partition.Count() || j < m_UnindexedRules.Count() )
+	{
+		int irule;
+		if ( j >= m_UnindexedRules.Count() || ( i < partition.Count() && partition[ i ] < m_UnindexedRules[ j ] ) )
+		{
+			irule = partition[ i++ ];
+		}
+		else
+		{
+			irule = m_UnindexedRules[ j++ ];
+		}
+
+		ScoreRuleForBest( set, irule, verbose, bestscore, bestrules );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+// Input  : set - 
+//			verbose - 
+// Output : int
+//-----------------------------------------------------------------------------
+int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose )
+{
+	CUtlVector< int >	bestrules;
+	GatherBestMatchingRules( set, verbose, rr_ruleindex.GetBool(), bestrules );
+
 	int bestCount = bestrules.Count();
 	if ( bestCount <= 0 )
 		return -1;
@@ -1723,6 +1924,133 @@ int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbo
 	return bestrules[ idx ];
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Adds values to the set that pass the criterion, for benchmarking
+//-----------------------------------------------------------------------------
+void CResponseSystem::AppendSatisfyingCriteria( Criteria *c, AI_CriteriaSet &set )
+{
+	if ( c->IsSubCriteriaType() )
+	{
+		for ( int i = 0; i < c->subcriteria.Count(); i++ )
+		{
+			AppendSatisfyingCriteria( &m_Criteria[ c->subcriteria[ i ] ], set );
+		}
+		return;
+	}
+
+	Matcher &m = c->matcher;
+	if ( !c->name || !m.valid )
+		return;
+
+	float v;
+	if ( m.usemin && m.usemax )
+	{
+		v = ( m.minval + m.maxval ) * 0.5f;
+	}
+	else if ( m.usemin )
+	{
+		v = m.minval + 1.0f;
+	}
+	else if ( m.usemax )
+	{
+		v = m.maxval - 1.0f;
+	}
+	else if ( m.notequal )
+	{
+		v = m.tokenval + 1.0f;
+		if ( !m.isnumeric )
+		{
+			set.AppendCriteria( c->name, "rr_benchmark" );
+			return;
+		}
+	}
+	else
+	{
+		set.AppendCriteria( c->name, m.GetToken() );
+		return;
+	}
+
+	set.AppendCriteria( c->name, CFmtStr( "%f", v ) );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times rule matching with and without the rule index, querying with a
+//			criteria set built to satisfy each rule in turn. Also checks that both
+//			find the same rules.
+//-----------------------------------------------------------------------------
+void CResponseSystem::Benchmark( int iterations )
+{
+	int c = m_Rules.Count();
+	if ( c <= 0 )
+	{
+		Msg( "No response rules loaded\n" );
+		return;
+	}
+
+	CUtlVector< AI_CriteriaSet > sets;
+	sets.SetCount( c );
+	for ( int i = 0; i < c; i++ )
+	{
+		Rule *rule = &m_Rules[ i ];
+		for ( int j = 0; j < rule->m_Criteria.Count(); j++ )
+		{
+			AppendSatisfyingCriteria( &m_Criteria[ rule->m_Criteria[ j ] ], sets[ i ] );
+		}
+	}
+
+	if ( m_bRuleIndexDirty )
+	{
+		BuildRuleIndex();
+	}
+
+	// Check first, so the timings below are comparing like with like
+	int mismatches = 0;
+	CUtlVector< int > scanRules, indexRules;
+	for ( int i = 0; i < c; i++ )
+	{
+		scanRules.RemoveAll();
+		indexRules.RemoveAll();
+		GatherBestMatchingRules( sets[ i ], false, false, scanRules );
+		GatherBestMatchingRules( sets[ i ], false, true, indexRules );
+
+		bool bSame = ( scanRules.Count() == indexRules.Count() );
+		for ( int j = 0; bSame && j < scanRules.Count(); j++ )
+		{
+			bSame = ( scanRules[ j ] == indexRules[ j ] );
+		}
+
+		if ( !bSame )
+		{
+			if ( ++mismatches <= 10 )
+			{
+				Warning( "Rule index disagrees with a full scan for the query built from rule '%s'\n", m_Rules.GetElementName( i ) );
+			}
+		}
+	}
+
+	double flTime[ 2 ];
+	for ( int bUseIndex = 0; bUseIndex < 2; bUseIndex++ )
+	{
+		double flStart = Plat_FloatTime();
+		for ( int n = 0; n < iterations; n++ )
+		{
+			for ( int i = 0; i < c; i++ )
+			{
+				scanRules.RemoveAll();
+				GatherBestMatchingRules( sets[ i ], false, bUseIndex != 0, scanRules );
+			}
+		}
+		flTime[ bUseIndex ] = Plat_FloatTime() - flStart;
+	}
+
+	int nQueries = c * iterations;
+	Msg( "%d rules, %d partitioned by '%s' into %d values, %d always scored\n",
+		c, c - m_UnindexedRules.Count(), m_RuleIndexKey.Get(), m_RuleIndex.Count(), m_UnindexedRules.Count() );
+	Msg( "%d queries: full scan %.3f ms (%.2f us/query), rule index %.3f ms (%.2f us/query)\n",
+		nQueries, flTime[ 0 ] * 1000.0, flTime[ 0 ] * 1000000.0 / nQueries, flTime[ 1 ] * 1000.0, flTime[ 1 ] * 1000000.0 / nQueries );
+	Msg( "%d queries found different rules\n", mismatches );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : set - 
@@ -2607,6 +2935,7 @@ void CResponseSystem::ParseRule( void )
 	if ( validRule )
 	{
 		m_Rules.Insert( ruleName, newRule );
+		m_bRuleIndexDirty = true;
 	}
 	else
 	{
@@ -2804,6 +3133,7 @@ void CResponseSystem::CopyRuleFrom( Rule *pSrcRule, int iRule, CResponseSystem *
 
 	// Add rule.
 	pCustomSystem->m_Rules.Insert( m_Rules.GetElementName( iRule ), dstRule );
+	pCustomSystem->m_bRuleIndexDirty = true;
 }
 
 //-----------------------------------------------------------------------------
@@ -3034,6 +3364,15 @@ void CDefaultResponseSystem::DestroyCustomResponseSystems()
 static CDefaultResponseSystem defaultresponsesytem;
 IResponseSystem *g_pResponseSystem = &defaultresponsesytem;
 
+CON_COMMAND( rr_benchmark, "Time response rule matching with and without the rule index. Arguments: <iterations>" )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int iterations = ( args.ArgC() > 1 ) ? MAX( atoi( args[ 1 ] ), 1 ) : 10;
+	defaultresponsesytem.Benchmark( iterations );
+}
+
 CON_COMMAND( rr_reloadresponsesystems, "Reload all response system scripts." )
 {
 	if ( !UTIL_IsCommandIssuedByServerAdmin() )
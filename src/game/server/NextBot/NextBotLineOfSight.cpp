@@ -0,0 +1,336 @@
+// NextBotLineOfSight.cpp
+// Batched and cached line-of-sight queries for NextBot vision
+//========= Copyright Valve Corporation, All rights reserved. ============//
+
+#include "cbase.h"
+
+#include "NextBot.h"
+#include "NextBotLineOfSight.h"
+#include "NextBotUtil.h"
+
+#include "tier0/vprof.h"
+#include "datacache/imdlcache.h"
+#include "vstdlib/jobthread.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+ConVar nb_vision_los_ttl( "nb_vision_los_ttl", "0.1", FCVAR_CHEAT, "How long, in seconds, a bot's line-of-sight result to an entity is reused. Negative disables reuse." );
+
+
+//----------------------------------------------------------------------------------------------------------------
+inline bool IsClearTrace( const trace_t &result )
+{
+	return ( result.fraction >= 1.0f && !result.startsolid );
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+NextBotLineOfSight::NextBotLineOfSight( void )
+{
+	m_expireTimer.Invalidate();
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+void NextBotLineOfSight::Reset( void )
+{
+	m_queryVector.RemoveAll();
+	m_jobVector.RemoveAll();
+	m_pendingPairs.RemoveAll();
+	m_cache.RemoveAll();
+	m_expireTimer.Invalidate();
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+/**
+ * Drop cached results nobody can use any more, so entities that went away don't pile up
+ */
+void NextBotLineOfSight::Update( void )
+{
+	if ( !m_expireTimer.IsElapsed() )
+	{
+		return;
+	}
+
+	m_expireTimer.Start( 1.0f );
+
+	float ttl = nb_vision_los_ttl.GetFloat();
+
+	UtlHashHandle_t h = m_cache.FirstHandle();
+	while ( h != m_cache.InvalidHandle() )
+	{
+		if ( ttl < 0.0f || gpGlobals->curtime - m_cache[h].m_timestamp > ttl )
+		{
+			h = m_cache.RemoveAndAdvance( h );
+		}
+		else
+		{
+			h = m_cache.NextHandle( h );
+		}
+	}
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+void NextBotLineOfSight::BeginBatch( void )
+{
+	m_queryVector.RemoveAll();
+	m_jobVector.RemoveAll();
+	m_pendingPairs.RemoveAll();
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+/**
+ * Queue the question "can 'viewer' standing at 'eyePos' see 'subject'" and return its index.
+ * The answer may already be known, in which case nothing is traced.
+ */
+int NextBotLineOfSight::AddEntityQuery( CBaseCombatCharacter *viewer, const Vector &eyePos, CBaseEntity *subject )
+{
+	int index = m_queryVector.AddToTail();
+	Query_t &query = m_queryVector[ index ];
+	query.m_viewer = viewer;
+	query.m_subject = subject;
+	query.m_eyePos = eyePos;
+	query.m_reverse = -1;
+	query.m_isClear = false;
+
+	// reject pairs the nav mesh knows cannot see each other before anything else
+	CBaseCombatCharacter *combat = subject->MyCombatCharacterPointer();
+	if ( combat )
+	{
+		CNavArea *viewerArea = viewer->GetLastKnownArea();
+		CNavArea *subjectArea = combat->GetLastKnownArea();
+		if ( viewerArea && subjectArea && !viewerArea->IsPotentiallyVisible( subjectArea ) )
+		{
+			VPROF_INCREMENT_COUNTER( "NextBotLineOfSight( pvs rejects )", 1 );
+			query.m_visibleSpot = eyePos;
+			return index;
+		}
+	}
+
+	if ( GetCachedResult( viewer, subject, &query.m_isClear, &query.m_visibleSpot ) )
+	{
+		VPROF_INCREMENT_COUNTER( "NextBotLineOfSight( cache hits )", 1 );
+		return index;
+	}
+
+	query.m_spot[ SPOT_CENTER ] = subject->WorldSpaceCenter();
+	query.m_spot[ SPOT_EYES ] = subject->EyePosition();
+	query.m_spot[ SPOT_FEET ] = subject->GetAbsOrigin();
+
+	// if the subject is looking back at us along the very same ray, ride along with its trace
+	UtlHashHandle_t h = m_pendingPairs.Find( PairKey( subject, viewer ) );
+	if ( h != m_pendingPairs.InvalidHandle() )
+	{
+		int other = m_pendingPairs[h];
+		Query_t &reverse = m_queryVector[ other ];
+
+		if ( reverse.m_reverse < 0 && reverse.m_eyePos == query.m_spot[ SPOT_EYES ] && reverse.m_spot[ SPOT_EYES ] == eyePos )
+		{
+			VPROF_INCREMENT_COUNTER( "NextBotLineOfSight( shared pairs )", 1 );
+			reverse.m_reverse = index;
+			query.m_reverse = other;
+			return index;
+		}
+	}
+
+	m_pendingPairs.Insert( PairKey( viewer, subject ), index );
+	m_jobVector.AddToTail( index );
+
+	return index;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+int NextBotLineOfSight::AddPositionQuery( CBaseCombatCharacter *viewer, const Vector &eyePos, const Vector &pos )
+{
+	int index = m_queryVector.AddToTail();
+	Query_t &query = m_queryVector[ index ];
+	query.m_viewer = viewer;
+	query.m_subject = NULL;
+	query.m_eyePos = eyePos;
+	query.m_spot[ SPOT_CENTER ] = pos;
+	query.m_reverse = -1;
+	query.m_isClear = false;
+
+	m_jobVector.AddToTail( index );
+
+	return index;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+void NextBotLineOfSight::PreTraceQueries( void )
+{
+	mdlcache->BeginLock();
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+void NextBotLineOfSight::PostTraceQueries( void )
+{
+	mdlcache->EndLock();
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+/**
+ * Trace the spots of an entity query in order until one is clear, as IsLineOfSightClearToEntity() does
+ */
+void NextBotLineOfSight::TraceSpots( Query_t &query, int skipSpot ) const
+{
+	NextBotTraceFilterIgnoreActors filter( query.m_subject, COLLISION_GROUP_NONE );
+	trace_t result;
+
+	query.m_isClear = false;
+	query.m_visibleSpot = query.m_eyePos;
+
+	for( int i=0; i<NUM_SPOTS; ++i )
+	{
+		if ( i == skipSpot )
+			continue;
+
+		UTIL_TraceLine( query.m_eyePos, query.m_spot[i], MASK_BLOCKLOS_AND_NPCS|CONTENTS_IGNORE_NODRAW_OPAQUE, &filter, &result );
+
+		query.m_visibleSpot = result.endpos;
+		query.m_isClear = IsClearTrace( result );
+
+		if ( query.m_isClear )
+			break;
+	}
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+/**
+ * Runs on the job pool. Only reads the world and writes the query (and its reverse) it was handed.
+ */
+void NextBotLineOfSight::TraceQuery( int &index )
+{
+	Query_t &query = m_queryVector[ index ];
+	trace_t result;
+
+	if ( query.m_subject == NULL )
+	{
+		// same trace as IVision::IsLineOfSightClear()
+		NextBotVisionTraceFilter filter( query.m_viewer, COLLISION_GROUP_NONE );
+		UTIL_TraceLine( query.m_eyePos, query.m_spot[ SPOT_CENTER ], MASK_BLOCKLOS_AND_NPCS|CONTENTS_IGNORE_NODRAW_OPAQUE, &filter, &result );
+
+		query.m_visibleSpot = result.endpos;
+		query.m_isClear = IsClearTrace( result );
+		return;
+	}
+
+	if ( query.m_reverse < 0 )
+	{
+		TraceSpots( query, -1 );
+		return;
+	}
+
+	// The eye-to-eye ray is the same segment both ways and the filter ignores every actor,
+	// so one trace answers it for both of us. Only if it is blocked do the other spots matter.
+	// Displacements only collide from their front side, so this is not exact: a ray clear
+	// through the back of one is taken as clear both ways, and a ray stopped by one is traced
+	// again from the other end.
+	Query_t &reverse = m_queryVector[ query.m_reverse ];
+
+	NextBotTraceFilterIgnoreActors filter( query.m_subject, COLLISION_GROUP_NONE );
+	UTIL_TraceLine( query.m_eyePos, query.m_spot[ SPOT_EYES ], MASK_BLOCKLOS_AND_NPCS|CONTENTS_IGNORE_NODRAW_OPAQUE, &filter, &result );
+
+	if ( IsClearTrace( result ) )
+	{
+		query.m_isClear = true;
+		query.m_visibleSpot = query.m_spot[ SPOT_EYES ];
+		reverse.m_isClear = true;
+		reverse.m_visibleSpot = reverse.m_spot[ SPOT_EYES ];
+		return;
+	}
+
+	TraceSpots( query, SPOT_EYES );
+	TraceSpots( reverse, result.IsDispSurface() ? -1 : SPOT_EYES );
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+void NextBotLineOfSight::ProcessBatch( void )
+{
+	VPROF_BUDGET( "NextBotLineOfSight::ProcessBatch", "NextBot" );
+	VPROF_INCREMENT_COUNTER( "NextBotLineOfSight( queries )", m_queryVector.Count() );
+	VPROF_INCREMENT_COUNTER( "NextBotLineOfSight( traced )", m_jobVector.Count() );
+
+	ParallelProcess( "NextBotLineOfSight::ProcessBatch", m_jobVector.Base(), m_jobVector.Count(), this, &NextBotLineOfSight::TraceQuery, &NextBotLineOfSight::PreTraceQueries, &NextBotLineOfSight::PostTraceQueries );
+
+	// remember what we learned
+	FOR_EACH_VEC( m_jobVector, it )
+	{
+		Query_t &query = m_queryVector[ m_jobVector[ it ] ];
+
+		if ( query.m_subject )
+		{
+			CacheResult( query.m_viewer, query.m_subject, query.m_isClear, query.m_visibleSpot );
+
+			if ( query.m_reverse >= 0 )
+			{
+				Query_t &reverse = m_queryVector[ query.m_reverse ];
+				CacheResult( reverse.m_viewer, reverse.m_subject, reverse.m_isClear, reverse.m_visibleSpot );
+			}
+		}
+	}
+
+	m_pendingPairs.RemoveAll();
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+bool NextBotLineOfSight::GetCachedResult( const CBaseEntity *viewer, const CBaseEntity *subject, bool *isClear, Vector *visibleSpot ) const
+{
+	float ttl = nb_vision_los_ttl.GetFloat();
+	if ( ttl < 0.0f )
+	{
+		return false;
+	}
+
+	const CacheEntry_t *entry = m_cache.GetPtr( PairKey( viewer, subject ) );
+	if ( entry == NULL || gpGlobals->curtime - entry->m_timestamp > ttl )
+	{
+		return false;
+	}
+
+	*isClear = entry->m_isClear;
+
+	if ( visibleSpot )
+	{
+		*visibleSpot = entry->m_visibleSpot;
+	}
+
+	return true;
+}
+
+
+//----------------------------------------------------------------------------------------------------------------
+void NextBotLineOfSight::CacheResult( const CBaseEntity *viewer, const CBaseEntity *subject, bool isClear, const Vector &visibleSpot )
+{
+	if ( nb_vision_los_ttl.GetFloat() < 0.0f )
+	{
+		return;
+	}
+
+	CacheEntry_t entry;
+	entry.m_timestamp = gpGlobals->curtime;
+	entry.m_visibleSpot = visibleSpot;
+	entry.m_isClear = isClear;
+
+	UtlHashHandle_t h = m_cache.Find( PairKey( viewer, subject ) );
+	if ( h == m_cache.InvalidHandle() )
+	{
+		m_cache.Insert( PairKey( viewer, subject ), entry );
+	}
+	else
+	{
+		m_cache[h] = entry;
+	}
+}
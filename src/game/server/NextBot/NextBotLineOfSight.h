@@ -0,0 +1,95 @@
+// NextBotLineOfSight.h
+// Batched and cached line-of-sight queries for NextBot vision
+//========= Copyright Valve Corporation, All rights reserved. ============//
+
+#ifndef _NEXT_BOT_LINE_OF_SIGHT_H_
+#define _NEXT_BOT_LINE_OF_SIGHT_H_
+
+#include "tier1/utlhashtable.h"
+
+class CBaseCombatCharacter;
+
+
+//----------------------------------------------------------------------------------------------------------------
+/**
+ * Resolves the line-of-sight queries of every bot sensing this tick as one batch.
+ * Pairs the nav mesh says are not potentially visible never trace, results younger than
+ * nb_vision_los_ttl are reused, and when two bots look at each other their common
+ * eye-to-eye ray is only traced once. The remaining traces run across the job pool.
+ * Everything except the traces is main thread only.
+ */
+class NextBotLineOfSight
+{
+public:
+	NextBotLineOfSight( void );
+
+	void Reset( void );								// forget all cached results
+	void Update( void );							// expire old cached results now and then
+
+	//- batch ---------------------------------------------------------------------------------------------------
+	void BeginBatch( void );						// discard the queries of the previous batch
+	int AddEntityQuery( CBaseCombatCharacter *viewer, const Vector &eyePos, CBaseEntity *subject );	// same question as IVision::IsLineOfSightClearToEntity()
+	int AddPositionQuery( CBaseCombatCharacter *viewer, const Vector &eyePos, const Vector &pos );		// same question as IVision::IsLineOfSightClear()
+	void ProcessBatch( void );						// resolve every query added since BeginBatch()
+	bool IsQueryClear( int query ) const;			// valid until the next BeginBatch()
+
+	//- cache ---------------------------------------------------------------------------------------------------
+	bool GetCachedResult( const CBaseEntity *viewer, const CBaseEntity *subject, bool *isClear, Vector *visibleSpot = NULL ) const;
+	void CacheResult( const CBaseEntity *viewer, const CBaseEntity *subject, bool isClear, const Vector &visibleSpot );
+
+private:
+	enum SpotType
+	{
+		SPOT_CENTER,
+		SPOT_EYES,
+		SPOT_FEET,
+
+		NUM_SPOTS
+	};
+
+	struct Query_t
+	{
+		CBaseEntity *m_viewer;
+		CBaseEntity *m_subject;						// NULL for position queries
+		Vector m_eyePos;
+		Vector m_spot[ NUM_SPOTS ];					// traced in order until one is clear, position queries only use the first
+		int m_reverse;								// index of the query looking back at us along the same eye ray, or -1
+		bool m_isClear;
+		Vector m_visibleSpot;
+	};
+	CUtlVector< Query_t > m_queryVector;
+	CUtlVector< int > m_jobVector;					// queries to trace - a reverse query is traced along with its partner
+	CUtlHashtable< uint64, int > m_pendingPairs;	// viewer/subject -> query, to find the reverse of a new query
+
+	void TraceQuery( int &index );					// job pool entry point, only reads the world
+	void TraceSpots( Query_t &query, int skipSpot ) const;
+	void PreTraceQueries( void );
+	void PostTraceQueries( void );
+
+	struct CacheEntry_t
+	{
+		float m_timestamp;
+		Vector m_visibleSpot;
+		bool m_isClear;
+	};
+	CUtlHashtable< uint64, CacheEntry_t > m_cache;
+	CountdownTimer m_expireTimer;
+
+	static uint64 PairKey( const CBaseEntity *viewer, const CBaseEntity *subject );
+};
+
+
+inline bool NextBotLineOfSight::IsQueryClear( int query ) const
+{
+	return m_queryVector.IsValidIndex( query ) && m_queryVector[ query ].m_isClear;
+}
+
+
+inline uint64 NextBotLineOfSight::PairKey( const CBaseEntity *viewer, const CBaseEntity *subject )
+{
+	// handles rather than pointers, so a reused slot never hits a stale result
+	return ( (uint64)(uint32)viewer->GetRefEHandle().ToInt() << 32 ) | (uint32)subject->GetRefEHandle().ToInt();
+}
+
+
+#endif // _NEXT_BOT_LINE_OF_SIGHT_H_
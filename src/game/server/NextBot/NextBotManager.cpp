@@ -6,6 +6,7 @@
 
 #include "NextBotManager.h"
 #include "NextBotInterface.h"
+#include "NextBotVisionInterface.h"
 
 #ifdef TERROR
 #include "ZombieBot/Infected/Infected.h"
@@ -15,6 +16,7 @@
 
 #include "SharedFunctorUtils.h"
 //#include "../../common/blackbox_helper.h"
+#include "tier0/vprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -25,6 +27,7 @@ ConVar nb_update_frequency( "nb_update_frequency", ".1", FCVAR_CHEAT );
 ConVar nb_update_framelimit( "nb_update_framelimit", ( IsDebug() ) ? "30" : "15", FCVAR_CHEAT );
 ConVar nb_update_maxslide( "nb_update_maxslide", "2", FCVAR_CHEAT );
 ConVar nb_update_debug( "nb_update_debug", "0", FCVAR_CHEAT );
+ConVar nb_parallel_sense( "nb_parallel_sense", "1", FCVAR_CHEAT, "Do the vision traces of the bots scheduled to update this tick up front, across the job pool" );
 
 //---------------------------------------------------------------------------------------------
 //---------------------------------------------------------------------------------------------
@@ -242,6 +245,9 @@ NextBotManager::NextBotManager( void )
 	m_selectedBot = NULL;
 	
 	m_iUpdateTickrate = 0;
+	m_CurUpdateStartTime = 0.0;
+	m_SumFrameTime = 0.0;
+	m_AvgUpdateTime = 0.0;
 }
 
 //---------------------------------------------------------------------------------------------
@@ -269,6 +275,8 @@ void NextBotManager::Reset( void )
 		i = iNext;
 	}
 
+	m_lineOfSight.Reset();
+
 	m_selectedBot = NULL;
 }
 
@@ -307,10 +315,18 @@ static int g_nBlockedSlides;
 
 void NextBotManager::Update( void )
 {
+	VPROF_BUDGET( "NextBotManager::Update", "NextBot" );
+
+	m_lineOfSight.Update();
+
 	// do lightweight upkeep every tick
-	for( int u=m_botList.Head(); u != m_botList.InvalidIndex(); u = m_botList.Next( u ) )
 	{
-		m_botList[ u ]->Upkeep();
+		VPROF_BUDGET( "NextBotManager::Update( upkeep )", "NextBot" );
+
+		for( int u=m_botList.Head(); u != m_botList.InvalidIndex(); u = m_botList.Next( u ) )
+		{
+			m_botList[ u ]->Upkeep();
+		}
 	}
 
 	// schedule full updates
@@ -409,9 +425,74 @@ void NextBotManager::Update( void )
 			g_nRun = g_nSlid = g_nBlockedSlides = 0;
 		}
 
+		if ( nb_parallel_sense.GetBool() )
+		{
+			SenseScheduledBots();
+		}
+	}
+}
+
+
+//---------------------------------------------------------------------------------------------
+/**
+ * Split the vision update of every bot that is about to update into a serial gather, the
+ * batched line-of-sight queries whose traces run across the job pool, and the serial apply
+ * that happens in each bot's own Update(). Bots that end up updating without being
+ * scheduled (sliders) just do their own traces as before.
+ * Only bots that ShouldUpdate() is expected to let through, and whose vision won't throttle
+ * itself, are sensed. A wrong guess either wastes the traces or makes the bot trace inline.
+ */
+void NextBotManager::SenseScheduledBots( void )
+{
+	m_lineOfSight.BeginBatch();
+
+	{
+		VPROF_BUDGET( "NextBotManager::Update( sense gather )", "NextBot" );
+
+		double expectedFrameTime = m_SumFrameTime;
+
+		for( int i=m_botList.Head(); i != m_botList.InvalidIndex(); i = m_botList.Next( i ) )
+		{
+			INextBot *bot = m_botList[i];
+
+			if ( m_iUpdateTickrate > 0 )
+			{
+				if ( !bot->IsFlaggedForUpdate() )
+					continue;
+
+				// the rest of the scheduled bots will be pushed back once the frame is out of budget
+				if ( !IsWithinFrameBudget( expectedFrameTime ) )
+					break;
+
+				expectedFrameTime += m_AvgUpdateTime;
+			}
+
+			if ( IsDead( bot ) )
+				continue;
+
+			IVision *vision = bot->GetVisionInterface();
+			if ( vision && vision->WillUpdateThisTick() )
+			{
+				vision->BeginSense();
+			}
+		}
+	}
+
+	{
+		VPROF_BUDGET( "NextBotManager::Update( sense traces )", "NextBot" );
+
+		m_lineOfSight.ProcessBatch();
 	}
 }
 
+//---------------------------------------------------------------------------------------------
+bool NextBotManager::IsWithinFrameBudget( double sumFrameTime ) const
+{
+	float frameLimit = nb_update_framelimit.GetFloat();
+
+	return frameLimit > 0.0f && sumFrameTime * 1000.0 < frameLimit;
+}
+
 //---------------------------------------------------------------------------------------------
 bool NextBotManager::ShouldUpdate( INextBot *bot )
 {
@@ -428,7 +509,7 @@ bool NextBotManager::ShouldUpdate( INextBot *bot )
 		sumFrameTime = m_SumFrameTime * 1000.0;
 		if ( frameLimit > 0.0f )
 		{
-			if ( sumFrameTime < frameLimit )
+			if ( IsWithinFrameBudget( m_SumFrameTime ) )
 			{
 				return true;
 			}
@@ -480,7 +561,9 @@ void NextBotManager::NotifyBeginUpdate( INextBot *bot )
 void NextBotManager::NotifyEndUpdate( INextBot *bot )
 {
 	// This might be a good place to detect a particular bot had spiked [3/14/2008 tom]
-	m_SumFrameTime += Plat_FloatTime() - m_CurUpdateStartTime;
+	double updateTime = Plat_FloatTime() - m_CurUpdateStartTime;
+	m_SumFrameTime += updateTime;
+	m_AvgUpdateTime += 0.1 * ( updateTime - m_AvgUpdateTime );
 }
 
 //---------------------------------------------------------------------------------------------
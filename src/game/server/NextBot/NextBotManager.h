@@ -6,6 +6,7 @@
 #define _NEXT_BOT_MANAGER_H_
 
 #include "NextBotInterface.h"
+#include "NextBotLineOfSight.h"
 
 class CTerrorPlayer;
 
@@ -28,6 +29,8 @@ public:
 
 	int GetNextBotCount( void ) const;				// How many nextbots are alive right now?
 
+	NextBotLineOfSight &GetLineOfSight( void );		// batched and cached line-of-sight queries for bot vision
+
 
 	/**
 	 * Populate given vector with all bots in the system
@@ -150,6 +153,11 @@ protected:
 	int m_iUpdateTickrate;
 	double m_CurUpdateStartTime;
 	double m_SumFrameTime;
+	double m_AvgUpdateTime;							// running average of a single bot update, to predict the frame budget
+
+	bool IsWithinFrameBudget( double sumFrameTime ) const;	// can a bot flagged for update still run after sumFrameTime seconds of updates this frame
+	void SenseScheduledBots( void );				// run the vision traces of this tick's bots as one batch
+	NextBotLineOfSight m_lineOfSight;
 
 	unsigned int m_debugType;						// debug flags
 
@@ -169,6 +177,11 @@ inline int NextBotManager::GetNextBotCount( void ) const
 	return m_botList.Count();
 }
 
+inline NextBotLineOfSight &NextBotManager::GetLineOfSight( void )
+{
+	return m_lineOfSight;
+}
+
 inline bool NextBotManager::IsDebugging( unsigned int type ) const
 {
 	if ( type & m_debugType )
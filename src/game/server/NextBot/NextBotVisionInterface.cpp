@@ -12,6 +12,8 @@
 #include "NextBotVisionInterface.h"
 #include "NextBotBodyInterface.h"
 #include "NextBotUtil.h"
+#include "NextBotManager.h"
+#include "NextBotLineOfSight.h"
 
 #ifdef TERROR
 #include "querycache.h"
@@ -53,6 +55,10 @@ void IVision::Reset( void )
 	{
 		m_notVisibleTimer[i].Invalidate();
 	}
+
+	m_sensedEntityVector.RemoveAll();
+	m_sensedPositionVector.RemoveAll();
+	m_senseTick = -1;
 }
 
 
@@ -368,18 +374,40 @@ void IVision::UpdateKnownEntities( void )
 {
 	VPROF_BUDGET( "IVision::UpdateKnownEntities", "NextBot" );
 
-	// construct set of potentially visible objects
-	CUtlVector< CBaseEntity * > potentiallyVisible;
-	CollectPotentiallyVisibleEntities( &potentiallyVisible );
-
 	// collect set of visible and recognized entities at this moment
 	CollectVisible visibleNow( this );
-	FOR_EACH_VEC( potentiallyVisible, pit )
+
+	if ( m_senseTick == gpGlobals->tickcount )
+	{
+		VPROF_BUDGET( "IVision::UpdateKnownEntities( apply sensed )", "NextBot" );
+
+		// the traces were done by the manager this tick, only noticing is left to us
+		const NextBotLineOfSight &lineOfSight = TheNextBots().GetLineOfSight();
+
+		FOR_EACH_VEC( m_sensedEntityVector, sit )
+		{
+			const SensedEntity_t &sensed = m_sensedEntityVector[ sit ];
+			CBaseEntity *entity = sensed.m_entity;
+
+			if ( entity && entity->IsAlive() && lineOfSight.IsQueryClear( sensed.m_query ) && IsVisibleEntityNoticed( entity ) )
+			{
+				visibleNow.m_recognized.AddToTail( entity );
+			}
+		}
+	}
+	else
 	{
-		VPROF_BUDGET( "IVision::UpdateKnownEntities( collect visible )", "NextBot" );
+		// construct set of potentially visible objects
+		CUtlVector< CBaseEntity * > potentiallyVisible;
+		CollectPotentiallyVisibleEntities( &potentiallyVisible );
 
-		if ( visibleNow( potentiallyVisible[ pit ] ) == false )
-			break;
+		FOR_EACH_VEC( potentiallyVisible, pit )
+		{
+			VPROF_BUDGET( "IVision::UpdateKnownEntities( collect visible )", "NextBot" );
+
+			if ( visibleNow( potentiallyVisible[ pit ] ) == false )
+				break;
+		}
 	}
 	
 	// update known set with new data
@@ -448,7 +476,7 @@ void IVision::UpdateKnownEntities( void )
 				if ( !known.HasLastKnownPositionBeenSeen() )
 				{
 					// can we see the entity's last know position?
-					if ( IsAbleToSee( known.GetLastKnownPosition(), IVision::USE_FOV ) )
+					if ( IsSensedPositionVisible( known.GetLastKnownPosition() ) )
 					{
 						known.MarkLastKnownPositionAsSeen();
 					}
@@ -482,6 +510,9 @@ void IVision::UpdateKnownEntities( void )
 		}
 	}
 
+	// sensed results are only good for one update
+	m_senseTick = -1;
+
 	// debugging
 	if ( nb_debug_known_entities.GetBool() )
 	{
@@ -534,6 +565,95 @@ void IVision::UpdateKnownEntities( void )
 }
 
 
+//------------------------------------------------------------------------------------------
+/**
+ * Do the cheap part of IsAbleToSee() for everything UpdateKnownEntities() will look at,
+ * and queue the traces that are left with the manager's NextBotLineOfSight.
+ */
+void IVision::BeginSense( void )
+{
+	m_sensedEntityVector.RemoveAll();
+	m_sensedPositionVector.RemoveAll();
+	m_senseTick = -1;
+
+	if ( nb_blind.GetBool() )
+	{
+		return;
+	}
+
+	NextBotLineOfSight &lineOfSight = TheNextBots().GetLineOfSight();
+	CBaseCombatCharacter *me = GetBot()->GetEntity();
+	Vector eyePos = GetBot()->GetBodyInterface()->GetEyePosition();
+	float maxRange = GetMaxVisionRange();
+
+	CUtlVector< CBaseEntity * > potentiallyVisible;
+	CollectPotentiallyVisibleEntities( &potentiallyVisible );
+
+	FOR_EACH_VEC( potentiallyVisible, pit )
+	{
+		CBaseEntity *entity = potentiallyVisible[ pit ];
+
+		if ( !entity || entity == me || IsIgnored( entity ) || !entity->IsAlive() )
+			continue;
+
+		if ( GetBot()->IsRangeGreaterThan( entity, maxRange ) || me->IsHiddenByFog( entity ) || !IsInFieldOfView( entity ) )
+			continue;
+
+		SensedEntity_t &sensed = m_sensedEntityVector[ m_sensedEntityVector.AddToTail() ];
+		sensed.m_entity = entity;
+		sensed.m_query = lineOfSight.AddEntityQuery( me, eyePos, entity );
+	}
+
+	// last known positions we have not yet seen
+	FOR_EACH_VEC( m_knownEntityVector, kit )
+	{
+		const CKnownEntity &known = m_knownEntityVector[ kit ];
+
+		if ( known.GetEntity() == NULL || known.IsObsolete() || known.HasLastKnownPositionBeenSeen() )
+			continue;
+
+		const Vector &pos = known.GetLastKnownPosition();
+
+		SensedPosition_t &sensed = m_sensedPositionVector[ m_sensedPositionVector.AddToTail() ];
+		sensed.m_pos = pos;
+		sensed.m_query = -1;
+
+		if ( !GetBot()->IsRangeGreaterThan( pos, maxRange ) && !me->IsHiddenByFog( pos ) && IsInFieldOfView( pos ) )
+		{
+			sensed.m_query = lineOfSight.AddPositionQuery( me, eyePos, pos );
+		}
+	}
+
+	m_senseTick = gpGlobals->tickcount;
+}
+
+
+//------------------------------------------------------------------------------------------
+bool IVision::WillUpdateThisTick( void ) const
+{
+	return true;
+}
+
+
+//------------------------------------------------------------------------------------------
+bool IVision::IsSensedPositionVisible( const Vector &pos ) const
+{
+	if ( m_senseTick == gpGlobals->tickcount )
+	{
+		FOR_EACH_VEC( m_sensedPositionVector, pit )
+		{
+			if ( m_sensedPositionVector[ pit ].m_pos == pos )
+			{
+				return TheNextBots().GetLineOfSight().IsQueryClear( m_sensedPositionVector[ pit ].m_query );
+			}
+		}
+	}
+
+	// position moved since we sensed it
+	return IsAbleToSee( pos, IVision::USE_FOV );
+}
+
+
 //------------------------------------------------------------------------------------------
 /**
  * Update internal state
@@ -749,6 +869,14 @@ bool IVision::IsLineOfSightClearToEntity( const CBaseEntity *subject, Vector *vi
 	// TODO: Use plain-old traces until querycache/etc gets integrated
 	VPROF_BUDGET( "IVision::IsLineOfSightClearToEntity", "NextBot" );
 
+	NextBotLineOfSight &lineOfSight = TheNextBots().GetLineOfSight();
+
+	bool isClear;
+	if ( lineOfSight.GetCachedResult( GetBot()->GetEntity(), subject, &isClear, visibleSpot ) )
+	{
+		return isClear;
+	}
+
 	trace_t result;
 	NextBotTraceFilterIgnoreActors filter( subject, COLLISION_GROUP_NONE );
 
@@ -768,7 +896,10 @@ bool IVision::IsLineOfSightClearToEntity( const CBaseEntity *subject, Vector *vi
 		*visibleSpot = result.endpos;
 	}
 
-	return ( result.fraction >= 1.0f && !result.startsolid );
+	isClear = ( result.fraction >= 1.0f && !result.startsolid );
+	lineOfSight.CacheResult( GetBot()->GetEntity(), subject, isClear, result.endpos );
+
+	return isClear;
 
 #endif
 }
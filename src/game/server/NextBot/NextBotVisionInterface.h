@@ -108,6 +108,22 @@ public:
 	virtual bool IsLookingAt( const Vector &pos, float cosTolerance = 0.95f ) const;					// are we looking at the given position
 	virtual bool IsLookingAt( const CBaseCombatCharacter *actor, float cosTolerance = 0.95f ) const;	// are we looking at the given actor
 
+	//-- batched sensing ------------------------------------------------------------------------
+
+	/**
+	 * The NextBotManager calls this ahead of the entity thinks for every bot scheduled to update
+	 * this tick. It does everything short of the traces and queues those with the manager's
+	 * NextBotLineOfSight, which resolves the queries of all bots together. The next
+	 * UpdateKnownEntities() on the same tick consumes the results instead of tracing.
+	 */
+	void BeginSense( void );
+
+	/**
+	 * Return false if the next Update() will skip looking at the world (ie: throttled),
+	 * so there is no point in sensing for it ahead of time.
+	 */
+	virtual bool WillUpdateThisTick( void ) const;
+
 private:
 	CountdownTimer m_scanTimer;			// for throttling update rate
 	
@@ -121,6 +137,22 @@ private:
 
 	float m_lastVisionUpdateTimestamp;
 	IntervalTimer m_notVisibleTimer[ MAX_TEAMS ];		// for tracking interval since last saw a member of the given team
+
+	struct SensedEntity_t
+	{
+		CHandle< CBaseEntity > m_entity;				// passed the cheap checks of IsAbleToSee()
+		int m_query;									// its NextBotLineOfSight query
+	};
+	struct SensedPosition_t
+	{
+		Vector m_pos;									// last known position of a known entity
+		int m_query;									// -1 if the cheap checks already rejected it
+	};
+	CUtlVector< SensedEntity_t > m_sensedEntityVector;
+	CUtlVector< SensedPosition_t > m_sensedPositionVector;
+	int m_senseTick;									// tick the sensed results are valid for, -1 if none
+
+	bool IsSensedPositionVisible( const Vector &pos ) const;	// IsAbleToSee( pos, USE_FOV ) using the sensed results if we have them
 };
 
 inline void IVision::CollectKnownEntities( CUtlVector< CKnownEntity > *knownVector )
@@ -7,6 +7,7 @@
 #define _NEXT_BOT_PATH_H_
 
 #include "NextBotInterface.h"
+#include "nav_hierarchy.h"
 
 #include "tier0/vprof.h"
 
@@ -190,7 +191,7 @@ public:
 		// Compute shortest path to subject
 		//
 		CNavArea *closestArea = NULL;
-		bool pathResult = NavAreaBuildPath( startArea, subjectArea, &subjectPos, costFunc, &closestArea, maxPathLength, bot->GetEntity()->GetTeamNumber() );
+		bool pathResult = NavAreaBuildHierarchicalPath( startArea, subjectArea, &subjectPos, costFunc, &closestArea, maxPathLength, bot->GetEntity()->GetTeamNumber() );
 
 		// Failed?
 		if ( closestArea == NULL )
@@ -318,7 +319,7 @@ public:
 		// Compute shortest path to goal
 		//
 		CNavArea *closestArea = NULL;
-		bool pathResult = NavAreaBuildPath( startArea, goalArea, &goal, costFunc, &closestArea, maxPathLength, bot->GetEntity()->GetTeamNumber() );
+		bool pathResult = NavAreaBuildHierarchicalPath( startArea, goalArea, &goal, costFunc, &closestArea, maxPathLength, bot->GetEntity()->GetTeamNumber() );
 
 		// Failed?
 		if ( closestArea == NULL )
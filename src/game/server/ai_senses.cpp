@@ -13,6 +13,10 @@
 #include "team.h"
 #include "ai_basenpc.h"
 #include "saverestore_utlvector.h"
+#include "igamesystem.h"
+#include "tier1/utlhashtable.h"
+#include "datacache/imdlcache.h"
+#include "vstdlib/jobthread.h"
 
 #ifdef PORTAL
 	#include "portal_util_shared.h"
@@ -35,10 +39,64 @@ const float AI_EFFICIENT_NPC_SEARCH_TIME = .35;
 const float AI_HIGH_PRIORITY_SEARCH_TIME = 0.15;
 const float AI_MISC_SEARCH_TIME  = 0.45;
 
+ConVar ai_sight_batch( "ai_sight_batch", "1", FCVAR_NONE, "Trace the sight of every NPC due to look this tick across the job pool before entities think" );
+
+extern ConVar ai_LOS_mode;
+
 //-----------------------------------------------------------------------------
 
 CAI_SensedObjectsManager g_AI_SensedObjectsManager;
 
+//-----------------------------------------------------------------------------
+// class CAI_SightBatch
+//
+// Purpose: Before entities think, collects the line of sight traces the NPCs
+//			due to look this tick will make in CanSeeEntity(), runs them across
+//			the job pool and primes the combat character visibility cache with
+//			the results, where FVisible() picks them up. Whether an entity is
+//			looked at, and what seeing it means, is still decided in the NPC's
+//			own think; a query not predicted here just traces there as before.
+//-----------------------------------------------------------------------------
+
+class CAI_SightBatch : public CAutoGameSystemPerFrame
+{
+public:
+	CAI_SightBatch()
+	 :	CAutoGameSystemPerFrame( "CAI_SightBatch" ),
+		m_bSimpleFilter( false )
+	{
+	}
+
+	virtual void LevelShutdownPostEntity();
+	virtual void FrameUpdatePreEntityThink();
+
+	void AddQuery( CAI_BaseNPC *pViewer, CBaseEntity *pSubject );
+
+private:
+	struct Query_t
+	{
+		CAI_BaseNPC *	pViewer;
+		CBaseEntity *	pSubject;
+		CBaseEntity *	pVehicle;			// hitting the subject's vehicle counts as seeing a player
+		bool			bSubjectIsPlayer;
+		Vector			vecEyes;
+		Vector			vecTarget;
+
+		bool			bVisible;
+		CBaseEntity *	pBlocker;
+	};
+
+	void TraceQuery( Query_t &query );		// job pool entry point, only reads the world
+	void PreTraceQueries()					{ mdlcache->BeginLock(); }
+	void PostTraceQueries()					{ mdlcache->EndLock(); }
+
+	CUtlVector<Query_t>		m_Queries;
+	CUtlHashtable<uint64>	m_Pairs;		// both directions of a pair share a cache entry, so trace it once
+	bool					m_bSimpleFilter;
+};
+
+CAI_SightBatch g_AI_SightBatch;
+
 //-----------------------------------------------------------------------------
 
 #pragma pack(push)
@@ -667,6 +725,85 @@ void CAI_Senses::PerformSensing( void )
 		Listen();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Hands the sight batch everything the Look() in this NPC's next
+//			PerformSensing() will consider, using the same timers and distance
+//			culls as the LookFor*() functions above
+//-----------------------------------------------------------------------------
+
+void CAI_Senses::AddSightQueries( CAI_SightBatch *pBatch )
+{
+	CAI_BaseNPC *pOuter = GetOuter();
+
+	if ( HasSensingFlags(SENSING_FLAGS_DONT_LOOK) || ( pOuter->m_spawnflags & SF_NPC_WAIT_TILL_SEEN ) )
+		return;
+
+	int iDistance = m_LookDist;
+	float distSq = ( iDistance * iDistance );
+	const Vector &origin = GetAbsOrigin();
+	int i;
+
+	// Players
+	if ( gpGlobals->curtime - m_TimeLastLookHighPriority > AI_HIGH_PRIORITY_SEARCH_TIME )
+	{
+		for ( i = 1; i <= gpGlobals->maxClients; i++ )
+		{
+			CBaseEntity *pPlayer = UTIL_PlayerByIndex( i );
+
+			if ( pPlayer && origin.DistToSqr(pPlayer->GetAbsOrigin()) < distSq )
+			{
+				pBatch->AddQuery( pOuter, pPlayer );
+			}
+		}
+	}
+
+	// NPCs
+	AI_Efficiency_t efficiency = pOuter->GetEfficiency();
+	float timeNPCs = ( efficiency < AIE_VERY_EFFICIENT ) ? AI_STANDARD_NPC_SEARCH_TIME : AI_EFFICIENT_NPC_SEARCH_TIME;
+	if ( gpGlobals->curtime - m_TimeLastLookNPCs > timeNPCs )
+	{
+		if ( efficiency < AIE_SUPER_EFFICIENT )
+		{
+			CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
+
+			for ( i = 0; i < g_AI_Manager.NumAIs(); i++ )
+			{
+				if ( ppAIs[i] != pOuter && ( ppAIs[i]->ShouldNotDistanceCull() || origin.DistToSqr(ppAIs[i]->GetAbsOrigin()) < distSq ) )
+				{
+					pBatch->AddQuery( pOuter, ppAIs[i] );
+				}
+			}
+		}
+		else
+		{
+			// Super efficient NPCs only recheck the ones they already see
+			for ( i = 0; i < m_SeenNPCs.Count(); i++ )
+			{
+				CAI_BaseNPC *pNPC = (CAI_BaseNPC *)m_SeenNPCs[i].Get();
+				if ( pNPC && ( pNPC->ShouldNotDistanceCull() || origin.DistToSqr(pNPC->GetAbsOrigin()) <= distSq ) )
+				{
+					pBatch->AddQuery( pOuter, pNPC );
+				}
+			}
+		}
+	}
+
+	// Objects
+	if ( gpGlobals->curtime - m_TimeLastLookMisc > AI_MISC_SEARCH_TIME )
+	{
+		int iter;
+		CBaseEntity *pEnt = g_AI_SensedObjectsManager.GetFirst( &iter );
+		while ( pEnt )
+		{
+			if ( ( pEnt->GetFlags() & FL_OBJECT ) && origin.DistToSqr(pEnt->GetAbsOrigin()) < distSq )
+			{
+				pBatch->AddQuery( pOuter, pEnt );
+			}
+			pEnt = g_AI_SensedObjectsManager.GetNext( &iter );
+		}
+	}
+}
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 
@@ -754,3 +891,137 @@ void CAI_SensedObjectsManager::AddEntity( CBaseEntity *pEntity )
 }
 
 //=============================================================================
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+
+void CAI_SightBatch::LevelShutdownPostEntity()
+{
+	m_Queries.Purge();
+	m_Pairs.Purge();
+}
+
+//-----------------------------------------------------------------------------
+
+void CAI_SightBatch::FrameUpdatePreEntityThink()
+{
+	m_Queries.RemoveAll();
+	m_Pairs.RemoveAll();
+
+	if ( !ai_sight_batch.GetBool() || !g_AI_Manager.NumAIs() )
+		return;
+
+	VPROF_BUDGET( "CAI_SightBatch::FrameUpdatePreEntityThink", VPROF_BUDGETGROUP_NPCS );
+
+	m_bSimpleFilter = ( !IsXbox() && ai_LOS_mode.GetBool() );
+
+	CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
+
+	for ( int i = 0; i < g_AI_Manager.NumAIs(); i++ )
+	{
+		CAI_BaseNPC *pNPC = ppAIs[i];
+
+		// Only NPCs that think this tick...
+		int thinktick = pNPC->GetNextThinkTick();
+		if ( thinktick <= 0 || thinktick > gpGlobals->tickcount )
+			continue;
+
+		// ...and will get as far as PerformSensing() in GatherConditions()
+		if ( !pNPC->GetSenses() || pNPC->IsFlaggedEfficient() ||
+			 pNPC->GetState() == NPC_STATE_NONE || pNPC->GetState() == NPC_STATE_DEAD )
+			continue;
+
+		if ( !pNPC->HasCondition( COND_IN_PVS ) && pNPC->GetState() != NPC_STATE_COMBAT && !pNPC->ShouldAlwaysThink() )
+			continue;
+
+		pNPC->GetSenses()->AddSightQueries( this );
+	}
+
+	VPROF_INCREMENT_COUNTER( "CAI_SightBatch( traces )", m_Queries.Count() );
+
+	if ( !m_Queries.Count() )
+		return;
+
+	ParallelProcess( "CAI_SightBatch::FrameUpdatePreEntityThink", m_Queries.Base(), m_Queries.Count(), this, &CAI_SightBatch::TraceQuery, &CAI_SightBatch::PreTraceQueries, &CAI_SightBatch::PostTraceQueries );
+
+	for ( int i = 0; i < m_Queries.Count(); i++ )
+	{
+		Query_t &query = m_Queries[i];
+		query.pViewer->PrimeVisibilityCache( query.pSubject, query.bVisible, query.pBlocker );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Queue the trace CanSeeEntity( pSubject ) would make, unless the
+//			checks Look() runs first, or FVisible() itself, would never get
+//			that far
+//-----------------------------------------------------------------------------
+
+void CAI_SightBatch::AddQuery( CAI_BaseNPC *pViewer, CBaseEntity *pSubject )
+{
+	if ( pSubject == pViewer || !pSubject->IsAlive() )
+		return;
+
+	if ( ( pSubject->GetFlags() & FL_NOTARGET ) || pSubject->HasSpawnFlags( SF_NPC_WAIT_TILL_SEEN ) )
+		return;
+
+#if HL1_DLL
+	if ( ( pViewer->GetWaterLevel() != 3 && pSubject->GetWaterLevel() == 3 ) ||
+		 ( pViewer->GetWaterLevel() == 3 && pSubject->GetWaterLevel() == 0 ) )
+		return;
+#endif
+
+	if ( !pSubject->CanBeSeenBy( pViewer ) || !pViewer->FInViewCone( pSubject ) )
+		return;
+
+	if ( !pViewer->NeedsVisibilityTrace( pSubject ) )
+		return;
+
+	uint32 hViewer = pViewer->GetRefEHandle().ToInt();
+	uint32 hSubject = pSubject->GetRefEHandle().ToInt();
+	uint64 key = ( hViewer < hSubject ) ? ( (uint64)hViewer << 32 ) | hSubject : ( (uint64)hSubject << 32 ) | hViewer;
+	if ( m_Pairs.Find( key ) != m_Pairs.InvalidHandle() )
+		return;
+	m_Pairs.Insert( key );
+
+	Query_t &query = m_Queries[ m_Queries.AddToTail() ];
+	query.pViewer = pViewer;
+	query.pSubject = pSubject;
+	query.bSubjectIsPlayer = pSubject->IsPlayer();
+	query.pVehicle = ( query.bSubjectIsPlayer ) ? assert_cast<CBasePlayer *>( pSubject )->GetVehicleEntity() : NULL;
+	query.vecEyes = pViewer->EyePosition();
+	query.vecTarget = pSubject->EyePosition();
+	query.bVisible = false;
+	query.pBlocker = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The trace CBaseEntity::FVisible() makes for MASK_BLOCKLOS, from an
+//			NPC's eyes. Runs on the job pool.
+//-----------------------------------------------------------------------------
+
+void CAI_SightBatch::TraceQuery( Query_t &query )
+{
+	trace_t tr;
+	if ( m_bSimpleFilter )
+	{
+		UTIL_TraceLine( query.vecEyes, query.vecTarget, MASK_BLOCKLOS, query.pViewer, COLLISION_GROUP_NONE, &tr );
+	}
+	else
+	{
+		CTraceFilterLOS traceFilter( query.pViewer, COLLISION_GROUP_NONE, query.pSubject );
+		UTIL_TraceLine( query.vecEyes, query.vecTarget, MASK_BLOCKLOS_AND_NPCS, &traceFilter, &tr );
+	}
+
+	query.bVisible = true;
+	query.pBlocker = NULL;
+
+	if ( tr.fraction != 1.0 || tr.startsolid )
+	{
+		if ( tr.m_pEnt == query.pSubject || ( query.bSubjectIsPlayer && tr.m_pEnt == query.pVehicle ) )
+			return;
+
+		query.bVisible = false;
+		query.pBlocker = tr.m_pEnt;
+	}
+}
@@ -20,6 +20,7 @@
 
 class CBaseEntity;
 class CSound;
+class CAI_SightBatch;
 
 //-------------------------------------
 
@@ -71,6 +72,7 @@ public:
 
 	void			Listen( void );
 	void			Look( int iDistance );// basic sight function for npcs
+	void			AddSightQueries( CAI_SightBatch *pBatch ); // the traces the next Look() is going to need
 
 	bool			ShouldSeeEntity( CBaseEntity *pEntity ); // logical query
 	bool			CanSeeEntity( CBaseEntity *pSightEnt ); // more expensive cone & raycast test
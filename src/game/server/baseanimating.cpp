@@ -2800,6 +2800,15 @@ CBoneCache *CBaseAnimating::GetBoneCache( void )
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: return the bone cache as it is, without setting up bones
+//-----------------------------------------------------------------------------
+CBoneCache *CBaseAnimating::GetExistingBoneCache( void )
+{
+	return Studio_GetBoneCache( m_boneCacheHandle );
+}
+
+
 void CBaseAnimating::InvalidateBoneCache( void )
 {
 	Studio_InvalidateBoneCache( m_boneCacheHandle );
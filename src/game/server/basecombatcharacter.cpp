@@ -331,31 +331,40 @@ public:
 static CUtlRBTree<VisibilityCacheEntry_t, unsigned short, CVisibilityCacheEntryLess> g_VisibilityCache;
 const float VIS_CACHE_ENTRY_LIFE = ( !IsXbox() ) ? .090 : .500;
 
-bool CBaseCombatCharacter::FVisible( CBaseEntity *pEntity, int traceMask, CBaseEntity **ppBlocker )
+static bool CanCacheVisibility( CBaseCombatCharacter *pLooker, CBaseEntity *pEntity, int traceMask )
 {
-	VPROF( "CBaseCombatCharacter::FVisible" );
-
-	if ( traceMask != MASK_BLOCKLOS || !ShouldUseVisibilityCache() || pEntity == this
+	return ( traceMask == MASK_BLOCKLOS && ShouldUseVisibilityCache() && pEntity != pLooker
 #if defined(HL2_DLL)
-		 || Classify() == CLASS_BULLSEYE || pEntity->Classify() == CLASS_BULLSEYE 
+		 && pLooker->Classify() != CLASS_BULLSEYE && pEntity->Classify() != CLASS_BULLSEYE 
 #endif
-		 )
-	{
-		return BaseClass::FVisible( pEntity, traceMask, ppBlocker );
-	}
-
-	VisibilityCacheEntry_t cacheEntry;
+		 );
+}
 
-	if ( this < pEntity )
+static void SetVisibilityCacheKey( VisibilityCacheEntry_t *pEntry, CBaseEntity *pLooker, CBaseEntity *pEntity )
+{
+	if ( pLooker < pEntity )
 	{
-		cacheEntry.pEntity1 = this;
-		cacheEntry.pEntity2 = pEntity;
+		pEntry->pEntity1 = pLooker;
+		pEntry->pEntity2 = pEntity;
 	}
 	else
 	{
-		cacheEntry.pEntity1 = pEntity;
-		cacheEntry.pEntity2 = this;
+		pEntry->pEntity1 = pEntity;
+		pEntry->pEntity2 = pLooker;
 	}
+}
+
+bool CBaseCombatCharacter::FVisible( CBaseEntity *pEntity, int traceMask, CBaseEntity **ppBlocker )
+{
+	VPROF( "CBaseCombatCharacter::FVisible" );
+
+	if ( !CanCacheVisibility( this, pEntity, traceMask ) )
+	{
+		return BaseClass::FVisible( pEntity, traceMask, ppBlocker );
+	}
+
+	VisibilityCacheEntry_t cacheEntry;
+	SetVisibilityCacheKey( &cacheEntry, this, pEntity );
 
 	int iCache = g_VisibilityCache.Find( cacheEntry );
 
@@ -419,6 +428,46 @@ bool CBaseCombatCharacter::FVisible( CBaseEntity *pEntity, int traceMask, CBaseE
 	return bResult;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Lets a caller that traces line of sight ahead of time (see CAI_SightBatch)
+//			skip pairs FVisible() would answer from the cache anyway, or never cache
+//-----------------------------------------------------------------------------
+bool CBaseCombatCharacter::NeedsVisibilityTrace( CBaseEntity *pEntity )
+{
+	if ( !CanCacheVisibility( this, pEntity, MASK_BLOCKLOS ) )
+		return false;
+
+	VisibilityCacheEntry_t cacheEntry;
+	SetVisibilityCacheKey( &cacheEntry, this, pEntity );
+
+	int iCache = g_VisibilityCache.Find( cacheEntry );
+	if ( iCache == g_VisibilityCache.InvalidIndex() )
+		return ( g_VisibilityCache.Count() != g_VisibilityCache.InvalidIndex() );
+
+	return ( gpGlobals->curtime - g_VisibilityCache[iCache].time >= VIS_CACHE_ENTRY_LIFE );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Stores the outcome of FVisible( pEntity ) with MASK_BLOCKLOS as if
+//			it had just been traced here
+//-----------------------------------------------------------------------------
+void CBaseCombatCharacter::PrimeVisibilityCache( CBaseEntity *pEntity, bool bVisible, CBaseEntity *pBlocker )
+{
+	VisibilityCacheEntry_t cacheEntry;
+	SetVisibilityCacheKey( &cacheEntry, this, pEntity );
+
+	int iCache = g_VisibilityCache.Find( cacheEntry );
+	if ( iCache == g_VisibilityCache.InvalidIndex() )
+	{
+		if ( g_VisibilityCache.Count() == g_VisibilityCache.InvalidIndex() )
+			return;
+		iCache = g_VisibilityCache.Insert( cacheEntry );
+	}
+
+	g_VisibilityCache[iCache].pBlocker = ( bVisible ) ? NULL : pBlocker;
+	g_VisibilityCache[iCache].time = gpGlobals->curtime;
+}
+
 void CBaseCombatCharacter::ResetVisibilityCache( CBaseCombatCharacter *pBCC )
 {
 	VPROF( "CBaseCombatCharacter::ResetVisibilityCache" );
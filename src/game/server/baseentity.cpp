@@ -702,6 +702,7 @@ CBaseEntity *CBaseEntity::GetFollowedEntity()
 void CBaseEntity::SetClassname( const char *className )
 {
 	m_iClassname = AllocPooledString( className );
+	gEntList.NotifyEntityClassnameChanged( this );
 }
 
 void CBaseEntity::SetModelIndex( int index )
@@ -3658,6 +3659,12 @@ int CBaseEntity::Restore( IRestore &restore )
 	// loops through the data description list, restoring each data desc block in order
 	int status = RestoreDataDescBlock( restore, GetDataDescMap() );
 
+	gEntList.NotifyEntityClassnameChanged( this );
+	if ( m_iName != NULL_STRING )
+	{
+		gEntList.NotifyEntityNameChanged( this );
+	}
+
 	// ---------------------------------------------------------------
 	// HACKHACK: We don't know the space of these vectors until now
 	// if they are worldspace, fix them up.
@@ -4201,6 +4208,15 @@ const char *CBaseEntity::GetDebugName(void)
 	}
 }
 
+//------------------------------------------------------------------------------
+// Purpose : Sets the targetname, anything looking entities up by name is told
+//------------------------------------------------------------------------------
+void CBaseEntity::SetName( string_t newName )
+{
+	m_iName = newName;
+	gEntList.NotifyEntityNameChanged( this );
+}
+
 //------------------------------------------------------------------------------
 // Purpose :
 // Input   :
@@ -4336,6 +4352,66 @@ void CBaseEntity::OnEntityEvent( EntityEvent_t event, void *pEventData )
 ConVar ent_messages_draw( "ent_messages_draw", "0", FCVAR_CHEAT, "Visualizes all entity input/output activity." );
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Per class tables of the inputs in a datadesc, so firing an input is a
+//			hash lookup instead of a walk over every field in the datamap chain.
+//			A class's table is built the first time one of its entities gets an
+//			input, and holds the inputs of the whole chain with derived classes
+//			taking precedence, the same one the walk would have found first.
+//-----------------------------------------------------------------------------
+typedef CUtlHashtable< const char *, typedescription_t *, CaselessStringHashFunctor, CaselessStringEqualFunctor > InputDispatchTable_t;
+
+class CInputDispatchTables
+{
+public:
+	~CInputDispatchTables()
+	{
+		for ( UtlHashHandle_t h = m_Tables.FirstHandle(); h != m_Tables.InvalidHandle(); h = m_Tables.NextHandle( h ) )
+		{
+			delete m_Tables[h];
+		}
+	}
+
+	typedescription_t *FindInput( datamap_t *pMap, const char *pszInputName )
+	{
+		UtlHashHandle_t hTable = m_Tables.Find( pMap );
+		if ( hTable == m_Tables.InvalidHandle() )
+		{
+			hTable = m_Tables.Insert( pMap, BuildTable( pMap ) );
+		}
+
+		InputDispatchTable_t *pTable = m_Tables[hTable];
+		UtlHashHandle_t hInput = pTable->Find( pszInputName );
+		return ( hInput != pTable->InvalidHandle() ) ? pTable->Element( hInput ) : NULL;
+	}
+
+private:
+	static InputDispatchTable_t *BuildTable( datamap_t *pMap )
+	{
+		InputDispatchTable_t *pTable = new InputDispatchTable_t;
+
+		for ( datamap_t *dmap = pMap; dmap != NULL; dmap = dmap->baseMap )
+		{
+			for ( int i = 0; i < dmap->dataNumFields; i++ )
+			{
+				typedescription_t *pField = &dmap->dataDesc[i];
+				if ( !( pField->flags & FTYPEDESC_INPUT ) || !pField->externalName )
+					continue;
+
+				// Insert() leaves an existing entry alone, so the most derived class wins
+				pTable->Insert( pField->externalName, pField );
+			}
+		}
+
+		return pTable;
+	}
+
+	CUtlHashtable< datamap_t *, InputDispatchTable_t *, PointerHashFunctor, PointerEqualFunctor > m_Tables;
+};
+
+static CInputDispatchTables g_InputDispatchTables;
+
+
 //-----------------------------------------------------------------------------
 // Purpose: calls the appropriate message mapped function in the entity according
 //			to the fired action.
@@ -4358,115 +4434,103 @@ bool CBaseEntity::AcceptInput( const char *szInputName, CBaseEntity *pActivator,
 		NDebugOverlay::Box( GetAbsOrigin(), Vector(-4, -4, -4), Vector(4, 4, 4), 0, 255, 0, 0, 3 );
 	}
 
-	// loop through the data description list, restoring each data desc block
-	for ( datamap_t *dmap = GetDataDescMap(); dmap != NULL; dmap = dmap->baseMap )
+	typedescription_t *pField = g_InputDispatchTables.FindInput( GetDataDescMap(), szInputName );
+	if ( pField )
 	{
-		// search through all the actions in the data description, looking for a match
-		for ( int i = 0; i < dmap->dataNumFields; i++ )
+		char szBuffer[256];
+		// mapper debug message
+		if (pCaller != NULL)
 		{
-			if ( dmap->dataDesc[i].flags & FTYPEDESC_INPUT )
-			{
-				if ( !Q_stricmp(dmap->dataDesc[i].externalName, szInputName) )
-				{
-					// found a match
-
-					char szBuffer[256];
-					// mapper debug message
-					if (pCaller != NULL)
-					{
-						Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input %s: %s.%s(%s)\n", gpGlobals->curtime, STRING(pCaller->m_iName), GetDebugName(), szInputName, Value.String() );
-					}
-					else
-					{
-						Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input <NULL>: %s.%s(%s)\n", gpGlobals->curtime, GetDebugName(), szInputName, Value.String() );
-					}
-					DevMsg( 2, "%s", szBuffer );
-					ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
-
-					if (m_debugOverlays & OVERLAY_MESSAGE_BIT)
-					{
-						DrawInputOverlay(szInputName,pCaller,Value);
-					}
-
-					// convert the value if necessary
-					if ( Value.FieldType() != dmap->dataDesc[i].fieldType )
-					{
-						if ( !(Value.FieldType() == FIELD_VOID && dmap->dataDesc[i].fieldType == FIELD_STRING) ) // allow empty strings
-						{
-							if ( !Value.Convert( (fieldtype_t)dmap->dataDesc[i].fieldType ) )
-							{
-								// bad conversion
-								Warning( "!! ERROR: bad input/output link:\n!! %s(%s,%s) doesn't match type from %s(%s)\n", 
-									STRING(m_iClassname), GetDebugName(), szInputName, 
-									( pCaller != NULL ) ? STRING(pCaller->m_iClassname) : "<null>",
-									( pCaller != NULL ) ? STRING(pCaller->m_iName) : "<null>" );
-								return false;
-							}
-						}
-					}
+			Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input %s: %s.%s(%s)\n", gpGlobals->curtime, STRING(pCaller->m_iName), GetDebugName(), szInputName, Value.String() );
+		}
+		else
+		{
+			Q_snprintf( szBuffer, sizeof(szBuffer), "(%0.2f) input <NULL>: %s.%s(%s)\n", gpGlobals->curtime, GetDebugName(), szInputName, Value.String() );
+		}
+		DevMsg( 2, "%s", szBuffer );
+		ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
 
-					// call the input handler, or if there is none just set the value
-					inputfunc_t pfnInput = dmap->dataDesc[i].inputFunc;
+		if (m_debugOverlays & OVERLAY_MESSAGE_BIT)
+		{
+			DrawInputOverlay(szInputName,pCaller,Value);
+		}
 
-					if ( pfnInput )
-					{ 
-						// Package the data into a struct for passing to the input handler.
-						inputdata_t data;
-						data.pActivator = pActivator;
-						data.pCaller = pCaller;
-						data.value = Value;
-						data.nOutputID = outputID;
+		// convert the value if necessary
+		if ( Value.FieldType() != pField->fieldType )
+		{
+			if ( !(Value.FieldType() == FIELD_VOID && pField->fieldType == FIELD_STRING) ) // allow empty strings
+			{
+				if ( !Value.Convert( (fieldtype_t)pField->fieldType ) )
+				{
+					// bad conversion
+					Warning( "!! ERROR: bad input/output link:\n!! %s(%s,%s) doesn't match type from %s(%s)\n", 
+						STRING(m_iClassname), GetDebugName(), szInputName, 
+						( pCaller != NULL ) ? STRING(pCaller->m_iClassname) : "<null>",
+						( pCaller != NULL ) ? STRING(pCaller->m_iName) : "<null>" );
+					return false;
+				}
+			}
+		}
 
-						// Now, see if there's a function named Input<Name of Input> in this entity's script file. 
-						// If so, execute it and let it decide whether to allow the default behavior to also execute.
-						bool bCallInputFunc = true; // Always assume default behavior (do call the input function)
-						ScriptVariant_t functionReturn;
+		// call the input handler, or if there is none just set the value
+		inputfunc_t pfnInput = pField->inputFunc;
 
-						if ( m_ScriptScope.IsInitialized() )
-						{
-							char szScriptFunctionName[255];
-							Q_strcpy( szScriptFunctionName, "Input" );
-							Q_strcat( szScriptFunctionName, szInputName, 255 );
+		if ( pfnInput )
+		{ 
+			// Package the data into a struct for passing to the input handler.
+			inputdata_t data;
+			data.pActivator = pActivator;
+			data.pCaller = pCaller;
+			data.value = Value;
+			data.nOutputID = outputID;
 
-							g_pScriptVM->SetValue( "activator", ( pActivator ) ? ScriptVariant_t( pActivator->GetScriptInstance() ) : SCRIPT_VARIANT_NULL );
-							g_pScriptVM->SetValue( "caller", ( pCaller ) ? ScriptVariant_t( pCaller->GetScriptInstance() ) : SCRIPT_VARIANT_NULL );
+			// Now, see if there's a function named Input<Name of Input> in this entity's script file. 
+			// If so, execute it and let it decide whether to allow the default behavior to also execute.
+			bool bCallInputFunc = true; // Always assume default behavior (do call the input function)
+			ScriptVariant_t functionReturn;
 
-							if( CallScriptFunction( szScriptFunctionName, &functionReturn ) )
-							{
-								bCallInputFunc = functionReturn;
-							}
-						}
+			if ( m_ScriptScope.IsInitialized() )
+			{
+				char szScriptFunctionName[255];
+				Q_strcpy( szScriptFunctionName, "Input" );
+				Q_strcat( szScriptFunctionName, szInputName, 255 );
 
-						if( bCallInputFunc )
-						{
-							(this->*pfnInput)( data );
-						}
-					
-						if ( m_ScriptScope.IsInitialized() )
-						{
-							g_pScriptVM->ClearValue( "activator" );
-							g_pScriptVM->ClearValue( "caller" );
-						}
-					}
-					else if ( dmap->dataDesc[i].flags & FTYPEDESC_KEY )
-					{
-						// set the value directly
-						Value.SetOther( ((char*)this) + dmap->dataDesc[i].fieldOffset[ TD_OFFSET_NORMAL ]);
-					
-						// TODO: if this becomes evil and causes too many full entity updates, then we should make
-						// a macro like this:
-						//
-						// define MAKE_INPUTVAR(x) void Note##x##Modified() { x.GetForModify(); }
-						//
-						// Then the datadesc points at that function and we call it here. The only pain is to add
-						// that function for all the DEFINE_INPUT calls.
-						NetworkStateChanged();
-					}
+				g_pScriptVM->SetValue( "activator", ( pActivator ) ? ScriptVariant_t( pActivator->GetScriptInstance() ) : SCRIPT_VARIANT_NULL );
+				g_pScriptVM->SetValue( "caller", ( pCaller ) ? ScriptVariant_t( pCaller->GetScriptInstance() ) : SCRIPT_VARIANT_NULL );
 
-					return true;
+				if( CallScriptFunction( szScriptFunctionName, &functionReturn ) )
+				{
+					bCallInputFunc = functionReturn;
 				}
 			}
+
+			if( bCallInputFunc )
+			{
+				(this->*pfnInput)( data );
+			}
+		
+			if ( m_ScriptScope.IsInitialized() )
+			{
+				g_pScriptVM->ClearValue( "activator" );
+				g_pScriptVM->ClearValue( "caller" );
+			}
+		}
+		else if ( pField->flags & FTYPEDESC_KEY )
+		{
+			// set the value directly
+			Value.SetOther( ((char*)this) + pField->fieldOffset[ TD_OFFSET_NORMAL ]);
+		
+			// TODO: if this becomes evil and causes too many full entity updates, then we should make
+			// a macro like this:
+			//
+			// define MAKE_INPUTVAR(x) void Note##x##Modified() { x.GetForModify(); }
+			//
+			// Then the datadesc points at that function and we call it here. The only pain is to add
+			// that function for all the DEFINE_INPUT calls.
+			NetworkStateChanged();
 		}
+
+		return true;
 	}
 
 	DevMsg( 2, "unhandled input: (%s) -> (%s,%s)\n", szInputName, STRING(m_iClassname), GetDebugName()/*,", from (%s,%s)" STRING(pCaller->m_iClassname), STRING(pCaller->m_iName)*/ );
@@ -2170,12 +2170,6 @@ inline const char *CBaseEntity::GetPreTemplateName()
 	return szStrippedName;
 }
 
-inline void CBaseEntity::SetName( string_t newName )
-{
-	m_iName = newName;
-}
-
-
 inline bool CBaseEntity::NameMatches( const char *pszNameOrWildcard )
 {
 	if ( IDENT_STRINGS(m_iName, pszNameOrWildcard) )
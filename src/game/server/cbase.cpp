@@ -731,8 +731,13 @@ CEventQueue g_EventQueue;
 
 CEventQueue::CEventQueue()
 {
-	m_Events.m_flFireTime = -FLT_MAX;
-	m_Events.m_pNext = NULL;
+	m_iNextSerial = 0;
+
+	m_nStatFrames = 0;
+	m_nStatServiced = 0;
+	m_nStatMaxServiced = 0;
+	m_nStatNamedTargets = 0;
+	m_nStatCacheRebuilds = 0;
 
 	Init();
 }
@@ -846,21 +851,20 @@ void CEventQueue::Init( void )
 void CEventQueue::Clear( void )
 {
 	// delete all the events in the queue
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
-	
-	while ( pe != NULL )
+	for ( int i = 0; i < m_Heap.Count(); i++ )
 	{
-		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
-		delete pe;
-		pe = next;
+		delete m_Heap[i];
 	}
 
-	m_Events.m_pNext = NULL;
+	m_Heap.RemoveAll();
+
+	m_TargetCache.PurgeAndDeleteElements();
 }
 
 void CEventQueue::Dump( void )
 {
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
+	CUtlVector< EventQueuePrioritizedEvent_t * > sorted;
+	GetSortedEvents( sorted );
 
 	Msg("Dumping event queue. Current time is: %.2f\n",
 #ifdef TF_DLL
@@ -870,9 +874,9 @@ void CEventQueue::Dump( void )
 #endif
 		);
 
-	while ( pe != NULL )
+	for ( int i = 0; i < sorted.Count(); i++ )
 	{
-		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
+		EventQueuePrioritizedEvent_t *pe = sorted[i];
 
 		Msg("   (%.2f) Target: '%s', Input: '%s', Parameter '%s'. Activator: '%s', Caller '%s'.  \n", 
 			pe->m_flFireTime, 
@@ -881,13 +885,48 @@ void CEventQueue::Dump( void )
 			pe->m_VariantValue.String(),
 			pe->m_pActivator ? pe->m_pActivator->GetDebugName() : "None", 
 			pe->m_pCaller ? pe->m_pCaller->GetDebugName() : "None"  );
-
-		pe = next;
 	}
 
 	Msg("Finished dump.\n");
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Prints the events serviced per frame since the last call, then resets the counts
+//-----------------------------------------------------------------------------
+void CEventQueue::DumpStats( void )
+{
+	int nFrames = MAX( m_nStatFrames, 1 );
+
+	Msg( "%d events pending, %d target names cached\n", m_Heap.Count(), m_TargetCache.Count() );
+	Msg( "%d frames: %d events serviced, %.2f per frame (max %d)\n", m_nStatFrames, m_nStatServiced, (float)m_nStatServiced / nFrames, m_nStatMaxServiced );
+	Msg( "%d events sent by name, %d needed the entity list searched\n", m_nStatNamedTargets, m_nStatCacheRebuilds );
+
+	m_nStatFrames = 0;
+	m_nStatServiced = 0;
+	m_nStatMaxServiced = 0;
+	m_nStatNamedTargets = 0;
+	m_nStatCacheRebuilds = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: returns the pending events in the order they will fire
+//-----------------------------------------------------------------------------
+static int EventFireOrderCompare( EventQueuePrioritizedEvent_t * const *a, EventQueuePrioritizedEvent_t * const *b )
+{
+	if ( (*a)->m_flFireTime != (*b)->m_flFireTime )
+		return ( (*a)->m_flFireTime < (*b)->m_flFireTime ) ? -1 : 1;
+
+	if ( (*a)->m_iSerial != (*b)->m_iSerial )
+		return ( (*a)->m_iSerial < (*b)->m_iSerial ) ? -1 : 1;
+
+	return 0;
+}
+
+void CEventQueue::GetSortedEvents( CUtlVector< EventQueuePrioritizedEvent_t * > &sorted )
+{
+	sorted.CopyArray( m_Heap.Base(), m_Heap.Count() );
+	sorted.Sort( EventFireOrderCompare );
+}
 
 //-----------------------------------------------------------------------------
 // Purpose: adds the action into the correct spot in the priority queue, targeting entity via string name
@@ -944,41 +983,138 @@ void CEventQueue::AddEvent( CBaseEntity *target, const char *action, float fireD
 
 
 //-----------------------------------------------------------------------------
-// Purpose: private function, adds an event into the list
-// Input  : *newEvent - the (already built) event to add
+// Purpose: true if a is due before b, events due at the same time fire in the
+//			order they were added
 //-----------------------------------------------------------------------------
-void CEventQueue::AddEvent( EventQueuePrioritizedEvent_t *newEvent )
+bool CEventQueue::FiresBefore( const EventQueuePrioritizedEvent_t *a, const EventQueuePrioritizedEvent_t *b )
+{
+	if ( a->m_flFireTime != b->m_flFireTime )
+		return a->m_flFireTime < b->m_flFireTime;
+
+	// serials only wrap after 4 billion events, and only compare across events pending at once
+	return (int)( a->m_iSerial - b->m_iSerial ) < 0;
+}
+
+void CEventQueue::HeapSet( int index, EventQueuePrioritizedEvent_t *pe )
+{
+	m_Heap[index] = pe;
+	pe->m_iHeapIndex = index;
+}
+
+void CEventQueue::HeapSiftUp( int index )
 {
-	// loop through the actions looking for a place to insert
-	EventQueuePrioritizedEvent_t *pe;
-	for ( pe = &m_Events; pe->m_pNext != NULL; pe = pe->m_pNext )
+	EventQueuePrioritizedEvent_t *pe = m_Heap[index];
+	while ( index > 0 )
 	{
-		if ( pe->m_pNext->m_flFireTime > newEvent->m_flFireTime )
-		{
+		int parent = ( index - 1 ) / 2;
+		if ( !FiresBefore( pe, m_Heap[parent] ) )
+			break;
+
+		HeapSet( index, m_Heap[parent] );
+		index = parent;
+	}
+	HeapSet( index, pe );
+}
+
+void CEventQueue::HeapSiftDown( int index )
+{
+	EventQueuePrioritizedEvent_t *pe = m_Heap[index];
+	int count = m_Heap.Count();
+	while ( true )
+	{
+		int child = 2 * index + 1;
+		if ( child >= count )
 			break;
+
+		if ( child + 1 < count && FiresBefore( m_Heap[child + 1], m_Heap[child] ) )
+		{
+			++child;
 		}
+
+		if ( !FiresBefore( m_Heap[child], pe ) )
+			break;
+
+		HeapSet( index, m_Heap[child] );
+		index = child;
 	}
+	HeapSet( index, pe );
+}
 
-	Assert( pe );
 
-	// insert
-	newEvent->m_pNext = pe->m_pNext;
-	newEvent->m_pPrev = pe;
-	pe->m_pNext = newEvent;
-	if ( newEvent->m_pNext )
+//-----------------------------------------------------------------------------
+// Purpose: private function, adds an event into the queue
+// Input  : *newEvent - the (already built) event to add
+//-----------------------------------------------------------------------------
+void CEventQueue::AddEvent( EventQueuePrioritizedEvent_t *newEvent )
+{
+	newEvent->m_iSerial = m_iNextSerial++;
+
+	int index = m_Heap.AddToTail( newEvent );
+	newEvent->m_iHeapIndex = index;
+	HeapSiftUp( index );
+}
+
+void CEventQueue::RemoveEvent( EventQueuePrioritizedEvent_t *pe )
+{
+	int index = pe->m_iHeapIndex;
+	Assert( m_Heap.IsValidIndex( index ) && m_Heap[index] == pe );
+
+	int last = m_Heap.Count() - 1;
+	if ( index != last )
+	{
+		HeapSet( index, m_Heap[last] );
+		m_Heap.RemoveMultipleFromTail( 1 );
+
+		// the moved event may belong above or below its new spot
+		if ( index > 0 && FiresBefore( m_Heap[index], m_Heap[( index - 1 ) / 2] ) )
+		{
+			HeapSiftUp( index );
+		}
+		else
+		{
+			HeapSiftDown( index );
+		}
+	}
+	else
 	{
-		newEvent->m_pNext->m_pPrev = newEvent;
+		m_Heap.RemoveMultipleFromTail( 1 );
 	}
+
+	pe->m_iHeapIndex = -1;
 }
 
-void CEventQueue::RemoveEvent( EventQueuePrioritizedEvent_t *pe )
+
+//-----------------------------------------------------------------------------
+// Purpose: returns the entities named pszTarget, searching the entity list only
+//			if names have changed since it was last searched for this name
+//-----------------------------------------------------------------------------
+CEventQueue::TargetCache_t *CEventQueue::GetTargetCache( const char *pszTarget )
 {
-	Assert( pe->m_pPrev );
-	pe->m_pPrev->m_pNext = pe->m_pNext;
-	if ( pe->m_pNext )
+	int iNameGeneration = gEntList.GetNameGeneration();
+
+	unsigned short i = m_TargetCache.Find( pszTarget );
+	if ( i == m_TargetCache.InvalidIndex() )
 	{
-		pe->m_pNext->m_pPrev = pe->m_pPrev;
+		TargetCache_t *pNewCache = new TargetCache_t;
+		pNewCache->m_iNameGeneration = iNameGeneration - 1;
+		i = m_TargetCache.Insert( pszTarget, pNewCache );
 	}
+
+	TargetCache_t *pCache = m_TargetCache[i];
+	if ( pCache->m_iNameGeneration != iNameGeneration )
+	{
+		++m_nStatCacheRebuilds;
+
+		pCache->m_Targets.RemoveAll();
+		CBaseEntity *target = NULL;
+		while ( ( target = gEntList.FindEntityByName( target, pszTarget ) ) != NULL )
+		{
+			pCache->m_Targets.AddToTail( target );
+		}
+		pCache->m_iNameGeneration = iNameGeneration;
+	}
+
+	return pCache;
 }
 
 
@@ -992,33 +1128,79 @@ void CEventQueue::ServiceEvents( void )
 		return;
 	}
 
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
+	int nServiced = 0;
 
 #ifdef TF_DLL
-	while ( pe != NULL && pe->m_flFireTime <= engine->GetServerTime() )
+	while ( m_Heap.Count() && m_Heap[0]->m_flFireTime <= engine->GetServerTime() )
 #else
-	while ( pe != NULL && pe->m_flFireTime <= gpGlobals->curtime )
+	while ( m_Heap.Count() && m_Heap[0]->m_flFireTime <= gpGlobals->curtime )
 #endif
 	{
 		MDLCACHE_CRITICAL_SECTION();
 
+		// take the event out before firing it, its inputs may add or cancel events
+		EventQueuePrioritizedEvent_t *pe = m_Heap[0];
+		RemoveEvent( pe );
+		++nServiced;
+
 		bool targetFound = false;
 
 		// find the targets
 		if ( pe->m_iTarget != NULL_STRING )
 		{
+			const char *pszTarget = STRING(pe->m_iTarget);
+
 			// In the context the event, the searching entity is also the caller
 			CBaseEntity *pSearchingEntity = pe->m_pCaller;
 			CBaseEntity *target = NULL;
-			while ( 1 )
+
+			if ( pszTarget[0] != '!' && !V_strstr( pszTarget, "*" ) )
 			{
-				target = gEntList.FindEntityByName( target, pe->m_iTarget, pSearchingEntity, pe->m_pActivator, pe->m_pCaller );
-				if ( !target )
-					break;
+				++m_nStatNamedTargets;
+
+				// copy the handles, an input may cause the cache to be rebuilt
+				TargetCache_t *pCache = GetTargetCache( pszTarget );
+				CUtlVector< EHANDLE > targets;
+				targets.CopyArray( pCache->m_Targets.Base(), pCache->m_Targets.Count() );
+
+				int iNameGeneration = gEntList.GetNameGeneration();
+				for ( int i = 0; i < targets.Count(); i++ )
+				{
+					target = targets[i];
+					if ( !target )
+						continue;
+
+					// pump the action into the target
+					target->AcceptInput( STRING(pe->m_iTargetInput), pe->m_pActivator, pe->m_pCaller, pe->m_VariantValue, pe->m_iOutputID );
+					targetFound = true;
+
+					if ( gEntList.GetNameGeneration() != iNameGeneration )
+					{
+						// the input named or renamed something, carry on through the entity list from here
+						while ( 1 )
+						{
+							target = gEntList.FindEntityByName( target, pe->m_iTarget, pSearchingEntity, pe->m_pActivator, pe->m_pCaller );
+							if ( !target )
+								break;
+
+							target->AcceptInput( STRING(pe->m_iTargetInput), pe->m_pActivator, pe->m_pCaller, pe->m_VariantValue, pe->m_iOutputID );
+						}
+						break;
+					}
+				}
+			}
+			else
+			{
+				while ( 1 )
+				{
+					target = gEntList.FindEntityByName( target, pe->m_iTarget, pSearchingEntity, pe->m_pActivator, pe->m_pCaller );
+					if ( !target )
+						break;
 
-				// pump the action into the target
-				target->AcceptInput( STRING(pe->m_iTargetInput), pe->m_pActivator, pe->m_pCaller, pe->m_VariantValue, pe->m_iOutputID );
-				targetFound = true;
+					// pump the action into the target
+					target->AcceptInput( STRING(pe->m_iTargetInput), pe->m_pActivator, pe->m_pCaller, pe->m_VariantValue, pe->m_iOutputID );
+					targetFound = true;
+				}
 			}
 		}
 
@@ -1065,8 +1247,6 @@ void CEventQueue::ServiceEvents( void )
 			ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
 		}
 
-		// remove the event from the list (remembering that the queue may have been added to)
-		RemoveEvent( pe );
 		delete pe;
 
 		//
@@ -1079,10 +1259,12 @@ void CEventQueue::ServiceEvents( void )
 				break;
 			}
 		}
-
-		// restart the list (to catch any new items have probably been added to the queue)
-		pe = m_Events.m_pNext;	
 	}
+
+	++m_nStatFrames;
+	m_nStatServiced += nServiced;
+	m_nStatMaxServiced = MAX( m_nStatMaxServiced, nServiced );
+	VPROF_INCREMENT_COUNTER( "CEventQueue( events serviced )", nServiced );
 }
 
 //-----------------------------------------------------------------------------
@@ -1097,6 +1279,18 @@ void CC_DumpEventQueue()
 }
 static ConCommand dumpeventqueue( "dumpeventqueue", CC_DumpEventQueue, "Dump the contents of the Entity I/O event queue to the console." );
 
+//-----------------------------------------------------------------------------
+// Purpose: Shows how many Entity I/O events were serviced per frame since the last call.
+//-----------------------------------------------------------------------------
+void CC_EventQueueStats()
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_EventQueue.DumpStats();
+}
+static ConCommand eventqueue_stats( "eventqueue_stats", CC_EventQueueStats, "Show how many Entity I/O events were serviced per frame since the last call, then reset the counts." );
+
 //-----------------------------------------------------------------------------
 // Purpose: Removes all pending events from the I/O queue that were added by the
 //			given caller.
@@ -1109,11 +1303,12 @@ void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 	if (!pCaller)
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	// removing from the heap reorders it, so collect the matches first
+	CUtlVector< EventQueuePrioritizedEvent_t * > deleteList;
 
-	while (pCur != NULL)
+	for ( int i = 0; i < m_Heap.Count(); i++ )
 	{
-		bool bDelete = false;
+		EventQueuePrioritizedEvent_t *pCur = m_Heap[i];
 		if (pCur->m_pCaller == pCaller)
 		{
 			// Pointers match; make sure everything else matches.
@@ -1121,18 +1316,15 @@ void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 				!stricmp(pCur->m_pCaller->GetClassname(), pCaller->GetClassname()))
 			{
 				// Found a matching event; delete it from the queue.
-				bDelete = true;
+				deleteList.AddToTail( pCur );
 			}
 		}
+	}
 
-		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
-
-		if (bDelete)
-		{
-			RemoveEvent( pCurSave );
-			delete pCurSave;
-		}
+	for ( int i = 0; i < deleteList.Count(); i++ )
+	{
+		RemoveEvent( deleteList[i] );
+		delete deleteList[i];
 	}
 }
 
@@ -1147,28 +1339,26 @@ void CEventQueue::CancelEventOn( CBaseEntity *pTarget, const char *sInputName )
 	if (!pTarget)
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	// removing from the heap reorders it, so collect the matches first
+	CUtlVector< EventQueuePrioritizedEvent_t * > deleteList;
 
-	while (pCur != NULL)
+	for ( int i = 0; i < m_Heap.Count(); i++ )
 	{
-		bool bDelete = false;
+		EventQueuePrioritizedEvent_t *pCur = m_Heap[i];
 		if (pCur->m_pEntTarget == pTarget)
 		{
 			if ( !Q_strncmp( STRING(pCur->m_iTargetInput), sInputName, strlen(sInputName) ) )
 			{
 				// Found a matching event; delete it from the queue.
-				bDelete = true;
+				deleteList.AddToTail( pCur );
 			}
 		}
+	}
 
-		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
-
-		if (bDelete)
-		{
-			RemoveEvent( pCurSave );
-			delete pCurSave;
-		}
+	for ( int i = 0; i < deleteList.Count(); i++ )
+	{
+		RemoveEvent( deleteList[i] );
+		delete deleteList[i];
 	}
 }
 
@@ -1182,10 +1372,9 @@ bool CEventQueue::HasEventPending( CBaseEntity *pTarget, const char *sInputName
 	if (!pTarget)
 		return false;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
-
-	while (pCur != NULL)
+	for ( int i = 0; i < m_Heap.Count(); i++ )
 	{
+		EventQueuePrioritizedEvent_t *pCur = m_Heap[i];
 		if (pCur->m_pEntTarget == pTarget)
 		{
 			if ( !sInputName )
@@ -1194,8 +1383,6 @@ bool CEventQueue::HasEventPending( CBaseEntity *pTarget, const char *sInputName
 			if ( !Q_strncmp( STRING(pCur->m_iTargetInput), sInputName, strlen(sInputName) ) )
 				return true;
 		}
-
-		pCur = pCur->m_pNext;
 	}
 
 	return false;
@@ -1213,7 +1400,7 @@ void ServiceEventQueue( void )
 // save data description for the event queue
 BEGIN_SIMPLE_DATADESC( CEventQueue )
 	// These are saved explicitly in CEventQueue::Save below
-	// DEFINE_FIELD( m_Events, EventQueuePrioritizedEvent_t ),
+	// DEFINE_FIELD( m_Heap, EventQueuePrioritizedEvent_t ),
 
 	DEFINE_FIELD( m_iListCount, FIELD_INTEGER ),	// this value is only used during save/restore
 END_DATADESC()
@@ -1230,29 +1417,28 @@ BEGIN_SIMPLE_DATADESC( EventQueuePrioritizedEvent_t )
 	DEFINE_FIELD( m_iOutputID, FIELD_INTEGER ),
 	DEFINE_CUSTOM_FIELD( m_VariantValue, variantFuncs ),
 
-//	DEFINE_FIELD( m_pNext, FIELD_??? ),
-//	DEFINE_FIELD( m_pPrev, FIELD_??? ),
+//	DEFINE_FIELD( m_iSerial, FIELD_INTEGER ),	// reassigned in order as the events are restored
+//	DEFINE_FIELD( m_iHeapIndex, FIELD_INTEGER ),
 END_DATADESC()
 
 
 int CEventQueue::Save( ISave &save )
 {
-	// count the number of items in the queue
-	EventQueuePrioritizedEvent_t *pe;
+	// save in firing order, so events due at the same time are restored in the same order
+	CUtlVector< EventQueuePrioritizedEvent_t * > sorted;
+	GetSortedEvents( sorted );
 
-	m_iListCount = 0;
-	for ( pe = m_Events.m_pNext; pe != NULL; pe = pe->m_pNext )
-	{
-		m_iListCount++;
-	}
+	// count the number of items in the queue
+	m_iListCount = sorted.Count();
 
 	// save that value out to disk, so we know how many to restore
 	if ( !save.WriteFields( "EventQueue", this, NULL, m_DataMap.dataDesc, m_DataMap.dataNumFields ) )
 		return 0;
 	
 	// cycle through all the events, saving them all
-	for ( pe = m_Events.m_pNext; pe != NULL; pe = pe->m_pNext )
+	for ( int i = 0; i < sorted.Count(); i++ )
 	{
+		EventQueuePrioritizedEvent_t *pe = sorted[i];
 		if ( !save.WriteFields( "PEvent", pe, NULL, pe->m_DataMap.dataDesc, pe->m_DataMap.dataNumFields ) )
 			return 0;
 	}
@@ -33,6 +33,171 @@ static CUtlVector<IServerNetworkable*> g_DeleteList;
 CGlobalEntityList gEntList;
 CBaseEntityList *g_pEntityList = &gEntList;
 
+//-----------------------------------------------------------------------------
+// Purpose: Hash index from targetname or classname to the entities using it, so
+//			searches for a plain name only look at entities that could match.
+//			Each bucket is an intrusive list of entity list slots, kept in the
+//			order the entities were added to the global list so iteration
+//			visits them in the same order a scan of the list would.
+//-----------------------------------------------------------------------------
+static unsigned int g_EntListOrder[NUM_ENT_ENTRIES];	// when each slot's entity was added to the list
+static unsigned int g_nNextEntListOrder;
+
+// Matches the case folding done by NamesMatch(): names differing only in ASCII case share a bucket
+static unsigned int HashEntityName( const char *pszName )
+{
+	unsigned int hash = 0;
+	for ( ; *pszName; ++pszName )
+	{
+		unsigned char c = *pszName;
+		if ( c - 'A' <= (unsigned char)'Z' - 'A' )
+		{
+			c += 'a' - 'A';
+		}
+		hash = hash * 31 + c;
+	}
+	return hash;
+}
+
+class CEntityNameIndex
+{
+public:
+	enum
+	{
+		NAME_HASH_BITS = 12,
+		NUM_NAME_BUCKETS = 1 << NAME_HASH_BITS,
+		INVALID_SLOT = 0xFFFF,
+	};
+
+	CEntityNameIndex()
+	{
+		for ( int i = 0; i < NUM_ENT_ENTRIES; i++ )
+		{
+			m_bucket[i] = INVALID_SLOT;
+		}
+
+		for ( int i = 0; i < NUM_NAME_BUCKETS; i++ )
+		{
+			m_head[i] = m_tail[i] = INVALID_SLOT;
+		}
+	}
+
+	static int BucketForName( const char *pszName )
+	{
+		return HashEntityName( pszName ) & ( NUM_NAME_BUCKETS - 1 );
+	}
+
+	// Files the slot under its new name, NULL_STRING just takes it out of the index
+	void Update( int iSlot, string_t iszName )
+	{
+		Remove( iSlot );
+
+		if ( iszName == NULL_STRING )
+			return;
+
+		int bucket = BucketForName( STRING(iszName) );
+
+		// newly added entities go on the end, only renames need to search back for their place
+		int prev = m_tail[bucket];
+		while ( prev != INVALID_SLOT && g_EntListOrder[prev] > g_EntListOrder[iSlot] )
+		{
+			prev = m_prev[prev];
+		}
+
+		int next = ( prev != INVALID_SLOT ) ? m_next[prev] : m_head[bucket];
+
+		m_bucket[iSlot] = bucket;
+		m_prev[iSlot] = prev;
+		m_next[iSlot] = next;
+
+		if ( prev != INVALID_SLOT )
+		{
+			m_next[prev] = iSlot;
+		}
+		else
+		{
+			m_head[bucket] = iSlot;
+		}
+
+		if ( next != INVALID_SLOT )
+		{
+			m_prev[next] = iSlot;
+		}
+		else
+		{
+			m_tail[bucket] = iSlot;
+		}
+	}
+
+	void Remove( int iSlot )
+	{
+		int bucket = m_bucket[iSlot];
+		if ( bucket == INVALID_SLOT )
+			return;
+
+		if ( m_prev[iSlot] != INVALID_SLOT )
+		{
+			m_next[m_prev[iSlot]] = m_next[iSlot];
+		}
+		else
+		{
+			m_head[bucket] = m_next[iSlot];
+		}
+
+		if ( m_next[iSlot] != INVALID_SLOT )
+		{
+			m_prev[m_next[iSlot]] = m_prev[iSlot];
+		}
+		else
+		{
+			m_tail[bucket] = m_prev[iSlot];
+		}
+
+		m_bucket[iSlot] = INVALID_SLOT;
+	}
+
+	// First slot that could hold a match for pszName after iStartSlot (-1 to start from the beginning)
+	int First( const char *pszName, int iStartSlot ) const
+	{
+		int bucket = BucketForName( pszName );
+
+		if ( iStartSlot < 0 )
+			return m_head[bucket];
+
+		if ( m_bucket[iStartSlot] == bucket )
+			return m_next[iStartSlot];
+
+		// the last entity found has been renamed since, pick up after where it sits in the list
+		int slot = m_head[bucket];
+		while ( slot != INVALID_SLOT && g_EntListOrder[slot] <= g_EntListOrder[iStartSlot] )
+		{
+			slot = m_next[slot];
+		}
+		return slot;
+	}
+
+	int Next( int iSlot ) const
+	{
+		return m_next[iSlot];
+	}
+
+private:
+	unsigned short m_head[NUM_NAME_BUCKETS];
+	unsigned short m_tail[NUM_NAME_BUCKETS];
+	unsigned short m_next[NUM_ENT_ENTRIES];
+	unsigned short m_prev[NUM_ENT_ENTRIES];
+	unsigned short m_bucket[NUM_ENT_ENTRIES];
+};
+
+static CEntityNameIndex g_EntityNameIndex;
+static CEntityNameIndex g_EntityClassnameIndex;
+
+// Names with a wildcard, or procedural names, can match more than one spelling and have to scan the list
+static bool CanUseNameIndex( const char *pszName )
+{
+	return pszName[0] && pszName[0] != '!' && !V_strchr( pszName, '*' );
+}
+
 class CAimTargetManager : public IEntityListener
 {
 public:
@@ -127,6 +292,11 @@ void AimTarget_ForceRepopulateList()
 // NOTE: This is usually a small subset of the global entity list, so it's
 // an optimization to maintain this list incrementally rather than polling each
 // frame.
+//
+// Entities that only think are also kept on a timing wheel keyed on their next
+// think tick, so finding what is due each tick only visits those entities rather
+// than the whole list. Entities that simulate, or whose think is due, sit on the
+// active bucket until they are rescheduled.
 struct simthinkentry_t
 {
 	unsigned short	entEntry;
@@ -146,7 +316,19 @@ public:
 		for ( int i = 0; i < ARRAYSIZE(m_entinfoIndex); i++ )
 		{
 			m_entinfoIndex[i] = 0xFFFF;
+			m_wheelBucket[i] = 0xFFFF;
+		}
+		for ( int i = 0; i < NUM_WHEEL_BUCKETS; i++ )
+		{
+			m_wheelHead[i] = 0xFFFF;
 		}
+		m_wheelTick = 0;
+
+		m_statTicks = 0;
+		m_statThinks = 0;
+		m_statMaxThinks = 0;
+		m_statListed = 0;
+		m_statLastTick = -1;
 	}
 	void LevelInitPreEntity()
 	{
@@ -175,6 +357,7 @@ public:
 		if ( listHandle != 0xFFFF )
 		{
 			Assert(m_simThinkList[listHandle].entEntry == index);
+			WheelUnlink( index );
 			m_simThinkList.FastRemove( listHandle );
 			m_entinfoIndex[index] = 0xFFFF;
 			
@@ -193,20 +376,53 @@ public:
 	int ListCopy( CBaseEntity *pList[], int listMax )
 	{
 		int count = MIN(listMax, ListCount());
-		int out = 0;
-		for ( int i = 0; i < count; i++ )
+
+		WheelAdvance( gpGlobals->tickcount );
+
+		// only copy out entities that will simulate or think this frame
+		m_dueList.RemoveAll();
+		int index = m_wheelHead[WHEEL_BUCKET_ACTIVE];
+		while ( index != 0xFFFF )
 		{
-			// only copy out entities that will simulate or think this frame
-			if ( m_simThinkList[i].nextThinkTick <= gpGlobals->tickcount )
+			int next = m_wheelNext[index];
+			int listHandle = m_entinfoIndex[index];
+			if ( m_simThinkList[listHandle].nextThinkTick <= gpGlobals->tickcount )
+			{
+				if ( listHandle < count )
+				{
+					m_dueList.AddToTail( listHandle );
+				}
+			}
+			else
 			{
-				Assert(m_simThinkList[i].nextThinkTick>=0);
-				int entinfoIndex = m_simThinkList[i].entEntry;
-				const CEntInfo *pInfo = gEntList.GetEntInfoPtrByIndex( entinfoIndex );
-				pList[out] = (CBaseEntity *)pInfo->m_pEntity;
-				Assert(m_simThinkList[i].nextThinkTick==0 || pList[out]->GetFirstThinkTick()==m_simThinkList[i].nextThinkTick);
-				Assert( gEntList.IsEntityPtr( pList[out] ) );
-				out++;
+				WheelSchedule( index );
 			}
+			index = next;
+		}
+
+		// hand them out in list order, as scanning the list would
+		m_dueList.Sort( DueListCompare );
+
+		int out = 0;
+		for ( int i = 0; i < m_dueList.Count(); i++ )
+		{
+			int listHandle = m_dueList[i];
+			Assert(m_simThinkList[listHandle].nextThinkTick>=0);
+			int entinfoIndex = m_simThinkList[listHandle].entEntry;
+			const CEntInfo *pInfo = gEntList.GetEntInfoPtrByIndex( entinfoIndex );
+			pList[out] = (CBaseEntity *)pInfo->m_pEntity;
+			Assert(m_simThinkList[listHandle].nextThinkTick==0 || pList[out]->GetFirstThinkTick()==m_simThinkList[listHandle].nextThinkTick);
+			Assert( gEntList.IsEntityPtr( pList[out] ) );
+			out++;
+		}
+
+		if ( m_statLastTick != gpGlobals->tickcount )
+		{
+			m_statLastTick = gpGlobals->tickcount;
+			++m_statTicks;
+			m_statThinks += out;
+			m_statListed += count;
+			m_statMaxThinks = MAX( m_statMaxThinks, out );
 		}
 
 		return out;
@@ -255,12 +471,190 @@ public:
 					m_simThinkList[m_entinfoIndex[index]].nextThinkTick = 0;
 				}
 			}
+
+			WheelSchedule( index );
+		}
+	}
+
+	void ReportStats()
+	{
+		int ticks = MAX( m_statTicks, 1 );
+		Msg( "%d entities simulating or thinking\n", m_simThinkList.Count() );
+		Msg( "%d ticks: %.1f due per tick (max %d), %.1f per tick in the list\n", m_statTicks, (float)m_statThinks / ticks, m_statMaxThinks, (float)m_statListed / ticks );
+
+		int active = 0, wheel = 0, overflow = 0;
+		for ( int i = 0; i < NUM_WHEEL_BUCKETS; i++ )
+		{
+			for ( int index = m_wheelHead[i]; index != 0xFFFF; index = m_wheelNext[index] )
+			{
+				if ( i == WHEEL_BUCKET_ACTIVE )
+					++active;
+				else if ( i == WHEEL_BUCKET_OVERFLOW )
+					++overflow;
+				else
+					++wheel;
+			}
 		}
+		Msg( "%d active, %d waiting on the wheel, %d waiting beyond it\n", active, wheel, overflow );
+	}
+
+	void ResetStats()
+	{
+		m_statTicks = 0;
+		m_statThinks = 0;
+		m_statMaxThinks = 0;
+		m_statListed = 0;
 	}
 
 private:
+	// Two level timing wheel: one tick per slot for the next WHEEL_SLOTS ticks, then
+	// WHEEL_SLOTS ticks per slot for WHEEL_LEVEL1_SLOTS more. Anything further out waits
+	// in the overflow bucket and is looked at again each time level 1 comes round.
+	enum
+	{
+		WHEEL_BITS = 8,
+		WHEEL_SLOTS = 1 << WHEEL_BITS,
+		WHEEL_LEVEL1_BITS = 6,
+		WHEEL_LEVEL1_SLOTS = 1 << WHEEL_LEVEL1_BITS,
+
+		WHEEL_BUCKET_ACTIVE = 0,
+		WHEEL_BUCKET_LEVEL0 = 1,
+		WHEEL_BUCKET_LEVEL1 = WHEEL_BUCKET_LEVEL0 + WHEEL_SLOTS,
+		WHEEL_BUCKET_OVERFLOW = WHEEL_BUCKET_LEVEL1 + WHEEL_LEVEL1_SLOTS,
+		NUM_WHEEL_BUCKETS
+	};
+
+	int WheelBucketForTick( int tick ) const
+	{
+		if ( tick <= m_wheelTick )
+			return WHEEL_BUCKET_ACTIVE;
+
+		if ( tick - m_wheelTick < WHEEL_SLOTS )
+			return WHEEL_BUCKET_LEVEL0 + ( tick & ( WHEEL_SLOTS - 1 ) );
+
+		if ( ( tick >> WHEEL_BITS ) - ( m_wheelTick >> WHEEL_BITS ) < WHEEL_LEVEL1_SLOTS )
+			return WHEEL_BUCKET_LEVEL1 + ( ( tick >> WHEEL_BITS ) & ( WHEEL_LEVEL1_SLOTS - 1 ) );
+
+		return WHEEL_BUCKET_OVERFLOW;
+	}
+
+	void WheelLink( int index, int bucket )
+	{
+		m_wheelBucket[index] = bucket;
+		m_wheelPrev[index] = 0xFFFF;
+		m_wheelNext[index] = m_wheelHead[bucket];
+		if ( m_wheelHead[bucket] != 0xFFFF )
+		{
+			m_wheelPrev[m_wheelHead[bucket]] = index;
+		}
+		m_wheelHead[bucket] = index;
+	}
+
+	void WheelUnlink( int index )
+	{
+		int bucket = m_wheelBucket[index];
+		if ( bucket == 0xFFFF )
+			return;
+
+		if ( m_wheelPrev[index] != 0xFFFF )
+		{
+			m_wheelNext[m_wheelPrev[index]] = m_wheelNext[index];
+		}
+		else
+		{
+			m_wheelHead[bucket] = m_wheelNext[index];
+		}
+
+		if ( m_wheelNext[index] != 0xFFFF )
+		{
+			m_wheelPrev[m_wheelNext[index]] = m_wheelPrev[index];
+		}
+
+		m_wheelBucket[index] = 0xFFFF;
+	}
+
+	// put an entry where its next think tick says it belongs
+	void WheelSchedule( int index )
+	{
+		int bucket = WheelBucketForTick( m_simThinkList[m_entinfoIndex[index]].nextThinkTick );
+		if ( bucket != m_wheelBucket[index] )
+		{
+			WheelUnlink( index );
+			WheelLink( index, bucket );
+		}
+	}
+
+	// move everything in a bucket to wherever it belongs now
+	void WheelCascade( int bucket )
+	{
+		int index = m_wheelHead[bucket];
+		m_wheelHead[bucket] = 0xFFFF;
+
+		while ( index != 0xFFFF )
+		{
+			int next = m_wheelNext[index];
+			WheelLink( index, WheelBucketForTick( m_simThinkList[m_entinfoIndex[index]].nextThinkTick ) );
+			index = next;
+		}
+	}
+
+	void WheelAdvance( int tick )
+	{
+		if ( tick < m_wheelTick || tick - m_wheelTick > WHEEL_SLOTS * WHEEL_LEVEL1_SLOTS )
+		{
+			// clock jumped, cheaper to start over than to step through it
+			m_wheelTick = tick;
+			for ( int i = 0; i < NUM_WHEEL_BUCKETS; i++ )
+			{
+				m_wheelHead[i] = 0xFFFF;
+			}
+			for ( int i = 0; i < m_simThinkList.Count(); i++ )
+			{
+				int index = m_simThinkList[i].entEntry;
+				WheelLink( index, WheelBucketForTick( m_simThinkList[i].nextThinkTick ) );
+			}
+			return;
+		}
+
+		while ( m_wheelTick < tick )
+		{
+			++m_wheelTick;
+
+			if ( ( m_wheelTick & ( WHEEL_SLOTS - 1 ) ) == 0 )
+			{
+				int level1Slot = ( m_wheelTick >> WHEEL_BITS ) & ( WHEEL_LEVEL1_SLOTS - 1 );
+				if ( level1Slot == 0 )
+				{
+					WheelCascade( WHEEL_BUCKET_OVERFLOW );
+				}
+				WheelCascade( WHEEL_BUCKET_LEVEL1 + level1Slot );
+			}
+
+			WheelCascade( WHEEL_BUCKET_LEVEL0 + ( m_wheelTick & ( WHEEL_SLOTS - 1 ) ) );
+		}
+	}
+
+	static int DueListCompare( const unsigned short *a, const unsigned short *b )
+	{
+		return (int)*a - (int)*b;
+	}
+
 	unsigned short m_entinfoIndex[NUM_ENT_ENTRIES];
 	CUtlVector<simthinkentry_t>	m_simThinkList;
+
+	unsigned short m_wheelHead[NUM_WHEEL_BUCKETS];
+	unsigned short m_wheelNext[NUM_ENT_ENTRIES];
+	unsigned short m_wheelPrev[NUM_ENT_ENTRIES];
+	unsigned short m_wheelBucket[NUM_ENT_ENTRIES];
+	int m_wheelTick;										// the wheel has handed out everything due up to this tick
+
+	CUtlVector<unsigned short> m_dueList;
+
+	int m_statTicks;
+	int m_statThinks;
+	int m_statMaxThinks;
+	int m_statListed;
+	int m_statLastTick;
 };
 
 CSimThinkManager g_SimThinkManager;
@@ -294,6 +688,7 @@ CGlobalEntityList::CGlobalEntityList()
 {
 	m_iHighestEnt = m_iNumEnts = m_iNumEdicts = 0;
 	m_bClearingEntities = false;
+	m_iNameGeneration = 0;
 }
 
 
@@ -381,6 +776,7 @@ void CGlobalEntityList::Clear( void )
 	CBaseEntity::m_bInDebugSelect = false; 
 	m_iHighestEnt = 0;
 	m_iNumEnts = 0;
+	++m_iNameGeneration;
 
 	m_bClearingEntities = false;
 }
@@ -481,6 +877,24 @@ bool CGlobalEntityList::IsEntityPtr( void *pTest )
 //-----------------------------------------------------------------------------
 CBaseEntity *CGlobalEntityList::FindEntityByClassname( CBaseEntity *pStartEntity, const char *szName, IEntityFindFilter *pFilter )
 {
+	if ( CanUseNameIndex( szName ) )
+	{
+		int iSlot = g_EntityClassnameIndex.First( szName, pStartEntity ? pStartEntity->GetRefEHandle().GetEntryIndex() : -1 );
+		for ( ; iSlot != CEntityNameIndex::INVALID_SLOT; iSlot = g_EntityClassnameIndex.Next( iSlot ) )
+		{
+			CBaseEntity *pEntity = (CBaseEntity *)GetEntInfoPtrByIndex( iSlot )->m_pEntity;
+			if ( !pEntity || !pEntity->ClassMatches(szName) )
+				continue;
+
+			if ( pFilter && !pFilter->ShouldFindEntity( pEntity ) )
+				continue;
+
+			return pEntity;
+		}
+
+		return NULL;
+	}
+
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
 	for ( ;pInfo; pInfo = pInfo->m_pNext )
@@ -595,6 +1009,24 @@ CBaseEntity *CGlobalEntityList::FindEntityByName( CBaseEntity *pStartEntity, con
 
 		return NULL;
 	}
+
+	if ( CanUseNameIndex( szName ) )
+	{
+		int iSlot = g_EntityNameIndex.First( szName, pStartEntity ? pStartEntity->GetRefEHandle().GetEntryIndex() : -1 );
+		for ( ; iSlot != CEntityNameIndex::INVALID_SLOT; iSlot = g_EntityNameIndex.Next( iSlot ) )
+		{
+			CBaseEntity *ent = (CBaseEntity *)GetEntInfoPtrByIndex( iSlot )->m_pEntity;
+			if ( !ent || !ent->NameMatches( szName ) )
+				continue;
+
+			if ( pFilter && !pFilter->ShouldFindEntity(ent) )
+				continue;
+
+			return ent;
+		}
+
+		return NULL;
+	}
 	
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
@@ -1128,6 +1560,12 @@ void CGlobalEntityList::OnAddEntity( IHandleEntity *pEnt, CBaseHandle handle )
 	
 	// NOTE: Must be a CBaseEntity on server
 	Assert( pBaseEnt );
+
+	// the classname (and sometimes the name) is set before the entity gets its slot
+	g_EntListOrder[handle.GetEntryIndex()] = g_nNextEntListOrder++;
+	g_EntityNameIndex.Update( handle.GetEntryIndex(), pBaseEnt->m_iName );
+	g_EntityClassnameIndex.Update( handle.GetEntryIndex(), pBaseEnt->m_iClassname );
+
 	//DevMsg(2,"Created %s\n", pBaseEnt->GetClassname() );
 	for ( i = m_entityListeners.Count()-1; i >= 0; i-- )
 	{
@@ -1158,6 +1596,9 @@ void CGlobalEntityList::OnRemoveEntity( IHandleEntity *pEnt, CBaseHandle handle
 	if ( pBaseEnt->edict() )
 		m_iNumEdicts--;
 
+	g_EntityNameIndex.Remove( handle.GetEntryIndex() );
+	g_EntityClassnameIndex.Remove( handle.GetEntryIndex() );
+
 	m_iNumEnts--;
 }
 
@@ -1188,6 +1629,28 @@ void CGlobalEntityList::NotifySpawn( CBaseEntity *pEnt )
 // NOTE: This doesn't happen in OnRemoveEntity() specifically because 
 // listeners may want to reference the object as it's being deleted
 // OnRemoveEntity isn't called until the destructor and all data is invalid.
+//-----------------------------------------------------------------------------
+// Purpose: An entity's targetname or classname was set, refile it in the name indices
+//-----------------------------------------------------------------------------
+void CGlobalEntityList::NotifyEntityNameChanged( CBaseEntity *pEnt )
+{
+	++m_iNameGeneration;
+
+	// not in the list yet, OnAddEntity() will index it
+	if ( !pEnt || LookupEntity( pEnt->GetRefEHandle() ) != pEnt )
+		return;
+
+	g_EntityNameIndex.Update( pEnt->GetRefEHandle().GetEntryIndex(), pEnt->m_iName );
+}
+
+void CGlobalEntityList::NotifyEntityClassnameChanged( CBaseEntity *pEnt )
+{
+	if ( !pEnt || LookupEntity( pEnt->GetRefEHandle() ) != pEnt )
+		return;
+
+	g_EntityClassnameIndex.Update( pEnt->GetRefEHandle().GetEntryIndex(), pEnt->m_iClassname );
+}
+
 void CGlobalEntityList::NotifyRemoveEntity( CBaseHandle hEnt )
 {
 	CBaseEntity *pBaseEnt = GetBaseEntity( hEnt );
@@ -1667,3 +2130,12 @@ CON_COMMAND(report_simthinklist, "Lists all simulating/thinking entities")
 	list.ReportEntityList();
 }
 
+CON_COMMAND(report_simthink_stats, "Shows how many entities were due to simulate or think per tick since the last call, then resets the counts")
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	g_SimThinkManager.ReportStats();
+	g_SimThinkManager.ResetStats();
+}
+
@@ -81,6 +81,8 @@ private:
 	bool m_bClearingEntities;
 	CUtlVector<IEntityListener *>	m_entityListeners;
 
+	int m_iNameGeneration;	// bumped whenever any entity's targetname changes
+
 public:
 	IServerNetworkable* GetServerNetworkable( CBaseHandle hEnt ) const;
 	CBaseNetworkable* GetBaseNetworkable( CBaseHandle hEnt ) const;
@@ -112,6 +114,12 @@ public:
 	void NotifyCreateEntity( CBaseEntity *pEnt );
 	void NotifySpawn( CBaseEntity *pEnt );
 	void NotifyRemoveEntity( CBaseHandle hEnt );
+
+	// an entity's targetname or classname was set; keeps the name indices current, and
+	// lookups cached by targetname are stale once the name generation changes
+	void NotifyEntityNameChanged( CBaseEntity *pEnt );
+	void NotifyEntityClassnameChanged( CBaseEntity *pEnt );
+	int GetNameGeneration() const	{ return m_iNameGeneration; }
 	// iteration functions
 
 	// returns the next entity after pCurrentEnt;  if pCurrentEnt is NULL, return the first entity
@@ -15,6 +15,7 @@
 #endif
 
 #include "mempool.h"
+#include "utldict.h"
 
 struct EventQueuePrioritizedEvent_t
 {
@@ -28,8 +29,8 @@ struct EventQueuePrioritizedEvent_t
 
 	variant_t m_VariantValue;	// variable-type parameter
 
-	EventQueuePrioritizedEvent_t *m_pNext;
-	EventQueuePrioritizedEvent_t *m_pPrev;
+	unsigned int m_iSerial;		// order the event was added in, events due at the same time fire in this order
+	int m_iHeapIndex;			// position in CEventQueue::m_Heap
 
 	DECLARE_SIMPLE_DATADESC();
 
@@ -65,14 +66,41 @@ public:
 	void Clear( void ); // resets the list
 
 	void Dump( void );
+	void DumpStats( void );
 
 private:
 
 	void AddEvent( EventQueuePrioritizedEvent_t *event );
 	void RemoveEvent( EventQueuePrioritizedEvent_t *pe );
 
+	// the pending events, as a binary heap on fire time then serial
+	static bool FiresBefore( const EventQueuePrioritizedEvent_t *a, const EventQueuePrioritizedEvent_t *b );
+	void HeapSet( int index, EventQueuePrioritizedEvent_t *pe );
+	void HeapSiftUp( int index );
+	void HeapSiftDown( int index );
+	void GetSortedEvents( CUtlVector< EventQueuePrioritizedEvent_t * > &sorted );
+
+	CUtlVector< EventQueuePrioritizedEvent_t * > m_Heap;
+	unsigned int m_iNextSerial;
+
+	// Entities matching each plain target name, valid while the entity list's name
+	// generation is unchanged. Procedural (!) and wildcard targets are always searched.
+	struct TargetCache_t
+	{
+		int m_iNameGeneration;
+		CUtlVector< EHANDLE > m_Targets;
+	};
+	CUtlDict< TargetCache_t *, int > m_TargetCache;
+	TargetCache_t *GetTargetCache( const char *pszTarget );
+
+	// counters for eventqueue_stats
+	int m_nStatFrames;
+	int m_nStatServiced;
+	int m_nStatMaxServiced;
+	int m_nStatNamedTargets;
+	int m_nStatCacheRebuilds;
+
 	DECLARE_SIMPLE_DATADESC();
-	EventQueuePrioritizedEvent_t m_Events;
 	int m_iListCount;
 };
 
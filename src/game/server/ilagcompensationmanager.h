@@ -13,6 +13,7 @@
 
 class CBasePlayer;
 class CUserCmd;
+class Vector;
 
 //-----------------------------------------------------------------------------
 // Purpose: This is also an IServerSystem
@@ -22,6 +23,9 @@ abstract_class ILagCompensationManager
 public:
 	// Called during player movement to set up/restore after lag compensation
 	virtual void	StartLagCompensation( CBasePlayer *player, CUserCmd *cmd ) = 0;
+	// Same, but only backtracks players a hitscan ray from vecShotStart along vecShotDir can reach,
+	// widened by flShotSpread units per unit of distance. Hulls and volume queries must use StartLagCompensation.
+	virtual void	StartLagCompensationForShot( CBasePlayer *player, CUserCmd *cmd, const Vector &vecShotStart, const Vector &vecShotDir, float flShotSpread ) = 0;
 	virtual void	FinishLagCompensation( CBasePlayer *player ) = 0;
 	virtual bool	IsCurrentlyDoingLagCompensation() const = 0;
 };
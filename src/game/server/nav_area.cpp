@@ -63,6 +63,7 @@ const float DEF_NAV_VIEW_DISTANCE = 1500.0;
 ConVar nav_max_view_distance( "nav_max_view_distance", "6000", FCVAR_CHEAT, "Maximum range for precomputed nav mesh visibility (0 = default 1500 units)" );
 ConVar nav_update_visibility_on_edit( "nav_update_visibility_on_edit", "0", FCVAR_CHEAT, "If nonzero editing the mesh will incrementally recompue visibility" );
 ConVar nav_potentially_visible_dot_tolerance( "nav_potentially_visible_dot_tolerance", "0.98", FCVAR_CHEAT );
+ConVar nav_generate_parallel( "nav_generate_parallel", "1", FCVAR_CHEAT, "If nonzero, mesh visibility is traced on the job threads while generating or analyzing. The result is the same either way." );
 ConVar nav_show_potentially_visible( "nav_show_potentially_visible", "0", FCVAR_CHEAT, "Show areas that are potentially visible from the current nav area" );
 
 Color s_selectedSetColor( 255, 255, 200, 96 );
@@ -188,6 +189,7 @@ CNavArea::CNavArea( void )
 	m_parentHow = GO_NORTH;
 	m_attributeFlags = 0;
 	m_place = TheNavMesh->GetNavPlace();
+	m_cluster = -1;
 	m_isUnderwater = false;
 	m_avoidanceObstacleHeight = 0.0f;
 
@@ -5525,24 +5527,43 @@ void CNavArea::ResetPotentiallyVisibleAreas()
  * in the PostCustomAnalysis() step.
  */
 
-CNavArea *g_pCurVisArea;
-CTSListWithFreeList< CNavArea::AreaBindInfo > g_ComputedVis;
+struct CNavArea::VisJob_t
+{
+	CNavArea *m_area;								// the area visibility is being computed for
+	CNavArea *m_other;
+	const byte *m_pvs;								// PVS of m_area, see SetupPVS()
+	VisibilityType m_visAreaToOther;
+	VisibilityType m_visOtherToArea;
+};
 
-void CNavArea::ComputeVisToArea( CNavArea *&pOtherArea )
+void CNavArea::ComputeVisToArea( VisJob_t &job )
 {
-	CNavArea *area = assert_cast< CNavArea * >( pOtherArea );
-	VisibilityType visThisToOther = ( area == g_pCurVisArea ) ? COMPLETELY_VISIBLE : NOT_VISIBLE;
+	CNavArea *area = job.m_other;
+	CNavArea *curVisArea = job.m_area;
+	VisibilityType visThisToOther = ( area == curVisArea ) ? COMPLETELY_VISIBLE : NOT_VISIBLE;
 	VisibilityType visOtherToThis = NOT_VISIBLE;
 
-	if ( area != g_pCurVisArea )
+	if ( area != curVisArea )
 	{
-		bool bOutsidePVS;
+		// the PVS test of ComputeVisibility(), against this job's own copy of the PVS
+		Vector eye( 0, 0, 0.75f * HumanHeight );
+		Extent areaExtent;
+		areaExtent.lo = areaExtent.hi = area->GetCenter() + eye;
+		areaExtent.Encompass( area->GetCorner( NORTH_WEST ) + eye );
+		areaExtent.Encompass( area->GetCorner( NORTH_EAST ) + eye );
+		areaExtent.Encompass( area->GetCorner( SOUTH_WEST ) + eye );
+		areaExtent.Encompass( area->GetCorner( SOUTH_EAST ) + eye );
 
-		visOtherToThis = g_pCurVisArea->ComputeVisibility( area, true, true, &bOutsidePVS ); // TODO: Hacky right now. Compute visibility for the "complete" case actually returns how completely visible the area is to the other. Should fix it to be more clear [1/30/2009 tom]
+		bool bOutsidePVS = !engine->CheckBoxInPVS( areaExtent.lo, areaExtent.hi, job.m_pvs, sizeof( m_PVS ) );
 
-		if ( !bOutsidePVS && ( visOtherToThis || ( g_pCurVisArea->GetCenter() - area->GetCenter() ).LengthSqr() < Sqr( nav_max_view_distance.GetFloat() ) ) )
+		if ( !bOutsidePVS )
 		{
-			visThisToOther = area->ComputeVisibility( g_pCurVisArea, true, false );
+			visOtherToThis = curVisArea->ComputeVisibility( area, true, false ); // TODO: Hacky right now. Compute visibility for the "complete" case actually returns how completely visible the area is to the other. Should fix it to be more clear [1/30/2009 tom]
+
+			if ( visOtherToThis || ( curVisArea->GetCenter() - area->GetCenter() ).LengthSqr() < Sqr( nav_max_view_distance.GetFloat() ) )
+			{
+				visThisToOther = area->ComputeVisibility( curVisArea, true, false );
+			}
 		}
 
 		if ( !visOtherToThis && visThisToOther )
@@ -5556,20 +5577,8 @@ void CNavArea::ComputeVisToArea( CNavArea *&pOtherArea )
 		}
 	}
 
-	CNavArea::AreaBindInfo info;
-	if ( visThisToOther != NOT_VISIBLE )
-	{
-		info.area = area;
-		info.attributes = visThisToOther;
-		g_ComputedVis.PushItem( info );
-	}
-
-	if ( visOtherToThis != NOT_VISIBLE )
-	{
-		info.area = g_pCurVisArea;
-		info.attributes = visOtherToThis;
-		area->m_potentiallyVisibleAreas.AddToTail( info );
-	}
+	job.m_visAreaToOther = visThisToOther;
+	job.m_visOtherToArea = visOtherToThis;
 }
 
 
@@ -5579,50 +5588,128 @@ void CNavArea::ComputeVisToArea( CNavArea *&pOtherArea )
  */
 void CNavArea::ComputeVisibilityToMesh( void )
 {
-	m_inheritVisibilityFrom.area = NULL;
-	m_isInheritedFrom = false;
+	CNavArea *area = this;
+	ComputeVisibilityToMesh( &area, 1 );
+}
 
-	// collect all possible nav areas that could be visible from this area
-	NavAreaCollector collector;
+
+//--------------------------------------------------------------------------------------------------------
+/**
+ * Determine visibility for a run of areas at once. The pairs to test are gathered for each area
+ * in turn, exactly as if they were done one by one, and then traced together so the job threads
+ * have enough work to stay busy. Results are stored per pair and merged afterwards in the same
+ * order, so the visibility lists do not depend on which thread finished first.
+ */
+void CNavArea::ComputeVisibilityToMesh( CNavArea **areas, int count )
+{
 	float radius = nav_max_view_distance.GetFloat();
 	if ( radius == 0.0f )
 	{
 		radius = DEF_NAV_VIEW_DISTANCE;
 	}
-	collector.m_area.EnsureCapacity( 1000 );
-	TheNavMesh->ForAllAreasInRadius( collector, GetCenter(), radius );
 
+	static CUtlVector< VisJob_t > jobVector;
+	static CUtlVector< int > firstJobVector;
+	static CUtlVector< byte > pvsVector;
+
+	jobVector.RemoveAll();
+	firstJobVector.RemoveAll();
+	pvsVector.SetCount( count * sizeof( m_PVS ) );
+
+	NavAreaCollector collector;
 	NavVisPair_t visPair;
 	UtlHashHandle_t hHash;
 
-	// First eliminate the ones already calculated
-	for ( int i = collector.m_area.Count() - 1; i >= 0; --i )
+	for( int i=0; i<count; ++i )
 	{
-		visPair.SetPair( this, collector.m_area[i] );
+		CNavArea *area = areas[i];
+
+		area->m_inheritVisibilityFrom.area = NULL;
+		area->m_isInheritedFrom = false;
 
-		hHash = g_pNavVisPairHash->Find( visPair );
-		if ( hHash != g_pNavVisPairHash->InvalidHandle() )
+		// collect all possible nav areas that could be visible from this area
+		collector.m_area.RemoveAll();
+		collector.m_area.EnsureCapacity( 1000 );
+		TheNavMesh->ForAllAreasInRadius( collector, area->GetCenter(), radius );
+
+		// First eliminate the ones already calculated
+		for ( int c = collector.m_area.Count() - 1; c >= 0; --c )
 		{
-			collector.m_area.FastRemove( i );
+			visPair.SetPair( area, collector.m_area[c] );
+
+			hHash = g_pNavVisPairHash->Find( visPair );
+			if ( hHash != g_pNavVisPairHash->InvalidHandle() )
+			{
+				collector.m_area.FastRemove( c );
+			}
+		}
+
+		FOR_EACH_VEC( collector.m_area, it )
+		{
+			visPair.SetPair( area, (CNavArea *)collector.m_area[it] );
+			Assert( g_pNavVisPairHash->Find( visPair ) == g_pNavVisPairHash->InvalidHandle() );
+			g_pNavVisPairHash->Insert( visPair );
 		}
-	}
 
-	SetupPVS();
+		// the engine only builds one PVS at a time, keep a copy for this area's jobs
+		area->SetupPVS();
+		byte *pvs = &pvsVector[ i * sizeof( m_PVS ) ];
+		V_memcpy( pvs, m_PVS, sizeof( m_PVS ) );
 
-	g_pCurVisArea = this;
-	ParallelProcess( "CNavArea::ComputeVisibilityToMesh", collector.m_area.Base(), collector.m_area.Count(), &ComputeVisToArea );
+		firstJobVector.AddToTail( jobVector.Count() );
 
-	m_potentiallyVisibleAreas.EnsureCapacity( g_ComputedVis.Count() );
-	while ( g_ComputedVis.Count() )
+		FOR_EACH_VEC( collector.m_area, it )
+		{
+			VisJob_t &job = jobVector[ jobVector.AddToTail() ];
+			job.m_area = area;
+			job.m_other = collector.m_area[it];
+			job.m_pvs = pvs;
+			job.m_visAreaToOther = NOT_VISIBLE;
+			job.m_visOtherToArea = NOT_VISIBLE;
+		}
+	}
+	firstJobVector.AddToTail( jobVector.Count() );
+
+	if ( nav_generate_parallel.GetBool() )
+	{
+		ParallelProcess( "CNavArea::ComputeVisibilityToMesh", jobVector.Base(), jobVector.Count(), &ComputeVisToArea );
+	}
+	else
 	{
-		g_ComputedVis.PopItem( &m_potentiallyVisibleAreas[ m_potentiallyVisibleAreas.AddToTail() ] );
+		FOR_EACH_VEC( jobVector, it )
+		{
+			ComputeVisToArea( jobVector[it] );
+		}
 	}
 
-	FOR_EACH_VEC( collector.m_area, it )
+	for( int i=0; i<count; ++i )
 	{
-		visPair.SetPair( this, (CNavArea *)collector.m_area[it] );
-		Assert( g_pNavVisPairHash->Find( visPair ) == g_pNavVisPairHash->InvalidHandle() );
-		g_pNavVisPairHash->Insert( visPair );
+		CNavArea *area = areas[i];
+		CNavArea::AreaBindInfo info;
+
+		for( int j = firstJobVector[i]; j < firstJobVector[i+1]; ++j )
+		{
+			const VisJob_t &job = jobVector[j];
+			if ( job.m_visOtherToArea != NOT_VISIBLE )
+			{
+				info.area = area;
+				info.attributes = job.m_visOtherToArea;
+				job.m_other->m_potentiallyVisibleAreas.AddToTail( info );
+			}
+		}
+
+		area->m_potentiallyVisibleAreas.EnsureCapacity( area->m_potentiallyVisibleAreas.Count() + firstJobVector[i+1] - firstJobVector[i] );
+
+		for( int j = firstJobVector[i]; j < firstJobVector[i+1]; ++j )
+		{
+			const VisJob_t &job = jobVector[j];
+			if ( job.m_visAreaToOther != NOT_VISIBLE )
+			{
+				info.area = job.m_other;
+				info.attributes = job.m_visAreaToOther;
+				area->m_potentiallyVisibleAreas.AddToTail( info );
+			}
+		}
 	}
 }
 
@@ -274,6 +274,8 @@ public:
 
 	virtual void Save( CUtlBuffer &fileBuffer, unsigned int version ) const;	// (EXTEND)
 	virtual NavErrorType Load( CUtlBuffer &fileBuffer, unsigned int version, unsigned int subVersion );		// (EXTEND)
+	virtual void SaveCustomData( CUtlBuffer &fileBuffer ) const { }										// store custom area data for derived classes, after the base data
+	virtual NavErrorType LoadCustomData( CUtlBuffer &fileBuffer, unsigned int subVersion ) { return NAV_OK; }	// load custom area data for derived classes
 	virtual NavErrorType PostLoad( void );								// (EXTEND) invoked after all areas have been loaded - for pointer binding, etc
 
 	virtual void SaveToSelectedSet( KeyValues *areaKey ) const;		// (EXTEND) saves attributes for the area to a KeyValues
@@ -455,6 +457,9 @@ public:
 	void SetPathLengthSoFar( float value )	{ DebuggerBreakOnNaN_StagingOnly( value ); Assert( value >= 0.0 && !IS_NAN(value) ); m_pathLengthSoFar = value; }
 	float GetPathLengthSoFar( void ) const	{ DebuggerBreakOnNaN_StagingOnly( m_pathLengthSoFar ); return m_pathLengthSoFar; }
 
+	void SetCluster( int cluster )		{ m_cluster = cluster; }
+	int GetCluster( void ) const		{ return m_cluster; }	// cluster of TheNavHierarchy this area belongs to, or -1
+
 	//- editing -----------------------------------------------------------------------------------------
 	virtual void Draw( void ) const;							// draw area for debugging & editing
 	virtual void DrawFilled( int r, int g, int b, int a, float deltaT = 0.1f, bool noDepthTest = true, float margin = 5.0f ) const;	// draw area as a filled rect of the given color
@@ -666,6 +671,7 @@ private:
 	unsigned int m_debugid;
 
 	Place m_place;												// place descriptor
+	int m_cluster;												// cluster of TheNavHierarchy, -1 if none
 
 	CountdownTimer m_blockedTimer;								// Throttle checks on our blocked state while blocked
 	void UpdateBlockedFromNavBlockers( void );					// checks if nav blockers are still blocking the area
@@ -738,8 +744,10 @@ private:
 
 	//- visibility --------------------------------------------------------------------------------------
 	void ComputeVisibilityToMesh( void );						// compute visibility to surrounding mesh
+	static void ComputeVisibilityToMesh( CNavArea **areas, int count );	// compute visibility to surrounding mesh for each of the given areas, in parallel
 	void ResetPotentiallyVisibleAreas();
-	static void ComputeVisToArea( CNavArea *&pOtherArea );
+	struct VisJob_t;
+	static void ComputeVisToArea( VisJob_t &job );
 
 #ifndef _X360
 	typedef CUtlVectorConservative<AreaBindInfo> CAreaBindInfoArray; // shaves 8 bytes off structure caused by need to support editing
@@ -11,6 +11,8 @@
 
 #include "cbase.h"
 #include "nav_mesh.h"
+#include "nav_hierarchy.h"
+#include "nav_mapped_file.h"
 #include "gamerules.h"
 #include "datacache/imdlcache.h"
 
@@ -38,6 +40,10 @@
 #include "tier0/memdbgon.h"
 
 
+ConVar nav_flat_file( "nav_flat_file", "1", FCVAR_GAMEDLL | FCVAR_CHEAT, "If nonzero, load the Navigation Mesh from its flat image when that is up to date, and write the image when the mesh is saved." );
+ConVar nav_flat_file_on_load( "nav_flat_file_on_load", "0", FCVAR_GAMEDLL | FCVAR_CHEAT, "If nonzero, also write the flat image of the Navigation Mesh after loading it from a .nav file that has none." );
+
+
 //--------------------------------------------------------------------------------------------------------------
 /// The current version of the nav file format
 
@@ -1220,6 +1226,12 @@ bool CNavMesh::Save( void ) const
 	unsigned int navSize = filesystem->Size( filename );
 	DevMsg( "Size of nav file '%s' is %u bytes.\n", filename, navSize );
 
+	// the mesh may have been edited since the clusters were built
+	TheNavHierarchy.Build();
+	TheNavHierarchy.Save();
+
+	SaveFlatFile();
+
 	return true;
 }
 
@@ -1446,6 +1458,19 @@ NavErrorType CNavMesh::Load( void )
 
 	CNavArea::m_nextID = 1;
 
+	NavErrorType flatResult;
+	if ( LoadFlatFile( &flatResult ) )
+	{
+		if ( flatResult == NAV_OK && !TheNavHierarchy.Load() )
+		{
+			TheNavHierarchy.Build();
+		}
+
+		WarnIfMeshNeedsAnalysis( NavCurrentVersion );
+
+		return flatResult;
+	}
+
 	bool navIsInBsp = false;
 	CUtlBuffer fileBuffer( 4096, 1024*1024, CUtlBuffer::READ_ONLY );
 	NavErrorType readResult = GetNavDataFromFile( fileBuffer, &navIsInBsp );
@@ -1603,6 +1628,20 @@ NavErrorType CNavMesh::Load( void )
 	//
 	NavErrorType loadResult = PostLoad( version );
 
+	//
+	// Cluster the areas for long distance path finding, unless the clusters saved with the mesh still fit it
+	//
+	if ( loadResult == NAV_OK && !TheNavHierarchy.Load() )
+	{
+		TheNavHierarchy.Build();
+	}
+
+	// next time, skip all of the above
+	if ( loadResult == NAV_OK && !navIsInBsp && nav_flat_file_on_load.GetBool() )
+	{
+		SaveFlatFile();
+	}
+
 	WarnIfMeshNeedsAnalysis( version );
 
 	return loadResult;
@@ -1633,10 +1672,13 @@ struct OneWayLink_t
 NavErrorType CNavMesh::PostLoad( unsigned int version )
 {
 	// allow areas to connect to each other, etc
-	FOR_EACH_VEC( TheNavAreas, pit )
+	if ( !m_isLoadingFlatFile )
 	{
-		CNavArea *area = TheNavAreas[ pit ];
-		area->PostLoad();
+		FOR_EACH_VEC( TheNavAreas, pit )
+		{
+			CNavArea *area = TheNavAreas[ pit ];
+			area->PostLoad();
+		}
 	}
 
 	// allow hiding spots to compute information
@@ -1724,3 +1766,960 @@ NavErrorType CNavMesh::PostLoad( unsigned int version )
 	
 	return NAV_OK;
 }
+
+
+//--------------------------------------------------------------------------------------------------------------
+//
+// Flat nav image
+//
+// A copy of the mesh laid out as plain arrays, one per field, so it can be mapped and copied
+// out rather than parsed. It lives next to the .nav it was made from and is only used while
+// that .nav is unchanged. Areas refer to each other by array index, so nothing is looked up
+// by ID, and the grid buckets are stored as built.
+//
+// Custom data of derived meshes and areas is kept as the opaque bytes they write to the .nav,
+// and handed back to their LoadCustomData() methods.
+//
+
+#define NAV_FLAT_MAGIC_NUMBER 0xFEEDF1A7			// to help identify flat nav images
+#define NAV_FLAT_VERSION 2
+#define NAV_FLAT_NONE 0xFFFFFFFF					// index of a missing area or hiding spot
+
+#ifdef _X360
+	#define FORMAT_NAVFLATFILE "maps\\%s.360.navf"
+#else
+	#define FORMAT_NAVFLATFILE "maps\\%s.navf"
+#endif
+
+enum NavFlatSectionType
+{
+	NAV_FLAT_AREA_ID,								// unsigned int per area
+	NAV_FLAT_AREA_ATTRIBUTES,						// int per area
+	NAV_FLAT_AREA_NW_CORNER,						// Vector per area
+	NAV_FLAT_AREA_SE_CORNER,						// Vector per area
+	NAV_FLAT_AREA_NE_Z,								// float per area
+	NAV_FLAT_AREA_SW_Z,								// float per area
+	NAV_FLAT_AREA_UNDERWATER,						// unsigned char per area
+	NAV_FLAT_AREA_PLACE,							// unsigned short per area, 1 + index of its name in NAV_FLAT_PLACE_NAMES, or 0
+	NAV_FLAT_AREA_OCCUPY_TIME,						// MAX_NAV_TEAMS floats per area
+	NAV_FLAT_AREA_LIGHT,							// NUM_CORNERS floats per area
+	NAV_FLAT_AREA_INHERIT_VISIBILITY,				// area index per area
+	NAV_FLAT_AREA_CUSTOM_FIRST,						// one per area plus one
+	NAV_FLAT_AREA_CUSTOM,							// what derived areas write after the base data, for CNavArea::LoadCustomData()
+
+	NAV_FLAT_CONNECT_FIRST,							// start of each area's connections in each direction, NUM_DIRECTIONS per area plus one
+	NAV_FLAT_CONNECT,								// area index
+	NAV_FLAT_LADDER_CONNECT_FIRST,					// NUM_LADDER_DIRECTIONS per area plus one
+	NAV_FLAT_LADDER_CONNECT,						// ladder index
+	NAV_FLAT_VISIBLE_FIRST,							// one per area plus one
+	NAV_FLAT_VISIBLE,								// NavFlatVisibleArea_t
+	NAV_FLAT_HIDING_SPOT_FIRST,						// one per area plus one
+	NAV_FLAT_HIDING_SPOT,							// NavFlatHidingSpot_t
+	NAV_FLAT_ENCOUNTER_FIRST,						// one per area plus one
+	NAV_FLAT_ENCOUNTER,								// NavFlatEncounter_t
+	NAV_FLAT_ENCOUNTER_SPOT,						// NavFlatEncounterSpot_t
+
+	NAV_FLAT_LADDERS,								// ladders in their .nav encoding - there are few, and they refer to areas by ID
+	NAV_FLAT_PLACE_NAMES,							// NUL terminated, back to back
+	NAV_FLAT_GRID_FIRST,							// one per grid cell plus one
+	NAV_FLAT_GRID,									// area index
+
+	NAV_FLAT_CUSTOM_PRE_AREA,						// from CNavMesh::SaveCustomDataPreArea()
+	NAV_FLAT_CUSTOM,								// from CNavMesh::SaveCustomData()
+
+	NUM_NAV_FLAT_SECTIONS
+};
+
+struct NavFlatHeader_t
+{
+	unsigned int m_magic;
+	unsigned int m_version;
+	unsigned int m_navFileSize;						// the .nav this image was made from
+	unsigned int m_navFileTime;
+	unsigned int m_subVersion;						// of the custom data
+	unsigned int m_bspSize;							// size of the bsp the mesh matches, 0 if it was out of date
+	unsigned int m_isAnalyzed;
+	unsigned int m_areaCount;
+	unsigned int m_ladderCount;
+	unsigned int m_placeCount;
+	float m_gridCellSize;
+	float m_gridMinX;
+	float m_gridMinY;
+	int m_gridSizeX;
+	int m_gridSizeY;
+
+	struct Section_t
+	{
+		unsigned int m_offset;						// from the start of the file, 16 byte aligned
+		unsigned int m_size;
+	};
+	Section_t m_section[ NUM_NAV_FLAT_SECTIONS ];
+};
+
+struct NavFlatVisibleArea_t
+{
+	unsigned int m_area;
+	unsigned int m_attributes;
+};
+
+struct NavFlatHidingSpot_t
+{
+	unsigned int m_id;
+	Vector m_pos;
+	unsigned int m_flags;
+};
+
+struct NavFlatEncounter_t
+{
+	unsigned int m_from;
+	unsigned int m_fromDir;
+	unsigned int m_to;
+	unsigned int m_toDir;
+	unsigned int m_firstSpot;						// into NAV_FLAT_ENCOUNTER_SPOT
+	unsigned int m_spotCount;
+};
+
+struct NavFlatEncounterSpot_t
+{
+	unsigned int m_spot;							// index into NAV_FLAT_HIDING_SPOT
+	float m_t;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+static void GetFlatFilenames( char *navFilename, int navSize, char *flatFilename, int flatSize )
+{
+	char maptmp[256];
+	const char *pszMapName = GetCleanMapName( STRING( gpGlobals->mapname ), maptmp );
+
+	Q_snprintf( navFilename, navSize, FORMAT_NAVFILE, pszMapName );
+	Q_snprintf( flatFilename, flatSize, FORMAT_NAVFLATFILE, pszMapName );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static unsigned int GetBspFileSize( void )
+{
+	char bspFilename[MAX_PATH] = { 0 };
+	Q_snprintf( bspFilename, sizeof( bspFilename ), FORMAT_BSPFILE , STRING( gpGlobals->mapname ) );
+
+	return filesystem->Size( bspFilename );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+template < typename T >
+static void PutFlatSection( CUtlBuffer &fileBuffer, NavFlatHeader_t *header, NavFlatSectionType section, const CUtlVector< T > &data )
+{
+	while( fileBuffer.TellPut() % 16 )
+	{
+		fileBuffer.PutUnsignedChar( 0 );
+	}
+
+	header->m_section[ section ].m_offset = fileBuffer.TellPut();
+	header->m_section[ section ].m_size = data.Count() * sizeof( T );
+
+	fileBuffer.Put( data.Base(), data.Count() * sizeof( T ) );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Append what was written to 'buffer' from offset 'start' on to 'data'
+ */
+static void GetFlatCustomData( const CUtlBuffer &buffer, int start, CUtlVector< unsigned char > *data )
+{
+	Assert( start <= buffer.TellPut() );
+
+	if ( buffer.TellPut() > start )
+	{
+		data->AddMultipleToTail( buffer.TellPut() - start, (const unsigned char *)buffer.Base() + start );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+template < typename T >
+static unsigned int GetFlatIndex( const CUtlHashtable< const T *, int, PointerHashFunctor, PointerEqualFunctor > &indexTable, const T *object )
+{
+	if ( object == NULL )
+		return NAV_FLAT_NONE;
+
+	UtlHashHandle_t h = indexTable.Find( object );
+	return ( h == indexTable.InvalidHandle() ) ? NAV_FLAT_NONE : indexTable[h];
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Store the mesh as it is now in the flat format, next to the .nav file it matches
+ */
+bool CNavMesh::SaveFlatFile( void ) const
+{
+	if ( !nav_flat_file.GetBool() || IsX360() )
+		return false;
+
+	char navFilename[ MAX_PATH ];
+	char flatFilename[ MAX_PATH ];
+	GetFlatFilenames( navFilename, sizeof( navFilename ), flatFilename, sizeof( flatFilename ) );
+
+	// the image is only good for as long as the .nav it stands in for is unchanged
+	unsigned int navFileSize = filesystem->Size( navFilename, "MOD" );
+	if ( navFileSize == 0 )
+		return false;
+
+	int areaCount = TheNavAreas.Count();
+
+	CUtlHashtable< const CNavArea *, int, PointerHashFunctor, PointerEqualFunctor > areaIndex;
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		areaIndex.Insert( TheNavAreas[ it ], it );
+	}
+
+	// number the hiding spots in the order they will be created on load
+	CUtlHashtable< const HidingSpot *, int, PointerHashFunctor, PointerEqualFunctor > spotIndex;
+	CUtlVector< NavFlatHidingSpot_t > spotVector;
+	CUtlVector< unsigned int > spotFirstVector;
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		spotFirstVector.AddToTail( spotVector.Count() );
+
+		const HidingSpotVector *spots = TheNavAreas[ it ]->GetHidingSpots();
+		FOR_EACH_VEC( (*spots), sit )
+		{
+			const HidingSpot *spot = spots->Element( sit );
+
+			spotIndex.Insert( spot, spotVector.Count() );
+
+			NavFlatHidingSpot_t &flatSpot = spotVector[ spotVector.AddToTail() ];
+			flatSpot.m_id = spot->GetID();
+			flatSpot.m_pos = spot->GetPosition();
+			flatSpot.m_flags = spot->GetFlags();
+		}
+	}
+	spotFirstVector.AddToTail( spotVector.Count() );
+
+	CUtlVector< unsigned int > idVector( 0, areaCount );
+	CUtlVector< int > attributeVector( 0, areaCount );
+	CUtlVector< Vector > nwCornerVector( 0, areaCount );
+	CUtlVector< Vector > seCornerVector( 0, areaCount );
+	CUtlVector< float > neZVector( 0, areaCount );
+	CUtlVector< float > swZVector( 0, areaCount );
+	CUtlVector< unsigned char > underwaterVector( 0, areaCount );
+	CUtlVector< unsigned short > placeVector( 0, areaCount );
+	CUtlVector< float > occupyTimeVector( 0, areaCount * MAX_NAV_TEAMS );
+	CUtlVector< float > lightVector( 0, areaCount * NUM_CORNERS );
+	CUtlVector< unsigned int > inheritVector( 0, areaCount );
+
+	CUtlVector< unsigned int > connectFirstVector, connectVector;
+	CUtlVector< unsigned int > ladderFirstVector, ladderVector;
+	CUtlVector< unsigned int > visibleFirstVector;
+	CUtlVector< NavFlatVisibleArea_t > visibleVector;
+	CUtlVector< unsigned int > encounterFirstVector;
+	CUtlVector< NavFlatEncounter_t > encounterVector;
+	CUtlVector< NavFlatEncounterSpot_t > encounterSpotVector;
+
+	CUtlVector< Place > placeNameVector;
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+
+		idVector.AddToTail( area->m_id );
+		attributeVector.AddToTail( area->m_attributeFlags );
+		nwCornerVector.AddToTail( area->m_nwCorner );
+		seCornerVector.AddToTail( area->m_seCorner );
+		neZVector.AddToTail( area->m_neZ );
+		swZVector.AddToTail( area->m_swZ );
+		underwaterVector.AddToTail( area->m_isUnderwater ? 1 : 0 );
+
+		unsigned short placeEntry = 0;
+		if ( area->GetPlace() != UNDEFINED_PLACE )
+		{
+			int entry = placeNameVector.Find( area->GetPlace() );
+			if ( entry == placeNameVector.InvalidIndex() )
+			{
+				entry = placeNameVector.AddToTail( area->GetPlace() );
+			}
+			placeEntry = (unsigned short)( entry + 1 );
+		}
+		placeVector.AddToTail( placeEntry );
+
+		occupyTimeVector.AddMultipleToTail( MAX_NAV_TEAMS, area->m_earliestOccupyTime );
+		lightVector.AddMultipleToTail( NUM_CORNERS, area->m_lightIntensity );
+		inheritVector.AddToTail( GetFlatIndex( areaIndex, (const CNavArea *)area->m_inheritVisibilityFrom.area ) );
+
+		for( int d=0; d<NUM_DIRECTIONS; ++d )
+		{
+			connectFirstVector.AddToTail( connectVector.Count() );
+			FOR_EACH_VEC( area->m_connect[d], cit )
+			{
+				unsigned int index = GetFlatIndex( areaIndex, (const CNavArea *)area->m_connect[d][ cit ].area );
+				if ( index != NAV_FLAT_NONE )
+				{
+					connectVector.AddToTail( index );
+				}
+			}
+		}
+
+		for( int d=0; d<CNavLadder::NUM_LADDER_DIRECTIONS; ++d )
+		{
+			ladderFirstVector.AddToTail( ladderVector.Count() );
+			FOR_EACH_VEC( area->m_ladder[d], lit )
+			{
+				int index = m_ladders.Find( area->m_ladder[d][ lit ].ladder );
+				if ( index != m_ladders.InvalidIndex() )
+				{
+					ladderVector.AddToTail( index );
+				}
+			}
+		}
+
+		visibleFirstVector.AddToTail( visibleVector.Count() );
+		FOR_EACH_VEC( area->m_potentiallyVisibleAreas, vit )
+		{
+			const CNavArea::AreaBindInfo &info = area->m_potentiallyVisibleAreas[ vit ];
+
+			unsigned int index = GetFlatIndex( areaIndex, (const CNavArea *)info.area );
+			if ( index != NAV_FLAT_NONE )
+			{
+				NavFlatVisibleArea_t &visible = visibleVector[ visibleVector.AddToTail() ];
+				visible.m_area = index;
+				visible.m_attributes = info.attributes;
+			}
+		}
+
+		encounterFirstVector.AddToTail( encounterVector.Count() );
+		FOR_EACH_VEC( area->m_spotEncounters, eit )
+		{
+			const SpotEncounter *e = area->m_spotEncounters[ eit ];
+
+			NavFlatEncounter_t &encounter = encounterVector[ encounterVector.AddToTail() ];
+			encounter.m_from = GetFlatIndex( areaIndex, (const CNavArea *)e->from.area );
+			encounter.m_fromDir = e->fromDir;
+			encounter.m_to = GetFlatIndex( areaIndex, (const CNavArea *)e->to.area );
+			encounter.m_toDir = e->toDir;
+			encounter.m_firstSpot = encounterSpotVector.Count();
+			encounter.m_spotCount = e->spots.Count();
+
+			FOR_EACH_VEC( e->spots, sit )
+			{
+				NavFlatEncounterSpot_t &spot = encounterSpotVector[ encounterSpotVector.AddToTail() ];
+				spot.m_spot = GetFlatIndex( spotIndex, (const HidingSpot *)e->spots[ sit ].spot );
+				spot.m_t = e->spots[ sit ].t;
+			}
+		}
+	}
+
+	connectFirstVector.AddToTail( connectVector.Count() );
+	ladderFirstVector.AddToTail( ladderVector.Count() );
+	visibleFirstVector.AddToTail( visibleVector.Count() );
+	encounterFirstVector.AddToTail( encounterVector.Count() );
+
+	CUtlVector< unsigned char > ladderData;
+	{
+		CUtlBuffer ladderBuffer( 1024, 64*1024 );
+		FOR_EACH_VEC( m_ladders, lit )
+		{
+			m_ladders[ lit ]->Save( ladderBuffer, NavCurrentVersion );
+		}
+		ladderData.AddMultipleToTail( ladderBuffer.TellPut(), (const unsigned char *)ladderBuffer.Base() );
+	}
+
+	// whatever derived areas add to the .nav after the base area data
+	CUtlVector< unsigned int > areaCustomFirstVector( 0, areaCount + 1 );
+	CUtlVector< unsigned char > areaCustomData;
+	{
+		CUtlBuffer areaBuffer( 1024, 64*1024 );
+		CUtlBuffer baseBuffer( 1024, 64*1024 );
+		FOR_EACH_VEC( TheNavAreas, it )
+		{
+			const CNavArea *area = TheNavAreas[ it ];
+
+			areaBuffer.Clear();
+			baseBuffer.Clear();
+			area->Save( areaBuffer, NavCurrentVersion );
+			area->CNavArea::Save( baseBuffer, NavCurrentVersion );
+
+			areaCustomFirstVector.AddToTail( areaCustomData.Count() );
+			GetFlatCustomData( areaBuffer, baseBuffer.TellPut(), &areaCustomData );
+		}
+		areaCustomFirstVector.AddToTail( areaCustomData.Count() );
+	}
+
+	CUtlVector< unsigned char > customPreAreaData;
+	CUtlVector< unsigned char > customData;
+	{
+		CUtlBuffer customBuffer( 1024, 64*1024 );
+		SaveCustomDataPreArea( customBuffer );
+		GetFlatCustomData( customBuffer, 0, &customPreAreaData );
+
+		customBuffer.Clear();
+		SaveCustomData( customBuffer );
+		GetFlatCustomData( customBuffer, 0, &customData );
+	}
+
+	CUtlVector< char > placeNameData;
+	FOR_EACH_VEC( placeNameVector, pit )
+	{
+		const char *name = PlaceToName( placeNameVector[ pit ] );
+		if ( name == NULL )
+		{
+			name = "";
+		}
+		placeNameData.AddMultipleToTail( V_strlen( name ) + 1, name );
+	}
+
+	CUtlVector< unsigned int > gridFirstVector( 0, m_grid.Count() + 1 );
+	CUtlVector< unsigned int > gridVector;
+	FOR_EACH_VEC( m_grid, git )
+	{
+		gridFirstVector.AddToTail( gridVector.Count() );
+		FOR_EACH_VEC( m_grid[ git ], ait )
+		{
+			unsigned int index = GetFlatIndex( areaIndex, (const CNavArea *)m_grid[ git ][ ait ] );
+			if ( index == NAV_FLAT_NONE )
+			{
+				// the grid is out of step with the area list, don't preserve that
+				return false;
+			}
+			gridVector.AddToTail( index );
+		}
+	}
+	gridFirstVector.AddToTail( gridVector.Count() );
+
+	NavFlatHeader_t header;
+	V_memset( &header, 0, sizeof( header ) );
+	header.m_magic = NAV_FLAT_MAGIC_NUMBER;
+	header.m_version = NAV_FLAT_VERSION;
+	header.m_navFileSize = navFileSize;
+	header.m_navFileTime = (unsigned int)filesystem->GetFileTime( navFilename, "MOD" );
+	header.m_subVersion = GetSubVersionNumber();
+	header.m_bspSize = m_isOutOfDate ? 0 : GetBspFileSize();
+	header.m_isAnalyzed = m_isAnalyzed;
+	header.m_areaCount = areaCount;
+	header.m_ladderCount = m_ladders.Count();
+	header.m_placeCount = placeNameVector.Count();
+	header.m_gridCellSize = m_gridCellSize;
+	header.m_gridMinX = m_minX;
+	header.m_gridMinY = m_minY;
+	header.m_gridSizeX = m_gridSizeX;
+	header.m_gridSizeY = m_gridSizeY;
+
+	CUtlBuffer fileBuffer( 4096, 1024*1024 );
+	fileBuffer.Put( &header, sizeof( header ) );
+
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_AREA_ID, idVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_AREA_ATTRIBUTES, attributeVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_AREA_NW_CORNER, nwCornerVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_AREA_SE_CORNER, seCornerVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_AREA_NE_Z, neZVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_AREA_SW_Z, swZVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_AREA_UNDERWATER, underwaterVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_AREA_PLACE, placeVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_AREA_OCCUPY_TIME, occupyTimeVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_AREA_LIGHT, lightVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_AREA_INHERIT_VISIBILITY, inheritVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_AREA_CUSTOM_FIRST, areaCustomFirstVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_AREA_CUSTOM, areaCustomData );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_CONNECT_FIRST, connectFirstVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_CONNECT, connectVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_LADDER_CONNECT_FIRST, ladderFirstVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_LADDER_CONNECT, ladderVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_VISIBLE_FIRST, visibleFirstVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_VISIBLE, visibleVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_HIDING_SPOT_FIRST, spotFirstVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_HIDING_SPOT, spotVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_ENCOUNTER_FIRST, encounterFirstVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_ENCOUNTER, encounterVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_ENCOUNTER_SPOT, encounterSpotVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_LADDERS, ladderData );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_PLACE_NAMES, placeNameData );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_GRID_FIRST, gridFirstVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_GRID, gridVector );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_CUSTOM_PRE_AREA, customPreAreaData );
+	PutFlatSection( fileBuffer, &header, NAV_FLAT_CUSTOM, customData );
+
+	// now that the sections are placed, fill in the real header
+	V_memcpy( fileBuffer.Base(), &header, sizeof( header ) );
+
+	if ( !filesystem->WriteFile( flatFilename, "MOD", fileBuffer ) )
+	{
+		Warning( "Unable to save %d bytes to %s\n", fileBuffer.Size(), flatFilename );
+		return false;
+	}
+
+	DevMsg( "Size of flat nav image '%s' is %d bytes.\n", flatFilename, fileBuffer.TellPut() );
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Read-only access to the sections of a mapped flat nav image
+ */
+class CNavFlatFileReader
+{
+public:
+	CNavFlatFileReader( const CNavMappedFile &file ) : m_file( file )
+	{
+		m_header = ( file.GetSize() >= sizeof( NavFlatHeader_t ) ) ? (const NavFlatHeader_t *)file.GetBase() : NULL;
+	}
+
+	const NavFlatHeader_t *GetHeader( void ) const	{ return m_header; }
+
+	// return the section as an array of T, or NULL if it does not fit the file or holds a different count
+	template < typename T >
+	const T *GetSection( NavFlatSectionType section, unsigned int count ) const
+	{
+		const NavFlatHeader_t::Section_t &s = m_header->m_section[ section ];
+
+		if ( s.m_offset % 16 || s.m_offset > m_file.GetSize() || s.m_size > m_file.GetSize() - s.m_offset )
+			return NULL;
+
+		if ( s.m_size != count * sizeof( T ) )
+			return NULL;
+
+		return (const T *)( (const unsigned char *)m_file.GetBase() + s.m_offset );
+	}
+
+	// return the element count of the section, or 0 if it does not fit the file
+	template < typename T >
+	unsigned int GetSectionCount( NavFlatSectionType section ) const
+	{
+		const NavFlatHeader_t::Section_t &s = m_header->m_section[ section ];
+
+		if ( s.m_offset % 16 || s.m_offset > m_file.GetSize() || s.m_size > m_file.GetSize() - s.m_offset || s.m_size % sizeof( T ) )
+			return 0;
+
+		return s.m_size / sizeof( T );
+	}
+
+private:
+	const CNavMappedFile &m_file;
+	const NavFlatHeader_t *m_header;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return true if 'first' marks 'runCount' consecutive runs covering exactly 'count' elements
+ */
+static bool IsValidFlatRunTable( const unsigned int *first, unsigned int runCount, unsigned int count )
+{
+	if ( first == NULL || first[0] != 0 || first[ runCount ] != count )
+		return false;
+
+	for( unsigned int i=0; i<runCount; ++i )
+	{
+		if ( first[i] > first[i+1] )
+			return false;
+	}
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static bool AreValidFlatIndices( const unsigned int *index, unsigned int count, unsigned int limit, bool allowNone )
+{
+	if ( index == NULL && count > 0 )
+		return false;
+
+	for( unsigned int i=0; i<count; ++i )
+	{
+		if ( index[i] >= limit && !( allowNone && index[i] == NAV_FLAT_NONE ) )
+			return false;
+	}
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Build the mesh from the flat image of this map's .nav, if there is one and it is up to date.
+ * Returns false, having changed nothing, if the image can't be used.
+ */
+bool CNavMesh::LoadFlatFile( NavErrorType *result )
+{
+	if ( !nav_flat_file.GetBool() || IsX360() )
+		return false;
+
+	char navFilename[ MAX_PATH ];
+	char flatFilename[ MAX_PATH ];
+	GetFlatFilenames( navFilename, sizeof( navFilename ), flatFilename, sizeof( flatFilename ) );
+
+	unsigned int navFileSize = filesystem->Size( navFilename, "MOD" );
+	if ( navFileSize == 0 )
+		return false;
+
+	char fullPath[ MAX_PATH ];
+	if ( !filesystem->RelativePathToFullPath_safe( flatFilename, "MOD", fullPath ) )
+		return false;
+
+	CNavMappedFile file;
+	if ( !file.Open( fullPath ) )
+		return false;
+
+	CNavFlatFileReader reader( file );
+	const NavFlatHeader_t *header = reader.GetHeader();
+
+	if ( header == NULL || header->m_magic != NAV_FLAT_MAGIC_NUMBER || header->m_version != NAV_FLAT_VERSION )
+		return false;
+
+	if ( header->m_navFileSize != navFileSize || header->m_navFileTime != (unsigned int)filesystem->GetFileTime( navFilename, "MOD" ) )
+	{
+		DevMsg( "Flat nav image '%s' is older than the .nav file.\n", flatFilename );
+		return false;
+	}
+
+	if ( header->m_gridCellSize != m_gridCellSize || header->m_areaCount == 0 || header->m_gridSizeX <= 0 || header->m_gridSizeY <= 0 )
+		return false;
+
+	//
+	// Find and check every section before creating anything
+	//
+	unsigned int areaCount = header->m_areaCount;
+	unsigned int gridCellCount = header->m_gridSizeX * header->m_gridSizeY;
+
+	const unsigned int *ids = reader.GetSection< unsigned int >( NAV_FLAT_AREA_ID, areaCount );
+	const int *attributes = reader.GetSection< int >( NAV_FLAT_AREA_ATTRIBUTES, areaCount );
+	const Vector *nwCorners = reader.GetSection< Vector >( NAV_FLAT_AREA_NW_CORNER, areaCount );
+	const Vector *seCorners = reader.GetSection< Vector >( NAV_FLAT_AREA_SE_CORNER, areaCount );
+	const float *neZ = reader.GetSection< float >( NAV_FLAT_AREA_NE_Z, areaCount );
+	const float *swZ = reader.GetSection< float >( NAV_FLAT_AREA_SW_Z, areaCount );
+	const unsigned char *underwater = reader.GetSection< unsigned char >( NAV_FLAT_AREA_UNDERWATER, areaCount );
+	const unsigned short *places = reader.GetSection< unsigned short >( NAV_FLAT_AREA_PLACE, areaCount );
+	const float *occupyTimes = reader.GetSection< float >( NAV_FLAT_AREA_OCCUPY_TIME, areaCount * MAX_NAV_TEAMS );
+	const float *light = reader.GetSection< float >( NAV_FLAT_AREA_LIGHT, areaCount * NUM_CORNERS );
+	const unsigned int *inherit = reader.GetSection< unsigned int >( NAV_FLAT_AREA_INHERIT_VISIBILITY, areaCount );
+
+	unsigned int areaCustomSize = reader.GetSectionCount< unsigned char >( NAV_FLAT_AREA_CUSTOM );
+	const unsigned int *areaCustomFirst = reader.GetSection< unsigned int >( NAV_FLAT_AREA_CUSTOM_FIRST, areaCount + 1 );
+	const unsigned char *areaCustom = reader.GetSection< unsigned char >( NAV_FLAT_AREA_CUSTOM, areaCustomSize );
+
+	unsigned int customPreAreaSize = reader.GetSectionCount< unsigned char >( NAV_FLAT_CUSTOM_PRE_AREA );
+	const unsigned char *customPreArea = reader.GetSection< unsigned char >( NAV_FLAT_CUSTOM_PRE_AREA, customPreAreaSize );
+
+	unsigned int customSize = reader.GetSectionCount< unsigned char >( NAV_FLAT_CUSTOM );
+	const unsigned char *custom = reader.GetSection< unsigned char >( NAV_FLAT_CUSTOM, customSize );
+
+	unsigned int connectCount = reader.GetSectionCount< unsigned int >( NAV_FLAT_CONNECT );
+	const unsigned int *connectFirst = reader.GetSection< unsigned int >( NAV_FLAT_CONNECT_FIRST, areaCount * NUM_DIRECTIONS + 1 );
+	const unsigned int *connects = reader.GetSection< unsigned int >( NAV_FLAT_CONNECT, connectCount );
+
+	unsigned int ladderConnectCount = reader.GetSectionCount< unsigned int >( NAV_FLAT_LADDER_CONNECT );
+	const unsigned int *ladderConnectFirst = reader.GetSection< unsigned int >( NAV_FLAT_LADDER_CONNECT_FIRST, areaCount * CNavLadder::NUM_LADDER_DIRECTIONS + 1 );
+	const unsigned int *ladderConnects = reader.GetSection< unsigned int >( NAV_FLAT_LADDER_CONNECT, ladderConnectCount );
+
+	unsigned int visibleCount = reader.GetSectionCount< NavFlatVisibleArea_t >( NAV_FLAT_VISIBLE );
+	const unsigned int *visibleFirst = reader.GetSection< unsigned int >( NAV_FLAT_VISIBLE_FIRST, areaCount + 1 );
+	const NavFlatVisibleArea_t *visibles = reader.GetSection< NavFlatVisibleArea_t >( NAV_FLAT_VISIBLE, visibleCount );
+
+	unsigned int spotCount = reader.GetSectionCount< NavFlatHidingSpot_t >( NAV_FLAT_HIDING_SPOT );
+	const unsigned int *spotFirst = reader.GetSection< unsigned int >( NAV_FLAT_HIDING_SPOT_FIRST, areaCount + 1 );
+	const NavFlatHidingSpot_t *spots = reader.GetSection< NavFlatHidingSpot_t >( NAV_FLAT_HIDING_SPOT, spotCount );
+
+	unsigned int encounterCount = reader.GetSectionCount< NavFlatEncounter_t >( NAV_FLAT_ENCOUNTER );
+	unsigned int encounterSpotCount = reader.GetSectionCount< NavFlatEncounterSpot_t >( NAV_FLAT_ENCOUNTER_SPOT );
+	const unsigned int *encounterFirst = reader.GetSection< unsigned int >( NAV_FLAT_ENCOUNTER_FIRST, areaCount + 1 );
+	const NavFlatEncounter_t *encounters = reader.GetSection< NavFlatEncounter_t >( NAV_FLAT_ENCOUNTER, encounterCount );
+	const NavFlatEncounterSpot_t *encounterSpots = reader.GetSection< NavFlatEncounterSpot_t >( NAV_FLAT_ENCOUNTER_SPOT, encounterSpotCount );
+
+	unsigned int ladderDataSize = reader.GetSectionCount< unsigned char >( NAV_FLAT_LADDERS );
+	const unsigned char *ladderData = reader.GetSection< unsigned char >( NAV_FLAT_LADDERS, ladderDataSize );
+
+	unsigned int placeNameSize = reader.GetSectionCount< char >( NAV_FLAT_PLACE_NAMES );
+	const char *placeNames = reader.GetSection< char >( NAV_FLAT_PLACE_NAMES, placeNameSize );
+
+	unsigned int gridCount = reader.GetSectionCount< unsigned int >( NAV_FLAT_GRID );
+	const unsigned int *gridFirst = reader.GetSection< unsigned int >( NAV_FLAT_GRID_FIRST, gridCellCount + 1 );
+	const unsigned int *grid = reader.GetSection< unsigned int >( NAV_FLAT_GRID, gridCount );
+
+	bool isValid = ids && attributes && nwCorners && seCorners && neZ && swZ && underwater && places && occupyTimes && light && inherit;
+	isValid = isValid && ( ladderData || header->m_ladderCount == 0 ) && ( placeNames || header->m_placeCount == 0 );
+	isValid = isValid && IsValidFlatRunTable( connectFirst, areaCount * NUM_DIRECTIONS, connectCount ) && AreValidFlatIndices( connects, connectCount, areaCount, false );
+	isValid = isValid && IsValidFlatRunTable( ladderConnectFirst, areaCount * CNavLadder::NUM_LADDER_DIRECTIONS, ladderConnectCount ) && AreValidFlatIndices( ladderConnects, ladderConnectCount, header->m_ladderCount, false );
+	isValid = isValid && IsValidFlatRunTable( visibleFirst, areaCount, visibleCount ) && ( visibles || visibleCount == 0 );
+	isValid = isValid && IsValidFlatRunTable( spotFirst, areaCount, spotCount ) && ( spots || spotCount == 0 );
+	isValid = isValid && IsValidFlatRunTable( encounterFirst, areaCount, encounterCount ) && ( encounters || encounterCount == 0 ) && ( encounterSpots || encounterSpotCount == 0 );
+	isValid = isValid && IsValidFlatRunTable( gridFirst, gridCellCount, gridCount ) && AreValidFlatIndices( grid, gridCount, areaCount, false );
+	isValid = isValid && AreValidFlatIndices( inherit, areaCount, areaCount, true );
+	isValid = isValid && IsValidFlatRunTable( areaCustomFirst, areaCount, areaCustomSize ) && ( areaCustom || areaCustomSize == 0 );
+	isValid = isValid && customPreArea && custom;
+
+	for( unsigned int i=0; isValid && i<areaCount; ++i )
+	{
+		isValid = ( places[i] <= header->m_placeCount );
+	}
+
+	for( unsigned int i=0; isValid && i<visibleCount; ++i )
+	{
+		isValid = ( visibles[i].m_area < areaCount );
+	}
+
+	for( unsigned int i=0; isValid && i<encounterCount; ++i )
+	{
+		const NavFlatEncounter_t &e = encounters[i];
+		isValid = ( e.m_from < areaCount || e.m_from == NAV_FLAT_NONE ) && ( e.m_to < areaCount || e.m_to == NAV_FLAT_NONE ) &&
+				  e.m_fromDir < NUM_DIRECTIONS && e.m_toDir < NUM_DIRECTIONS &&
+				  e.m_firstSpot <= encounterSpotCount && e.m_spotCount <= encounterSpotCount - e.m_firstSpot;
+	}
+
+	for( unsigned int i=0; isValid && i<encounterSpotCount; ++i )
+	{
+		isValid = ( encounterSpots[i].m_spot < spotCount || encounterSpots[i].m_spot == NAV_FLAT_NONE );
+	}
+
+	// place names are NUL terminated, one per place
+	CUtlVector< Place > placeVector;
+	placeVector.AddToTail( UNDEFINED_PLACE );
+	for( unsigned int start = 0, i = 0; isValid && i<placeNameSize; ++i )
+	{
+		if ( placeNames[i] == '\0' )
+		{
+			placeVector.AddToTail( NameToPlace( &placeNames[ start ] ) );
+			start = i + 1;
+		}
+	}
+	isValid = isValid && ( placeVector.Count() == (int)header->m_placeCount + 1 );
+
+	if ( !isValid )
+	{
+		DevWarning( "Flat nav image '%s' is corrupt.\n", flatFilename );
+		return false;
+	}
+
+	//
+	// Create the areas
+	//
+	m_isAnalyzed = header->m_isAnalyzed != 0;
+	m_isOutOfDate = ( header->m_bspSize != GetBspFileSize() );
+
+	// derived classes get their custom data back just as they wrote it to the .nav
+	unsigned int subVersion = header->m_subVersion;
+
+	CUtlBuffer customPreAreaBuffer( customPreArea, customPreAreaSize, CUtlBuffer::READ_ONLY );
+	LoadCustomDataPreArea( customPreAreaBuffer, subVersion );
+
+	PreLoadAreas( areaCount );
+	TheNavAreas.EnsureCapacity( areaCount );
+
+	bool isCustomValid = true;
+
+	for( unsigned int i=0; i<areaCount; ++i )
+	{
+		CNavArea *area = CreateArea();
+
+		area->m_id = ids[i];
+		if ( area->m_id >= CNavArea::m_nextID )
+		{
+			CNavArea::m_nextID = area->m_id + 1;
+		}
+
+		area->m_attributeFlags = attributes[i];
+		area->m_nwCorner = nwCorners[i];
+		area->m_seCorner = seCorners[i];
+		area->m_center = ( area->m_nwCorner + area->m_seCorner ) / 2.0f;
+
+		if ( ( area->m_seCorner.x - area->m_nwCorner.x ) > 0.0f && ( area->m_seCorner.y - area->m_nwCorner.y ) > 0.0f )
+		{
+			area->m_invDxCorners = 1.0f / ( area->m_seCorner.x - area->m_nwCorner.x );
+			area->m_invDyCorners = 1.0f / ( area->m_seCorner.y - area->m_nwCorner.y );
+		}
+		else
+		{
+			area->m_invDxCorners = area->m_invDyCorners = 0;
+		}
+
+		area->m_neZ = neZ[i];
+		area->m_swZ = swZ[i];
+		area->m_isUnderwater = ( underwater[i] != 0 );
+		area->SetPlace( placeVector[ places[i] ] );
+
+		V_memcpy( area->m_earliestOccupyTime, &occupyTimes[ i * MAX_NAV_TEAMS ], sizeof( area->m_earliestOccupyTime ) );
+		V_memcpy( area->m_lightIntensity, &light[ i * NUM_CORNERS ], sizeof( area->m_lightIntensity ) );
+
+		TheNavAreas.AddToTail( area );
+		AddNavAreaToHashTable( area );
+
+		// it has to read back exactly what it wrote
+		CUtlBuffer areaCustomBuffer( areaCustom + areaCustomFirst[i], areaCustomFirst[i+1] - areaCustomFirst[i], CUtlBuffer::READ_ONLY );
+		if ( area->LoadCustomData( areaCustomBuffer, subVersion ) != NAV_OK || !areaCustomBuffer.IsValid() || areaCustomBuffer.TellGet() != areaCustomBuffer.TellPut() )
+		{
+			isCustomValid = false;
+			break;
+		}
+	}
+
+	if ( !isCustomValid )
+	{
+		DevWarning( "Flat nav image '%s' has custom area data this game can't read.\n", flatFilename );
+
+		Reset();
+		CNavArea::m_nextID = 1;
+		return false;
+	}
+
+	// the grid buckets, as they were
+	m_grid.RemoveAll();
+	m_minX = header->m_gridMinX;
+	m_minY = header->m_gridMinY;
+	m_gridSizeX = header->m_gridSizeX;
+	m_gridSizeY = header->m_gridSizeY;
+	m_grid.SetCount( gridCellCount );
+
+	for( unsigned int c=0; c<gridCellCount; ++c )
+	{
+		NavAreaVector &cell = m_grid[c];
+		cell.EnsureCapacity( gridFirst[c+1] - gridFirst[c] );
+
+		for( unsigned int g = gridFirst[c]; g < gridFirst[c+1]; ++g )
+		{
+			cell.AddToTail( TheNavAreas[ grid[g] ] );
+		}
+	}
+
+	// hiding spots are created in area order, which is the order encounters refer to them by
+	CUtlVector< HidingSpot * > spotVector( 0, spotCount );
+	for( unsigned int i=0; i<areaCount; ++i )
+	{
+		CNavArea *area = TheNavAreas[i];
+
+		for( unsigned int s = spotFirst[i]; s < spotFirst[i+1]; ++s )
+		{
+			HidingSpot *spot = CreateHidingSpot();
+			spot->m_id = spots[s].m_id;
+			spot->m_pos = spots[s].m_pos;
+			spot->m_flags = spots[s].m_flags;
+
+			if ( spot->m_id >= HidingSpot::m_nextID )
+			{
+				HidingSpot::m_nextID = spot->m_id + 1;
+			}
+
+			area->m_hidingSpots.AddToTail( spot );
+			spotVector.AddToTail( spot );
+		}
+	}
+
+	// ladders find their areas by ID, which works now the areas are hashed
+	if ( header->m_ladderCount )
+	{
+		CUtlBuffer ladderBuffer( ladderData, ladderDataSize, CUtlBuffer::READ_ONLY );
+		m_ladders.EnsureCapacity( header->m_ladderCount );
+
+		for( unsigned int l=0; l<header->m_ladderCount; ++l )
+		{
+			CNavLadder *ladder = new CNavLadder;
+			ladder->Load( ladderBuffer, NavCurrentVersion );
+			m_ladders.AddToTail( ladder );
+		}
+
+		if ( !ladderBuffer.IsValid() )
+		{
+			DevWarning( "Flat nav image '%s' is corrupt.\n", flatFilename );
+
+			Reset();
+			CNavArea::m_nextID = 1;
+			return false;
+		}
+	}
+
+	//
+	// Bind the areas together
+	//
+	for( unsigned int i=0; i<areaCount; ++i )
+	{
+		CNavArea *area = TheNavAreas[i];
+
+		for( int d=0; d<NUM_DIRECTIONS; ++d )
+		{
+			unsigned int run = i * NUM_DIRECTIONS + d;
+			area->m_connect[d].EnsureCapacity( connectFirst[ run+1 ] - connectFirst[ run ] );
+
+			for( unsigned int c = connectFirst[ run ]; c < connectFirst[ run+1 ]; ++c )
+			{
+				NavConnect connect;
+				connect.area = TheNavAreas[ connects[c] ];
+				connect.length = ( connect.area->GetCenter() - area->GetCenter() ).Length();
+				area->m_connect[d].AddToTail( connect );
+			}
+		}
+
+		for( int d=0; d<CNavLadder::NUM_LADDER_DIRECTIONS; ++d )
+		{
+			unsigned int run = i * CNavLadder::NUM_LADDER_DIRECTIONS + d;
+
+			for( unsigned int c = ladderConnectFirst[ run ]; c < ladderConnectFirst[ run+1 ]; ++c )
+			{
+				NavLadderConnect connect;
+				connect.ladder = m_ladders[ ladderConnects[c] ];
+				area->m_ladder[d].AddToTail( connect );
+			}
+		}
+
+		area->m_potentiallyVisibleAreas.EnsureCapacity( visibleFirst[i+1] - visibleFirst[i] );
+		for( unsigned int v = visibleFirst[i]; v < visibleFirst[i+1]; ++v )
+		{
+			CNavArea::AreaBindInfo info;
+			info.area = TheNavAreas[ visibles[v].m_area ];
+			info.attributes = (unsigned char)visibles[v].m_attributes;
+			area->m_potentiallyVisibleAreas.AddToTail( info );
+		}
+
+		area->m_inheritVisibilityFrom.area = ( inherit[i] == NAV_FLAT_NONE ) ? NULL : TheNavAreas[ inherit[i] ];
+
+		for( unsigned int e = encounterFirst[i]; e < encounterFirst[i+1]; ++e )
+		{
+			const NavFlatEncounter_t &flat = encounters[e];
+
+			SpotEncounter *encounter = new SpotEncounter;
+			encounter->from.area = ( flat.m_from == NAV_FLAT_NONE ) ? NULL : TheNavAreas[ flat.m_from ];
+			encounter->fromDir = (NavDirType)flat.m_fromDir;
+			encounter->to.area = ( flat.m_to == NAV_FLAT_NONE ) ? NULL : TheNavAreas[ flat.m_to ];
+			encounter->toDir = (NavDirType)flat.m_toDir;
+
+			if ( encounter->from.area && encounter->to.area )
+			{
+				// compute path, as CNavArea::PostLoad() does
+				float halfWidth;
+				area->ComputePortal( encounter->to.area, encounter->toDir, &encounter->path.to, &halfWidth );
+				area->ComputePortal( encounter->from.area, encounter->fromDir, &encounter->path.from, &halfWidth );
+
+				const float eyeHeight = HalfHumanHeight;
+				encounter->path.from.z = encounter->from.area->GetZ( encounter->path.from ) + eyeHeight;
+				encounter->path.to.z = encounter->to.area->GetZ( encounter->path.to ) + eyeHeight;
+			}
+
+			for( unsigned int s = 0; s < flat.m_spotCount; ++s )
+			{
+				const NavFlatEncounterSpot_t &flatSpot = encounterSpots[ flat.m_firstSpot + s ];
+
+				SpotOrder order;
+				order.spot = ( flatSpot.m_spot == NAV_FLAT_NONE ) ? NULL : spotVector[ flatSpot.m_spot ];
+				order.t = flatSpot.m_t;
+				encounter->spots.AddToTail( order );
+			}
+
+			area->m_spotEncounters.AddToTail( encounter );
+		}
+
+		// func avoid/prefer attributes are controlled by func_nav_cost entities
+		area->ClearAllNavCostEntities();
+	}
+
+	CUtlBuffer customBuffer( custom, customSize, CUtlBuffer::READ_ONLY );
+	LoadCustomData( customBuffer, subVersion );
+
+	m_isLoadingFlatFile = true;
+	*result = PostLoad( NavCurrentVersion );
+	m_isLoadingFlatFile = false;
+
+	DevMsg( "Loaded %d nav areas from flat image '%s'.\n", areaCount, flatFilename );
+
+	return true;
+}
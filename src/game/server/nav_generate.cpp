@@ -43,6 +43,7 @@ ConVar nav_generate_jump_connections( "nav_generate_jump_connections", "1", FCVA
 ConVar nav_generate_incremental_range( "nav_generate_incremental_range", "2000", FCVAR_CHEAT );
 ConVar nav_generate_incremental_tolerance( "nav_generate_incremental_tolerance", "0", FCVAR_CHEAT, "Z tolerance for adding new nav areas." );
 ConVar nav_area_max_size( "nav_area_max_size", "50", FCVAR_CHEAT, "Max area size created in nav generation" );
+ConVar nav_generate_visibility_batch( "nav_generate_visibility_batch", "32", FCVAR_CHEAT, "Number of nav areas whose visibility is traced together in one parallel pass" );
 
 // Common bounding box for traces
 Vector NavTraceMins( -0.45, -0.45, 0 );
@@ -3795,10 +3796,10 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 		{
 			while( m_generationIndex < TheNavAreas.Count() )
 			{
-				CNavArea *area = TheNavAreas[ m_generationIndex ];
-				++m_generationIndex;
+				int count = MIN( MAX( nav_generate_visibility_batch.GetInt(), 1 ), TheNavAreas.Count() - m_generationIndex );
 
-				area->ComputeVisibilityToMesh();
+				CNavArea::ComputeVisibilityToMesh( &TheNavAreas[ m_generationIndex ], count );
+				m_generationIndex += count;
 
 				// don't go over our time allotment
 				if ( Plat_FloatTime() - startTime > maxTime )
@@ -0,0 +1,601 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// nav_hierarchy.cpp
+// Cluster graph over the Navigation Mesh for long distance path-finding
+
+#include "cbase.h"
+#include "nav_mesh.h"
+#include "nav_hierarchy.h"
+
+#include "tier0/fasttimer.h"
+#include "tier1/checksum_crc.h"
+#include "vstdlib/random.h"
+#include "util_shared.h"
+
+// NOTE: This has to be the last file included!
+#include "tier0/memdbgon.h"
+
+
+#define NAV_HIERARCHY_MAGIC_NUMBER 0xFEEDC1A5		// to help identify cluster files
+#define NAV_HIERARCHY_VERSION 1
+
+#ifdef _X360
+	#define FORMAT_NAVHIERARCHYFILE "maps\\%s.360.navc"
+#else
+	#define FORMAT_NAVHIERARCHYFILE "maps\\%s.navc"
+#endif
+
+
+ConVar nav_hierarchy( "nav_hierarchy", "1", FCVAR_GAMEDLL | FCVAR_CHEAT, "If nonzero, long paths are planned over clusters of nav areas first and then refined within them." );
+ConVar nav_hierarchy_min_distance( "nav_hierarchy_min_distance", "1500", FCVAR_GAMEDLL | FCVAR_CHEAT, "Paths between areas closer than this are always searched directly." );
+ConVar nav_hierarchy_cluster_size( "nav_hierarchy_cluster_size", "64", FCVAR_GAMEDLL | FCVAR_CHEAT, "Maximum number of nav areas in a cluster. Takes effect when the clusters are next built." );
+ConVar nav_hierarchy_cluster_radius( "nav_hierarchy_cluster_radius", "750", FCVAR_GAMEDLL | FCVAR_CHEAT, "Maximum distance of a clustered area from the area the cluster was grown from. Takes effect when the clusters are next built." );
+ConVar nav_hierarchy_corridor_neighbors( "nav_hierarchy_corridor_neighbors", "1", FCVAR_GAMEDLL | FCVAR_CHEAT, "If nonzero, the clusters next to the planned cluster route are searched too." );
+
+
+CNavHierarchy TheNavHierarchy;
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavHierarchy::CNavHierarchy( void ) : m_openQueue( 0, 0, OpenEntry_t::IsLowerPriority )
+{
+	m_corridorMarker = 0;
+	m_searchMarker = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Forget all clusters. Does not touch the areas, which may already be gone.
+ */
+void CNavHierarchy::Reset( void )
+{
+	m_clusterVector.RemoveAll();
+	m_linkVector.RemoveAll();
+	m_searchVector.RemoveAll();
+	m_openQueue.RemoveAll();
+	m_corridorMarker = 0;
+	m_searchMarker = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavHierarchy::Build( void )
+{
+	Reset();
+
+	if ( TheNavAreas.Count() == 0 )
+		return;
+
+	Partition();
+	Connect();
+
+	DevMsg( "Nav hierarchy: %d areas in %d clusters with %d links.\n", TheNavAreas.Count(), m_clusterVector.Count(), m_linkVector.Count() );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Grow clusters breadth-first from each area not yet in one, so they stay compact and connected
+ */
+void CNavHierarchy::Partition( void )
+{
+	int maxAreaCount = MAX( 1, nav_hierarchy_cluster_size.GetInt() );
+	float maxRadius = nav_hierarchy_cluster_radius.GetFloat();
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		TheNavAreas[ it ]->SetCluster( -1 );
+	}
+
+	CUtlVector< CNavArea * > openVector;
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		CNavArea *seed = TheNavAreas[ it ];
+		if ( seed->GetCluster() >= 0 )
+			continue;
+
+		int cluster = m_clusterVector.AddToTail();
+
+		seed->SetCluster( cluster );
+		openVector.RemoveAll();
+		openVector.AddToTail( seed );
+
+		for( int head=0; head<openVector.Count() && openVector.Count() < maxAreaCount; ++head )
+		{
+			CNavArea *area = openVector[ head ];
+
+			for( int dir=0; dir<NUM_DIRECTIONS && openVector.Count() < maxAreaCount; ++dir )
+			{
+				const NavConnectVector *adjList = area->GetAdjacentAreas( (NavDirType)dir );
+
+				for( int i=0; i<adjList->Count() && openVector.Count() < maxAreaCount; ++i )
+				{
+					CNavArea *adjArea = adjList->Element( i ).area;
+
+					if ( adjArea->GetCluster() >= 0 )
+						continue;
+
+					if ( ( adjArea->GetCenter() - seed->GetCenter() ).IsLengthGreaterThan( maxRadius ) )
+						continue;
+
+					adjArea->SetCluster( cluster );
+					openVector.AddToTail( adjArea );
+				}
+			}
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static void AddClusterLink( CUtlVector< uint64 > *pairVector, int fromCluster, const CNavArea *toArea )
+{
+	if ( toArea == NULL )
+		return;
+
+	int toCluster = toArea->GetCluster();
+	if ( toCluster < 0 || toCluster == fromCluster )
+		return;
+
+	pairVector->AddToTail( ( (uint64)fromCluster << 32 ) | (uint32)toCluster );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static int CompareClusterLinks( const uint64 *a, const uint64 *b )
+{
+	if ( *a < *b )
+		return -1;
+
+	return ( *a > *b ) ? 1 : 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Everything but the partition itself is derived here, from the cluster each area is in.
+ * A cluster links to another if any of its areas connects to one of the other's, by the
+ * same floor, ladder and elevator connections NavAreaBuildPath() follows.
+ */
+void CNavHierarchy::Connect( void )
+{
+	FOR_EACH_VEC( m_clusterVector, cit )
+	{
+		Cluster_t &cluster = m_clusterVector[ cit ];
+		cluster.m_center = vec3_origin;
+		cluster.m_areaCount = 0;
+		cluster.m_firstLink = 0;
+		cluster.m_linkCount = 0;
+		cluster.m_corridorMarker = 0;
+	}
+
+	CUtlVector< uint64 > pairVector;
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+
+		int from = area->GetCluster();
+		if ( from < 0 )
+			continue;
+
+		m_clusterVector[ from ].m_center += area->GetCenter();
+		++m_clusterVector[ from ].m_areaCount;
+
+		for( int dir=0; dir<NUM_DIRECTIONS; ++dir )
+		{
+			const NavConnectVector *adjList = area->GetAdjacentAreas( (NavDirType)dir );
+			FOR_EACH_VEC( (*adjList), i )
+			{
+				AddClusterLink( &pairVector, from, adjList->Element( i ).area );
+			}
+		}
+
+		const NavLadderConnectVector *upList = area->GetLadders( CNavLadder::LADDER_UP );
+		FOR_EACH_VEC( (*upList), i )
+		{
+			const CNavLadder *ladder = upList->Element( i ).ladder;
+			AddClusterLink( &pairVector, from, ladder->m_topForwardArea );
+			AddClusterLink( &pairVector, from, ladder->m_topLeftArea );
+			AddClusterLink( &pairVector, from, ladder->m_topRightArea );
+		}
+
+		const NavLadderConnectVector *downList = area->GetLadders( CNavLadder::LADDER_DOWN );
+		FOR_EACH_VEC( (*downList), i )
+		{
+			AddClusterLink( &pairVector, from, downList->Element( i ).ladder->m_bottomArea );
+		}
+
+		const NavConnectVector &elevatorAreas = area->GetElevatorAreas();
+		FOR_EACH_VEC( elevatorAreas, i )
+		{
+			AddClusterLink( &pairVector, from, elevatorAreas[ i ].area );
+		}
+	}
+
+	FOR_EACH_VEC( m_clusterVector, cit )
+	{
+		Cluster_t &cluster = m_clusterVector[ cit ];
+		if ( cluster.m_areaCount > 0 )
+		{
+			cluster.m_center /= (float)cluster.m_areaCount;
+		}
+	}
+
+	// sorting by (from, to) groups each cluster's links together and puts duplicates side by side
+	pairVector.Sort( CompareClusterLinks );
+
+	m_linkVector.RemoveAll();
+	m_linkVector.EnsureCapacity( pairVector.Count() );
+
+	FOR_EACH_VEC( pairVector, pit )
+	{
+		if ( pit > 0 && pairVector[ pit ] == pairVector[ pit - 1 ] )
+			continue;
+
+		int from = (int)( pairVector[ pit ] >> 32 );
+		int to = (int)( pairVector[ pit ] & 0xFFFFFFFF );
+
+		Cluster_t &cluster = m_clusterVector[ from ];
+		if ( cluster.m_linkCount == 0 )
+		{
+			cluster.m_firstLink = m_linkVector.Count();
+		}
+		++cluster.m_linkCount;
+
+		Link_t &link = m_linkVector[ m_linkVector.AddToTail() ];
+		link.m_cluster = to;
+		link.m_cost = ( m_clusterVector[ to ].m_center - cluster.m_center ).Length();
+	}
+
+	m_searchVector.SetCount( m_clusterVector.Count() );
+	FOR_EACH_VEC( m_searchVector, sit )
+	{
+		m_searchVector[ sit ].m_marker = 0;
+	}
+
+	m_corridorMarker = 0;
+	m_searchMarker = 0;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavHierarchy::MarkCorridor( int cluster )
+{
+	m_clusterVector[ cluster ].m_corridorMarker = m_corridorMarker;
+
+	if ( nav_hierarchy_corridor_neighbors.GetBool() )
+	{
+		const Cluster_t &c = m_clusterVector[ cluster ];
+		for( int i=0; i<c.m_linkCount; ++i )
+		{
+			m_clusterVector[ m_linkVector[ c.m_firstLink + i ].m_cluster ].m_corridorMarker = m_corridorMarker;
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A* over the clusters from the start area's cluster to the goal area's. On success the clusters
+ * on the route (and, optionally, their neighbors) become the corridor tested by IsInCorridor().
+ */
+bool CNavHierarchy::BuildCorridor( const CNavArea *startArea, const CNavArea *goalArea )
+{
+	Assert( ThreadInMainThread() );
+
+	int startCluster = startArea->GetCluster();
+	int goalCluster = goalArea->GetCluster();
+
+	if ( !m_clusterVector.IsValidIndex( startCluster ) || !m_clusterVector.IsValidIndex( goalCluster ) )
+		return false;
+
+	if ( ++m_corridorMarker == 0 )
+	{
+		m_corridorMarker = 1;
+	}
+
+	if ( startCluster == goalCluster )
+	{
+		MarkCorridor( startCluster );
+		return true;
+	}
+
+	if ( ++m_searchMarker == 0 )
+	{
+		m_searchMarker = 1;
+	}
+
+	const Vector &goalCenter = m_clusterVector[ goalCluster ].m_center;
+
+	SearchNode_t &start = m_searchVector[ startCluster ];
+	start.m_costSoFar = 0.0f;
+	start.m_parent = -1;
+	start.m_marker = m_searchMarker;
+	start.m_isClosed = false;
+
+	m_openQueue.RemoveAll();
+
+	OpenEntry_t entry;
+	entry.m_totalCost = ( m_clusterVector[ startCluster ].m_center - goalCenter ).Length();
+	entry.m_cluster = startCluster;
+	m_openQueue.Insert( entry );
+
+	while( m_openQueue.Count() )
+	{
+		int cluster = m_openQueue.ElementAtHead().m_cluster;
+		m_openQueue.RemoveAtHead();
+
+		SearchNode_t &node = m_searchVector[ cluster ];
+		if ( node.m_isClosed )
+			continue;
+
+		node.m_isClosed = true;
+
+		if ( cluster == goalCluster )
+		{
+			for( int c = goalCluster; c >= 0; c = m_searchVector[ c ].m_parent )
+			{
+				MarkCorridor( c );
+			}
+
+			return true;
+		}
+
+		const Cluster_t &from = m_clusterVector[ cluster ];
+		for( int i=0; i<from.m_linkCount; ++i )
+		{
+			const Link_t &link = m_linkVector[ from.m_firstLink + i ];
+			float newCostSoFar = node.m_costSoFar + link.m_cost;
+
+			SearchNode_t &next = m_searchVector[ link.m_cluster ];
+			if ( next.m_marker == m_searchMarker && ( next.m_isClosed || next.m_costSoFar <= newCostSoFar ) )
+				continue;
+
+			next.m_costSoFar = newCostSoFar;
+			next.m_parent = cluster;
+			next.m_marker = m_searchMarker;
+			next.m_isClosed = false;
+
+			entry.m_totalCost = newCostSoFar + ( m_clusterVector[ link.m_cluster ].m_center - goalCenter ).Length();
+			entry.m_cluster = link.m_cluster;
+			m_openQueue.Insert( entry );
+		}
+	}
+
+	return false;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Area IDs and connection counts change with any edit that would invalidate the partition
+ */
+unsigned int CNavHierarchy::ComputeChecksum( void ) const
+{
+	CRC32_t crc;
+	CRC32_Init( &crc );
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		const CNavArea *area = TheNavAreas[ it ];
+
+		unsigned int data[ 1 + NUM_DIRECTIONS ];
+		data[0] = area->GetID();
+		for( int dir=0; dir<NUM_DIRECTIONS; ++dir )
+		{
+			data[ 1 + dir ] = area->GetAdjacentCount( (NavDirType)dir );
+		}
+
+		CRC32_ProcessBuffer( &crc, data, sizeof( data ) );
+	}
+
+	CRC32_Final( &crc );
+	return crc;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+static void GetHierarchyFilename( char *filename, int size )
+{
+	char maptmp[256];
+	const char *pszMapName = GetCleanMapName( STRING( gpGlobals->mapname ), maptmp );
+
+	Q_snprintf( filename, size, FORMAT_NAVHIERARCHYFILE, pszMapName );
+	V_FixSlashes( filename );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Only the cluster of each area is stored - linking the clusters is cheap and done on load
+ */
+bool CNavHierarchy::Save( void ) const
+{
+	if ( !IsBuilt() )
+		return false;
+
+	char filename[ MAX_PATH ];
+	GetHierarchyFilename( filename, sizeof( filename ) );
+
+	CUtlBuffer fileBuffer( 4096, 1024*1024 );
+
+	fileBuffer.PutUnsignedInt( NAV_HIERARCHY_MAGIC_NUMBER );
+	fileBuffer.PutUnsignedInt( NAV_HIERARCHY_VERSION );
+	fileBuffer.PutUnsignedInt( TheNavAreas.Count() );
+	fileBuffer.PutUnsignedInt( ComputeChecksum() );
+	fileBuffer.PutUnsignedInt( m_clusterVector.Count() );
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		fileBuffer.PutInt( TheNavAreas[ it ]->GetCluster() );
+	}
+
+	if ( !filesystem->WriteFile( filename, "MOD", fileBuffer ) )
+	{
+		Warning( "Unable to save %d bytes to %s\n", fileBuffer.Size(), filename );
+		return false;
+	}
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+bool CNavHierarchy::Load( void )
+{
+	Reset();
+
+	char filename[ MAX_PATH ];
+	GetHierarchyFilename( filename, sizeof( filename ) );
+
+	CUtlBuffer fileBuffer( 4096, 1024*1024, CUtlBuffer::READ_ONLY );
+	if ( !filesystem->ReadFile( filename, "MOD", fileBuffer ) )
+		return false;
+
+	unsigned int magic = fileBuffer.GetUnsignedInt();
+	unsigned int version = fileBuffer.GetUnsignedInt();
+	if ( !fileBuffer.IsValid() || magic != NAV_HIERARCHY_MAGIC_NUMBER || version != NAV_HIERARCHY_VERSION )
+	{
+		DevMsg( "Nav hierarchy: '%s' is not a cluster file this build understands.\n", filename );
+		return false;
+	}
+
+	unsigned int areaCount = fileBuffer.GetUnsignedInt();
+	unsigned int checksum = fileBuffer.GetUnsignedInt();
+	int clusterCount = fileBuffer.GetUnsignedInt();
+	if ( !fileBuffer.IsValid() || areaCount != (unsigned int)TheNavAreas.Count() || checksum != ComputeChecksum() || clusterCount <= 0 )
+	{
+		DevMsg( "Nav hierarchy: '%s' was built for a different nav mesh.\n", filename );
+		return false;
+	}
+
+	FOR_EACH_VEC( TheNavAreas, it )
+	{
+		int cluster = fileBuffer.GetInt();
+		if ( !fileBuffer.IsValid() || cluster < 0 || cluster >= clusterCount )
+		{
+			DevMsg( "Nav hierarchy: '%s' is corrupt.\n", filename );
+
+			FOR_EACH_VEC( TheNavAreas, cit )
+			{
+				TheNavAreas[ cit ]->SetCluster( -1 );
+			}
+			return false;
+		}
+
+		TheNavAreas[ it ]->SetCluster( cluster );
+	}
+
+	m_clusterVector.SetCount( clusterCount );
+	Connect();
+
+	DevMsg( "Nav hierarchy: loaded %d clusters with %d links.\n", m_clusterVector.Count(), m_linkVector.Count() );
+
+	return true;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CON_COMMAND_F( nav_hierarchy_build, "Rebuilds the clusters used for long distance path finding and saves them next to the .nav file.", FCVAR_GAMEDLL | FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	TheNavHierarchy.Build();
+
+	if ( TheNavHierarchy.Save() )
+	{
+		Msg( "Built %d clusters for %d nav areas.\n", TheNavHierarchy.GetClusterCount(), TheNavAreas.Count() );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Times NavAreaBuildPath() against NavAreaBuildHierarchicalPath() over the same random pairs of
+ * areas at least nav_hierarchy_min_distance apart, and compares the cost of the paths found.
+ */
+CON_COMMAND_F( nav_hierarchy_benchmark, "Compares long distance path finding with and without the cluster graph. Arguments: [number of paths]", FCVAR_GAMEDLL | FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	if ( !TheNavHierarchy.IsBuilt() || !nav_hierarchy.GetBool() )
+	{
+		Msg( "The nav hierarchy is not built or nav_hierarchy is 0.\n" );
+		return;
+	}
+
+	int pathCount = ( args.ArgC() > 1 ) ? MAX( 1, atoi( args[1] ) ) : 200;
+
+	// same pairs every run, without disturbing the game's random stream
+	CUniformRandomStream random;
+	random.SetSeed( 1 );
+
+	int tried = 0, found = 0;
+	double flatTotal = 0.0, flatMax = 0.0;
+	double hierTotal = 0.0, hierMax = 0.0;
+	double costRatioTotal = 0.0;
+
+	for( int attempt = 0; tried < pathCount && attempt < pathCount * 20; ++attempt )
+	{
+		CNavArea *startArea = TheNavAreas[ random.RandomInt( 0, TheNavAreas.Count()-1 ) ];
+		CNavArea *goalArea = TheNavAreas[ random.RandomInt( 0, TheNavAreas.Count()-1 ) ];
+
+		if ( ( startArea->GetCenter() - goalArea->GetCenter() ).IsLengthLessThan( nav_hierarchy_min_distance.GetFloat() ) )
+			continue;
+
+		++tried;
+
+		ShortestPathCost cost;
+		CFastTimer timer;
+
+		timer.Start();
+		bool flatFound = NavAreaBuildPath( startArea, goalArea, NULL, cost );
+		timer.End();
+
+		double flatTime = timer.GetDuration().GetMillisecondsF();
+		float flatCost = goalArea->GetCostSoFar();
+
+		timer.Start();
+		bool hierFound = NavAreaBuildHierarchicalPath( startArea, goalArea, NULL, cost );
+		timer.End();
+
+		double hierTime = timer.GetDuration().GetMillisecondsF();
+		float hierCost = goalArea->GetCostSoFar();
+
+		flatTotal += flatTime;
+		flatMax = MAX( flatMax, flatTime );
+		hierTotal += hierTime;
+		hierMax = MAX( hierMax, hierTime );
+
+		if ( flatFound && hierFound && flatCost > 0.0f )
+		{
+			++found;
+			costRatioTotal += hierCost / flatCost;
+		}
+	}
+
+	if ( tried == 0 )
+	{
+		Msg( "No pairs of areas are at least nav_hierarchy_min_distance apart.\n" );
+		return;
+	}
+
+	Msg( "%d paths over %d areas in %d clusters:\n", tried, TheNavAreas.Count(), TheNavHierarchy.GetClusterCount() );
+	Msg( "  flat:         %.3f ms average, %.3f ms max\n", flatTotal / tried, flatMax );
+	Msg( "  hierarchical: %.3f ms average, %.3f ms max\n", hierTotal / tried, hierMax );
+
+	if ( found )
+	{
+		Msg( "  hierarchical paths cost %.1f%% of flat paths on average (%d found by both)\n", 100.0 * costRatioTotal / found, found );
+	}
+}
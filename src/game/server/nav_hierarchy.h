@@ -0,0 +1,157 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// nav_hierarchy.h
+// Cluster graph over the Navigation Mesh for long distance path-finding
+
+#ifndef _NAV_HIERARCHY_H_
+#define _NAV_HIERARCHY_H_
+
+#include "nav_pathfind.h"
+#include "tier1/utlpriorityqueue.h"
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Groups the nav areas into small connected clusters and links clusters whose areas connect.
+ * A long path is first planned over this graph, which is tiny compared to the mesh. The
+ * clusters along that route form a corridor, and the real A* over the areas is then
+ * confined to it instead of flooding everything closer to the goal than the start.
+ *
+ * The partition is built after the mesh is loaded and kept next to the .nav file, so it
+ * only needs to be rebuilt when the mesh changes.
+ */
+class CNavHierarchy
+{
+public:
+	CNavHierarchy( void );
+
+	void Reset( void );
+	void Build( void );											// partition the current mesh into clusters and link them
+	bool Load( void );											// read the partition saved for this map, false if missing or out of date
+	bool Save( void ) const;									// store the partition next to the .nav file
+
+	bool IsBuilt( void ) const			{ return m_clusterVector.Count() > 0; }
+	int GetClusterCount( void ) const	{ return m_clusterVector.Count(); }
+
+	bool BuildCorridor( const CNavArea *startArea, const CNavArea *goalArea );	// plan over the clusters and mark the corridor, false if the goal cluster can't be reached
+	bool IsInCorridor( const CNavArea *area ) const;			// true if area is within the corridor of the last BuildCorridor()
+
+private:
+	struct Cluster_t
+	{
+		Vector m_center;										// average of the area centers
+		int m_areaCount;
+		int m_firstLink;										// this cluster's links are m_linkVector[ m_firstLink ... m_firstLink + m_linkCount - 1 ]
+		int m_linkCount;
+		unsigned int m_corridorMarker;
+	};
+	CUtlVector< Cluster_t > m_clusterVector;
+
+	struct Link_t
+	{
+		int m_cluster;											// the cluster this one has an area connecting to
+		float m_cost;
+	};
+	CUtlVector< Link_t > m_linkVector;
+
+	unsigned int m_corridorMarker;
+
+	struct SearchNode_t
+	{
+		float m_costSoFar;
+		int m_parent;
+		unsigned int m_marker;
+		bool m_isClosed;
+	};
+	CUtlVector< SearchNode_t > m_searchVector;					// cluster A* state, parallel to m_clusterVector
+	unsigned int m_searchMarker;
+
+	struct OpenEntry_t
+	{
+		float m_totalCost;
+		int m_cluster;
+
+		static bool IsLowerPriority( const OpenEntry_t &a, const OpenEntry_t &b )	{ return a.m_totalCost > b.m_totalCost; }
+	};
+	CUtlPriorityQueue< OpenEntry_t > m_openQueue;				// stale entries are skipped when popped rather than updated in place
+
+	void Partition( void );										// assign every area a cluster
+	void Connect( void );										// derive centers and links from the area clusters
+	void MarkCorridor( int cluster );
+
+	unsigned int ComputeChecksum( void ) const;					// identifies the mesh the partition was built for
+};
+
+extern CNavHierarchy TheNavHierarchy;
+
+
+//--------------------------------------------------------------------------------------------------------------
+inline bool CNavHierarchy::IsInCorridor( const CNavArea *area ) const
+{
+	int cluster = area->GetCluster();
+	return cluster >= 0 && cluster < m_clusterVector.Count() && m_clusterVector[ cluster ].m_corridorMarker == m_corridorMarker;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Wraps a cost functor to treat every area outside the current corridor as a dead end
+ */
+template< typename CostFunctor >
+class NavCorridorCost
+{
+public:
+	NavCorridorCost( CostFunctor &costFunc ) : m_costFunc( costFunc ) { }
+
+	float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length )
+	{
+		if ( !TheNavHierarchy.IsInCorridor( area ) )
+			return -1.0f;
+
+		return m_costFunc( area, fromArea, ladder, elevator, length );
+	}
+
+private:
+	CostFunctor &m_costFunc;
+};
+
+
+extern ConVar nav_hierarchy;
+extern ConVar nav_hierarchy_min_distance;
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Same contract as NavAreaBuildPath(), but long queries are planned over the cluster graph first
+ * and refined inside the resulting corridor. If the corridor holds no path - blocked areas, or
+ * areas added since the clusters were built - the whole mesh is searched as before.
+ * Main thread only.
+ */
+template< typename CostFunctor >
+bool NavAreaBuildHierarchicalPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+{
+	if ( nav_hierarchy.GetBool() && TheNavHierarchy.IsBuilt() && startArea && goalArea && startArea != goalArea )
+	{
+		float minDistance = nav_hierarchy_min_distance.GetFloat();
+		if ( ( startArea->GetCenter() - goalArea->GetCenter() ).IsLengthGreaterThan( minDistance ) )
+		{
+			VPROF_BUDGET( "NavAreaBuildHierarchicalPath", "NextBotSpiky" );
+
+			if ( TheNavHierarchy.BuildCorridor( startArea, goalArea ) )
+			{
+				NavCorridorCost< CostFunctor > corridorCost( costFunc );
+				if ( NavAreaBuildPath( startArea, goalArea, goalPos, corridorCost, closestArea, maxPathLength, teamID, ignoreNavBlockers ) )
+					return true;
+			}
+		}
+	}
+
+	return NavAreaBuildPath( startArea, goalArea, goalPos, costFunc, closestArea, maxPathLength, teamID, ignoreNavBlockers );
+}
+
+
+#endif // _NAV_HIERARCHY_H_
@@ -0,0 +1,155 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// nav_mapped_file.cpp
+// Read-only memory mapping of a file, used to load flat nav images
+
+#if defined( _WIN32 ) && !defined( _X360 )
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined( POSIX )
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "cbase.h"
+#include "nav_mapped_file.h"
+
+// NOTE: This has to be the last file included!
+#include "tier0/memdbgon.h"
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavMappedFile::CNavMappedFile( void )
+{
+	m_base = NULL;
+	m_size = 0;
+
+#ifdef _WIN32
+	m_file = NULL;
+	m_mapping = NULL;
+#else
+	m_fd = -1;
+#endif
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavMappedFile::~CNavMappedFile()
+{
+	Close();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+bool CNavMappedFile::Open( const char *fullPath )
+{
+	Close();
+
+#if defined( _WIN32 ) && !defined( _X360 )
+	HANDLE file = CreateFileA( fullPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( file == INVALID_HANDLE_VALUE )
+		return false;
+
+	m_file = file;
+
+	DWORD sizeHigh = 0;
+	DWORD size = GetFileSize( file, &sizeHigh );
+	if ( size == INVALID_FILE_SIZE || sizeHigh != 0 || size == 0 )
+	{
+		Close();
+		return false;
+	}
+
+	m_mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	if ( m_mapping == NULL )
+	{
+		Close();
+		return false;
+	}
+
+	m_base = MapViewOfFile( (HANDLE)m_mapping, FILE_MAP_READ, 0, 0, 0 );
+	if ( m_base == NULL )
+	{
+		Close();
+		return false;
+	}
+
+	m_size = size;
+	return true;
+
+#elif defined( POSIX )
+	m_fd = open( fullPath, O_RDONLY );
+	if ( m_fd < 0 )
+		return false;
+
+	struct stat fileInfo;
+	if ( fstat( m_fd, &fileInfo ) != 0 || fileInfo.st_size <= 0 || (uint64)fileInfo.st_size > 0xFFFFFFFF )
+	{
+		Close();
+		return false;
+	}
+
+	void *base = mmap( NULL, fileInfo.st_size, PROT_READ, MAP_SHARED, m_fd, 0 );
+	if ( base == MAP_FAILED )
+	{
+		Close();
+		return false;
+	}
+
+	m_base = base;
+	m_size = (unsigned int)fileInfo.st_size;
+	return true;
+
+#else
+	return false;
+#endif
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavMappedFile::Close( void )
+{
+#if defined( _WIN32 ) && !defined( _X360 )
+	if ( m_base )
+	{
+		UnmapViewOfFile( m_base );
+	}
+
+	if ( m_mapping )
+	{
+		CloseHandle( (HANDLE)m_mapping );
+	}
+
+	if ( m_file )
+	{
+		CloseHandle( (HANDLE)m_file );
+	}
+
+	m_file = NULL;
+	m_mapping = NULL;
+
+#elif defined( POSIX )
+	if ( m_base )
+	{
+		munmap( const_cast< void * >( m_base ), m_size );
+	}
+
+	if ( m_fd >= 0 )
+	{
+		close( m_fd );
+	}
+
+	m_fd = -1;
+#endif
+
+	m_base = NULL;
+	m_size = 0;
+}
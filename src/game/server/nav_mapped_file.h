@@ -0,0 +1,45 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// nav_mapped_file.h
+// Read-only memory mapping of a file, used to load flat nav images
+
+#ifndef _NAV_MAPPED_FILE_H_
+#define _NAV_MAPPED_FILE_H_
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Maps a whole file read-only. The pages are backed by the file itself, so every server
+ * process on the host mapping the same file shares them.
+ */
+class CNavMappedFile
+{
+public:
+	CNavMappedFile( void );
+	~CNavMappedFile();
+
+	bool Open( const char *fullPath );			// map the file at the given absolute path
+	void Close( void );
+
+	const void *GetBase( void ) const		{ return m_base; }
+	unsigned int GetSize( void ) const		{ return m_size; }
+
+private:
+	const void *m_base;
+	unsigned int m_size;
+
+#ifdef _WIN32
+	void *m_file;
+	void *m_mapping;
+#else
+	int m_fd;
+#endif
+};
+
+
+#endif // _NAV_MAPPED_FILE_H_
@@ -21,6 +21,7 @@
 #endif
 #include "functorutils.h"
 #include "nav_pathfind.h"
+#include "nav_hierarchy.h"
 
 #ifdef TF_DLL
 #include "tf/nav_mesh/tf_nav_area.h"
@@ -71,6 +72,7 @@ CNavMesh::CNavMesh( void )
 	m_hostThreadModeRestoreValue = 0;
 	m_placeCount = 0;
 	m_placeName = NULL;
+	m_isLoadingFlatFile = false;
 
 	LoadPlaceDatabase();
 
@@ -103,6 +105,7 @@ CNavMesh::~CNavMesh()
  */
 void CNavMesh::Reset( void )
 {
+	TheNavHierarchy.Reset();
 	DestroyNavigationMesh();
 
 	m_generationMode = GENERATE_NONE;
@@ -490,6 +493,12 @@ void CNavMesh::AddNavArea( CNavArea *area )
 		}
 	}
 
+	AddNavAreaToHashTable( area );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavMesh::AddNavAreaToHashTable( CNavArea *area )
+{
 	// add to hash table
 	int key = ComputeHashKey( area->GetID() );
 
@@ -292,6 +292,7 @@ public:
 	const CUtlVector< Place > *GetPlacesFromNavFile( bool *hasUnnamedPlaces );	// Reads the used place names from the nav file (can be used to selectively precache before the nav is loaded)
 
 	virtual bool Save( void ) const;									// store Navigation Mesh to a file
+	bool SaveFlatFile( void ) const;									// store a flat, memory-mappable image of the mesh next to the .nav file
 	bool IsOutOfDate( void ) const	{ return m_isOutOfDate; }			// return true if the Navigation Mesh is older than the current map version
 
 	virtual unsigned int GetSubVersionNumber( void ) const;										// returns sub-version number of data format used by derived classes
@@ -1112,6 +1113,10 @@ private:
 	void GridToWorld( int gridX, int gridY, Vector *pos ) const;
 
 	void AddNavArea( CNavArea *area );							// add an area to the grid
+	void AddNavAreaToHashTable( CNavArea *area );				// also tracks transient areas and the area count
+
+	bool LoadFlatFile( NavErrorType *result );					// build the mesh from its flat image, false if there is no usable image
+	bool m_isLoadingFlatFile;									// true while PostLoad() runs over areas built from a flat image, which are bound already
 
 	void DestroyNavigationMesh( bool incremental = false );		// free all resources of the mesh and reset it to empty state
 	void DestroyHidingSpots( void );
@@ -15,6 +15,7 @@
 #include "tier0/vprof.h"
 #include "mathlib/ssemath.h"
 #include "nav_area.h"
+#include "tier1/utlhashtable.h"
 
 
 
@@ -39,6 +40,12 @@ class ShortestPathCost
 {
 public:
 	float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length )
+	{
+		return (*this)( area, fromArea, ladder, elevator, length, ( fromArea ) ? fromArea->GetCostSoFar() : 0.0f );
+	}
+
+	// the form used by a CNavPathSearch, which keeps the cost so far itself
+	float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length, float fromCostSoFar )
 	{
 		if ( fromArea == NULL )
 		{
@@ -63,7 +70,7 @@ public:
 				dist = ( area->GetCenter() - fromArea->GetCenter() ).Length();
 			}
 
-			float cost = dist + fromArea->GetCostSoFar();
+			float cost = dist + fromCostSoFar;
 
 			// if this is a "crouch" area, add penalty
 			if ( area->GetAttributes() & NAV_MESH_CROUCH )
@@ -84,24 +91,242 @@ public:
 	}
 };
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The state of one A* search over the nav mesh. Keeping it here rather than on the CNavArea
+ * lets several searches run at once - give each thread its own CNavPathSearch. The open list
+ * is a binary heap on total cost that tracks where each area sits in it, so adding, improving
+ * and popping an area are O(log n) instead of the sorted insertion of the CNavArea open list.
+ */
+class CNavPathSearch
+{
+public:
+	CNavPathSearch( void ) { }
+
+	void Reset( void );								// start a new search, reusing the memory of the last one
+
+	// results of the last search, for the areas it reached
+	bool IsVisited( const CNavArea *area ) const;
+	CNavArea *GetParent( const CNavArea *area ) const;
+	NavTraverseType GetParentHow( const CNavArea *area ) const;
+	float GetCostSoFar( const CNavArea *area ) const;
+	float GetTotalCost( const CNavArea *area ) const;
+	float GetPathLengthSoFar( const CNavArea *area ) const;
+
+	void CopyToAreas( void ) const;					// store the results on the areas, for callers walking CNavArea::GetParent(). Main thread only.
+
+	//- used by NavAreaBuildPath() ----------------------------------------------------------------------
+	struct Node_t
+	{
+		CNavArea *m_area;
+		CNavArea *m_parent;
+		NavTraverseType m_parentHow;
+		float m_costSoFar;
+		float m_totalCost;
+		float m_pathLengthSoFar;
+		int m_heapIndex;							// position on the open heap, -1 if not open
+	};
+
+	int FindNode( const CNavArea *area ) const;		// -1 if the search has not reached this area
+	int AddNode( CNavArea *area );					// NOTE: invalidates Node_t references
+	Node_t &GetNode( int node )						{ return m_nodeVector[ node ]; }
+
+	bool IsOpenEmpty( void ) const					{ return m_openHeap.Count() == 0; }
+	void AddToOpen( int node );						// add, or move up after its total cost dropped
+	int PopOpen( void );							// remove and return the node with the lowest total cost
+
+private:
+	void HeapUp( int heapIndex );
+	void HeapDown( int heapIndex );
+	void HeapSet( int heapIndex, int node );
+
+	CUtlVector< Node_t > m_nodeVector;
+	CUtlVector< int > m_openHeap;
+	CUtlHashtable< const CNavArea *, int, PointerHashFunctor, PointerEqualFunctor > m_nodeIndex;
+};
+
+
+inline void CNavPathSearch::Reset( void )
+{
+	m_nodeVector.RemoveAll();
+	m_openHeap.RemoveAll();
+	m_nodeIndex.RemoveAll();
+}
+
+inline int CNavPathSearch::FindNode( const CNavArea *area ) const
+{
+	UtlHashHandle_t h = m_nodeIndex.Find( area );
+	return ( h == m_nodeIndex.InvalidHandle() ) ? -1 : m_nodeIndex[h];
+}
+
+inline int CNavPathSearch::AddNode( CNavArea *area )
+{
+	int node = m_nodeVector.AddToTail();
+	Node_t &n = m_nodeVector[ node ];
+	n.m_area = area;
+	n.m_parent = NULL;
+	n.m_parentHow = NUM_TRAVERSE_TYPES;
+	n.m_costSoFar = 0.0f;
+	n.m_totalCost = 0.0f;
+	n.m_pathLengthSoFar = 0.0f;
+	n.m_heapIndex = -1;
+
+	m_nodeIndex.Insert( area, node );
+	return node;
+}
+
+inline bool CNavPathSearch::IsVisited( const CNavArea *area ) const
+{
+	return FindNode( area ) >= 0;
+}
+
+inline CNavArea *CNavPathSearch::GetParent( const CNavArea *area ) const
+{
+	int node = FindNode( area );
+	return ( node >= 0 ) ? m_nodeVector[ node ].m_parent : NULL;
+}
+
+inline NavTraverseType CNavPathSearch::GetParentHow( const CNavArea *area ) const
+{
+	int node = FindNode( area );
+	return ( node >= 0 ) ? m_nodeVector[ node ].m_parentHow : NUM_TRAVERSE_TYPES;
+}
+
+inline float CNavPathSearch::GetCostSoFar( const CNavArea *area ) const
+{
+	int node = FindNode( area );
+	return ( node >= 0 ) ? m_nodeVector[ node ].m_costSoFar : 0.0f;
+}
+
+inline float CNavPathSearch::GetTotalCost( const CNavArea *area ) const
+{
+	int node = FindNode( area );
+	return ( node >= 0 ) ? m_nodeVector[ node ].m_totalCost : 0.0f;
+}
+
+inline float CNavPathSearch::GetPathLengthSoFar( const CNavArea *area ) const
+{
+	int node = FindNode( area );
+	return ( node >= 0 ) ? m_nodeVector[ node ].m_pathLengthSoFar : 0.0f;
+}
+
+inline void CNavPathSearch::CopyToAreas( void ) const
+{
+	FOR_EACH_VEC( m_nodeVector, it )
+	{
+		const Node_t &n = m_nodeVector[ it ];
+		n.m_area->SetParent( n.m_parent, n.m_parentHow );
+		n.m_area->SetCostSoFar( n.m_costSoFar );
+		n.m_area->SetTotalCost( n.m_totalCost );
+		n.m_area->SetPathLengthSoFar( n.m_pathLengthSoFar );
+	}
+}
+
+inline void CNavPathSearch::HeapSet( int heapIndex, int node )
+{
+	m_openHeap[ heapIndex ] = node;
+	m_nodeVector[ node ].m_heapIndex = heapIndex;
+}
+
+inline void CNavPathSearch::HeapUp( int heapIndex )
+{
+	int node = m_openHeap[ heapIndex ];
+	float cost = m_nodeVector[ node ].m_totalCost;
+
+	while( heapIndex > 0 )
+	{
+		int parentIndex = ( heapIndex - 1 ) / 2;
+		if ( m_nodeVector[ m_openHeap[ parentIndex ] ].m_totalCost <= cost )
+			break;
+
+		HeapSet( heapIndex, m_openHeap[ parentIndex ] );
+		heapIndex = parentIndex;
+	}
+
+	HeapSet( heapIndex, node );
+}
+
+inline void CNavPathSearch::HeapDown( int heapIndex )
+{
+	int count = m_openHeap.Count();
+	int node = m_openHeap[ heapIndex ];
+	float cost = m_nodeVector[ node ].m_totalCost;
+
+	while( true )
+	{
+		int childIndex = 2 * heapIndex + 1;
+		if ( childIndex >= count )
+			break;
+
+		// pick the cheaper child
+		if ( childIndex + 1 < count && m_nodeVector[ m_openHeap[ childIndex + 1 ] ].m_totalCost < m_nodeVector[ m_openHeap[ childIndex ] ].m_totalCost )
+			++childIndex;
+
+		if ( cost <= m_nodeVector[ m_openHeap[ childIndex ] ].m_totalCost )
+			break;
+
+		HeapSet( heapIndex, m_openHeap[ childIndex ] );
+		heapIndex = childIndex;
+	}
+
+	HeapSet( heapIndex, node );
+}
+
+inline void CNavPathSearch::AddToOpen( int node )
+{
+	int heapIndex = m_nodeVector[ node ].m_heapIndex;
+	if ( heapIndex < 0 )
+	{
+		heapIndex = m_openHeap.AddToTail( node );
+	}
+
+	// total cost only ever drops, so it can only move towards the top
+	HeapUp( heapIndex );
+}
+
+inline int CNavPathSearch::PopOpen( void )
+{
+	Assert( !IsOpenEmpty() );
+
+	int node = m_openHeap[0];
+	int last = m_openHeap[ m_openHeap.Count() - 1 ];
+	m_openHeap.RemoveMultipleFromTail( 1 );
+
+	if ( last != node )
+	{
+		HeapSet( 0, last );
+		HeapDown( 0 );
+	}
+
+	m_nodeVector[ node ].m_heapIndex = -1;
+	return node;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Find path from startArea to goalArea via an A* search, using supplied cost heuristic.
  * If cost functor returns -1 for an area, that area is considered a dead end.
  * This doesn't actually build a path, but the path is defined by following parent
- * pointers back from goalArea to startArea.
+ * pointers in 'search' back from goalArea to startArea.
  * If 'closestArea' is non-NULL, the closest area to the goal is returned (useful if the path fails).
  * If 'goalArea' is NULL, will compute a path as close as possible to 'goalPos'.
  * If 'goalPos' is NULL, will use the center of 'goalArea' as the goal position.
  * If 'maxPathLength' is nonzero, path building will stop when this length is reached.
  * Returns true if a path exists.
+ *
+ * This version touches nothing but 'search', so it is safe to run on any thread as long as the
+ * cost functor is. The functor is handed the cost so far of 'fromArea' as an extra argument:
+ *   float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length, float fromCostSoFar )
  */
 #define IGNORE_NAV_BLOCKERS true
 template< typename CostFunctor >
-bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+bool NavAreaBuildPath( CNavPathSearch &search, CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
 {
 	VPROF_BUDGET( "NavAreaBuildPath", "NextBotSpiky" );
 
+	search.Reset();
+
 	if ( closestArea )
 	{
 		*closestArea = startArea;
@@ -111,7 +336,7 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 	if (startArea == NULL)
 		return false;
 
-	startArea->SetParent( NULL );
+	int startNode = search.AddNode( startArea );
 
 	if (goalArea != NULL && goalArea->IsBlocked( teamID, ignoreNavBlockers ))
 		goalArea = NULL;
@@ -128,29 +353,28 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 	// determine actual goal position
 	Vector actualGoalPos = (goalPos) ? *goalPos : goalArea->GetCenter();
 
-	// start search
-	CNavArea::ClearSearchLists();
+	float initCost = costFunc( startArea, NULL, NULL, NULL, -1.0f, 0.0f );	
+	if (initCost < 0.0f)
+		return false;
 
 	// compute estimate of path length
 	/// @todo Cost might work as "manhattan distance"
-	startArea->SetTotalCost( (startArea->GetCenter() - actualGoalPos).Length() );
+	CNavPathSearch::Node_t &start = search.GetNode( startNode );
+	start.m_totalCost = (startArea->GetCenter() - actualGoalPos).Length();
+	start.m_costSoFar = initCost;
+	start.m_pathLengthSoFar = 0.0f;
 
-	float initCost = costFunc( startArea, NULL, NULL, NULL, -1.0f );	
-	if (initCost < 0.0f)
-		return false;
-	startArea->SetCostSoFar( initCost );
-	startArea->SetPathLengthSoFar( 0.0 );
-
-	startArea->AddToOpenList();
+	search.AddToOpen( startNode );
 
 	// keep track of the area we visit that is closest to the goal
-	float closestAreaDist = startArea->GetTotalCost();
+	float closestAreaDist = start.m_totalCost;
 
 	// do A* search
-	while( !CNavArea::IsOpenListEmpty() )
+	while( !search.IsOpenEmpty() )
 	{
 		// get next area to check
-		CNavArea *area = CNavArea::PopOpenList();
+		int node = search.PopOpen();
+		CNavArea *area = search.GetNode( node ).m_area;
 
 
 		// don't consider blocked areas
@@ -323,7 +547,7 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 
 			// don't backtrack
 			Assert( newArea );
-			if ( newArea == area->GetParent() )
+			if ( newArea == search.GetNode( node ).m_parent )
 				continue;
 			if ( newArea == area ) // self neighbor?
 				continue;
@@ -332,7 +556,8 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 			if ( newArea->IsBlocked( teamID, ignoreNavBlockers ) )
 				continue;
 
-			float newCostSoFar = costFunc( newArea, area, ladder, elevator, length );
+			float costSoFar = search.GetNode( node ).m_costSoFar;
+			float newCostSoFar = costFunc( newArea, area, ladder, elevator, length, costSoFar );
 
 			// NaNs really mess this function up causing tough to track down hangs. If
 			//  we get inf back, clamp it down to a really high number.
@@ -346,75 +571,126 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 
 			// Safety check against a bogus functor.  The cost of the path
 			// A...B, C should always be at least as big as the path A...B.
-			Assert( newCostSoFar >= area->GetCostSoFar() );
+			Assert( newCostSoFar >= costSoFar );
 
 			// And now that we've asserted, let's be a bit more defensive.
 			// Make sure that any jump to a new area incurs some pathfinsing
 			// cost, to avoid us spinning our wheels over insignificant cost
 			// benefit, floating point precision bug, or busted cost functor.
-			float minNewCostSoFar = area->GetCostSoFar() * 1.00001f + 0.00001f;
+			float minNewCostSoFar = costSoFar * 1.00001f + 0.00001f;
 			newCostSoFar = Max( newCostSoFar, minNewCostSoFar );
 				
 			// stop if path length limit reached
+			float newLengthSoFar = 0.0f;
 			if ( bHaveMaxPathLength )
 			{
 				// keep track of path length so far
 				float deltaLength = ( newArea->GetCenter() - area->GetCenter() ).Length();
-				float newLengthSoFar = area->GetPathLengthSoFar() + deltaLength;
+				newLengthSoFar = search.GetNode( node ).m_pathLengthSoFar + deltaLength;
 				if ( newLengthSoFar > maxPathLength )
 					continue;
-				
-				newArea->SetPathLengthSoFar( newLengthSoFar );
 			}
 
-			if ( ( newArea->IsOpen() || newArea->IsClosed() ) && newArea->GetCostSoFar() <= newCostSoFar )
+			int newNode = search.FindNode( newArea );
+			if ( newNode >= 0 && search.GetNode( newNode ).m_costSoFar <= newCostSoFar )
 			{
 				// this is a worse path - skip it
 				continue;
 			}
-			else
-			{
-				// compute estimate of distance left to go
-				float distSq = ( newArea->GetCenter() - actualGoalPos ).LengthSqr();
-				float newCostRemaining = ( distSq > 0.0 ) ? FastSqrt( distSq ) : 0.0 ;
 
-				// track closest area to goal in case path fails
-				if ( closestArea && newCostRemaining < closestAreaDist )
-				{
-					*closestArea = newArea;
-					closestAreaDist = newCostRemaining;
-				}
-				
-				newArea->SetCostSoFar( newCostSoFar );
-				newArea->SetTotalCost( newCostSoFar + newCostRemaining );
+			// compute estimate of distance left to go
+			float distSq = ( newArea->GetCenter() - actualGoalPos ).LengthSqr();
+			float newCostRemaining = ( distSq > 0.0 ) ? FastSqrt( distSq ) : 0.0 ;
 
-				if ( newArea->IsClosed() )
-				{
-					newArea->RemoveFromClosedList();
-				}
-
-				if ( newArea->IsOpen() )
-				{
-					// area already on open list, update the list order to keep costs sorted
-					newArea->UpdateOnOpenList();
-				}
-				else
-				{
-					newArea->AddToOpenList();
-				}
+			// track closest area to goal in case path fails
+			if ( closestArea && newCostRemaining < closestAreaDist )
+			{
+				*closestArea = newArea;
+				closestAreaDist = newCostRemaining;
+			}
 
-				newArea->SetParent( area, how );
+			if ( newNode < 0 )
+			{
+				newNode = search.AddNode( newArea );
 			}
+
+			CNavPathSearch::Node_t &next = search.GetNode( newNode );
+			next.m_costSoFar = newCostSoFar;
+			next.m_totalCost = newCostSoFar + newCostRemaining;
+			next.m_pathLengthSoFar = newLengthSoFar;
+			next.m_parent = area;
+			next.m_parentHow = how;
+
+			// (re)open it - this also takes a closed area back if we found a cheaper way to it
+			search.AddToOpen( newNode );
 		}
 
-		// we have searched this area
-		area->AddToClosedList();
+		// we have searched this area - having left the open heap, it counts as closed
 	}
 
 	return false;
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Hands the cost so far kept by a CNavPathSearch to cost functors that read it off
+ * 'fromArea' via CNavArea::GetCostSoFar().
+ */
+template< typename CostFunctor >
+class NavAreaCostSoFarAdapter
+{
+public:
+	NavAreaCostSoFarAdapter( CostFunctor &costFunc ) : m_costFunc( costFunc ) { }
+
+	float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder, const CFuncElevator *elevator, float length, float fromCostSoFar )
+	{
+		if ( fromArea )
+		{
+			fromArea->SetCostSoFar( fromCostSoFar );
+		}
+
+		return m_costFunc( area, fromArea, ladder, elevator, length );
+	}
+
+private:
+	CostFunctor &m_costFunc;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The search used by the CNavArea flavor of NavAreaBuildPath() below
+ */
+inline CNavPathSearch &NavAreaMainThreadPathSearch( void )
+{
+	static CNavPathSearch search;
+	return search;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * As above, but with the result left on the areas themselves: the path is defined by following
+ * CNavArea::GetParent() back from goalArea to startArea. Cost functors read the cost so far with
+ * fromArea->GetCostSoFar(). Main thread only.
+ */
+template< typename CostFunctor >
+bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, CostFunctor &costFunc, CNavArea **closestArea = NULL, float maxPathLength = 0.0f, int teamID = TEAM_ANY, bool ignoreNavBlockers = false )
+{
+	Assert( ThreadInMainThread() );
+
+	CNavPathSearch &search = NavAreaMainThreadPathSearch();
+	NavAreaCostSoFarAdapter< CostFunctor > adapter( costFunc );
+
+	bool result = NavAreaBuildPath( search, startArea, goalArea, goalPos, adapter, closestArea, maxPathLength, teamID, ignoreNavBlockers );
+
+	search.CopyToAreas();
+
+	return result;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Compute distance between two areas. Return -1 if can't reach 'endArea' from 'startArea'.
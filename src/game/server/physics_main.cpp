@@ -37,6 +37,7 @@
 #include "vphysicsupdateai.h"
 #include "tier0/vcrmode.h"
 #include "pushentity.h"
+#include "igamemovement.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -50,6 +51,10 @@ ConVar vprof_scope_entity_thinks( "vprof_scope_entity_thinks", "0" );
 ConVar vprof_scope_entity_gamephys( "vprof_scope_entity_gamephys", "0" );
 
 ConVar	npc_vphysics	( "npc_vphysics","0");
+ConVar	sv_movement_batch( "sv_movement_batch", "1", 0, "Share static world queries between all players' movement within a tick" );
+
+extern IGameMovement *g_pGameMovement;
+
 //-----------------------------------------------------------------------------
 // helper method for trace hull as used by physics...
 //-----------------------------------------------------------------------------
@@ -2037,6 +2042,13 @@ void Physics_RunThinkFunctions( bool simulating )
 	// clear all entites freed outside of this loop
 	gEntList.CleanupDeleteList();
 
+	// every player's usercmds for this tick run below, in the usual entity order
+	bool bMovementBatch = sv_movement_batch.GetBool();
+	if ( bMovementBatch )
+	{
+		g_pGameMovement->BeginMovementBatch();
+	}
+
 	if ( !simulating )
 	{
 		// only simulate players
@@ -2079,6 +2091,11 @@ void Physics_RunThinkFunctions( bool simulating )
 		UTIL_EnableRemoveImmediate();
 	}
 
+	if ( bMovementBatch )
+	{
+		g_pGameMovement->EndMovementBatch();
+	}
+
 	gpGlobals->curtime = starttime;
 }
 
@@ -10,8 +10,9 @@
 #include "igamesystem.h"
 #include "ilagcompensationmanager.h"
 #include "inetchannelinfo.h"
-#include "utllinkedlist.h"
 #include "BaseAnimatingOverlay.h"
+#include "bone_setup.h"
+#include "collisionutils.h"
 #include "tier0/vprof.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
@@ -24,6 +25,7 @@
 #define LC_ANGLES_CHANGED	(1<<9)
 #define LC_SIZE_CHANGED		(1<<10)
 #define LC_ANIMATION_CHANGED (1<<11)
+#define LC_BONES_CHANGED	(1<<12)
 
 static ConVar sv_lagcompensation_teleport_dist( "sv_lagcompensation_teleport_dist", "64", FCVAR_DEVELOPMENTONLY | FCVAR_CHEAT, "How far a player got moved by game code before we can't lag compensate their position back" );
 #define LAG_COMPENSATION_EPS_SQR ( 0.1f * 0.1f )
@@ -36,6 +38,16 @@ ConVar sv_lagflushbonecache( "sv_lagflushbonecache", "1", FCVAR_DEVELOPMENTONLY,
 ConVar sv_showlagcompensation( "sv_showlagcompensation", "0", FCVAR_CHEAT, "Show lag compensated hitboxes whenever a player is lag compensated." );
 
 ConVar sv_unlag_fixstuck( "sv_unlag_fixstuck", "0", FCVAR_DEVELOPMENTONLY, "Disallow backtracking a player for lag compensation if it will cause them to become stuck" );
+ConVar sv_lagcompensation_bonesnapshots( "sv_lagcompensation_bonesnapshots", "1", FCVAR_DEVELOPMENTONLY, "Record hitbox bones with the lag records so backtracking doesn't re-animate players. 0 = off, 1 = record bones already set up this tick, 2 = set up bones every tick." );
+
+ConVar sv_lagcompensation_broadphase( "sv_lagcompensation_broadphase", "1", FCVAR_DEVELOPMENTONLY, "Let StartLagCompensationForShot only lag compensate players whose bounds since the target tick can be reached by the shot ray and spread cone" );
+ConVar sv_lagcompensation_broadphase_bloat( "sv_lagcompensation_broadphase_bloat", "8", FCVAR_DEVELOPMENTONLY, "Extra units added around each player's bounds by the lag compensation broadphase" );
+
+// History is kept for the largest sv_maxunlag
+#define LAG_HISTORY_SECONDS		1.0f
+
+// Players whose hitbox set has more hitboxes than this are always re-animated
+#define LAG_MAX_SNAPSHOT_BONES	32
 
 //-----------------------------------------------------------------------------
 // Purpose: 
@@ -127,6 +139,138 @@ public:
 };
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Fixed size history of a player's lag records, newest first.
+// The fields live in separate arrays so walking the history in BacktrackPlayer
+// only touches the times, flags and origins. When the bone cache was set up
+// on the tick a record was made, the hitbox bones are kept too, so
+// backtracking can put them back instead of re-animating the player.
+//-----------------------------------------------------------------------------
+class CLagRecordTrack
+{
+public:
+	CLagRecordTrack()
+	{
+		m_nCapacity = 0;
+		m_iNewest = -1;
+		m_nCount = 0;
+	}
+
+	void Init( int nCapacity )
+	{
+		if ( nCapacity == m_nCapacity )
+		{
+			RemoveAll();
+			return;
+		}
+
+		Purge();
+		m_nCapacity = nCapacity;
+		m_flSimulationTime.SetCount( nCapacity );
+		m_fFlags.SetCount( nCapacity );
+		m_vecOrigin.SetCount( nCapacity );
+		m_vecAngles.SetCount( nCapacity );
+		m_vecMinsPreScaled.SetCount( nCapacity );
+		m_vecMaxsPreScaled.SetCount( nCapacity );
+		m_vecSurroundingMins.SetCount( nCapacity );
+		m_vecSurroundingMaxs.SetCount( nCapacity );
+		m_masterSequence.SetCount( nCapacity );
+		m_masterCycle.SetCount( nCapacity );
+		m_layerRecords.SetCount( nCapacity * MAX_LAYER_RECORDS );
+		m_flPoseParameters.SetCount( nCapacity * MAXSTUDIOPOSEPARAM );
+		m_nHitboxBones.SetCount( nCapacity );
+		m_nBonesModelIndex.SetCount( nCapacity );
+		m_nBonesHitboxSet.SetCount( nCapacity );
+		m_HitboxBones.SetCount( nCapacity * LAG_MAX_SNAPSHOT_BONES );
+	}
+
+	void Purge()
+	{
+		m_flSimulationTime.Purge();
+		m_fFlags.Purge();
+		m_vecOrigin.Purge();
+		m_vecAngles.Purge();
+		m_vecMinsPreScaled.Purge();
+		m_vecMaxsPreScaled.Purge();
+		m_vecSurroundingMins.Purge();
+		m_vecSurroundingMaxs.Purge();
+		m_masterSequence.Purge();
+		m_masterCycle.Purge();
+		m_layerRecords.Purge();
+		m_flPoseParameters.Purge();
+		m_nHitboxBones.Purge();
+		m_nBonesModelIndex.Purge();
+		m_nBonesHitboxSet.Purge();
+		m_HitboxBones.Purge();
+		m_nCapacity = 0;
+		RemoveAll();
+	}
+
+	void RemoveAll()
+	{
+		m_iNewest = -1;
+		m_nCount = 0;
+	}
+
+	int Count() const		{ return m_nCount; }
+	int Capacity() const	{ return m_nCapacity; }
+
+	// Slot of the record nAge records older than the newest one
+	int Slot( int nAge ) const
+	{
+		Assert( nAge >= 0 && nAge < m_nCount );
+		int iSlot = m_iNewest - nAge;
+		return ( iSlot < 0 ) ? iSlot + m_nCapacity : iSlot;
+	}
+
+	// Returns the slot for the new record, dropping the oldest one if the track is full
+	int AddNewest()
+	{
+		Assert( m_nCapacity > 0 );
+		m_iNewest = ( m_iNewest + 1 ) % m_nCapacity;
+		if ( m_nCount < m_nCapacity )
+			++m_nCount;
+		return m_iNewest;
+	}
+
+	void RemoveOldest()
+	{
+		Assert( m_nCount > 0 );
+		--m_nCount;
+	}
+
+	LayerRecord	*Layers( int iSlot )			{ return &m_layerRecords[ iSlot * MAX_LAYER_RECORDS ]; }
+	float		*PoseParameters( int iSlot )	{ return &m_flPoseParameters[ iSlot * MAXSTUDIOPOSEPARAM ]; }
+	matrix3x4_t	*HitboxBones( int iSlot )		{ return &m_HitboxBones[ iSlot * LAG_MAX_SNAPSHOT_BONES ]; }
+
+public:
+	CUtlVector< float >			m_flSimulationTime;
+	CUtlVector< int >			m_fFlags;
+	CUtlVector< Vector >		m_vecOrigin;
+	CUtlVector< QAngle >		m_vecAngles;
+	CUtlVector< Vector >		m_vecMinsPreScaled;
+	CUtlVector< Vector >		m_vecMaxsPreScaled;
+	CUtlVector< Vector >		m_vecSurroundingMins;	// world space, for the broadphase
+	CUtlVector< Vector >		m_vecSurroundingMaxs;
+	CUtlVector< int >			m_masterSequence;
+	CUtlVector< float >			m_masterCycle;
+	CUtlVector< LayerRecord >	m_layerRecords;			// MAX_LAYER_RECORDS per record
+	CUtlVector< float >			m_flPoseParameters;		// MAXSTUDIOPOSEPARAM per record
+
+	// One bone to world transform per hitbox, for the model and hitbox set the player had then.
+	// m_nHitboxBones is 0 if the bones weren't recorded.
+	CUtlVector< int >			m_nHitboxBones;
+	CUtlVector< int >			m_nBonesModelIndex;
+	CUtlVector< int >			m_nBonesHitboxSet;
+	CUtlVector< matrix3x4_t >	m_HitboxBones;			// LAG_MAX_SNAPSHOT_BONES per record
+
+private:
+	int						m_nCapacity;
+	int						m_iNewest;
+	int						m_nCount;
+};
+
+
 //
 // Try to take the player from his current origin to vWantedPos.
 // If it can't get there, leave the player where he is.
@@ -205,12 +349,18 @@ public:
 
 	// Called during player movement to set up/restore after lag compensation
 	void			StartLagCompensation( CBasePlayer *player, CUserCmd *cmd );
+	void			StartLagCompensationForShot( CBasePlayer *player, CUserCmd *cmd, const Vector &vecShotStart, const Vector &vecShotDir, float flShotSpread );
 	void			FinishLagCompensation( CBasePlayer *player );
 
 	bool			IsCurrentlyDoingLagCompensation() const OVERRIDE { return m_isCurrentlyDoingCompensation; }
 
 private:
+	void			StartLagCompensation( CBasePlayer *player, CUserCmd *cmd, bool bBroadphase, const Vector &vecShotStart, const Vector &vecShotDir, float flShotSpread );
 	void			BacktrackPlayer( CBasePlayer *player, float flTargetTime );
+	bool			IsShotCandidate( CBasePlayer *pPlayer, float flTargetTime, const Vector &vecShotStart, const Vector &vecShotDir, float flShotSpread );
+	void			RecordHitboxBones( CBasePlayer *pPlayer, CLagRecordTrack *track, int iSlot, bool bSetupBones );
+	bool			RestoreHitboxBones( CBasePlayer *pPlayer, CLagRecordTrack *track, int iSlot, int iPrevSlot, float frac, const Vector &org );
+	void			UndoHitboxBones( CBasePlayer *pPlayer );
 
 	void ClearHistory()
 	{
@@ -218,8 +368,8 @@ private:
 			m_PlayerTrack[i].Purge();
 	}
 
-	// keep a list of lag records for each player
-	CUtlFixedLinkedList< LagRecord >	m_PlayerTrack[ MAX_PLAYERS ];
+	// keep a history of lag records for each player
+	CLagRecordTrack			m_PlayerTrack[ MAX_PLAYERS ];
 
 	// Scratchpad for determining what needs to be restored
 	CBitVec<MAX_PLAYERS>	m_RestorePlayer;
@@ -228,6 +378,11 @@ private:
 	LagRecord				m_RestoreData[ MAX_PLAYERS ];	// player data before we moved him back
 	LagRecord				m_ChangeData[ MAX_PLAYERS ];	// player data where we moved him back
 
+	// Cached hitbox bones we overwrote with recorded ones, see RestoreHitboxBones
+	matrix3x4_t				m_RestoreBones[ MAX_PLAYERS ][ LAG_MAX_SNAPSHOT_BONES ];
+	int						m_nRestoreBones[ MAX_PLAYERS ];
+	float					m_flRestoreBonesTime[ MAX_PLAYERS ];
+
 	CBasePlayer				*m_pCurrentPlayer;	// The player we are doing lag compensation for
 
 	float					m_flTeleportDistanceSqr;
@@ -255,14 +410,18 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 	VPROF_BUDGET( "FrameUpdatePostEntityThink", "CLagCompensationManager" );
 
 	// remove all records before that time:
-	int flDeadtime = gpGlobals->curtime - sv_maxunlag.GetFloat();
+	float flDeadtime = gpGlobals->curtime - sv_maxunlag.GetFloat();
+
+	// one record per tick at most
+	int nTrackCapacity = TIME_TO_TICKS( LAG_HISTORY_SECONDS ) + 2;
+	int nBoneSnapshots = sv_lagcompensation_bonesnapshots.GetInt();
 
 	// Iterate all active players
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
 	{
 		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
 
-		CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[i-1];
+		CLagRecordTrack *track = &m_PlayerTrack[i-1];
 
 		if ( !pPlayer )
 		{
@@ -274,66 +433,72 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 			continue;
 		}
 
-		Assert( track->Count() < 1000 ); // insanity check
+		if ( track->Capacity() != nTrackCapacity )
+		{
+			track->Init( nTrackCapacity );
+		}
 
 		// remove tail records that are too old
-		intp tailIndex = track->Tail();
-		while ( track->IsValidIndex( tailIndex ) )
+		while ( track->Count() > 0 )
 		{
-			LagRecord &tail = track->Element( tailIndex );
-
 			// if tail is within limits, stop
-			if ( tail.m_flSimulationTime >= flDeadtime )
+			if ( track->m_flSimulationTime[ track->Slot( track->Count() - 1 ) ] >= flDeadtime )
 				break;
-			
-			// remove tail, get new tail
-			track->Remove( tailIndex );
-			tailIndex = track->Tail();
+
+			// remove tail
+			track->RemoveOldest();
 		}
 
 		// check if head has same simulation time
 		if ( track->Count() > 0 )
 		{
-			LagRecord &head = track->Element( track->Head() );
-
 			// check if player changed simulation time since last time updated
-			if ( head.m_flSimulationTime >= pPlayer->GetSimulationTime() )
+			if ( track->m_flSimulationTime[ track->Slot( 0 ) ] >= pPlayer->GetSimulationTime() )
 				continue; // don't add new entry for same or older time
 		}
 
 		// add new record to player track
-		LagRecord &record = track->Element( track->AddToHead() );
+		int iSlot = track->AddNewest();
 
-		record.m_fFlags = 0;
+		track->m_fFlags[iSlot] = 0;
 		if ( pPlayer->IsAlive() )
 		{
-			record.m_fFlags |= LC_ALIVE;
+			track->m_fFlags[iSlot] |= LC_ALIVE;
 		}
 
-		record.m_flSimulationTime	= pPlayer->GetSimulationTime();
-		record.m_vecAngles			= pPlayer->GetLocalAngles();
-		record.m_vecOrigin			= pPlayer->GetLocalOrigin();
-		record.m_vecMinsPreScaled	= pPlayer->CollisionProp()->OBBMinsPreScaled();
-		record.m_vecMaxsPreScaled	= pPlayer->CollisionProp()->OBBMaxsPreScaled();
+		track->m_flSimulationTime[iSlot]	= pPlayer->GetSimulationTime();
+		track->m_vecAngles[iSlot]			= pPlayer->GetLocalAngles();
+		track->m_vecOrigin[iSlot]			= pPlayer->GetLocalOrigin();
+		track->m_vecMinsPreScaled[iSlot]	= pPlayer->CollisionProp()->OBBMinsPreScaled();
+		track->m_vecMaxsPreScaled[iSlot]	= pPlayer->CollisionProp()->OBBMaxsPreScaled();
+		pPlayer->CollisionProp()->WorldSpaceSurroundingBounds( &track->m_vecSurroundingMins[iSlot], &track->m_vecSurroundingMaxs[iSlot] );
 
+		LayerRecord *layerRecords = track->Layers( iSlot );
 		int layerCount = pPlayer->GetNumAnimOverlays();
 		for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
 		{
 			CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
 			if( currentLayer )
 			{
-				record.m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
-				record.m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
-				record.m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
-				record.m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
+				layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
+				layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
+				layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
+				layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
 			}
 		}
-		record.m_masterSequence = pPlayer->GetSequence();
-		record.m_masterCycle = pPlayer->GetCycle();
+		track->m_masterSequence[iSlot] = pPlayer->GetSequence();
+		track->m_masterCycle[iSlot] = pPlayer->GetCycle();
 
+		float *poseParameters = track->PoseParameters( iSlot );
 		for( int i=0; i<MAXSTUDIOPOSEPARAM; i++ )
 		{
-			record.m_flPoseParameters[i] = pPlayer->GetPoseParameter(i);
+			poseParameters[i] = pPlayer->GetPoseParameter(i);
+		}
+
+		track->m_nHitboxBones[iSlot] = 0;
+		if ( nBoneSnapshots > 0 )
+		{
+			RecordHitboxBones( pPlayer, track, iSlot, nBoneSnapshots >= 2 );
 		}
 	}
 
@@ -341,8 +506,175 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 	m_pCurrentPlayer = NULL;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Copies the player's hitbox bones into the record if they are set up
+// for this tick. With bSetupBones, sets them up if they aren't.
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::RecordHitboxBones( CBasePlayer *pPlayer, CLagRecordTrack *track, int iSlot, bool bSetupBones )
+{
+	CStudioHdr *pStudioHdr = pPlayer->GetModelPtr();
+	if ( !pStudioHdr )
+		return;
+
+	mstudiohitboxset_t *set = pStudioHdr->pHitboxSet( pPlayer->GetHitboxSet() );
+	if ( !set || set->numhitboxes <= 0 || set->numhitboxes > LAG_MAX_SNAPSHOT_BONES )
+		return;
+
+	CBoneCache *pCache = pPlayer->GetExistingBoneCache();
+	if ( bSetupBones && ( !pCache || pCache->m_timeValid != gpGlobals->curtime ) )
+	{
+		// GetBoneCache accepts bones up to 0.1s old, we want this tick's
+		pPlayer->InvalidateBoneCache();
+		pCache = pPlayer->GetBoneCache();
+	}
+
+	if ( !pCache || pCache->m_timeValid != gpGlobals->curtime || !( pCache->m_boneMask & BONE_USED_BY_HITBOX ) )
+		return;
+
+	matrix3x4_t *pBones = track->HitboxBones( iSlot );
+	// Every saved copy of a shared bone is its original, so the order doesn't matter
+	for ( int i = 0; i < set->numhitboxes; i++ )
+	{
+		matrix3x4_t *pMatrix = pCache->GetCachedBone( set->pHitbox(i)->bone );
+		if ( !pMatrix )
+			return;
+
+		MatrixCopy( *pMatrix, pBones[i] );
+	}
+
+	track->m_nHitboxBones[iSlot] = set->numhitboxes;
+	track->m_nBonesModelIndex[iSlot] = pPlayer->GetModelIndex();
+	track->m_nBonesHitboxSet[iSlot] = pPlayer->GetHitboxSet();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Puts the recorded hitbox bones, interpolated and moved to org, into
+// the player's bone cache, saving the cached ones for UndoHitboxBones.
+// Returns false if the records don't have usable bones.
+//-----------------------------------------------------------------------------
+bool CLagCompensationManager::RestoreHitboxBones( CBasePlayer *pPlayer, CLagRecordTrack *track, int iSlot, int iPrevSlot, float frac, const Vector &org )
+{
+	int nBones = track->m_nHitboxBones[iSlot];
+	if ( nBones == 0 ||
+		 track->m_nBonesModelIndex[iSlot] != pPlayer->GetModelIndex() ||
+		 track->m_nBonesHitboxSet[iSlot] != pPlayer->GetHitboxSet() )
+		return false;
+
+	bool bInterpolate = ( frac > 0.0f );
+	if ( bInterpolate )
+	{
+		if ( track->m_nHitboxBones[iPrevSlot] != nBones ||
+			 track->m_nBonesModelIndex[iPrevSlot] != track->m_nBonesModelIndex[iSlot] ||
+			 track->m_nBonesHitboxSet[iPrevSlot] != track->m_nBonesHitboxSet[iSlot] )
+			return false;
+	}
+
+	CStudioHdr *pStudioHdr = pPlayer->GetModelPtr();
+	if ( !pStudioHdr )
+		return false;
+
+	mstudiohitboxset_t *set = pStudioHdr->pHitboxSet( pPlayer->GetHitboxSet() );
+	if ( !set || set->numhitboxes != nBones )
+		return false;
+
+	CBoneCache *pCache = pPlayer->GetExistingBoneCache();
+	if ( !pCache || !( pCache->m_boneMask & BONE_USED_BY_HITBOX ) )
+		return false;
+
+	// The bones were recorded where the player was, move them to where we put him
+	Vector vecRecordOrigin = bInterpolate ? Lerp( frac, track->m_vecOrigin[iSlot], track->m_vecOrigin[iPrevSlot] ) : track->m_vecOrigin[iSlot];
+	Vector vecOffset = org - vecRecordOrigin;
+
+	// Save every cached bone before writing any of them. Hitboxes can share a
+	// bone, so saving as we go would save one we already moved.
+	int pl_index = pPlayer->entindex() - 1;
+	matrix3x4_t *pCachedBones[LAG_MAX_SNAPSHOT_BONES];
+	for ( int i = 0; i < nBones; i++ )
+	{
+		pCachedBones[i] = pCache->GetCachedBone( set->pHitbox(i)->bone );
+		if ( !pCachedBones[i] )
+			return false;
+	}
+	for ( int i = 0; i < nBones; i++ )
+	{
+		MatrixCopy( *pCachedBones[i], m_RestoreBones[pl_index][i] );
+	}
+
+	const matrix3x4_t *pBones = track->HitboxBones( iSlot );
+	const matrix3x4_t *pPrevBones = bInterpolate ? track->HitboxBones( iPrevSlot ) : NULL;
+	for ( int i = 0; i < nBones; i++ )
+	{
+		matrix3x4_t *pMatrix = pCachedBones[i];
+
+		if ( bInterpolate )
+		{
+			// Records are a tick apart, so blending the matrices is close enough
+			// and keeps any model scale in them
+			const float *pFrom = pBones[i].Base();
+			const float *pTo = pPrevBones[i].Base();
+			float *pOut = pMatrix->Base();
+			for ( int j = 0; j < 12; j++ )
+			{
+				pOut[j] = Lerp( frac, pFrom[j], pTo[j] );
+			}
+		}
+		else
+		{
+			MatrixCopy( pBones[i], *pMatrix );
+		}
+
+		(*pMatrix)[0][3] += vecOffset.x;
+		(*pMatrix)[1][3] += vecOffset.y;
+		(*pMatrix)[2][3] += vecOffset.z;
+	}
+
+	// Other bones in the cache (attachments) keep their values
+	m_nRestoreBones[pl_index] = nBones;
+	m_flRestoreBonesTime[pl_index] = pCache->m_timeValid;
+	pCache->m_timeValid = gpGlobals->curtime;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Puts back the bones RestoreHitboxBones overwrote
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::UndoHitboxBones( CBasePlayer *pPlayer )
+{
+	CStudioHdr *pStudioHdr = pPlayer->GetModelPtr();
+	CBoneCache *pCache = pPlayer->GetExistingBoneCache();
+	mstudiohitboxset_t *set = pStudioHdr ? pStudioHdr->pHitboxSet( pPlayer->GetHitboxSet() ) : NULL;
+	int pl_index = pPlayer->entindex() - 1;
+	if ( !pCache || !set || set->numhitboxes != m_nRestoreBones[pl_index] )
+	{
+		// The cache went away or the model changed while compensated
+		pPlayer->InvalidateBoneCache();
+		return;
+	}
+
+	// Every saved copy of a shared bone is its original, so the order doesn't matter
+	for ( int i = 0; i < set->numhitboxes; i++ )
+	{
+		matrix3x4_t *pMatrix = pCache->GetCachedBone( set->pHitbox(i)->bone );
+		if ( pMatrix )
+		{
+			MatrixCopy( m_RestoreBones[pl_index][i], *pMatrix );
+		}
+	}
+	pCache->m_timeValid = m_flRestoreBonesTime[pl_index];
+}
+
 // Called during player movement to set up/restore after lag compensation
 void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCmd *cmd )
+{
+	StartLagCompensation( player, cmd, false, vec3_origin, vec3_origin, 0.0f );
+}
+
+void CLagCompensationManager::StartLagCompensationForShot( CBasePlayer *player, CUserCmd *cmd, const Vector &vecShotStart, const Vector &vecShotDir, float flShotSpread )
+{
+	StartLagCompensation( player, cmd, sv_lagcompensation_broadphase.GetBool(), vecShotStart, vecShotDir, flShotSpread );
+}
+
+void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCmd *cmd, bool bBroadphase, const Vector &vecShotStart, const Vector &vecShotDir, float flShotSpread )
 {
 	Assert( !m_isCurrentlyDoingCompensation );
 
@@ -411,6 +743,8 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		targettick = gpGlobals->tickcount - TIME_TO_TICKS( correct );
 	}
 	
+	float flTargetTime = TICKS_TO_TIME( targettick );
+
 	// Iterate all active players
 	const CBitVec<MAX_EDICTS> *pEntityTransmitBits = engine->GetEntityTransmitBitsForClient( player->entindex() - 1 );
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
@@ -432,9 +766,46 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		if ( !player->WantsLagCompensationOnEntity( pPlayer, cmd, pEntityTransmitBits ) )
 			continue;
 
+		// Leave players alone if the shot can't reach them
+		if ( bBroadphase && !IsShotCandidate( pPlayer, flTargetTime, vecShotStart, vecShotDir, flShotSpread ) )
+			continue;
+
 		// Move other player back in time
-		BacktrackPlayer( pPlayer, TICKS_TO_TIME( targettick ) );
+		BacktrackPlayer( pPlayer, flTargetTime );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Can the shot ray, widened by the spread cone, hit the player where
+// they are now or anywhere they were back to flTargetTime? If not, backtracking them
+// can't change what the shot hits.
+//-----------------------------------------------------------------------------
+bool CLagCompensationManager::IsShotCandidate( CBasePlayer *pPlayer, float flTargetTime, const Vector &vecShotStart, const Vector &vecShotDir, float flShotSpread )
+{
+	VPROF_BUDGET( "IsShotCandidate", "CLagCompensationManager" );
+
+	Vector vecMins, vecMaxs;
+	pPlayer->CollisionProp()->WorldSpaceSurroundingBounds( &vecMins, &vecMaxs );
+
+	// Add the records back to the one BacktrackPlayer will stop at
+	CLagRecordTrack *track = &m_PlayerTrack[ pPlayer->entindex() - 1 ];
+	for ( int age = 0; age < track->Count(); age++ )
+	{
+		int iSlot = track->Slot( age );
+		VectorMin( vecMins, track->m_vecSurroundingMins[iSlot], vecMins );
+		VectorMax( vecMaxs, track->m_vecSurroundingMaxs[iSlot], vecMaxs );
+
+		if ( track->m_flSimulationTime[iSlot] <= flTargetTime )
+			break;
 	}
+
+	// Grow the box by how far off the ray the cone gets at the far side of it
+	Vector vecCenter = ( vecMins + vecMaxs ) * 0.5f;
+	float flFarDist = vecCenter.DistTo( vecShotStart ) + vecMaxs.DistTo( vecCenter );
+	float flBloat = flFarDist * flShotSpread + sv_lagcompensation_broadphase_bloat.GetFloat();
+	Vector vecBloat( flBloat, flBloat, flBloat );
+
+	return IsBoxIntersectingRay( vecMins - vecBloat, vecMaxs + vecBloat, vecShotStart, vecShotDir * MAX_TRACE_LENGTH );
 }
 
 void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTargetTime )
@@ -448,35 +819,33 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	int pl_index = pPlayer->entindex() - 1;
 
 	// get track history of this player
-	CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[ pl_index ];
+	CLagRecordTrack *track = &m_PlayerTrack[ pl_index ];
 
 	// check if we have at leat one entry
 	if ( track->Count() <= 0 )
 		return;
 
-	intp curr = track->Head();
-
-	LagRecord *prevRecord = NULL;
-	LagRecord *record = NULL;
+	int prevRecord = -1;
+	int record = -1;
 
 	Vector prevOrg = pPlayer->GetLocalOrigin();
 	
 	// Walk context looking for any invalidating event
-	while( track->IsValidIndex(curr) )
+	for ( int age = 0; age < track->Count(); age++ )
 	{
 		// remember last record
 		prevRecord = record;
 
 		// get next record
-		record = &track->Element( curr );
+		record = track->Slot( age );
 
-		if ( !(record->m_fFlags & LC_ALIVE) )
+		if ( !(track->m_fFlags[record] & LC_ALIVE) )
 		{
 			// player most be alive, lost track
 			return;
 		}
 
-		Vector delta = record->m_vecOrigin - prevOrg;
+		Vector delta = track->m_vecOrigin[record] - prevOrg;
 		if ( delta.Length2DSqr() > m_flTeleportDistanceSqr )
 		{
 			// lost track, too much difference
@@ -484,18 +853,15 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 		}
 
 		// did we find a context smaller than target time ?
-		if ( record->m_flSimulationTime <= flTargetTime )
+		if ( track->m_flSimulationTime[record] <= flTargetTime )
 			break; // hurra, stop
 
-		prevOrg = record->m_vecOrigin;
-
-		// go one step back
-		curr = track->Next( curr );
+		prevOrg = track->m_vecOrigin[record];
 	}
 
-	Assert( record );
+	Assert( record != -1 );
 
-	if ( !record )
+	if ( record == -1 )
 	{
 		if ( sv_unlag_debug.GetBool() )
 		{
@@ -506,35 +872,35 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	}
 
 	float frac = 0.0f;
-	if ( prevRecord && 
-		 (record->m_flSimulationTime < flTargetTime) &&
-		 (record->m_flSimulationTime < prevRecord->m_flSimulationTime) )
+	if ( prevRecord != -1 && 
+		 (track->m_flSimulationTime[record] < flTargetTime) &&
+		 (track->m_flSimulationTime[record] < track->m_flSimulationTime[prevRecord]) )
 	{
 		// we didn't find the exact time but have a valid previous record
 		// so interpolate between these two records;
 
-		Assert( prevRecord->m_flSimulationTime > record->m_flSimulationTime );
-		Assert( flTargetTime < prevRecord->m_flSimulationTime );
+		Assert( track->m_flSimulationTime[prevRecord] > track->m_flSimulationTime[record] );
+		Assert( flTargetTime < track->m_flSimulationTime[prevRecord] );
 
 		// calc fraction between both records
-		frac = ( flTargetTime - record->m_flSimulationTime ) / 
-			( prevRecord->m_flSimulationTime - record->m_flSimulationTime );
+		frac = ( flTargetTime - track->m_flSimulationTime[record] ) / 
+			( track->m_flSimulationTime[prevRecord] - track->m_flSimulationTime[record] );
 
 		Assert( frac > 0 && frac < 1 ); // should never extrapolate
 
-		ang				= Lerp( frac, record->m_vecAngles, prevRecord->m_vecAngles );
-		org				= Lerp( frac, record->m_vecOrigin, prevRecord->m_vecOrigin );
-		minsPreScaled	= Lerp( frac, record->m_vecMinsPreScaled, prevRecord->m_vecMinsPreScaled );
-		maxsPreScaled	= Lerp( frac, record->m_vecMaxsPreScaled, prevRecord->m_vecMaxsPreScaled );
+		ang				= Lerp( frac, track->m_vecAngles[record], track->m_vecAngles[prevRecord] );
+		org				= Lerp( frac, track->m_vecOrigin[record], track->m_vecOrigin[prevRecord] );
+		minsPreScaled	= Lerp( frac, track->m_vecMinsPreScaled[record], track->m_vecMinsPreScaled[prevRecord] );
+		maxsPreScaled	= Lerp( frac, track->m_vecMaxsPreScaled[record], track->m_vecMaxsPreScaled[prevRecord] );
 	}
 	else
 	{
 		// we found the exact record or no other record to interpolate with
 		// just copy these values since they are the best we have
-		org				= record->m_vecOrigin;
-		ang				= record->m_vecAngles;
-		minsPreScaled	= record->m_vecMinsPreScaled;
-		maxsPreScaled	= record->m_vecMaxsPreScaled;
+		org				= track->m_vecOrigin[record];
+		ang				= track->m_vecAngles[record];
+		minsPreScaled	= track->m_vecMinsPreScaled[record];
+		maxsPreScaled	= track->m_vecMaxsPreScaled[record];
 	}
 
 	// See if this is still a valid position for us to teleport to
@@ -638,114 +1004,131 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 		change->m_vecOrigin = org;
 	}
 
-	// Sorry for the loss of the optimization for the case of people
-	// standing still, but you breathe even on the server.
-	// This is quicker than actually comparing all bazillion floats.
-	flags |= LC_ANIMATION_CHANGED;
-	restore->m_masterSequence = pPlayer->GetSequence();
-	restore->m_masterCycle = pPlayer->GetCycle();
-
-	bool interpolationAllowed = false;
-	if( prevRecord && (record->m_masterSequence == prevRecord->m_masterSequence) )
+	if ( RestoreHitboxBones( pPlayer, track, record, prevRecord, frac, org ) )
 	{
-		// If the master state changes, all layers will be invalid too, so don't interp (ya know, interp barely ever happens anyway)
-		interpolationAllowed = true;
+		// Hitbox traces only look at the bones, so the animation state can stay as it is
+		flags |= LC_BONES_CHANGED;
 	}
-	
-	////////////////////////
-	// First do the master settings
-	bool interpolatedMasters = false;
-	if( frac > 0.0f && interpolationAllowed )
+	else
 	{
-		interpolatedMasters = true;
-		pPlayer->SetSequence( Lerp( frac, record->m_masterSequence, prevRecord->m_masterSequence ) );
-		pPlayer->SetCycle( Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle ) );
-
-		if( record->m_masterCycle > prevRecord->m_masterCycle )
-		{
-			// the older record is higher in frame than the newer, it must have wrapped around from 1 back to 0
-			// add one to the newer so it is lerping from .9 to 1.1 instead of .9 to .1, for example.
-			float newCycle = Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle + 1 );
-			pPlayer->SetCycle(newCycle < 1 ? newCycle : newCycle - 1 );// and make sure .9 to 1.2 does not end up 1.05
-		}
-		else
+		// Sorry for the loss of the optimization for the case of people
+		// standing still, but you breathe even on the server.
+		// This is quicker than actually comparing all bazillion floats.
+		flags |= LC_ANIMATION_CHANGED;
+		restore->m_masterSequence = pPlayer->GetSequence();
+		restore->m_masterCycle = pPlayer->GetCycle();
+		for( int i=0; i<MAXSTUDIOPOSEPARAM; i++ )
 		{
-			pPlayer->SetCycle( Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle ) );
+			restore->m_flPoseParameters[i] = pPlayer->GetPoseParameter(i);
 		}
 
-		for( int i=0; i<MAXSTUDIOPOSEPARAM; i++ )
+		const float *recordPoseParameters = track->PoseParameters( record );
+		const LayerRecord *recordLayerRecords = track->Layers( record );
+		const LayerRecord *prevLayerRecords = ( prevRecord != -1 ) ? track->Layers( prevRecord ) : NULL;
+
+		bool interpolationAllowed = false;
+		if( prevRecord != -1 && (track->m_masterSequence[record] == track->m_masterSequence[prevRecord]) )
 		{
-			//don't lerp pose params, just pick the closest
-			pPlayer->SetPoseParameter( i, record->m_flPoseParameters[i] );
-			//pAnimating->SetPoseParameter( i, Lerp( frac, record->m_flPoseParameters[i], prevRecord->m_flPoseParameters[i] ) );
+			// If the master state changes, all layers will be invalid too, so don't interp (ya know, interp barely ever happens anyway)
+			interpolationAllowed = true;
 		}
-	}
-	if( !interpolatedMasters )
-	{
-		pPlayer->SetSequence(record->m_masterSequence);
-		pPlayer->SetCycle(record->m_masterCycle);
+	
+		////////////////////////
+		// First do the master settings
+		bool interpolatedMasters = false;
+		if( frac > 0.0f && interpolationAllowed )
+		{
+			interpolatedMasters = true;
+			pPlayer->SetSequence( Lerp( frac, track->m_masterSequence[record], track->m_masterSequence[prevRecord] ) );
+			pPlayer->SetCycle( Lerp( frac, track->m_masterCycle[record], track->m_masterCycle[prevRecord] ) );
 
-		for( int i=0; i<MAXSTUDIOPOSEPARAM; i++ )
+			if( track->m_masterCycle[record] > track->m_masterCycle[prevRecord] )
+			{
+				// the older record is higher in frame than the newer, it must have wrapped around from 1 back to 0
+				// add one to the newer so it is lerping from .9 to 1.1 instead of .9 to .1, for example.
+				float newCycle = Lerp( frac, track->m_masterCycle[record], track->m_masterCycle[prevRecord] + 1 );
+				pPlayer->SetCycle(newCycle < 1 ? newCycle : newCycle - 1 );// and make sure .9 to 1.2 does not end up 1.05
+			}
+			else
+			{
+				pPlayer->SetCycle( Lerp( frac, track->m_masterCycle[record], track->m_masterCycle[prevRecord] ) );
+			}
+
+			for( int i=0; i<MAXSTUDIOPOSEPARAM; i++ )
+			{
+				//don't lerp pose params, just pick the closest
+				pPlayer->SetPoseParameter( i, recordPoseParameters[i] );
+				//pAnimating->SetPoseParameter( i, Lerp( frac, recordPoseParameters[i], track->PoseParameters( prevRecord )[i] ) );
+			}
+		}
+		if( !interpolatedMasters )
 		{
-			pPlayer->SetPoseParameter( i, record->m_flPoseParameters[i] );
+			pPlayer->SetSequence(track->m_masterSequence[record]);
+			pPlayer->SetCycle(track->m_masterCycle[record]);
+
+			for( int i=0; i<MAXSTUDIOPOSEPARAM; i++ )
+			{
+				pPlayer->SetPoseParameter( i, recordPoseParameters[i] );
+			}
 		}
-	}
 
-	////////////////////////
-	// Now do all the layers
-	int layerCount = pPlayer->GetNumAnimOverlays();
-	for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
-	{
-		CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
-		if( currentLayer )
+		////////////////////////
+		// Now do all the layers
+		int layerCount = pPlayer->GetNumAnimOverlays();
+		for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
 		{
-			restore->m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
-			restore->m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
-			restore->m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
-			restore->m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
-
-			bool interpolated = false;
-			if( (frac > 0.0f)  &&  interpolationAllowed )
+			CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
+			if( currentLayer )
 			{
-				LayerRecord &recordsLayerRecord = record->m_layerRecords[layerIndex];
-				LayerRecord &prevRecordsLayerRecord = prevRecord->m_layerRecords[layerIndex];
-				if( (recordsLayerRecord.m_order == prevRecordsLayerRecord.m_order)
-					&& (recordsLayerRecord.m_sequence == prevRecordsLayerRecord.m_sequence)
-					)
+				restore->m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
+				restore->m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
+				restore->m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
+				restore->m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
+
+				bool interpolated = false;
+				if( (frac > 0.0f)  &&  interpolationAllowed )
 				{
-					// We can't interpolate across a sequence or order change
-					interpolated = true;
-					if( recordsLayerRecord.m_cycle > prevRecordsLayerRecord.m_cycle )
+					const LayerRecord &recordsLayerRecord = recordLayerRecords[layerIndex];
+					const LayerRecord &prevRecordsLayerRecord = prevLayerRecords[layerIndex];
+					if( (recordsLayerRecord.m_order == prevRecordsLayerRecord.m_order)
+						&& (recordsLayerRecord.m_sequence == prevRecordsLayerRecord.m_sequence)
+						)
 					{
-						// the older record is higher in frame than the newer, it must have wrapped around from 1 back to 0
-						// add one to the newer so it is lerping from .9 to 1.1 instead of .9 to .1, for example.
-						float newCycle = Lerp( frac, recordsLayerRecord.m_cycle, prevRecordsLayerRecord.m_cycle + 1 );
-						currentLayer->m_flCycle = newCycle < 1 ? newCycle : newCycle - 1;// and make sure .9 to 1.2 does not end up 1.05
+						// We can't interpolate across a sequence or order change
+						interpolated = true;
+						if( recordsLayerRecord.m_cycle > prevRecordsLayerRecord.m_cycle )
+						{
+							// the older record is higher in frame than the newer, it must have wrapped around from 1 back to 0
+							// add one to the newer so it is lerping from .9 to 1.1 instead of .9 to .1, for example.
+							float newCycle = Lerp( frac, recordsLayerRecord.m_cycle, prevRecordsLayerRecord.m_cycle + 1 );
+							currentLayer->m_flCycle = newCycle < 1 ? newCycle : newCycle - 1;// and make sure .9 to 1.2 does not end up 1.05
+						}
+						else
+						{
+							currentLayer->m_flCycle = Lerp( frac, recordsLayerRecord.m_cycle, prevRecordsLayerRecord.m_cycle  );
+						}
+						currentLayer->m_nOrder = recordsLayerRecord.m_order;
+						currentLayer->m_nSequence = recordsLayerRecord.m_sequence;
+						currentLayer->m_flWeight = Lerp( frac, recordsLayerRecord.m_weight, prevRecordsLayerRecord.m_weight  );
 					}
-					else
-					{
-						currentLayer->m_flCycle = Lerp( frac, recordsLayerRecord.m_cycle, prevRecordsLayerRecord.m_cycle  );
-					}
-					currentLayer->m_nOrder = recordsLayerRecord.m_order;
-					currentLayer->m_nSequence = recordsLayerRecord.m_sequence;
-					currentLayer->m_flWeight = Lerp( frac, recordsLayerRecord.m_weight, prevRecordsLayerRecord.m_weight  );
 				}
-			}
-			if( !interpolated )
-			{
-				//Either no interp, or interp failed.  Just use record.
-				currentLayer->m_flCycle = record->m_layerRecords[layerIndex].m_cycle;
-				currentLayer->m_nOrder = record->m_layerRecords[layerIndex].m_order;
-				currentLayer->m_nSequence = record->m_layerRecords[layerIndex].m_sequence;
-				currentLayer->m_flWeight = record->m_layerRecords[layerIndex].m_weight;
+				if( !interpolated )
+				{
+					//Either no interp, or interp failed.  Just use record.
+					currentLayer->m_flCycle = recordLayerRecords[layerIndex].m_cycle;
+					currentLayer->m_nOrder = recordLayerRecords[layerIndex].m_order;
+					currentLayer->m_nSequence = recordLayerRecords[layerIndex].m_sequence;
+					currentLayer->m_flWeight = recordLayerRecords[layerIndex].m_weight;
+				}
 			}
 		}
-	}
 	
+	}
+
 	if ( !flags )
 		return; // we didn't change anything
 
-	if ( sv_lagflushbonecache.GetBool() )
+	if ( sv_lagflushbonecache.GetBool() && !( flags & LC_BONES_CHANGED ) )
 		pPlayer->InvalidateBoneCache();
 
 	/*char text[256]; Q_snprintf( text, sizeof(text), "time %.2f", flTargetTime );
@@ -863,6 +1246,13 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 			}
 		}
 
+		if ( restore->m_fFlags & LC_BONES_CHANGED )
+		{
+			restoreSimulationTime = true;
+
+			UndoHitboxBones( pPlayer );
+		}
+
 		if ( restoreSimulationTime )
 		{
 			pPlayer->SetSimulationTime( restore->m_flSimulationTime );
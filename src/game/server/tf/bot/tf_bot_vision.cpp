@@ -100,6 +100,19 @@ void CTFBotVision::CollectPotentiallyVisibleEntities( CUtlVector< CBaseEntity *
 }
 
 
+//------------------------------------------------------------------------------------------
+// Update() returns early until the MvM scan timer runs out
+bool CTFBotVision::WillUpdateThisTick( void ) const
+{
+	if ( TFGameRules()->IsMannVsMachineMode() )
+	{
+		return m_scanTimer.IsElapsed();
+	}
+
+	return IVision::WillUpdateThisTick();
+}
+
+
 //------------------------------------------------------------------------------------------
 void CTFBotVision::UpdatePotentiallyVisibleNPCVector( void )
 {
@@ -19,6 +19,7 @@ public:
 	virtual ~CTFBotVision() { }
 
 	virtual void Update( void );								// update internal state
+	virtual bool WillUpdateThisTick( void ) const;				// false while MvM robots are throttled
 
 	/**
 	 * Populate "potentiallyVisible" with the set of all entities we could potentially see. 
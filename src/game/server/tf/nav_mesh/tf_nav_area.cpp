@@ -781,9 +781,7 @@ void CTFNavArea::Save( CUtlBuffer &fileBuffer, unsigned int version ) const
 {
 	CNavArea::Save( fileBuffer, version );
 
-	// save attribute flags
-	unsigned int attributes = m_attributeFlags & TF_NAV_PERSISTENT_ATTRIBUTES;
-	fileBuffer.PutUnsignedInt( attributes );
+	SaveCustomData( fileBuffer );
 }
 
 
@@ -793,6 +791,22 @@ NavErrorType CTFNavArea::Load( CUtlBuffer &fileBuffer, unsigned int version, uns
 	// load base class data
 	CNavArea::Load( fileBuffer, version, subVersion );
 
+	return LoadCustomData( fileBuffer, subVersion );
+}
+
+
+//------------------------------------------------------------------------------------------------
+void CTFNavArea::SaveCustomData( CUtlBuffer &fileBuffer ) const
+{
+	// save attribute flags
+	unsigned int attributes = m_attributeFlags & TF_NAV_PERSISTENT_ATTRIBUTES;
+	fileBuffer.PutUnsignedInt( attributes );
+}
+
+
+//------------------------------------------------------------------------------------------------
+NavErrorType CTFNavArea::LoadCustomData( CUtlBuffer &fileBuffer, unsigned int subVersion )
+{
 	if ( subVersion > TheNavMesh->GetSubVersionNumber() )
 	{
 		Warning( "Unknown NavArea sub-version number\n" );
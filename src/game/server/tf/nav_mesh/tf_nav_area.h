@@ -77,6 +77,8 @@ public:
 
 	virtual void Save( CUtlBuffer &fileBuffer, unsigned int version ) const;								// (EXTEND)
 	virtual NavErrorType Load( CUtlBuffer &fileBuffer, unsigned int version, unsigned int subVersion );		// (EXTEND)
+	virtual void SaveCustomData( CUtlBuffer &fileBuffer ) const;
+	virtual NavErrorType LoadCustomData( CUtlBuffer &fileBuffer, unsigned int subVersion );
 
 	float GetIncursionDistance( int team ) const;				// return travel distance from the team's active spawn room to this area, -1 for invalid
 	CTFNavArea *GetNextIncursionArea( int team ) const;			// return adjacent area with largest increase in incursion distance
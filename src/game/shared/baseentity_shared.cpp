@@ -441,6 +441,13 @@ bool CBaseEntity::KeyValue( const char *szKeyName, const char *szValue )
 	if ( FStrEq( szKeyName, "targetname" ) )
 	{
 		m_iName = AllocPooledString( szValue );
+		gEntList.NotifyEntityNameChanged( this );
+		return true;
+	}
+
+	if ( FStrEq( szKeyName, "classname" ) )
+	{
+		SetClassname( szValue );
 		return true;
 	}
 
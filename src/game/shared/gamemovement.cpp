@@ -623,6 +623,12 @@ CGameMovement::CGameMovement( void )
 	mv					= NULL;
 
 	memset( m_flStuckCheckTime, 0, sizeof(m_flStuckCheckTime) );
+
+	memset( m_BatchPointContents, 0, sizeof(m_BatchPointContents) );
+	m_nMovementBatch	= 0;
+	m_bInMovementBatch	= false;
+
+	ResetTraceStats();
 }
 
 //-----------------------------------------------------------------------------
@@ -1139,6 +1145,8 @@ void CGameMovement::ProcessMovement( CBasePlayer *pPlayer, CMoveData *pMove )
 
 	ResetGetPointContentsCache();
 
+	++m_TraceStats.m_nCommands;
+
 	// Cropping movement speed scales mv->m_fForwardSpeed etc. globally
 	// Once we crop, we don't want to recursively crop again, so we set the crop
 	//  flag globally here once per usercmd cycle.
@@ -2904,7 +2912,7 @@ bool CGameMovement::LadderMove( void )
 	VectorCopy( mv->GetAbsOrigin(), floor );
 	floor[2] += GetPlayerMins()[2] - 1;
 
-	if( enginetrace->GetPointContents( floor ) == CONTENTS_SOLID || player->GetGroundEntity() != NULL )
+	if( GetPointContentsUncached( floor ) == CONTENTS_SOLID || player->GetGroundEntity() != NULL )
 	{
 		onFloor = true;
 	}
@@ -3496,6 +3504,8 @@ void CGameMovement::ResetGetPointContentsCache()
 
 int CGameMovement::GetPointContentsCached( const Vector &point, int slot )
 {
+	++m_TraceStats.m_nPointContents;
+
 	if ( g_bMovementOptimizations ) 
 	{
 		Assert( player );
@@ -3505,12 +3515,12 @@ int CGameMovement::GetPointContentsCached( const Vector &point, int slot )
 		
 		if ( idx >= MAX_PLAYERS )
 		{
-			return enginetrace->GetPointContents ( point );
+			return GetPointContentsBatched( point );
 		}
 
 		if ( m_CachedGetPointContents[ idx ][ slot ] == -9999 || point.DistToSqr( m_CachedGetPointContentsPoint[ idx ][ slot ] ) > 1 )
 		{
-			m_CachedGetPointContents[ idx ][ slot ] = enginetrace->GetPointContents ( point );
+			m_CachedGetPointContents[ idx ][ slot ] = GetPointContentsBatched( point );
 			m_CachedGetPointContentsPoint[ idx ][ slot ] = point;
 		}
 		
@@ -3518,11 +3528,119 @@ int CGameMovement::GetPointContentsCached( const Vector &point, int slot )
 	}
 	else
 	{
+		++m_TraceStats.m_nPointContentsIssued;
 		return enginetrace->GetPointContents ( point );
 	}
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Point contents straight from the engine, for queries that must not
+//			be cached. Counted like the cached ones.
+//-----------------------------------------------------------------------------
+int CGameMovement::GetPointContentsUncached( const Vector &point )
+{
+	++m_TraceStats.m_nPointContents;
+	++m_TraceStats.m_nPointContentsIssued;
+
+	return enginetrace->GetPointContents( point );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Point contents through the cache shared by all players in the
+//			current movement batch. Only solid world is kept: an empty
+//			result can still change when a mover with contents (water,
+//			ladders) moves over the point later in the batch.
+//-----------------------------------------------------------------------------
+int CGameMovement::GetPointContentsBatched( const Vector &point )
+{
+	if ( !m_bInMovementBatch )
+	{
+		++m_TraceStats.m_nPointContentsIssued;
+		return enginetrace->GetPointContents( point );
+	}
+
+	int x = (int)floorf( point.x );
+	int y = (int)floorf( point.y );
+	int z = (int)floorf( point.z );
+	unsigned int hash = ( (unsigned int)x * 73856093u ) ^ ( (unsigned int)y * 19349663u ) ^ ( (unsigned int)z * 83492791u );
+
+	BatchPointContents_t &entry = m_BatchPointContents[ hash % BATCH_PC_CACHE_SIZE ];
+	if ( entry.m_nBatch == m_nMovementBatch && point.DistToSqr( entry.m_point ) <= 1 )
+	{
+		return entry.m_contents;
+	}
+
+	++m_TraceStats.m_nPointContentsIssued;
+
+	IHandleEntity *pHandleEntity = NULL;
+	int contents = enginetrace->GetPointContents( point, &pHandleEntity );
+
+	CBaseEntity *pEntity = pHandleEntity ? EntityFromEntityHandle( pHandleEntity ) : NULL;
+	if ( ( contents & CONTENTS_SOLID ) && ( pHandleEntity == NULL || ( pEntity && pEntity->IsWorld() ) ) )
+	{
+		entry.m_point = point;
+		entry.m_contents = contents;
+		entry.m_nBatch = m_nMovementBatch;
+	}
+
+	return contents;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Start sharing static world queries between the players moved until
+//			EndMovementBatch(). Nothing is carried over from earlier batches.
+//-----------------------------------------------------------------------------
+void CGameMovement::BeginMovementBatch( void )
+{
+	Assert( !m_bInMovementBatch );
+
+	++m_nMovementBatch;
+	if ( m_nMovementBatch == 0 )
+	{
+		// wrapped around, stale entries could look current again
+		memset( m_BatchPointContents, 0, sizeof(m_BatchPointContents) );
+		m_nMovementBatch = 1;
+	}
+
+	m_bInMovementBatch = true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+void CGameMovement::EndMovementBatch( void )
+{
+	m_bInMovementBatch = false;
+}
+
+
+#ifdef GAME_DLL
+extern IGameMovement *g_pGameMovement;
+
+CON_COMMAND_F( sv_movement_trace_stats, "Show the world queries made by player movement per usercmd since the last call, then reset the counts.", FCVAR_CHEAT )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	CGameMovement *pGameMovement = static_cast< CGameMovement * >( g_pGameMovement );
+	const CGameMovement::TraceStats_t &stats = pGameMovement->GetTraceStats();
+
+	float flCommands = MAX( stats.m_nCommands, 1 );
+
+	Msg( "%d usercmds\n", stats.m_nCommands );
+	Msg( "  hull traces:    %8d  (%.2f per usercmd)\n", stats.m_nHullTraces, stats.m_nHullTraces / flCommands );
+	Msg( "  ground traces:  %8d  (%.2f per usercmd)\n", stats.m_nGroundTraces, stats.m_nGroundTraces / flCommands );
+	Msg( "  point contents: %8d  (%.2f per usercmd), %d reached the engine\n", stats.m_nPointContents, stats.m_nPointContents / flCommands, stats.m_nPointContentsIssued );
+
+	pGameMovement->ResetTraceStats();
+}
+#endif // GAME_DLL
+
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : &input - 
@@ -3655,9 +3773,9 @@ void CGameMovement::SetGroundEntity( trace_t *pm )
 // can be stood upon (normal's z >= 0.7f).  Regardless of success or failure,
 // replace the fraction and endpos with the original ones, so we don't try to
 // move the player down to the new floor and get stuck on a leaning wall that
-// the original trace hit first.
+// the original trace hit first. Returns the number of traces made.
 //-----------------------------------------------------------------------------
-void TracePlayerBBoxForGround( const Vector& start, const Vector& end, const Vector& minsSrc,
+int TracePlayerBBoxForGround( const Vector& start, const Vector& end, const Vector& minsSrc,
 							  const Vector& maxsSrc, IHandleEntity *player, unsigned int fMask,
 							  int collisionGroup, trace_t& pm )
 {
@@ -3678,7 +3796,7 @@ void TracePlayerBBoxForGround( const Vector& start, const Vector& end, const Vec
 	{
 		pm.fraction = fraction;
 		pm.endpos = endpos;
-		return;
+		return 1;
 	}
 
 	// Check the +x, +y quadrant
@@ -3690,7 +3808,7 @@ void TracePlayerBBoxForGround( const Vector& start, const Vector& end, const Vec
 	{
 		pm.fraction = fraction;
 		pm.endpos = endpos;
-		return;
+		return 2;
 	}
 
 	// Check the -x, +y quadrant
@@ -3702,7 +3820,7 @@ void TracePlayerBBoxForGround( const Vector& start, const Vector& end, const Vec
 	{
 		pm.fraction = fraction;
 		pm.endpos = endpos;
-		return;
+		return 3;
 	}
 
 	// Check the +x, -y quadrant
@@ -3714,11 +3832,12 @@ void TracePlayerBBoxForGround( const Vector& start, const Vector& end, const Vec
 	{
 		pm.fraction = fraction;
 		pm.endpos = endpos;
-		return;
+		return 4;
 	}
 
 	pm.fraction = fraction;
 	pm.endpos = endpos;
+	return 4;
 }
 
 //-----------------------------------------------------------------------------
@@ -4921,6 +5040,8 @@ void CGameMovement::TracePlayerBBox( const Vector& start, const Vector& end, uns
 {
 	VPROF( "CGameMovement::TracePlayerBBox" );
 
+	++m_TraceStats.m_nHullTraces;
+
 	Ray_t ray;
 	ray.Init( start, end, GetPlayerMins(), GetPlayerMaxs() );
 	UTIL_TraceRay( ray, fMask, mv->m_nPlayerHandle.Get(), collisionGroup, &pm );
@@ -4936,6 +5057,8 @@ void  CGameMovement::TryTouchGround( const Vector& start, const Vector& end, con
 {
 	VPROF( "CGameMovement::TryTouchGround" );
 
+	++m_TraceStats.m_nGroundTraces;
+
 	Ray_t ray;
 	ray.Init( start, end, mins, maxs );
 	UTIL_TraceRay( ray, fMask, mv->m_nPlayerHandle.Get(), collisionGroup, &pm );
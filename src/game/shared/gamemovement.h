@@ -53,6 +53,21 @@ public:
 	virtual Vector	GetPlayerMaxs( bool ducked ) const;
 	virtual Vector	GetPlayerViewOffset( bool ducked ) const;
 
+	virtual void	BeginMovementBatch( void );
+	virtual void	EndMovementBatch( void );
+
+	// Totals of world queries made by movement, to see what each usercmd costs
+	struct TraceStats_t
+	{
+		int m_nCommands;
+		int m_nHullTraces;					// TracePlayerBBox()
+		int m_nGroundTraces;				// TryTouchGround(), TracePlayerBBoxForGround()
+		int m_nPointContents;				// GetPointContentsCached() and GetPointContentsUncached() calls
+		int m_nPointContentsIssued;			// of those, the ones that reached the engine
+	};
+	const TraceStats_t &GetTraceStats( void ) const		{ return m_TraceStats; }
+	void			ResetTraceStats( void )				{ memset( &m_TraceStats, 0, sizeof( m_TraceStats ) ); }
+
 // For sanity checking getting stuck on CMoveData::SetAbsOrigin
 	virtual void	TracePlayerBBox( const Vector& start, const Vector& end, unsigned int fMask, int collisionGroup, trace_t& pm );
 	
@@ -214,6 +229,7 @@ protected:
 
 	void ResetGetPointContentsCache();
 	int GetPointContentsCached( const Vector &point, int slot );
+	int GetPointContentsUncached( const Vector &point );
 
 	// Ducking
 	virtual void	Duck( void );
@@ -273,6 +289,27 @@ protected:
 	int m_CachedGetPointContents[ MAX_PLAYERS_ARRAY_SAFE ][ MAX_PC_CACHE_SLOTS ];
 	Vector m_CachedGetPointContentsPoint[ MAX_PLAYERS_ARRAY_SAFE ][ MAX_PC_CACHE_SLOTS ];	
 
+	// Point contents shared by every player while a movement batch is open. Direct mapped on
+	// the point rounded to whole units, entries from older batches are ignored.
+	enum
+	{
+		BATCH_PC_CACHE_SIZE = 512,
+	};
+
+	struct BatchPointContents_t
+	{
+		Vector m_point;
+		int m_contents;
+		unsigned int m_nBatch;
+	};
+	BatchPointContents_t m_BatchPointContents[ BATCH_PC_CACHE_SIZE ];
+	unsigned int	m_nMovementBatch;		// serial of the current batch
+	bool			m_bInMovementBatch;
+
+	int				GetPointContentsBatched( const Vector &point );
+
+	TraceStats_t	m_TraceStats;
+
 	Vector			m_vecProximityMins;		// Used to be globals in sv_user.cpp.
 	Vector			m_vecProximityMaxs;
 
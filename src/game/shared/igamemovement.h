@@ -124,6 +124,11 @@ public:
 	virtual Vector	GetPlayerMaxs( bool ducked ) const = 0;
 	virtual Vector  GetPlayerViewOffset( bool ducked ) const = 0;
 
+	// Bracket a pass that runs many players' commands in the same tick, so work that
+	// only depends on the static world can be shared between them
+	virtual void	BeginMovementBatch( void ) = 0;
+	virtual void	EndMovementBatch( void ) = 0;
+
 };
 
 
@@ -226,8 +226,31 @@ void FX_FireBullets( CTFWeaponBase *pWpn, int iPlayer, const Vector &vecOrigin,
 	StartGroupingSounds();
 
 #if !defined (CLIENT_DLL)
-	// Move other players back to history positions based on local player's lag
-	lagcompensation->StartLagCompensation( pPlayer, pPlayer->GetCurrentCommand() );
+	// Move other players back to history positions based on local player's lag. Only the ones
+	// the bullets can reach need to move, unless an explosive headshot will hit players around the victim.
+	int iExplosiveShot = 0;
+	CALL_ATTRIB_HOOK_INT_ON_OTHER( pPlayer, iExplosiveShot, explosive_sniper_shot );
+	if ( iExplosiveShot )
+	{
+		lagcompensation->StartLagCompensation( pPlayer, pPlayer->GetCurrentCommand() );
+	}
+	else
+	{
+		// Each axis of the spread below is at most twice the variance (fixed patterns stay within 1.07),
+		// so a pellet lands at most sqrt(2) times that off the aim, per unit of spread
+		float flMaxVariance = 0.5f;
+		if ( pWpn )
+		{
+			float flFirstShotVariance = 0.f;
+			CALL_ATTRIB_HOOK_FLOAT_ON_OTHER( pWpn, flFirstShotVariance, mult_spread_scale_first_shot );
+			flMaxVariance = Max( flMaxVariance, flFirstShotVariance );
+		}
+
+		Vector vecShotDir;
+		AngleVectors( vecAngles, &vecShotDir );
+		float flShotSpread = flSpread * Max( 1.07f, 2.f * flMaxVariance ) * 1.415f;
+		lagcompensation->StartLagCompensationForShot( pPlayer, pPlayer->GetCurrentCommand(), vecOrigin, vecShotDir, flShotSpread );
+	}
 	
 	// PASSTIME custom lag compensation for the ball; see also tf_weapon_flamethrower.cpp
 	// it would be better if all entities could opt-in to this, or a way for lagcompensation to handle non-players automatically
@@ -297,6 +297,8 @@ void CTFGameMovement::ProcessMovement( CBasePlayer *pBasePlayer, CMoveData *pMov
 	// Reset point contents for water check.
 	ResetGetPointContentsCache();
 
+	++m_TraceStats.m_nCommands;
+
 	// Cropping movement speed scales mv->m_fForwardSpeed etc. globally
 	// Once we crop, we don't want to recursively crop again, so we set the crop
 	// flag globally here once per usercmd cycle.
@@ -1687,7 +1689,7 @@ void CTFGameMovement::WaterMove( void )
 			Vector vecNewWaterPoint;
 			VectorCopy( m_vecWaterPoint, vecNewWaterPoint );
 			vecNewWaterPoint.z += ( dest.z - mv->GetAbsOrigin().z );
-			bool bOutOfWater = !( enginetrace->GetPointContents( vecNewWaterPoint ) & MASK_WATER );
+			bool bOutOfWater = !( GetPointContentsUncached( vecNewWaterPoint ) & MASK_WATER );
 			if ( bOutOfWater && ( mv->m_vecVelocity.z > 0.0f ) && ( pm.fraction == 1.0f )  )
 			{
 				// Check the waist level water positions.
@@ -2197,7 +2199,7 @@ void CTFGameMovement::AirMove( void )
 	VectorSubtract( mv->m_vecVelocity, player->GetBaseVelocity(), mv->m_vecVelocity );
 }
 
-extern void TracePlayerBBoxForGround( const Vector& start, const Vector& end, const Vector& minsSrc,
+extern int TracePlayerBBoxForGround( const Vector& start, const Vector& end, const Vector& minsSrc,
 							  const Vector& maxsSrc, IHandleEntity *player, unsigned int fMask,
 							  int collisionGroup, trace_t& pm );
 
@@ -2319,6 +2321,8 @@ void CTFGameMovement::TracePlayerBBox( const Vector& start, const Vector& end, u
 	if( tf_solidobjects.GetBool() == false )
 		return BaseClass::TracePlayerBBox( start, end, fMask, collisionGroup, pm );
 
+	++m_TraceStats.m_nHullTraces;
+
 	Ray_t ray;
 	ray.Init( start, end, GetPlayerMins(), GetPlayerMaxs() );
 	
@@ -2421,7 +2425,7 @@ void CTFGameMovement::CategorizePosition( void )
 	if ( !bInAir && trace.plane.normal.z < 0.7f )
 	{
 		// Test four sub-boxes, to see if any of them would have found shallower slope we could actually stand on.
-		TracePlayerBBoxForGround( vecStartPos, vecEndPos, GetPlayerMins(), GetPlayerMaxs(), mv->m_nPlayerHandle.Get(), PlayerSolidMask(), COLLISION_GROUP_PLAYER_MOVEMENT, trace );
+		m_TraceStats.m_nGroundTraces += TracePlayerBBoxForGround( vecStartPos, vecEndPos, GetPlayerMins(), GetPlayerMaxs(), mv->m_nPlayerHandle.Get(), PlayerSolidMask(), COLLISION_GROUP_PLAYER_MOVEMENT, trace );
 
 		if ( trace.plane.normal[2] < 0.7f )
 		{
@@ -41,6 +41,18 @@ public:
 
 };
 
+// 8 rays traced as one packet. Kept as two SSE halves so the kd-tree traversal cost is
+// shared by all 8 rays while the triangle tests stay 4-wide.
+class EightRays
+{
+public:
+	FourRays m_Rays[2];
+
+	// returns direction sign mask for all 8 rays, or -1 if the two halves can not be traced
+	// as a bundle.
+	int CalculateDirectionSignMask(void) const;
+};
+
 /// The format a triangle is stored in for intersections. size of this structure is important.
 /// This structure can be in one of two forms. Before the ray tracing environment is set up, the
 /// ProjectedEdgeEquations hold the coordinates of the 3 vertices, for facilitating bounding box
@@ -192,6 +204,45 @@ protected:
 
 };
 
+// Node of the optional bounding volume hierarchy (RTE_FLAGS_USE_BVH), packed into 32 bytes
+// so two nodes share a cache line:
+//
+// A) the left child is always stored directly after its parent, so only the right child index
+//    is stored.
+// B) the low 2 bits of m_nTypeAndCount hold the split axis, or KDNODE_STATE_LEAF for leaves, in
+//    which case the upper bits hold the number of triangles in the leaf.
+struct CacheOptimizedBVHNode
+{
+	float m_flMins[3];
+	int32 m_nRightChildOrFirstTri;							// right child idx, or start in
+															// TriangleIndexList for leaves
+	float m_flMaxs[3];
+	int32 m_nTypeAndCount;
+
+	inline int NodeType(void) const
+	{
+		return m_nTypeAndCount & 3;
+	}
+
+	inline int32 TriangleIndexStart(void) const
+	{
+		assert(NodeType()==KDNODE_STATE_LEAF);
+		return m_nRightChildOrFirstTri;
+	}
+
+	inline int NumberOfTrianglesInLeaf(void) const
+	{
+		assert(NodeType()==KDNODE_STATE_LEAF);
+		return m_nTypeAndCount >> 2;
+	}
+
+	inline int RightChild(void) const
+	{
+		assert(NodeType()!=KDNODE_STATE_LEAF);
+		return m_nRightChildOrFirstTri;
+	}
+};
+
 
 struct RayTracingSingleResult
 {
@@ -208,6 +259,11 @@ struct RayTracingResult
 	fltx4 HitDistance;										// distance to intersection
 };
 
+struct RayTracingResult8
+{
+	RayTracingResult m_Results[2];							// one per EightRays half
+};
+
 
 class RayTraceLight
 {
@@ -220,6 +276,7 @@ public:
 #define RTE_FLAGS_FAST_TREE_GENERATION 1
 #define RTE_FLAGS_DONT_STORE_TRIANGLE_COLORS 2				// saves memory if not needed
 #define RTE_FLAGS_DONT_STORE_TRIANGLE_MATERIALS 4
+#define RTE_FLAGS_USE_BVH 8									// build a SAH bvh instead of the kd-tree
 
 enum RayTraceLightingMode_t {
 	DIRECT_LIGHTING,										// just dot product lighting
@@ -262,6 +319,7 @@ public:
 
 	FourVectors BackgroundColor;							//< color where no intersection
 	CUtlVector<CacheOptimizedKDNode> OptimizedKDTree;		//< the packed kdtree. root is 0
+	CUtlVector<CacheOptimizedBVHNode> OptimizedBVH;			//< the packed bvh, if RTE_FLAGS_USE_BVH. root is 0
 	CUtlBlockVector<CacheOptimizedTriangle> OptimizedTriangleList; //< the packed triangles
 	CUtlVector<int32> TriangleIndexList;					//< the list of triangle indices.
 	CUtlVector<LightDesc_t> LightList;						//< the list of lights
@@ -310,6 +368,18 @@ public:
 					RayTracingResult *rslt_out,
 					int32 skip_id=-1, ITransparentTriangleCallback *pCallback = NULL);
 
+	// trace 8 rays at once, sharing the tree traversal. All 8 rays must be in the same direction
+	// octant (see EightRays::CalculateDirectionSignMask). ppCallbacks, if non-NULL, holds one
+	// callback per half.
+	void Trace8Rays(const EightRays &rays, const fltx4 TMin[2], const fltx4 TMax[2], int DirectionSignMask,
+					RayTracingResult8 *rslt_out,
+					int32 skip_id=-1, ITransparentTriangleCallback **ppCallbacks = NULL);
+
+	// higher level version which falls back to Trace4Rays per half when the packet isn't coherent
+	void Trace8Rays(const EightRays &rays, const fltx4 TMin[2], const fltx4 TMax[2],
+					RayTracingResult8 *rslt_out,
+					int32 skip_id=-1, ITransparentTriangleCallback **ppCallbacks = NULL);
+
 	// compute virtual light sources to model inter-reflection
 	void ComputeVirtualLightSources(void);
 
@@ -356,6 +426,15 @@ public:
 	void CalculateTriangleListBounds(int32 const *tris,int ntris,
 									 Vector &minout, Vector &maxout);
 
+	// builds OptimizedBVH instead of the kd-tree. Called by SetupAccelerationStructure when
+	// RTE_FLAGS_USE_BVH is set.
+	void BuildBVH(void);
+
+	// Trace4Rays against OptimizedBVH
+	void Trace4RaysBVH(const FourRays &rays, fltx4 TMin, fltx4 TMax, int DirectionSignMask,
+					   RayTracingResult *rslt_out,
+					   int32 skip_id, ITransparentTriangleCallback *pCallback);
+
 	void AddInfinitePointLight(Vector position,				// light center
 							   Vector intensity);			// rgb amount
 
@@ -0,0 +1,458 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Surface area heuristic bounding volume hierarchy, built as an alternative to
+// the kd-tree when RTE_FLAGS_USE_BVH is set. The build partitions triangles instead of
+// space, so maps with lots of small overlapping static prop triangles don't blow up the
+// tree size or the build time.
+//
+//=============================================================================//
+
+#include "raytrace.h"
+#include "tier0/threadtools.h"
+
+// Triangles whose bounding box has a much larger surface area than the average get split
+// into several references with tighter boxes before the build ("early split clipping").
+// Long thin diagonal triangles would otherwise make every node they land in huge.
+#define BVH_SPLIT_AREA_RATIO		16.0f
+#define BVH_MAX_TRIANGLE_SPLITS		3						// at most 2^3 references per triangle
+
+#define BVH_NUM_BINS				16
+#define BVH_MAX_LEAF_TRIS			8
+#define BVH_MAX_DEPTH				60						// Trace4RaysBVH's stack must hold this
+
+#define BVH_COST_OF_TRAVERSAL		75						// same scale as the kd-tree costs
+#define BVH_COST_OF_INTERSECTION	167
+
+#define BVH_MAX_BUILD_THREADS		32
+#define BVH_MIN_TASK_REFS			4096					// don't bother threading tiny subtrees
+
+
+struct BVHBuildRef_t
+{
+	Vector m_vMins;
+	Vector m_vMaxs;
+	int32 m_nTriangle;
+};
+
+struct BVHBuildNode_t
+{
+	Vector m_vMins;
+	Vector m_vMaxs;
+	int m_nLeft;											// child nodes, -1 for leaves
+	int m_nRight;
+	int m_nFirstRef;										// leaf references
+	int m_nRefCount;
+	int m_nAxis;
+	int m_nSubtree;											// >= 0 if built by a subtree task
+};
+
+struct BVHSubtreeTask_t
+{
+	int m_nFirstRef;
+	int m_nRefCount;
+	int m_nDepth;
+	CUtlVector<BVHBuildNode_t> m_Nodes;
+};
+
+
+static float BoundsSurfaceArea( const Vector &vMins, const Vector &vMaxs )
+{
+	Vector vDim = vMaxs - vMins;
+	return 2.0f * ( vDim.x * vDim.y + vDim.x * vDim.z + vDim.y * vDim.z );
+}
+
+static void AddBoundsToBounds( const Vector &vOtherMins, const Vector &vOtherMaxs, Vector &vMins, Vector &vMaxs )
+{
+	AddPointToBounds( vOtherMins, vMins, vMaxs );
+	AddPointToBounds( vOtherMaxs, vMins, vMaxs );
+}
+
+
+//-----------------------------------------------------------------------------
+// Keeps the part of a convex polygon on one side of an axial plane
+//-----------------------------------------------------------------------------
+#define MAX_CLIP_VERTS 16
+
+static int ClipPolygonToAxialPlane( const Vector *pIn, int nIn, int nAxis, float flValue, bool bKeepAbove, Vector *pOut )
+{
+	int nOut = 0;
+	for ( int i = 0; i < nIn; i++ )
+	{
+		const Vector &a = pIn[i];
+		const Vector &b = pIn[ ( i + 1 ) % nIn ];
+		float da = bKeepAbove ? a[nAxis] - flValue : flValue - a[nAxis];
+		float db = bKeepAbove ? b[nAxis] - flValue : flValue - b[nAxis];
+
+		if ( da >= 0 && nOut < MAX_CLIP_VERTS )
+			pOut[nOut++] = a;
+
+		if ( ( ( da > 0 ) && ( db < 0 ) ) || ( ( da < 0 ) && ( db > 0 ) ) )
+		{
+			if ( nOut < MAX_CLIP_VERTS )
+			{
+				Vector vSplit = a + ( b - a ) * ( da / ( da - db ) );
+				vSplit[nAxis] = flValue;
+				pOut[nOut++] = vSplit;
+			}
+		}
+	}
+	return nOut;
+}
+
+
+class CBVHBuilder
+{
+public:
+	CBVHBuilder( RayTracingEnvironment *pEnv ) : m_pEnv( pEnv ), m_nNextTask( 0 ) {}
+	~CBVHBuilder()
+	{
+		m_Tasks.PurgeAndDeleteElements();
+	}
+
+	void Build( void );
+
+private:
+	void AddTriangleRefs( int32 nTriangle, float flSplitArea );
+	void SplitRef( const Vector *pPoly, int nVerts, int32 nTriangle, float flSplitArea, int nDepth );
+
+	int BuildNode( CUtlVector<BVHBuildNode_t> &nodes, int nFirst, int nCount, int nDepth, bool bSpawnTasks );
+	int MakeLeaf( CUtlVector<BVHBuildNode_t> &nodes, int nNode );
+	void Emit( const CUtlVector<BVHBuildNode_t> &nodes, int nNode );
+
+	void RunTasks( void );
+	static uintp TaskThreadFn( void *pParam );
+
+	RayTracingEnvironment *m_pEnv;
+	CUtlVector<BVHBuildRef_t> m_Refs;
+	CUtlVector<BVHSubtreeTask_t *> m_Tasks;
+	int m_nTaskSize;
+	int32 volatile m_nNextTask;
+};
+
+
+void CBVHBuilder::SplitRef( const Vector *pPoly, int nVerts, int32 nTriangle, float flSplitArea, int nDepth )
+{
+	Vector vMins, vMaxs;
+	ClearBounds( vMins, vMaxs );
+	for ( int i = 0; i < nVerts; i++ )
+		AddPointToBounds( pPoly[i], vMins, vMaxs );
+
+	if ( ( nDepth < BVH_MAX_TRIANGLE_SPLITS ) && ( BoundsSurfaceArea( vMins, vMaxs ) > flSplitArea ) )
+	{
+		Vector vDim = vMaxs - vMins;
+		int nAxis = ( vDim.x > vDim.y ) ? ( ( vDim.x > vDim.z ) ? 0 : 2 ) : ( ( vDim.y > vDim.z ) ? 1 : 2 );
+		float flMid = 0.5f * ( vMins[nAxis] + vMaxs[nAxis] );
+
+		Vector below[MAX_CLIP_VERTS], above[MAX_CLIP_VERTS];
+		int nBelow = ClipPolygonToAxialPlane( pPoly, nVerts, nAxis, flMid, false, below );
+		int nAbove = ClipPolygonToAxialPlane( pPoly, nVerts, nAxis, flMid, true, above );
+		if ( ( nBelow >= 3 ) && ( nAbove >= 3 ) )
+		{
+			SplitRef( below, nBelow, nTriangle, flSplitArea, nDepth + 1 );
+			SplitRef( above, nAbove, nTriangle, flSplitArea, nDepth + 1 );
+			return;
+		}
+	}
+
+	BVHBuildRef_t &ref = m_Refs[ m_Refs.AddToTail() ];
+	ref.m_vMins = vMins;
+	ref.m_vMaxs = vMaxs;
+	ref.m_nTriangle = nTriangle;
+}
+
+
+void CBVHBuilder::AddTriangleRefs( int32 nTriangle, float flSplitArea )
+{
+	CacheOptimizedTriangle const &tri = m_pEnv->OptimizedTriangleList[nTriangle];
+	Vector verts[3] = { tri.Vertex( 0 ), tri.Vertex( 1 ), tri.Vertex( 2 ) };
+	SplitRef( verts, 3, nTriangle, flSplitArea, 0 );
+}
+
+
+int CBVHBuilder::MakeLeaf( CUtlVector<BVHBuildNode_t> &nodes, int nNode )
+{
+	nodes[nNode].m_nLeft = -1;
+	nodes[nNode].m_nRight = -1;
+	nodes[nNode].m_nAxis = KDNODE_STATE_LEAF;
+	return nNode;
+}
+
+
+int CBVHBuilder::BuildNode( CUtlVector<BVHBuildNode_t> &nodes, int nFirst, int nCount, int nDepth, bool bSpawnTasks )
+{
+	BVHBuildRef_t *pRefs = m_Refs.Base() + nFirst;
+
+	int nNode = nodes.AddToTail();
+	nodes[nNode].m_nFirstRef = nFirst;
+	nodes[nNode].m_nRefCount = nCount;
+	nodes[nNode].m_nSubtree = -1;
+
+	if ( bSpawnTasks && ( nCount <= m_nTaskSize ) )
+	{
+		// hand this subtree off to the worker threads
+		BVHSubtreeTask_t *pTask = new BVHSubtreeTask_t;
+		pTask->m_nFirstRef = nFirst;
+		pTask->m_nRefCount = nCount;
+		pTask->m_nDepth = nDepth;
+		nodes[nNode].m_nSubtree = m_Tasks.AddToTail( pTask );
+		return nNode;
+	}
+
+	Vector vMins, vMaxs, vCentroidMins, vCentroidMaxs;
+	ClearBounds( vMins, vMaxs );
+	ClearBounds( vCentroidMins, vCentroidMaxs );
+	for ( int i = 0; i < nCount; i++ )
+	{
+		AddBoundsToBounds( pRefs[i].m_vMins, pRefs[i].m_vMaxs, vMins, vMaxs );
+		AddPointToBounds( 0.5f * ( pRefs[i].m_vMins + pRefs[i].m_vMaxs ), vCentroidMins, vCentroidMaxs );
+	}
+	nodes[nNode].m_vMins = vMins;
+	nodes[nNode].m_vMaxs = vMaxs;
+
+	if ( ( nCount <= 2 ) || ( nDepth >= BVH_MAX_DEPTH ) )
+		return MakeLeaf( nodes, nNode );
+
+	// binned SAH: drop the reference centroids into buckets along each axis, and evaluate the
+	// cost of splitting between every pair of neighboring buckets.
+	float flInvParentArea = 1.0f / max( BoundsSurfaceArea( vMins, vMaxs ), 1.0e-6f );
+	float flBestCost = 1.0e23;
+	int nBestAxis = -1;
+	int nBestBin = 0;
+	for ( int nAxis = 0; nAxis < 3; nAxis++ )
+	{
+		float flExtent = vCentroidMaxs[nAxis] - vCentroidMins[nAxis];
+		if ( flExtent <= 0 )
+			continue;
+		float flBinScale = BVH_NUM_BINS * 0.9999f / flExtent;
+
+		int nBinCount[BVH_NUM_BINS];
+		Vector vBinMins[BVH_NUM_BINS], vBinMaxs[BVH_NUM_BINS];
+		for ( int b = 0; b < BVH_NUM_BINS; b++ )
+		{
+			nBinCount[b] = 0;
+			ClearBounds( vBinMins[b], vBinMaxs[b] );
+		}
+		for ( int i = 0; i < nCount; i++ )
+		{
+			float flCentroid = 0.5f * ( pRefs[i].m_vMins[nAxis] + pRefs[i].m_vMaxs[nAxis] );
+			int b = (int)( ( flCentroid - vCentroidMins[nAxis] ) * flBinScale );
+			nBinCount[b]++;
+			AddBoundsToBounds( pRefs[i].m_vMins, pRefs[i].m_vMaxs, vBinMins[b], vBinMaxs[b] );
+		}
+
+		// sweep from the right to get the area of everything above each split
+		float flRightArea[BVH_NUM_BINS];
+		int nRightCount[BVH_NUM_BINS];
+		Vector vSweepMins, vSweepMaxs;
+		ClearBounds( vSweepMins, vSweepMaxs );
+		int nSweepCount = 0;
+		for ( int b = BVH_NUM_BINS - 1; b > 0; b-- )
+		{
+			AddBoundsToBounds( vBinMins[b], vBinMaxs[b], vSweepMins, vSweepMaxs );
+			nSweepCount += nBinCount[b];
+			flRightArea[b] = nSweepCount ? BoundsSurfaceArea( vSweepMins, vSweepMaxs ) : 0.0f;
+			nRightCount[b] = nSweepCount;
+		}
+
+		ClearBounds( vSweepMins, vSweepMaxs );
+		nSweepCount = 0;
+		for ( int b = 0; b < BVH_NUM_BINS - 1; b++ )
+		{
+			AddBoundsToBounds( vBinMins[b], vBinMaxs[b], vSweepMins, vSweepMaxs );
+			nSweepCount += nBinCount[b];
+			if ( !nSweepCount || !nRightCount[b+1] )
+				continue;
+
+			float flCost = BVH_COST_OF_TRAVERSAL + BVH_COST_OF_INTERSECTION * flInvParentArea *
+				( BoundsSurfaceArea( vSweepMins, vSweepMaxs ) * nSweepCount + flRightArea[b+1] * nRightCount[b+1] );
+			if ( flCost < flBestCost )
+			{
+				flBestCost = flCost;
+				nBestAxis = nAxis;
+				nBestBin = b;
+			}
+		}
+	}
+
+	float flLeafCost = (float)BVH_COST_OF_INTERSECTION * nCount;
+	if ( ( nBestAxis == -1 ) || ( ( flBestCost >= flLeafCost ) && ( nCount <= BVH_MAX_LEAF_TRIS ) ) )
+	{
+		// all centroids coincide, or splitting doesn't pay off
+		return MakeLeaf( nodes, nNode );
+	}
+
+	// partition the references in place around the chosen bucket boundary
+	float flBinScale = BVH_NUM_BINS * 0.9999f / ( vCentroidMaxs[nBestAxis] - vCentroidMins[nBestAxis] );
+	int nLeft = 0;
+	int nRight = nCount - 1;
+	while ( nLeft <= nRight )
+	{
+		float flCentroid = 0.5f * ( pRefs[nLeft].m_vMins[nBestAxis] + pRefs[nLeft].m_vMaxs[nBestAxis] );
+		int b = (int)( ( flCentroid - vCentroidMins[nBestAxis] ) * flBinScale );
+		if ( b <= nBestBin )
+		{
+			nLeft++;
+		}
+		else
+		{
+			V_swap( pRefs[nLeft], pRefs[nRight] );
+			nRight--;
+		}
+	}
+	Assert( ( nLeft > 0 ) && ( nLeft < nCount ) );
+
+	nodes[nNode].m_nAxis = nBestAxis;
+	int nLeftChild = BuildNode( nodes, nFirst, nLeft, nDepth + 1, bSpawnTasks );
+	int nRightChild = BuildNode( nodes, nFirst + nLeft, nCount - nLeft, nDepth + 1, bSpawnTasks );
+	nodes[nNode].m_nLeft = nLeftChild;
+	nodes[nNode].m_nRight = nRightChild;
+	return nNode;
+}
+
+
+uintp CBVHBuilder::TaskThreadFn( void *pParam )
+{
+	CBVHBuilder *pBuilder = (CBVHBuilder *)pParam;
+	while ( 1 )
+	{
+		int nTask = ThreadInterlockedIncrement( &pBuilder->m_nNextTask ) - 1;
+		if ( nTask >= pBuilder->m_Tasks.Count() )
+			break;
+
+		BVHSubtreeTask_t *pTask = pBuilder->m_Tasks[nTask];
+		pBuilder->BuildNode( pTask->m_Nodes, pTask->m_nFirstRef, pTask->m_nRefCount, pTask->m_nDepth, false );
+	}
+	return 0;
+}
+
+
+void CBVHBuilder::RunTasks( void )
+{
+	int nThreads = min( (int)GetCPUInformation()->m_nLogicalProcessors, BVH_MAX_BUILD_THREADS );
+	nThreads = min( nThreads, m_Tasks.Count() );
+
+	m_nNextTask = 0;
+	if ( nThreads <= 1 )
+	{
+		TaskThreadFn( this );
+		return;
+	}
+
+	ThreadHandle_t hThreads[BVH_MAX_BUILD_THREADS];
+	for ( int i = 0; i < nThreads; i++ )
+		hThreads[i] = CreateSimpleThread( TaskThreadFn, this );
+	for ( int i = 0; i < nThreads; i++ )
+	{
+		ThreadJoin( hThreads[i] );
+		ReleaseThreadHandle( hThreads[i] );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Writes the build tree out depth first, so every left child directly follows its parent
+//-----------------------------------------------------------------------------
+void CBVHBuilder::Emit( const CUtlVector<BVHBuildNode_t> &nodes, int nNode )
+{
+	const BVHBuildNode_t &node = nodes[nNode];
+	if ( node.m_nSubtree >= 0 )
+	{
+		Emit( m_Tasks[node.m_nSubtree]->m_Nodes, 0 );
+		return;
+	}
+
+	CUtlVector<CacheOptimizedBVHNode> &bvh = m_pEnv->OptimizedBVH;
+	int nOut = bvh.AddToTail();
+	for ( int c = 0; c < 3; c++ )
+	{
+		bvh[nOut].m_flMins[c] = node.m_vMins[c];
+		bvh[nOut].m_flMaxs[c] = node.m_vMaxs[c];
+	}
+
+	if ( node.m_nLeft == -1 )
+	{
+		// a split triangle may have several references landing in the same leaf
+		CUtlVector<int32> &triList = m_pEnv->TriangleIndexList;
+		int nStart = triList.Count();
+		for ( int i = 0; i < node.m_nRefCount; i++ )
+		{
+			int32 nTriangle = m_Refs[node.m_nFirstRef + i].m_nTriangle;
+			int j;
+			for ( j = nStart; j < triList.Count(); j++ )
+			{
+				if ( triList[j] == nTriangle )
+					break;
+			}
+			if ( j == triList.Count() )
+				triList.AddToTail( nTriangle );
+		}
+
+		bvh[nOut].m_nRightChildOrFirstTri = nStart;
+		bvh[nOut].m_nTypeAndCount = ( ( triList.Count() - nStart ) << 2 ) | KDNODE_STATE_LEAF;
+		return;
+	}
+
+	Emit( nodes, node.m_nLeft );
+	bvh[nOut].m_nRightChildOrFirstTri = bvh.Count();
+	bvh[nOut].m_nTypeAndCount = node.m_nAxis;
+	Emit( nodes, node.m_nRight );
+}
+
+
+void CBVHBuilder::Build( void )
+{
+	int nTriangles = m_pEnv->OptimizedTriangleList.Count();
+
+	float flTotalArea = 0;
+	for ( int i = 0; i < nTriangles; i++ )
+	{
+		CacheOptimizedTriangle const &tri = m_pEnv->OptimizedTriangleList[i];
+		Vector vMins, vMaxs;
+		ClearBounds( vMins, vMaxs );
+		for ( int v = 0; v < 3; v++ )
+			AddPointToBounds( tri.Vertex( v ), vMins, vMaxs );
+		flTotalArea += BoundsSurfaceArea( vMins, vMaxs );
+	}
+	float flSplitArea = nTriangles ? BVH_SPLIT_AREA_RATIO * flTotalArea / nTriangles : 0.0f;
+
+	m_Refs.EnsureCapacity( nTriangles + nTriangles / 4 );
+	for ( int i = 0; i < nTriangles; i++ )
+		AddTriangleRefs( i, flSplitArea );
+
+	CUtlVector<BVHBuildNode_t> topNodes;
+	if ( !m_Refs.Count() )
+	{
+		// empty scene. make a single empty leaf
+		int nNode = topNodes.AddToTail();
+		ClearBounds( topNodes[nNode].m_vMins, topNodes[nNode].m_vMaxs );
+		topNodes[nNode].m_nFirstRef = 0;
+		topNodes[nNode].m_nRefCount = 0;
+		topNodes[nNode].m_nSubtree = -1;
+		MakeLeaf( topNodes, nNode );
+	}
+	else
+	{
+		// split the top of the tree serially until there are enough independent subtrees to
+		// keep every thread busy, then build those in parallel.
+		int nThreads = min( (int)GetCPUInformation()->m_nLogicalProcessors, BVH_MAX_BUILD_THREADS );
+		m_nTaskSize = max( m_Refs.Count() / ( 4 * max( nThreads, 1 ) ), BVH_MIN_TASK_REFS );
+		BuildNode( topNodes, 0, m_Refs.Count(), 0, true );
+		RunTasks();
+	}
+
+	m_pEnv->OptimizedBVH.Purge();
+	m_pEnv->TriangleIndexList.Purge();
+	m_pEnv->TriangleIndexList.EnsureCapacity( m_Refs.Count() );
+	Emit( topNodes, 0 );
+
+	const CacheOptimizedBVHNode &root = m_pEnv->OptimizedBVH[0];
+	m_pEnv->m_MinBound.Init( root.m_flMins[0], root.m_flMins[1], root.m_flMins[2] );
+	m_pEnv->m_MaxBound.Init( root.m_flMaxs[0], root.m_flMaxs[1], root.m_flMaxs[2] );
+}
+
+
+void RayTracingEnvironment::BuildBVH(void)
+{
+	CBVHBuilder builder( this );
+	builder.Build();
+}
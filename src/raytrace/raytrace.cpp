@@ -67,6 +67,15 @@ int FourRays::CalculateDirectionSignMask(void) const
 	return ret;
 }
 
+int EightRays::CalculateDirectionSignMask(void) const
+{
+	// both halves have to agree, since the packet walks the tree in a single order
+	int msk=m_Rays[0].CalculateDirectionSignMask();
+	if ( ( msk == -1 ) || ( msk != m_Rays[1].CalculateDirectionSignMask() ) )
+		return -1;
+	return msk;
+}
+
 
 
 
@@ -274,6 +283,106 @@ static float BoxSurfaceArea(Vector const &boxmin, Vector const &boxmax)
 	return 2.0*((boxdim[0]*boxdim[2])+(boxdim[0]*boxdim[1])+(boxdim[1]*boxdim[2]));
 }
 
+//-----------------------------------------------------------------------------
+// Intersects 4 rays against one triangle, updating the closest hit in rslt_out
+//-----------------------------------------------------------------------------
+static FORCEINLINE void Intersect4RaysWithTriangle( TriIntersectData_t const *tri, int32 tnum,
+												   const FourRays &rays, RayTracingResult *rslt_out,
+												   ITransparentTriangleCallback *pCallback )
+{
+	// compute plane intersection
+	FourVectors N;
+	N.x = ReplicateX4( tri->m_flNx );
+	N.y = ReplicateX4( tri->m_flNy );
+	N.z = ReplicateX4( tri->m_flNz );
+
+	fltx4 DDotN = rays.direction * N;
+	// mask off zero or near zero (ray parallel to surface)
+	fltx4 did_hit = OrSIMD( CmpGtSIMD( DDotN,FourEpsilons ),
+							CmpLtSIMD( DDotN, FourNegativeEpsilons ) );
+
+	fltx4 numerator=SubSIMD( ReplicateX4( tri->m_flD ), rays.origin * N );
+
+	fltx4 isect_t=DivSIMD( numerator,DDotN );
+	// now, we have the distance to the plane. lets update our mask
+	did_hit = AndSIMD( did_hit, CmpGtSIMD( isect_t, FourZeros ) );
+	//did_hit=AndSIMD(did_hit,CmpLtSIMD(isect_t,TMax));
+	did_hit = AndSIMD( did_hit, CmpLtSIMD( isect_t, rslt_out->HitDistance ) );
+
+	if ( ! IsAnyNegative( did_hit ) )
+		return;
+
+	// now, check 3 edges
+	fltx4 hitc1 = AddSIMD( rays.origin[tri->m_nCoordSelect0],
+						MulSIMD( isect_t, rays.direction[ tri->m_nCoordSelect0] ) );
+	fltx4 hitc2 = AddSIMD( rays.origin[tri->m_nCoordSelect1],
+						   MulSIMD( isect_t, rays.direction[tri->m_nCoordSelect1] ) );
+	
+	// do barycentric coordinate check
+	fltx4 B0 = MulSIMD( ReplicateX4( tri->m_ProjectedEdgeEquations[0] ), hitc1 );
+
+	B0 = AddSIMD(
+		B0,
+		MulSIMD( ReplicateX4( tri->m_ProjectedEdgeEquations[1] ), hitc2 ) );
+	B0 = AddSIMD(
+		B0, ReplicateX4( tri->m_ProjectedEdgeEquations[2] ) );
+
+	did_hit = AndSIMD( did_hit, CmpGeSIMD( B0, FourZeros ) );
+
+	fltx4 B1 = MulSIMD( ReplicateX4( tri->m_ProjectedEdgeEquations[3] ), hitc1 );
+	B1 = AddSIMD(
+		B1,
+		MulSIMD( ReplicateX4( tri->m_ProjectedEdgeEquations[4]), hitc2 ) );
+
+	B1 = AddSIMD(
+		B1, ReplicateX4( tri->m_ProjectedEdgeEquations[5] ) );
+	
+	did_hit = AndSIMD( did_hit, CmpGeSIMD( B1, FourZeros ) );
+
+	fltx4 B2 = AddSIMD( B1, B0 );
+	did_hit = AndSIMD( did_hit, CmpLeSIMD( B2, Four_Ones ) );
+
+	if ( ! IsAnyNegative( did_hit ) )
+		return;
+
+	// if the triangle is transparent
+	if ( tri->m_nFlags & FCACHETRI_TRANSPARENT )
+	{
+		if ( pCallback )
+		{
+			// assuming a triangle indexed as v0, v1, v2
+			// the projected edge equations are set up such that the vert opposite the first
+			// equation is v2, and the vert opposite the second equation is v0
+			// Therefore we pass them back in 1, 2, 0 order
+			// Also B2 is currently B1 + B0 and needs to be 1 - (B1+B0) in order to be a real
+			// barycentric coordinate.  Compute that now and pass it to the callback
+			fltx4 b2 = SubSIMD( Four_Ones, B2 );
+			if ( pCallback->VisitTriangle_ShouldContinue( *tri, rays, &did_hit, &B1, &b2, &B0, tnum ) )
+			{
+				did_hit = Four_Zeros;
+			}
+		}
+	}
+	// now, set the hit_id and closest_hit fields for any enabled rays
+	fltx4 replicated_n = ReplicateIX4(tnum);
+	StoreAlignedSIMD((float *) rslt_out->HitIds,
+				 OrSIMD(AndSIMD(replicated_n,did_hit),
+						   AndNotSIMD(did_hit,LoadAlignedSIMD(
+											 (float *) rslt_out->HitIds))));
+	rslt_out->HitDistance=OrSIMD(AndSIMD(isect_t,did_hit),
+					 AndNotSIMD(did_hit,rslt_out->HitDistance));
+
+	rslt_out->surface_normal.x=OrSIMD(
+		AndSIMD(N.x,did_hit),
+		AndNotSIMD(did_hit,rslt_out->surface_normal.x));
+	rslt_out->surface_normal.y=OrSIMD(
+		AndSIMD(N.y,did_hit),
+		AndNotSIMD(did_hit,rslt_out->surface_normal.y));
+	rslt_out->surface_normal.z=OrSIMD(
+		AndSIMD(N.z,did_hit),
+		AndNotSIMD(did_hit,rslt_out->surface_normal.z));
+}
+
 void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 TMax,
 									   RayTracingResult *rslt_out,
 									   int32 skip_id, ITransparentTriangleCallback *pCallback)
@@ -346,6 +455,12 @@ void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 T
 									   int DirectionSignMask, RayTracingResult *rslt_out,
 									   int32 skip_id, ITransparentTriangleCallback *pCallback)
 {
+	if ( OptimizedBVH.Count() )
+	{
+		Trace4RaysBVH( rays, TMin, TMax, DirectionSignMask, rslt_out, skip_id, pCallback );
+		return;
+	}
+
 	rays.Check();
 
 	memset(rslt_out->HitIds,0xff,sizeof(rslt_out->HitIds));
@@ -475,118 +590,291 @@ void RayTracingEnvironment::Trace4Rays(const FourRays &rays, fltx4 TMin, fltx4 T
 				if ( ( mailboxids[mbox_slot] != tnum ) && ( tri->m_nTriangleID != skip_id ) )
 				{
 					mailboxids[mbox_slot] = tnum;
-					// compute plane intersection
+					Intersect4RaysWithTriangle( tri, tnum, rays, rslt_out, pCallback );
+				}
+			} while (--ntris);
+			// now, check if all rays have terminated
+			fltx4 raydone=CmpLeSIMD(TMax,rslt_out->HitDistance);
+			if (! IsAnyNegative(raydone))
+			{
+				return;
+			}
+		}
+		
+ 		if (stack_ptr==&NodeQueue[MAX_NODE_STACK_LEN])
+		{
+			return;
+		}
+		// pop stack!
+		CurNode=stack_ptr->node;
+		TMin=stack_ptr->TMin;
+		TMax=stack_ptr->TMax;
+		stack_ptr++;
+	}
+}
 
 
-					FourVectors N;
-					N.x = ReplicateX4( tri->m_flNx );
-					N.y = ReplicateX4( tri->m_flNy );
-					N.z = ReplicateX4( tri->m_flNz );
+#define MAX_BVH_STACK_LEN 128
 
-					fltx4 DDotN = rays.direction * N;
-					// mask off zero or near zero (ray parallel to surface)
-					fltx4 did_hit = OrSIMD( CmpGtSIMD( DDotN,FourEpsilons ),
-											CmpLtSIMD( DDotN, FourNegativeEpsilons ) );
+void RayTracingEnvironment::Trace4RaysBVH(const FourRays &rays, fltx4 TMin, fltx4 TMax,
+										  int DirectionSignMask, RayTracingResult *rslt_out,
+										  int32 skip_id, ITransparentTriangleCallback *pCallback)
+{
+	rays.Check();
 
-					fltx4 numerator=SubSIMD( ReplicateX4( tri->m_flD ), rays.origin * N );
+	memset(rslt_out->HitIds,0xff,sizeof(rslt_out->HitIds));
+	rslt_out->HitDistance=ReplicateX4(1.0e23);
+	rslt_out->surface_normal.DuplicateVector(Vector(0.,0.,0.));
 
-					fltx4 isect_t=DivSIMD( numerator,DDotN );
-					// now, we have the distance to the plane. lets update our mask
-					did_hit = AndSIMD( did_hit, CmpGtSIMD( isect_t, FourZeros ) );
-					//did_hit=AndSIMD(did_hit,CmpLtSIMD(isect_t,TMax));
-					did_hit = AndSIMD( did_hit, CmpLtSIMD( isect_t, rslt_out->HitDistance ) );
+	FourVectors OneOverRayDir=rays.direction;
+	OneOverRayDir.MakeReciprocalSaturate();
 
-					if ( ! IsAnyNegative( did_hit ) )
-						continue;
+	int32 mailboxids[MAILBOX_HASH_SIZE];					// used to avoid redundant triangle tests
+	memset(mailboxids,0xff,sizeof(mailboxids));
+
+	// since all rays share direction signs, the child nearer to the ray origins along the
+	// node's split axis can be picked from the sign mask alone.
+	int32 NodeStack[MAX_BVH_STACK_LEN];
+	int32 *stack_ptr = NodeStack;
+	int nNode = 0;
+	while ( 1 )
+	{
+		CacheOptimizedBVHNode const *CurNode = &OptimizedBVH[nNode];
 
-					// now, check 3 edges
-					fltx4 hitc1 = AddSIMD( rays.origin[tri->m_nCoordSelect0],
-										MulSIMD( isect_t, rays.direction[ tri->m_nCoordSelect0] ) );
-					fltx4 hitc2 = AddSIMD( rays.origin[tri->m_nCoordSelect1],
-										   MulSIMD( isect_t, rays.direction[tri->m_nCoordSelect1] ) );
-					
-					// do barycentric coordinate check
-					fltx4 B0 = MulSIMD( ReplicateX4( tri->m_ProjectedEdgeEquations[0] ), hitc1 );
+		// slab test the node bounds against all 4 rays
+		fltx4 tnear = TMin;
+		fltx4 tfar = MinSIMD( TMax, rslt_out->HitDistance );
+		for ( int c = 0; c < 3; c++ )
+		{
+			fltx4 t0 = MulSIMD( SubSIMD( ReplicateX4( CurNode->m_flMins[c] ), rays.origin[c] ), OneOverRayDir[c] );
+			fltx4 t1 = MulSIMD( SubSIMD( ReplicateX4( CurNode->m_flMaxs[c] ), rays.origin[c] ), OneOverRayDir[c] );
+			tnear = MaxSIMD( tnear, MinSIMD( t0, t1 ) );
+			tfar = MinSIMD( tfar, MaxSIMD( t0, t1 ) );
+		}
+
+		if ( IsAnyNegative( CmpLeSIMD( tnear, tfar ) ) )
+		{
+			int nType = CurNode->NodeType();
+			if ( nType != KDNODE_STATE_LEAF )
+			{
+				int nNear = nNode + 1;
+				int nFar = CurNode->RightChild();
+				if ( DirectionSignMask & ( 1 << nType ) )
+					V_swap( nNear, nFar );
+
+				assert( stack_ptr < &NodeStack[MAX_BVH_STACK_LEN] );
+				*(stack_ptr++) = nFar;
+				nNode = nNear;
+				continue;
+			}
+
+			int32 const *tlist = &( TriangleIndexList[CurNode->TriangleIndexStart()] );
+			for ( int ntris = CurNode->NumberOfTrianglesInLeaf(); ntris; --ntris )
+			{
+				int tnum = *(tlist++);
+				int mbox_slot = tnum & (MAILBOX_HASH_SIZE-1);
+				TriIntersectData_t const *tri = &( OptimizedTriangleList[tnum].m_Data.m_IntersectData );
+				if ( ( mailboxids[mbox_slot] != tnum ) && ( tri->m_nTriangleID != skip_id ) )
+				{
+					mailboxids[mbox_slot] = tnum;
+					Intersect4RaysWithTriangle( tri, tnum, rays, rslt_out, pCallback );
+				}
+			}
+		}
 
-					B0 = AddSIMD(
-						B0,
-						MulSIMD( ReplicateX4( tri->m_ProjectedEdgeEquations[1] ), hitc2 ) );
-					B0 = AddSIMD(
-						B0, ReplicateX4( tri->m_ProjectedEdgeEquations[2] ) );
+		if ( stack_ptr == NodeStack )
+			return;
+		nNode = *(--stack_ptr);
+	}
+}
 
-					did_hit = AndSIMD( did_hit, CmpGeSIMD( B0, FourZeros ) );
 
-					fltx4 B1 = MulSIMD( ReplicateX4( tri->m_ProjectedEdgeEquations[3] ), hitc1 );
-					B1 = AddSIMD(
-						B1,
-						MulSIMD( ReplicateX4( tri->m_ProjectedEdgeEquations[4]), hitc2 ) );
+struct NodeToVisit8 {
+	CacheOptimizedKDNode const *node;
+	fltx4 TMin[2];
+	fltx4 TMax[2];
+};
 
-					B1 = AddSIMD(
-						B1, ReplicateX4( tri->m_ProjectedEdgeEquations[5] ) );
-					
-					did_hit = AndSIMD( did_hit, CmpGeSIMD( B1, FourZeros ) );
+void RayTracingEnvironment::Trace8Rays(const EightRays &rays, const fltx4 TMin[2], const fltx4 TMax[2],
+									   RayTracingResult8 *rslt_out,
+									   int32 skip_id, ITransparentTriangleCallback **ppCallbacks)
+{
+	ITransparentTriangleCallback *pCallbacks[2] = { NULL, NULL };
+	if ( ppCallbacks )
+	{
+		pCallbacks[0] = ppCallbacks[0];
+		pCallbacks[1] = ppCallbacks[1];
+	}
 
-					fltx4 B2 = AddSIMD( B1, B0 );
-					did_hit = AndSIMD( did_hit, CmpLeSIMD( B2, Four_Ones ) );
+	int msk = rays.CalculateDirectionSignMask();
+	if ( msk != -1 )
+	{
+		Trace8Rays( rays, TMin, TMax, msk, rslt_out, skip_id, pCallbacks );
+	}
+	else
+	{
+		// the two halves don't share a direction octant. Trace them separately, which also
+		// handles any sign mismatches inside each half.
+		for ( int h = 0; h < 2; h++ )
+			Trace4Rays( rays.m_Rays[h], TMin[h], TMax[h], &rslt_out->m_Results[h], skip_id, pCallbacks[h] );
+	}
+}
 
-					if ( ! IsAnyNegative( did_hit ) )
-						continue;
 
-					// if the triangle is transparent
-					if ( tri->m_nFlags & FCACHETRI_TRANSPARENT )
-					{
-						if ( pCallback )
-						{
-							// assuming a triangle indexed as v0, v1, v2
-							// the projected edge equations are set up such that the vert opposite the first
-							// equation is v2, and the vert opposite the second equation is v0
-							// Therefore we pass them back in 1, 2, 0 order
-							// Also B2 is currently B1 + B0 and needs to be 1 - (B1+B0) in order to be a real
-							// barycentric coordinate.  Compute that now and pass it to the callback
-							fltx4 b2 = SubSIMD( Four_Ones, B2 );
-							if ( pCallback->VisitTriangle_ShouldContinue( *tri, rays, &did_hit, &B1, &b2, &B0, tnum ) )
-							{
-								did_hit = Four_Zeros;
-							}
-						}
-					}
-					// now, set the hit_id and closest_hit fields for any enabled rays
-					fltx4 replicated_n = ReplicateIX4(tnum);
-					StoreAlignedSIMD((float *) rslt_out->HitIds,
-								 OrSIMD(AndSIMD(replicated_n,did_hit),
-										   AndNotSIMD(did_hit,LoadAlignedSIMD(
-															 (float *) rslt_out->HitIds))));
-					rslt_out->HitDistance=OrSIMD(AndSIMD(isect_t,did_hit),
-									 AndNotSIMD(did_hit,rslt_out->HitDistance));
-
-					rslt_out->surface_normal.x=OrSIMD(
-						AndSIMD(N.x,did_hit),
-						AndNotSIMD(did_hit,rslt_out->surface_normal.x));
-					rslt_out->surface_normal.y=OrSIMD(
-						AndSIMD(N.y,did_hit),
-						AndNotSIMD(did_hit,rslt_out->surface_normal.y));
-					rslt_out->surface_normal.z=OrSIMD(
-						AndSIMD(N.z,did_hit),
-						AndNotSIMD(did_hit,rslt_out->surface_normal.z));
-					
+void RayTracingEnvironment::Trace8Rays(const EightRays &rays, const fltx4 TMinIn[2], const fltx4 TMaxIn[2],
+									   int DirectionSignMask, RayTracingResult8 *rslt_out,
+									   int32 skip_id, ITransparentTriangleCallback **ppCallbacks)
+{
+	// Same traversal as Trace4Rays, but the node visits and stack traffic are shared by both
+	// halves of the packet. A child is skipped only if all 8 rays miss it.
+	ITransparentTriangleCallback *pCallbacks[2] = { NULL, NULL };
+	if ( ppCallbacks )
+	{
+		pCallbacks[0] = ppCallbacks[0];
+		pCallbacks[1] = ppCallbacks[1];
+	}
+
+	if ( OptimizedBVH.Count() )
+	{
+		for ( int h = 0; h < 2; h++ )
+			Trace4RaysBVH( rays.m_Rays[h], TMinIn[h], TMaxIn[h], DirectionSignMask, &rslt_out->m_Results[h], skip_id, pCallbacks[h] );
+		return;
+	}
+
+	fltx4 TMin[2], TMax[2];
+	FourVectors OneOverRayDir[2];
+	for ( int h = 0; h < 2; h++ )
+	{
+		rays.m_Rays[h].Check();
+
+		RayTracingResult *pResult = &rslt_out->m_Results[h];
+		memset( pResult->HitIds, 0xff, sizeof( pResult->HitIds ) );
+		pResult->HitDistance = ReplicateX4( 1.0e23 );
+		pResult->surface_normal.DuplicateVector( Vector( 0., 0., 0. ) );
+
+		OneOverRayDir[h] = rays.m_Rays[h].direction;
+		OneOverRayDir[h].MakeReciprocalSaturate();
+
+		// clip rays against bounding box
+		TMin[h] = TMinIn[h];
+		TMax[h] = TMaxIn[h];
+		for ( int c = 0; c < 3; c++ )
+		{
+			fltx4 isect_min_t =
+				MulSIMD( SubSIMD( ReplicateX4( m_MinBound[c] ), rays.m_Rays[h].origin[c] ), OneOverRayDir[h][c] );
+			fltx4 isect_max_t =
+				MulSIMD( SubSIMD( ReplicateX4( m_MaxBound[c] ), rays.m_Rays[h].origin[c] ), OneOverRayDir[h][c] );
+			TMin[h] = MaxSIMD( TMin[h], MinSIMD( isect_min_t, isect_max_t ) );
+			TMax[h] = MinSIMD( TMax[h], MaxSIMD( isect_min_t, isect_max_t ) );
+		}
+	}
+
+	if ( ! IsAnyNegative( OrSIMD( CmpLeSIMD( TMin[0], TMax[0] ), CmpLeSIMD( TMin[1], TMax[1] ) ) ) )
+		return;												// missed bounding box
+
+	int32 mailboxids[MAILBOX_HASH_SIZE];					// used to avoid redundant triangle tests
+	memset( mailboxids, 0xff, sizeof( mailboxids ) );
+
+	int front_idx[3], back_idx[3];							// based on ray direction, whether to
+															// visit left or right node first
+	for ( int c = 0; c < 3; c++ )
+	{
+		back_idx[c] = ( DirectionSignMask & ( 1 << c ) ) ? 0 : 1;
+		front_idx[c] = 1 - back_idx[c];
+	}
+
+	NodeToVisit8 NodeQueue[MAX_NODE_STACK_LEN];
+	CacheOptimizedKDNode const *CurNode = &( OptimizedKDTree[0] );
+	NodeToVisit8 *stack_ptr = &NodeQueue[MAX_NODE_STACK_LEN];
+	while ( 1 )
+	{
+		while ( CurNode->NodeType() != KDNODE_STATE_LEAF )		// traverse until next leaf
+		{
+			int split_plane_number = CurNode->NodeType();
+			CacheOptimizedKDNode const *FrontChild = &( OptimizedKDTree[CurNode->LeftChild()] );
+			fltx4 split_value = ReplicateX4( CurNode->SplittingPlaneValue );
+
+			fltx4 dist_to_sep_plane[2];
+			fltx4 hits_front = Four_Zeros;
+			fltx4 hits_back = Four_Zeros;
+			for ( int h = 0; h < 2; h++ )
+			{
+				dist_to_sep_plane[h] =						// dist=(split-org)/dir
+					MulSIMD( SubSIMD( split_value, rays.m_Rays[h].origin[split_plane_number] ),
+							 OneOverRayDir[h][split_plane_number] );
+				fltx4 active = CmpLeSIMD( TMin[h], TMax[h] );
+				hits_front = OrSIMD( hits_front, AndSIMD( active, CmpGeSIMD( dist_to_sep_plane[h], TMin[h] ) ) );
+				hits_back = OrSIMD( hits_back, AndSIMD( active, CmpLeSIMD( dist_to_sep_plane[h], TMax[h] ) ) );
+			}
+
+			if ( ! IsAnyNegative( hits_front ) )
+			{
+				// missed the front. only traverse back
+				CurNode = FrontChild + back_idx[split_plane_number];
+				for ( int h = 0; h < 2; h++ )
+					TMin[h] = MaxSIMD( TMin[h], dist_to_sep_plane[h] );
+			}
+			else if ( ! IsAnyNegative( hits_back ) )
+			{
+				// missed the back - only need to traverse front node
+				CurNode = FrontChild + front_idx[split_plane_number];
+				for ( int h = 0; h < 2; h++ )
+					TMax[h] = MinSIMD( TMax[h], dist_to_sep_plane[h] );
+			}
+			else
+			{
+				// at least some rays hit both nodes. must push far, traverse near
+				assert( stack_ptr > NodeQueue );
+				--stack_ptr;
+				stack_ptr->node = FrontChild + back_idx[split_plane_number];
+				for ( int h = 0; h < 2; h++ )
+				{
+					stack_ptr->TMin[h] = MaxSIMD( TMin[h], dist_to_sep_plane[h] );
+					stack_ptr->TMax[h] = TMax[h];
+					TMax[h] = MinSIMD( TMax[h], dist_to_sep_plane[h] );
 				}
-			} while (--ntris);
+				CurNode = FrontChild + front_idx[split_plane_number];
+			}
+		}
+
+		// hit a leaf! must do intersection check
+		int ntris = CurNode->NumberOfTrianglesInLeaf();
+		if ( ntris )
+		{
+			int32 const *tlist = &( TriangleIndexList[CurNode->TriangleIndexStart()] );
+			do
+			{
+				int tnum = *( tlist++ );
+				int mbox_slot = tnum & ( MAILBOX_HASH_SIZE - 1 );
+				TriIntersectData_t const *tri = &( OptimizedTriangleList[tnum].m_Data.m_IntersectData );
+				if ( ( mailboxids[mbox_slot] != tnum ) && ( tri->m_nTriangleID != skip_id ) )
+				{
+					mailboxids[mbox_slot] = tnum;
+					Intersect4RaysWithTriangle( tri, tnum, rays.m_Rays[0], &rslt_out->m_Results[0], pCallbacks[0] );
+					Intersect4RaysWithTriangle( tri, tnum, rays.m_Rays[1], &rslt_out->m_Results[1], pCallbacks[1] );
+				}
+			} while ( --ntris );
+
 			// now, check if all rays have terminated
-			fltx4 raydone=CmpLeSIMD(TMax,rslt_out->HitDistance);
-			if (! IsAnyNegative(raydone))
+			fltx4 raydone = OrSIMD( CmpLeSIMD( TMax[0], rslt_out->m_Results[0].HitDistance ),
+									CmpLeSIMD( TMax[1], rslt_out->m_Results[1].HitDistance ) );
+			if ( ! IsAnyNegative( raydone ) )
 			{
 				return;
 			}
 		}
-		
- 		if (stack_ptr==&NodeQueue[MAX_NODE_STACK_LEN])
+
+		if ( stack_ptr == &NodeQueue[MAX_NODE_STACK_LEN] )
 		{
 			return;
 		}
 		// pop stack!
-		CurNode=stack_ptr->node;
-		TMin=stack_ptr->TMin;
-		TMax=stack_ptr->TMax;
+		CurNode = stack_ptr->node;
+		for ( int h = 0; h < 2; h++ )
+		{
+			TMin[h] = stack_ptr->TMin[h];
+			TMax[h] = stack_ptr->TMax[h];
+		}
 		stack_ptr++;
 	}
 }
@@ -871,6 +1159,16 @@ void RayTracingEnvironment::RefineNode(int node_number,int32 const *tri_list,int
 
 void RayTracingEnvironment::SetupAccelerationStructure(void)
 {
+	if ( Flags & RTE_FLAGS_USE_BVH )
+	{
+		BuildBVH();
+
+		// now, convert all triangles to "intersection format"
+		for(int i=0;i<OptimizedTriangleList.Count();i++)
+			OptimizedTriangleList[i].ChangeIntoIntersectionFormat();
+		return;
+	}
+
 	CacheOptimizedKDNode root{};
 	OptimizedKDTree.AddToTail(root);
 	int32 *root_triangle_list=new int32[OptimizedTriangleList.Count()];
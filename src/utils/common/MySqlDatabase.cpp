@@ -24,17 +24,17 @@ CMySqlDatabase::~CMySqlDatabase()
 	m_bRunThread = false;
 
 	// pulse the thread to make it run
-	::SetEvent(m_hEvent);
+	m_Event.Set();
 
 	// make sure it's done
-	::EnterCriticalSection(&m_csThread);
-	::LeaveCriticalSection(&m_csThread);
+	m_csThread.Lock();
+	m_csThread.Unlock();
 }
 
 //-----------------------------------------------------------------------------
 // Purpose: Thread access function
 //-----------------------------------------------------------------------------
-static DWORD WINAPI staticThreadFunc(void *param)
+static uintp staticThreadFunc(void *param)
 {
 	((CMySqlDatabase *)param)->RunThread();
 	return 0;
@@ -46,21 +46,17 @@ static DWORD WINAPI staticThreadFunc(void *param)
 //-----------------------------------------------------------------------------
 bool CMySqlDatabase::Initialize()
 {
-	// prepare critical sections
-	//!! need to download SDK and replace these with InitializeCriticalSectionAndSpinCount() calls
-	::InitializeCriticalSection(&m_csThread);
-	::InitializeCriticalSection(&m_csInQueue);
-	::InitializeCriticalSection(&m_csOutQueue);
-	::InitializeCriticalSection(&m_csDBAccess);
-
 	// initialize wait calls
-	m_hEvent = ::CreateEvent(NULL, false, true, NULL);
+	m_Event.Set();
 
 	// start the DB-access thread
 	m_bRunThread = true;
 
-	unsigned long threadID;
-	::CreateThread(NULL, 0, staticThreadFunc, this, 0, &threadID);
+	ThreadHandle_t hThread = CreateSimpleThread(staticThreadFunc, this);
+	if (!hThread)
+		return false;
+
+	ReleaseThreadHandle(hThread);
 
 	return true;
 }
@@ -70,34 +66,34 @@ bool CMySqlDatabase::Initialize()
 //-----------------------------------------------------------------------------
 void CMySqlDatabase::RunThread()
 {
-	::EnterCriticalSection(&m_csThread);
+	m_csThread.Lock();
 	while (m_bRunThread)
 	{
 		if (m_InQueue.Count() > 0)
 		{
 			// get a dispatched DB request
-			::EnterCriticalSection(&m_csInQueue);
+			m_csInQueue.Lock();
 
 			// pop the front of the queue
 			int headIndex = m_InQueue.Head();
 			msg_t msg = m_InQueue[headIndex];
 			m_InQueue.Remove(headIndex);
 
-			::LeaveCriticalSection(&m_csInQueue);
+			m_csInQueue.Unlock();
 
-			::EnterCriticalSection(&m_csDBAccess);
+			m_csDBAccess.Lock();
 			
 			// run sqldb command
 			msg.result = msg.cmd->RunCommand();
 
-			::LeaveCriticalSection(&m_csDBAccess);
+			m_csDBAccess.Unlock();
 
 			if (msg.replyTarget)
 			{
 				// put the results in the outgoing queue
-				::EnterCriticalSection(&m_csOutQueue);
+				m_csOutQueue.Lock();
 				m_OutQueue.AddToTail(msg);
-				::LeaveCriticalSection(&m_csOutQueue);
+				m_csOutQueue.Unlock();
 
 				// wake up out queue
 				msg.replyTarget->WakeUp();
@@ -111,16 +107,16 @@ void CMySqlDatabase::RunThread()
 		else
 		{
 			// nothing in incoming queue, so wait until we get the signal
-			::WaitForSingleObject(m_hEvent, INFINITE);
+			m_Event.Wait();
 		}
 
 		// check the size of the outqueue; if it's getting too big, sleep to let the main thread catch up
 		if (m_OutQueue.Count() > 50)
 		{
-			::Sleep(2);
+			ThreadSleep(2);
 		}
 	}
-	::LeaveCriticalSection(&m_csThread);
+	m_csThread.Unlock();
 }
 
 //-----------------------------------------------------------------------------
@@ -128,16 +124,16 @@ void CMySqlDatabase::RunThread()
 //-----------------------------------------------------------------------------
 void CMySqlDatabase::AddCommandToQueue(ISQLDBCommand *cmd, ISQLDBReplyTarget *replyTarget, int returnState)
 {
-	::EnterCriticalSection(&m_csInQueue);
+	m_csInQueue.Lock();
 
 	// add to the queue
 	msg_t msg = { cmd, replyTarget, 0, returnState };
 	m_InQueue.AddToTail(msg);
 
-	::LeaveCriticalSection(&m_csInQueue);
+	m_csInQueue.Unlock();
 
 	// signal the thread to start running
-	::SetEvent(m_hEvent);
+	m_Event.Set();
 }
 
 //-----------------------------------------------------------------------------
@@ -149,14 +145,14 @@ bool CMySqlDatabase::RunFrame()
 
 	while (m_OutQueue.Count() > 0)
 	{
-		::EnterCriticalSection(&m_csOutQueue);
+		m_csOutQueue.Lock();
 
 		// pop the first item in the queue
 		int headIndex = m_OutQueue.Head();
 		msg_t msg = m_OutQueue[headIndex];
 		m_OutQueue.Remove(headIndex);
 
-		::LeaveCriticalSection(&m_csOutQueue);
+		m_csOutQueue.Unlock();
 
 		// run result
 		if (msg.replyTarget)
@@ -11,10 +11,10 @@
 #pragma once
 #endif
 
-#include <windows.h>
+#include "tier0/threadtools.h"
 #include "ISQLDBReplyTarget.h"
 #include "utlvector.h"
-#include "UtlLinkedList.h"
+#include "utllinkedlist.h"
 
 class ISQLDBCommand;
 
@@ -51,13 +51,13 @@ private:
 
 	// threading data
 	bool m_bRunThread;
-	CRITICAL_SECTION m_csThread;
-	CRITICAL_SECTION m_csInQueue;
-	CRITICAL_SECTION m_csOutQueue;
-	CRITICAL_SECTION m_csDBAccess;
+	CThreadMutex m_csThread;
+	CThreadMutex m_csInQueue;
+	CThreadMutex m_csOutQueue;
+	CThreadMutex m_csDBAccess;
 
 	// wait event
-	HANDLE m_hEvent;
+	CThreadEvent m_Event;
 
 	struct msg_t
 	{
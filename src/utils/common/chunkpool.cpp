@@ -0,0 +1,221 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Chunked free list allocator for the map tools.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "cmdlib.h"
+#include "chunkpool.h"
+
+
+//-----------------------------------------------------------------------------
+// Stats
+//-----------------------------------------------------------------------------
+void ChunkPoolStats_t::Clear()
+{
+	memset( this, 0, sizeof( *this ) );
+}
+
+void ChunkPoolStats_t::Add( const ChunkPoolStats_t &other )
+{
+	m_nAllocs += other.m_nAllocs;
+	m_nLive += other.m_nLive;
+	m_nPeakLive += other.m_nPeakLive;
+	m_nReservedBytes += other.m_nReservedBytes;
+	m_nPeakReservedBytes += other.m_nPeakReservedBytes;
+	m_nReleasedBytes += other.m_nReleasedBytes;
+}
+
+void PrintChunkPoolStats( const char *pName, const ChunkPoolStats_t &stats )
+{
+	qprintf( "%-10s %9i live (peak %9i) %11lld allocs %8.1f MB held (peak %8.1f MB) %8.1f MB released\n",
+		pName, stats.m_nLive, stats.m_nPeakLive, (long long)stats.m_nAllocs,
+		stats.m_nReservedBytes / ( 1024.0f * 1024.0f ),
+		stats.m_nPeakReservedBytes / ( 1024.0f * 1024.0f ),
+		stats.m_nReleasedBytes / ( 1024.0f * 1024.0f ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// CChunkPool
+//-----------------------------------------------------------------------------
+CChunkPool::CChunkPool()
+{
+	m_pName = "chunkpool";
+	m_nItemSize = 0;
+	m_nItemsPerChunk = 0;
+	m_pFreeList = NULL;
+	m_Stats.Clear();
+}
+
+CChunkPool::CChunkPool( const char *pName, int nItemSize, int nChunkBytes )
+{
+	m_pFreeList = NULL;
+	m_Stats.Clear();
+	Init( pName, nItemSize, nChunkBytes );
+}
+
+CChunkPool::~CChunkPool()
+{
+	for ( int i = 0; i < m_Chunks.Count(); i++ )
+	{
+		free( m_Chunks[i] );
+	}
+}
+
+void CChunkPool::Init( const char *pName, int nItemSize, int nChunkBytes )
+{
+	Assert( m_Chunks.Count() == 0 );
+
+	m_pName = pName;
+
+	// Keep the items (and the free list link at their end) aligned
+	m_nItemSize = AlignValue( Max( nItemSize, (int)sizeof( byte* ) ), 16 );
+	m_nItemsPerChunk = Max( 1, nChunkBytes / m_nItemSize );
+}
+
+void CChunkPool::AddChunk()
+{
+	int nChunkBytes = m_nItemSize * m_nItemsPerChunk;
+	byte *pChunk = (byte*)malloc( nChunkBytes );
+	if ( !pChunk )
+		Error( "CChunkPool: out of memory allocating %s", m_pName );
+
+	// Insert keeping the chunks sorted, so FindChunk can binary search
+	int i = m_Chunks.Count();
+	while ( i > 0 && m_Chunks[i-1] > pChunk )
+		--i;
+	m_Chunks.InsertBefore( i, pChunk );
+
+	// Thread the items so they are handed out front to back
+	for ( int j = m_nItemsPerChunk - 1; j >= 0; --j )
+	{
+		byte *pItem = pChunk + j * m_nItemSize;
+		NextFree( pItem ) = m_pFreeList;
+		m_pFreeList = pItem;
+	}
+
+	m_Stats.m_nReservedBytes += nChunkBytes;
+	if ( m_Stats.m_nReservedBytes > m_Stats.m_nPeakReservedBytes )
+		m_Stats.m_nPeakReservedBytes = m_Stats.m_nReservedBytes;
+}
+
+int CChunkPool::FindChunk( const byte *pItem ) const
+{
+	// Last chunk starting at or below the item
+	int lo = 0, hi = m_Chunks.Count() - 1;
+	while ( lo < hi )
+	{
+		int mid = ( lo + hi + 1 ) / 2;
+		if ( m_Chunks[mid] <= pItem )
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+void *CChunkPool::Alloc()
+{
+	Assert( m_nItemSize > 0 );
+
+	AUTO_LOCK( m_Mutex );
+
+	if ( !m_pFreeList )
+		AddChunk();
+
+	byte *pItem = m_pFreeList;
+	m_pFreeList = NextFree( pItem );
+
+	m_Stats.m_nAllocs++;
+	m_Stats.m_nLive++;
+	if ( m_Stats.m_nLive > m_Stats.m_nPeakLive )
+		m_Stats.m_nPeakLive = m_Stats.m_nLive;
+
+	return pItem;
+}
+
+void CChunkPool::Free( void *p )
+{
+	if ( !p )
+		return;
+
+	AUTO_LOCK( m_Mutex );
+
+	byte *pItem = (byte*)p;
+	NextFree( pItem ) = m_pFreeList;
+	m_pFreeList = pItem;
+	m_Stats.m_nLive--;
+}
+
+int64 CChunkPool::ReleaseUnused()
+{
+	AUTO_LOCK( m_Mutex );
+
+	int nChunks = m_Chunks.Count();
+	if ( nChunks == 0 )
+		return 0;
+
+	int64 nChunkBytes = (int64)m_nItemSize * m_nItemsPerChunk;
+	int64 nReleased = 0;
+
+	if ( m_Stats.m_nLive == 0 )
+	{
+		// Everything is free, drop it all
+		for ( int i = 0; i < nChunks; i++ )
+		{
+			free( m_Chunks[i] );
+		}
+		m_Chunks.RemoveAll();
+		m_pFreeList = NULL;
+		nReleased = nChunks * nChunkBytes;
+	}
+	else
+	{
+		// Count the free items in each chunk
+		CUtlVector<int> freeCount;
+		freeCount.SetCount( nChunks );
+		memset( freeCount.Base(), 0, nChunks * sizeof( int ) );
+
+		byte *pItem;
+		for ( pItem = m_pFreeList; pItem; pItem = NextFree( pItem ) )
+		{
+			freeCount[ FindChunk( pItem ) ]++;
+		}
+
+		// Rebuild the free list without the items of empty chunks, keeping the order
+		byte *pHead = NULL;
+		byte **ppTail = &pHead;
+		for ( pItem = m_pFreeList; pItem; pItem = NextFree( pItem ) )
+		{
+			if ( freeCount[ FindChunk( pItem ) ] == m_nItemsPerChunk )
+				continue;
+
+			*ppTail = pItem;
+			ppTail = &NextFree( pItem );
+		}
+		*ppTail = NULL;
+		m_pFreeList = pHead;
+
+		for ( int i = nChunks - 1; i >= 0; --i )
+		{
+			if ( freeCount[i] != m_nItemsPerChunk )
+				continue;
+
+			free( m_Chunks[i] );
+			m_Chunks.Remove( i );
+			nReleased += nChunkBytes;
+		}
+	}
+
+	m_Stats.m_nReservedBytes -= nReleased;
+	m_Stats.m_nReleasedBytes += nReleased;
+	return nReleased;
+}
+
+void CChunkPool::GetStats( ChunkPoolStats_t &stats )
+{
+	AUTO_LOCK( m_Mutex );
+	stats = m_Stats;
+}
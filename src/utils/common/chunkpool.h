@@ -0,0 +1,81 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Chunked free list allocator for the short lived geometry the map
+//			tools create and destroy by the million (windings, brushes, faces).
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef CHUNKPOOL_H
+#define CHUNKPOOL_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/threadtools.h"
+#include "tier1/utlvector.h"
+
+
+struct ChunkPoolStats_t
+{
+	int64	m_nAllocs;				// total allocations made
+	int		m_nLive;				// items currently handed out
+	int		m_nPeakLive;
+	int64	m_nReservedBytes;		// bytes currently held in chunks
+	int64	m_nPeakReservedBytes;
+	int64	m_nReleasedBytes;		// bytes given back by ReleaseUnused
+
+	void	Clear();
+
+	// Sums the counters. Peaks of several pools are summed as well, so they are an upper bound.
+	void	Add( const ChunkPoolStats_t &other );
+};
+
+// Prints one line of stats through qprintf (i.e. only with -verbose).
+void PrintChunkPoolStats( const char *pName, const ChunkPoolStats_t &stats );
+
+
+//-----------------------------------------------------------------------------
+// Hands out fixed size items carved from large chunks. Freed items go on a
+// free list and are reused; ReleaseUnused() gives chunks whose items are all
+// free back to the system, so tools call it at the end of each phase.
+//
+// The free list link is kept in the last pointer of a freed item, so the
+// leading bytes (e.g. the freed flag in winding_t::numpoints) survive Free().
+// Items are not cleared. All functions are thread safe.
+//-----------------------------------------------------------------------------
+class CChunkPool
+{
+public:
+	CChunkPool();
+	CChunkPool( const char *pName, int nItemSize, int nChunkBytes = 64 * 1024 );
+	~CChunkPool();
+
+	// Must be called before the first Alloc() when default constructed.
+	void	Init( const char *pName, int nItemSize, int nChunkBytes = 64 * 1024 );
+
+	void	*Alloc();
+	void	Free( void *p );
+
+	// Frees every chunk that has no live items. Returns the number of bytes released.
+	int64	ReleaseUnused();
+
+	int		ItemSize() const	{ return m_nItemSize; }
+	void	GetStats( ChunkPoolStats_t &stats );
+
+private:
+	byte	*&NextFree( byte *pItem ) const	{ return *(byte**)( pItem + m_nItemSize - sizeof( byte* ) ); }
+	void	AddChunk();
+	int		FindChunk( const byte *pItem ) const;
+
+	CThreadFastMutex	m_Mutex;
+	const char			*m_pName;
+	int					m_nItemSize;
+	int					m_nItemsPerChunk;
+	byte				*m_pFreeList;
+	CUtlVector<byte*>	m_Chunks;		// sorted by address
+	ChunkPoolStats_t	m_Stats;
+};
+
+
+#endif // CHUNKPOOL_H
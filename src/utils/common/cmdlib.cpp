@@ -60,6 +60,7 @@ CUtlLinkedList<SpewHookFn, unsigned short> g_ExtraSpewHooks;
 
 bool g_bStopOnExit = false;
 void (*g_ExtraSpewHook)(const char*) = NULL;
+bool g_bSuppressPrintfOutput = false;
 
 #if defined( _WIN32 ) || defined( WIN32 )
 
@@ -218,7 +219,6 @@ void Error( char const *pMsg, ... )
 
 CRITICAL_SECTION g_SpewCS;
 bool g_bSpewCSInitted = false;
-bool g_bSuppressPrintfOutput = false;
 
 SpewRetval_t CmdLib_SpewOutputFunc( SpewType_t type, char const *pMsg )
 {
@@ -592,6 +592,35 @@ void Q_mkdir (char *path)
 	Error ("mkdir failed %s\n", path );
 }
 
+bool CmdLib_GetTempFileName( const char *pPrefix, char *pOut, int outLen )
+{
+#if defined( _WIN32 ) || defined( WIN32 )
+	char tempPath[MAX_PATH], tempFile[MAX_PATH];
+	if ( GetTempPath( sizeof( tempPath ), tempPath ) == 0 )
+		return false;
+
+	if ( GetTempFileName( tempPath, pPrefix, 0, tempFile ) == 0 )
+		return false;
+
+	Q_strncpy( pOut, tempFile, outLen );
+	return true;
+#else
+	const char *pTempDir = getenv( "TMPDIR" );
+	if ( !pTempDir || !pTempDir[0] )
+		pTempDir = "/tmp";
+
+	char tempFile[MAX_PATH];
+	Q_snprintf( tempFile, sizeof( tempFile ), "%s/%sXXXXXX", pTempDir, pPrefix );
+	int fd = mkstemp( tempFile );
+	if ( fd == -1 )
+		return false;
+
+	close( fd );
+	Q_strncpy( pOut, tempFile, outLen );
+	return true;
+#endif
+}
+
 void CmdLib_InitFileSystem( const char *pFilename, int maxMemoryUsage )
 {
 	FileSystem_Init( pFilename, maxMemoryUsage );
@@ -84,6 +84,9 @@ int	FileTime (char *path);
 
 void	Q_mkdir( char *path );
 
+// Creates an empty, uniquely named file in the system temp directory and returns its name.
+bool	CmdLib_GetTempFileName( const char *pPrefix, char *pOut, int outLen );
+
 char *ExpandArg (char *path);	// expand relative to CWD
 char *ExpandPath (char *path);	// expand relative to gamedir
 
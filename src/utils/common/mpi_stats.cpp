@@ -17,6 +17,13 @@
 #include "vmpi_tools_shared.h"
 #include "tier0/icommandline.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#define MAX_COMPUTERNAME_LENGTH	255
+#endif
+
 /*
 
 -- MySQL code to create the databases, create the users, and set access privileges.
@@ -132,9 +139,8 @@ char			g_MachineName[MAX_COMPUTERNAME_LENGTH+1] = {0};
 unsigned long	g_CurrentMessageIndex = 0;
 
 
-HANDLE	g_hPerfThread = NULL;
-DWORD	g_PerfThreadID = 0xFEFEFEFE;
-HANDLE	g_hPerfThreadExitEvent = NULL;
+ThreadHandle_t	g_hPerfThread = NULL;
+CThreadEvent	g_PerfThreadExitEvent;
 
 // These are set by the app and they go into the database.
 extern uint64 g_ThreadWUs[4];
@@ -295,7 +301,7 @@ public:
 		query.Execute( g_pSQL  );
 
 		// Now set RunningTimeMS.
-		unsigned long runningTimeMS = GetTickCount() - g_StatsStartTime;
+		unsigned long runningTimeMS = Plat_MSTime() - g_StatsStartTime;
 		query.Format( "update job_master_start set RunningTimeMS=%lu where JobID=%lu", runningTimeMS, g_JobPrimaryID );
 		query.Execute( g_pSQL );
 		return 1;
@@ -305,7 +311,7 @@ public:
 
 void UpdateJobWorkerRunningTime()
 {
-	unsigned long runningTimeMS = GetTickCount() - g_StatsStartTime;
+	unsigned long runningTimeMS = Plat_MSTime() - g_StatsStartTime;
 	
 	char curStage[256];
 	VMPI_GetCurrentStage( curStage, sizeof( curStage ) );
@@ -450,7 +456,7 @@ void PerfThread_AddGraphEntry( DWORD startTicks, DWORD &lastSent, DWORD &lastRec
 
 	g_pDB->AddCommandToQueue( 
 		new CSQLDBCommand_GraphEntry( 
-			GetTickCount() - startTicks,
+			Plat_MSTime() - startTicks,
 			curSent - lastSent, 
 			curReceived - lastReceived ), 
 		NULL );
@@ -461,13 +467,13 @@ void PerfThread_AddGraphEntry( DWORD startTicks, DWORD &lastSent, DWORD &lastRec
 
 
 // This function adds a graph_entry into the database periodically.
-DWORD WINAPI PerfThreadFn( LPVOID pParameter )
+static uintp PerfThreadFn( void *pParameter )
 {
 	DWORD lastSent = 0;
 	DWORD lastReceived = 0;
-	DWORD startTicks = GetTickCount();
+	DWORD startTicks = Plat_MSTime();
 
-	while ( WaitForSingleObject( g_hPerfThreadExitEvent, 1000 ) != WAIT_OBJECT_0 )
+	while ( !g_PerfThreadExitEvent.Wait( 1000 ) )
 	{
 		PerfThread_AddGraphEntry( startTicks, lastSent, lastReceived );
 
@@ -486,12 +492,35 @@ DWORD WINAPI PerfThreadFn( LPVOID pParameter )
 	// Add the remaining text and one last graph entry (which will include the current stage info).
 	PerfThread_SendSpewText();
 	PerfThread_AddGraphEntry( startTicks, lastSent, lastReceived );
-
-	SetEvent( g_hPerfThreadExitEvent );
 	return 0;
 }
 
 
+// Fills in g_MachineName, which goes into the database with each row.
+static void GetStatsMachineName()
+{
+#ifdef _WIN32
+	DWORD size = sizeof( g_MachineName );
+	GetComputerName( g_MachineName, &size );
+#else
+	if ( gethostname( g_MachineName, sizeof( g_MachineName ) ) != 0 )
+		g_MachineName[0] = 0;
+	g_MachineName[sizeof( g_MachineName ) - 1] = 0;
+#endif
+}
+
+
+// Gets the full path of the running executable.
+static bool GetStatsExeFilename( char *pOut, int outLen )
+{
+#ifdef _WIN32
+	return GetModuleFileName( NULL, pOut, outLen ) != 0;
+#else
+	return Plat_GetExecutablePath( pOut, outLen );
+#endif
+}
+
+
 // -------------------------------------------------------------------------------- //
 // VMPI_Stats interface.
 // -------------------------------------------------------------------------------- //
@@ -561,8 +590,7 @@ bool VMPI_Stats_Init_Master(
 		return false;
 	}
 
-	DWORD size = sizeof( g_MachineName );
-	GetComputerName( g_MachineName, &size );
+	GetStatsMachineName();
 
 	// Create the job_master_start row.
 	Q_FileBase( pBSPFilename, g_BSPFilename, sizeof( g_BSPFilename ) );
@@ -590,7 +618,7 @@ bool VMPI_Stats_Init_Master(
 
 bool VMPI_Stats_Init_Worker( const char *pHostName, const char *pDBName, const char *pUserName, unsigned long DBJobID )
 {
-	g_StatsStartTime = GetTickCount();
+	g_StatsStartTime = Plat_MSTime();
 	
 	// If pDBServerName is null, then we're the master and we just want to make the job_worker_start entry.
 	if ( pHostName )
@@ -607,8 +635,7 @@ bool VMPI_Stats_Init_Worker( const char *pHostName, const char *pDBName, const c
 		}
 		
 		// Get our machine name to store in the database.
-		DWORD size = sizeof( g_MachineName );
-		GetComputerName( g_MachineName, &size );
+		GetStatsMachineName();
 	}
 
 
@@ -629,14 +656,8 @@ bool VMPI_Stats_Init_Worker( const char *pHostName, const char *pDBName, const c
 	}
 
 	// Now create a thread that samples perf data and stores it in the database.
-	g_hPerfThreadExitEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
-	g_hPerfThread = CreateThread(
-		NULL,
-		0,
-		PerfThreadFn,
-		NULL,
-		0,
-		&g_PerfThreadID );
+	g_PerfThreadExitEvent.Reset();
+	g_hPerfThread = CreateSimpleThread( PerfThreadFn, NULL );
 
 	return true;	
 }
@@ -648,14 +669,13 @@ void VMPI_Stats_Term()
 		return;
 
 	// Stop the thread.
-	SetEvent( g_hPerfThreadExitEvent );
-	WaitForSingleObject( g_hPerfThread, INFINITE );
-	
-	CloseHandle( g_hPerfThreadExitEvent );
-	g_hPerfThreadExitEvent = NULL;
-
-	CloseHandle( g_hPerfThread );
-	g_hPerfThread = NULL;
+	if ( g_hPerfThread )
+	{
+		g_PerfThreadExitEvent.Set();
+		ThreadJoin( g_hPerfThread );
+		ReleaseThreadHandle( g_hPerfThread );
+		g_hPerfThread = NULL;
+	}
 
 	if ( g_bMaster )
 	{
@@ -664,8 +684,8 @@ void VMPI_Stats_Term()
 	}
 
 	// Wait for up to a second for the DB to finish writing its data.
-	DWORD startTime = GetTickCount();
-	while ( GetTickCount() - startTime < 1000 )
+	DWORD startTime = Plat_MSTime();
+	while ( Plat_MSTime() - startTime < 1000 )
 	{
 		if ( g_pDB->QueriesInOutQueue() == 0 )
 			break;
@@ -700,8 +720,8 @@ static bool ReadStringFromFile( FILE *fp, char *pStr, int strSize )
 void GetDBInfo( const char *pDBInfoFilename, CDBInfo *pInfo )
 {
 	char baseExeFilename[512];
-	if ( !GetModuleFileName( GetModuleHandle( NULL ), baseExeFilename, sizeof( baseExeFilename ) ) )
-		Error( "GetModuleFileName failed." );
+	if ( !GetStatsExeFilename( baseExeFilename, sizeof( baseExeFilename ) ) )
+		Error( "GetDBInfo: can't get the executable's filename." );
 	
 	// Look for the info file in the same directory as the exe.
 	char dbInfoFilename[512];
@@ -734,6 +754,7 @@ void GetDBInfo( const char *pDBInfoFilename, CDBInfo *pInfo )
 
 void RunJobWatchApp( char *pCmdLine )
 {
+#ifdef _WIN32
 	STARTUPINFO si;
 	memset( &si, 0, sizeof( si ) );
 	si.cb = sizeof( si );
@@ -769,6 +790,10 @@ void RunJobWatchApp( char *pCmdLine )
 			}
 		}
 	}
+#else
+	// vmpi_job_watch is a Windows app; run it from a Windows machine that can reach the database.
+	Warning( "%s - vmpi_job_watch isn't available on this platform.\n", VMPI_GetParamString( mpi_Job_Watch ) );
+#endif
 }
 
 
@@ -12,6 +12,7 @@
 #include "polylib.h"
 #include "worldsize.h"
 #include "threads.h"
+#include "chunkpool.h"
 #include "tier0/dbg.h"
 
 // doesn't seem to need to be here? -- in threads.h
@@ -31,7 +32,23 @@ void pw(winding_t *w)
 		printf ("(%5.1f, %5.1f, %5.1f)\n",w->p[i][0], w->p[i][1],w->p[i][2]);
 }
 
-winding_t *winding_pool[MAX_POINTS_ON_WINDING+4];
+// One pool per point count; the points are stored right after the winding_t.
+// Bigger windings than that are rare enough to go through malloc.
+#define NUM_WINDING_POOLS	(MAX_POINTS_ON_WINDING+4)
+
+class CWindingPools
+{
+public:
+	CWindingPools()
+	{
+		for (int i=0 ; i<NUM_WINDING_POOLS ; i++)
+			m_Pools[i].Init ("winding", sizeof(winding_t) + i*sizeof(Vector));
+	}
+
+	CChunkPool	m_Pools[NUM_WINDING_POOLS];
+};
+
+static CWindingPools s_WindingPools;
 
 /*
 =============
@@ -50,18 +67,11 @@ winding_t *AllocWinding (int points)
 		if (c_active_windings > c_peak_windings)
 			c_peak_windings = c_active_windings;
 	}
-	ThreadLock();
-	if (winding_pool[points])
-	{
-		w = winding_pool[points];
-		winding_pool[points] = w->next;
-	}
+	if (points < NUM_WINDING_POOLS)
+		w = (winding_t *)s_WindingPools.m_Pools[points].Alloc();
 	else
-	{
-		w = (winding_t *)malloc(sizeof(*w));
-		w->p = (Vector *)calloc( points, sizeof(Vector) );
-	}
-	ThreadUnlock();
+		w = (winding_t *)malloc(sizeof(*w) + points*sizeof(Vector));
+	w->p = (Vector *)(w + 1);
 	w->numpoints = 0; // None are occupied yet even though allocated.
 	w->maxpoints = points;
 	w->next = NULL;
@@ -73,11 +83,35 @@ void FreeWinding (winding_t *w)
 	if (w->numpoints == 0xdeaddead)
 		Error ("FreeWinding: freed a freed winding");
 	
-	ThreadLock();
 	w->numpoints = 0xdeaddead; // flag as freed
-	w->next = winding_pool[w->maxpoints];
-	winding_pool[w->maxpoints] = w;
-	ThreadUnlock();
+	if (w->maxpoints < NUM_WINDING_POOLS)
+		s_WindingPools.m_Pools[w->maxpoints].Free(w);
+	else
+		free(w);
+}
+
+/*
+=============
+ReleaseUnusedWindings
+
+Gives the memory of freed windings back to the system
+=============
+*/
+void ReleaseUnusedWindings (void)
+{
+	for (int i=0 ; i<NUM_WINDING_POOLS ; i++)
+		s_WindingPools.m_Pools[i].ReleaseUnused();
+}
+
+void GetWindingPoolStats (ChunkPoolStats_t &stats)
+{
+	stats.Clear();
+	for (int i=0 ; i<NUM_WINDING_POOLS ; i++)
+	{
+		ChunkPoolStats_t poolStats;
+		s_WindingPools.m_Pools[i].GetStats (poolStats);
+		stats.Add (poolStats);
+	}
 }
 
 /*
@@ -62,6 +62,12 @@ void	WindingPlane (winding_t *w, Vector &normal, vec_t *dist);
 void	RemoveColinearPoints (winding_t *w);
 int		WindingOnPlaneSide (winding_t *w, const Vector &normal, vec_t dist);
 void	FreeWinding (winding_t *w);
+
+// Windings come from per size chunk pools. Call at the end of a phase to
+// give the memory of freed windings back to the system.
+struct ChunkPoolStats_t;
+void	ReleaseUnusedWindings (void);
+void	GetWindingPoolStats (ChunkPoolStats_t &stats);
 void	WindingBounds (winding_t *w, Vector &mins, Vector &maxs);
 
 void	ChopWindingInPlace (winding_t **w, const Vector &normal, vec_t dist, vec_t epsilon);
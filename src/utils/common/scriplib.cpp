@@ -16,8 +16,9 @@
 #include "xbox\xbox_win32stubs.h"
 #endif
 #if defined(POSIX)
-#include "../../filesystem/linux_support.h"
 #include <sys/stat.h>
+#include <dirent.h>
+#include <fnmatch.h>
 #endif
 /*
 =============================================================================
@@ -1219,55 +1220,49 @@ int CScriptLib::GetFileList( const char* pDirPath, const char* pPattern, CUtlVec
 
 	_findclose( h );
 #elif defined(POSIX)
-	FIND_DATA findData;
-	Q_FixSlashes( fullPath );
-	void *h = FindFirstFile( fullPath, &findData );
-	if ( (intp)h == -1 )
+	Q_FixSlashes( sourcePath );
+	const char *pMatch = bFindDirs ? "*" : pPattern;
+
+	DIR *pDir = opendir( sourcePath );
+	if ( !pDir )
 	{
 		return 0;
 	}
 
-	do
+	while ( struct dirent *pEntry = readdir( pDir ) )
 	{
-		// dos attribute complexities i.e. _A_NORMAL is 0
-		if ( bFindDirs )
-		{
-			// skip non dirs
-			if ( !( findData.dwFileAttributes & S_IFDIR ) )
-				continue;
-		}
-		else
-		{
-			// skip dirs
-			if ( findData.dwFileAttributes & S_IFDIR )
-				continue;
-		}
+		if ( !stricmp( pEntry->d_name, "." ) )
+			continue;
 
-		if ( !stricmp( findData.cFileName, "." ) )
+		if ( !stricmp( pEntry->d_name, ".." ) )
 			continue;
 
-		if ( !stricmp( findData.cFileName, ".." ) )
+		if ( fnmatch( pMatch, pEntry->d_name, FNM_CASEFOLD ) != 0 )
 			continue;
 
 		char fileName[MAX_PATH];
 		strcpy( fileName, sourcePath );
-		strcat( fileName, findData.cFileName );
+		strcat( fileName, pEntry->d_name );
+
+		struct stat statbuf;
+		if ( stat( fileName, &statbuf ) != 0 )
+			continue;
+
+		// skip dirs when finding files and files when finding dirs
+		bool bIsDir = S_ISDIR( statbuf.st_mode ) != 0;
+		if ( bIsDir != bFindDirs )
+			continue;
 
 		int j = fileList.AddToTail();
 		fileList[j].fileName.Set( fileName );
-		struct stat statbuf;
-		if ( stat( fileName, &statbuf ) )
 #ifdef OSX
-			fileList[j].timeWrite = statbuf.st_mtimespec.tv_sec;
+		fileList[j].timeWrite = statbuf.st_mtimespec.tv_sec;
 #else
-			fileList[j].timeWrite = statbuf.st_mtime;
+		fileList[j].timeWrite = statbuf.st_mtime;
 #endif
-		else
-			fileList[j].timeWrite = 0;
 	}
-	while ( !FindNextFile( h, &findData ) );
 
-	FindClose( h );
+	closedir( pDir );
 
 #else
 #error
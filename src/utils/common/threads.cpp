@@ -13,13 +13,19 @@
 
 #define	USED
 
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <unistd.h>
+#endif
 #include "cmdlib.h"
 #define NO_THREAD_NAMES
 #include "threads.h"
 #include "pacifier.h"
+#include "tier0/threadtools.h"
+#include "tier1/utlvector.h"
 
-#define	MAX_THREADS	16
+#define	MAX_THREADS	MAX_TOOL_THREADS
 
 
 class CRunThreadsData
@@ -28,6 +34,8 @@ public:
 	int m_iThread;
 	void *m_pUserData;
 	RunThreadsFn m_Fn;
+	int m_nPriority;
+	bool m_bSetPriority;
 };
 
 CRunThreadsData g_RunThreadsData[MAX_THREADS];
@@ -40,7 +48,7 @@ qboolean		pacifier;
 qboolean	threaded;
 bool g_bLowPriorityThreads = false;
 
-HANDLE g_ThreadHandles[MAX_THREADS];
+ThreadHandle_t g_ThreadHandles[MAX_THREADS];
 
 
 
@@ -74,70 +82,233 @@ int	GetThreadWork (void)
 
 ThreadWorkerFn workfunction;
 
+
+//-----------------------------------------------------------------------------
+// Work-stealing dispatch for RunThreadsOnIndividual.
+//
+// Each thread owns a contiguous range [begin,end) of g_WorkOrder. Both ends are
+// packed into a single 64-bit word so the owner and any thieves can update the
+// range with one compare-and-swap. The owner pops from the front; an idle thread
+// steals the back half of another thread's range.
+//-----------------------------------------------------------------------------
+class ALIGN128 CThreadWorkRange
+{
+public:
+	static int64 Pack( int iBegin, int iEnd )	{ return (int64)( ( (uint64)(uint32)iEnd << 32 ) | (uint32)iBegin ); }
+	static int Begin( int64 nRange )			{ return (int)(uint32)( (uint64)nRange & 0xFFFFFFFF ); }
+	static int End( int64 nRange )				{ return (int)(uint32)( (uint64)nRange >> 32 ); }
+
+	int64 volatile m_nRange;
+} ALIGN128_POST;
+
+static CThreadWorkRange g_ThreadWorkRanges[MAX_THREADS];
+static CUtlVector<int> g_WorkOrder;
+static int32 volatile g_nWorkDone;
+static int32 volatile g_nPacifierStep;	// last fortieth of the work the pacifier was moved to
+
+
+// Takes the next item from the front of iThread's own range.
+static int PopThreadWork( int iThread )
+{
+	CThreadWorkRange *pRange = &g_ThreadWorkRanges[iThread];
+	while ( 1 )
+	{
+		int64 nOld = pRange->m_nRange;
+		int iBegin = CThreadWorkRange::Begin( nOld );
+		int iEnd = CThreadWorkRange::End( nOld );
+		if ( iBegin >= iEnd )
+			return -1;
+
+		if ( ThreadInterlockedAssignIf64( &pRange->m_nRange, CThreadWorkRange::Pack( iBegin+1, iEnd ), nOld ) )
+			return g_WorkOrder[iBegin];
+	}
+}
+
+
+// Moves the back half of some other thread's range into iThread's (empty) range.
+static bool StealThreadWork( int iThread )
+{
+	for ( int i=1; i < numthreads; i++ )
+	{
+		CThreadWorkRange *pVictim = &g_ThreadWorkRanges[(iThread + i) % numthreads];
+		while ( 1 )
+		{
+			int64 nOld = pVictim->m_nRange;
+			int iBegin = CThreadWorkRange::Begin( nOld );
+			int iEnd = CThreadWorkRange::End( nOld );
+			if ( iBegin >= iEnd )
+				break;
+
+			int iSplit = iEnd - ( iEnd - iBegin + 1 ) / 2;
+			if ( ThreadInterlockedAssignIf64( &pVictim->m_nRange, CThreadWorkRange::Pack( iBegin, iSplit ), nOld ) )
+			{
+				// Nobody steals from an empty range, so only we can be writing ours now.
+				ThreadInterlockedExchange64( &g_ThreadWorkRanges[iThread].m_nRange, CThreadWorkRange::Pack( iSplit, iEnd ) );
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+
 void ThreadWorkerFunction( int iThread, void *pUserData )
 {
 	int		work;
 
 	while (1)
 	{
-		work = GetThreadWork ();
+		work = PopThreadWork( iThread );
 		if (work == -1)
-			break;
-		 
+		{
+			if ( !StealThreadWork( iThread ) )
+				break;
+			continue;
+		}
+
 		workfunction( iThread, work );
+
+		int nDone = ThreadInterlockedIncrement( &g_nWorkDone );
+		if ( pacifier )
+		{
+			// Whichever thread finishes the item that reaches the next step moves the
+			// pacifier, so it doesn't stall when one thread runs out of work early.
+			int nStep = (int)( (int64)nDone * 40 / workcount );
+			int nLastStep = g_nPacifierStep;
+			if ( nStep > nLastStep && ThreadInterlockedAssignIf( &g_nPacifierStep, nStep, nLastStep ) )
+			{
+				ThreadLock();
+				UpdatePacifier( (float)nDone / workcount );
+				ThreadUnlock();
+			}
+		}
 	}
 }
 
-void RunThreadsOnIndividual (int workcnt, qboolean showpacifier, ThreadWorkerFn func)
+
+struct WorkCost_t
+{
+	int m_iWorkItem;
+	float m_flCost;
+};
+
+static int WorkCostCompare( const void *pA, const void *pB )
+{
+	const WorkCost_t *a = (const WorkCost_t*)pA;
+	const WorkCost_t *b = (const WorkCost_t*)pB;
+
+	// Most expensive first; fall back to the item index to keep the order deterministic.
+	if ( a->m_flCost != b->m_flCost )
+		return ( a->m_flCost > b->m_flCost ) ? -1 : 1;
+	return a->m_iWorkItem - b->m_iWorkItem;
+}
+
+
+// Deals the (optionally cost-sorted) work items round-robin into per-thread ranges,
+// so every thread starts with an even share of the expensive items.
+static void SetupThreadWorkRanges( int workcnt, ThreadWorkCostFn costFn )
+{
+	CUtlVector<int> sorted;
+	sorted.SetCount( workcnt );
+
+	if ( costFn )
+	{
+		CUtlVector<WorkCost_t> costs;
+		costs.SetCount( workcnt );
+		for ( int i=0; i < workcnt; i++ )
+		{
+			costs[i].m_iWorkItem = i;
+			costs[i].m_flCost = costFn( i );
+		}
+		qsort( costs.Base(), workcnt, sizeof( WorkCost_t ), WorkCostCompare );
+
+		for ( int i=0; i < workcnt; i++ )
+			sorted[i] = costs[i].m_iWorkItem;
+	}
+	else
+	{
+		for ( int i=0; i < workcnt; i++ )
+			sorted[i] = i;
+	}
+
+	g_WorkOrder.SetCount( workcnt );
+
+	int iOut = 0;
+	for ( int iThread=0; iThread < numthreads; iThread++ )
+	{
+		int iBegin = iOut;
+		for ( int i=iThread; i < workcnt; i += numthreads )
+			g_WorkOrder[iOut++] = sorted[i];
+
+		g_ThreadWorkRanges[iThread].m_nRange = CThreadWorkRange::Pack( iBegin, iOut );
+	}
+
+	g_nWorkDone = 0;
+	g_nPacifierStep = 0;
+}
+
+
+void RunThreadsOnIndividualWithCost (int workcnt, qboolean showpacifier, ThreadWorkerFn func, ThreadWorkCostFn costFn)
 {
 	if (numthreads == -1)
 		ThreadSetDefault ();
-	
+
+	if ( numthreads > MAX_TOOL_THREADS )
+		numthreads = MAX_TOOL_THREADS;
+
 	workfunction = func;
+	SetupThreadWorkRanges( workcnt, costFn );
 	RunThreadsOn (workcnt, showpacifier, ThreadWorkerFunction);
+
+	g_WorkOrder.Purge();
+}
+
+void RunThreadsOnIndividual (int workcnt, qboolean showpacifier, ThreadWorkerFn func)
+{
+	RunThreadsOnIndividualWithCost( workcnt, showpacifier, func, NULL );
 }
 
 
 /*
 ===================================================================
 
-WIN32
+PLATFORM
 
 ===================================================================
 */
 
 int		numthreads = -1;
-CRITICAL_SECTION		crit;
+CThreadMutex	crit;
 static int enter;
 
 
-class CCritInit
-{
-public:
-	CCritInit()
-	{
-		InitializeCriticalSection (&crit);
-	}
-} g_CritInit;
-
-
-
 void SetLowPriority()
 {
+#ifdef _WIN32
 	SetPriorityClass( GetCurrentProcess(), IDLE_PRIORITY_CLASS );
+#else
+	if ( nice( 19 ) == -1 )
+		Warning( "SetLowPriority: nice() failed.\n" );
+#endif
 }
 
 
 void ThreadSetDefault (void)
 {
-	SYSTEM_INFO info;
-
 	if (numthreads == -1)	// not set manually
 	{
+#ifdef _WIN32
+		SYSTEM_INFO info;
 		GetSystemInfo (&info);
 		numthreads = info.dwNumberOfProcessors;
-		if (numthreads < 1 || numthreads > 32)
+#else
+		numthreads = (int)sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+		if (numthreads < 1)
 			numthreads = 1;
+		else if (numthreads > MAX_TOOL_THREADS)
+			numthreads = MAX_TOOL_THREADS;
 	}
 
 	Msg ("%i threads\n", numthreads);
@@ -148,7 +319,7 @@ void ThreadLock (void)
 {
 	if (!threaded)
 		return;
-	EnterCriticalSection (&crit);
+	crit.Lock();
 	if (enter)
 		Error ("Recursive ThreadLock\n");
 	enter = 1;
@@ -161,14 +332,17 @@ void ThreadUnlock (void)
 	if (!enter)
 		Error ("ThreadUnlock without lock\n");
 	enter = 0;
-	LeaveCriticalSection (&crit);
+	crit.Unlock();
 }
 
 
 // This runs in the thread and dispatches a RunThreadsFn call.
-DWORD WINAPI InternalRunThreadsFn( LPVOID pParameter )
+static uintp InternalRunThreadsFn( void *pParameter )
 {
 	CRunThreadsData *pData = (CRunThreadsData*)pParameter;
+	if ( pData->m_bSetPriority )
+		ThreadSetPriority( pData->m_nPriority );
+
 	pData->m_Fn( pData->m_iThread, pData->m_pUserData );
 	return 0;
 }
@@ -187,34 +361,38 @@ void RunThreads_Start( RunThreadsFn fn, void *pUserData, ERunThreadsPriority ePr
 		g_RunThreadsData[i].m_iThread = i;
 		g_RunThreadsData[i].m_pUserData = pUserData;
 		g_RunThreadsData[i].m_Fn = fn;
-
-		DWORD dwDummy;
-		g_ThreadHandles[i] = CreateThread(
-		   NULL,	// LPSECURITY_ATTRIBUTES lpsa,
-		   0,		// DWORD cbStack,
-		   InternalRunThreadsFn,	// LPTHREAD_START_ROUTINE lpStartAddr,
-		   &g_RunThreadsData[i],	// LPVOID lpvThreadParm,
-		   0,			// DWORD fdwCreate,
-		   &dwDummy );
+		g_RunThreadsData[i].m_bSetPriority = false;
 
 		if ( ePriority == k_eRunThreadsPriority_UseGlobalState )
 		{
 			if( g_bLowPriorityThreads )
-				SetThreadPriority( g_ThreadHandles[i], THREAD_PRIORITY_LOWEST );
+			{
+				g_RunThreadsData[i].m_bSetPriority = true;
+				g_RunThreadsData[i].m_nPriority = TP_PRIORITY_LOWEST;
+			}
 		}
 		else if ( ePriority == k_eRunThreadsPriority_Idle )
 		{
-			SetThreadPriority( g_ThreadHandles[i], THREAD_PRIORITY_IDLE );
+			g_RunThreadsData[i].m_bSetPriority = true;
+#ifdef _WIN32
+			g_RunThreadsData[i].m_nPriority = THREAD_PRIORITY_IDLE;
+#else
+			g_RunThreadsData[i].m_nPriority = TP_PRIORITY_LOWEST;
+#endif
 		}
+
+		g_ThreadHandles[i] = CreateSimpleThread( InternalRunThreadsFn, &g_RunThreadsData[i] );
 	}
 }
 
 
 void RunThreads_End()
 {
-	WaitForMultipleObjects( numthreads, g_ThreadHandles, TRUE, INFINITE );
 	for ( int i=0; i < numthreads; i++ )
-		CloseHandle( g_ThreadHandles[i] );
+	{
+		ThreadJoin( g_ThreadHandles[i] );
+		ReleaseThreadHandle( g_ThreadHandles[i] );
+	}
 
 	threaded = false;
 }
@@ -18,7 +18,7 @@
 
 // Arrays that are indexed by thread should always be MAX_TOOL_THREADS+1
 // large so THREADINDEX_MAIN can be used from the main thread.
-#define MAX_TOOL_THREADS	16
+#define MAX_TOOL_THREADS	64
 #define THREADINDEX_MAIN	(MAX_TOOL_THREADS)
 
 
@@ -30,6 +30,9 @@ extern bool	g_bLowPriorityThreads;
 typedef void (*ThreadWorkerFn)( int iThread, int iWorkItem );
 typedef void (*RunThreadsFn)( int iThread, void *pUserData );
 
+// Returns a relative estimate of how expensive a work item is. Only the ordering matters.
+typedef float (*ThreadWorkCostFn)( int iWorkItem );
+
 
 enum ERunThreadsPriority
 {
@@ -45,8 +48,14 @@ void SetLowPriority();
 void ThreadSetDefault (void);
 int	GetThreadWork (void);
 
+// Work items are split across per-thread queues and idle threads steal from busy ones,
+// so uneven per-item cost doesn't leave most threads waiting on a long tail.
 void RunThreadsOnIndividual ( int workcnt, qboolean showpacifier, ThreadWorkerFn fn );
 
+// Same as RunThreadsOnIndividual, but each thread runs its most expensive items first
+// (as estimated by costFn) and steals the cheapest ones from the others.
+void RunThreadsOnIndividualWithCost ( int workcnt, qboolean showpacifier, ThreadWorkerFn fn, ThreadWorkCostFn costFn );
+
 void RunThreadsOn ( int workcnt, qboolean showpacifier, RunThreadsFn fn, void *pUserData=NULL );
 
 // This version doesn't track work items - it just runs your function and waits for it to finish.
@@ -60,6 +69,7 @@ void ThreadUnlock (void);
 #ifndef NO_THREAD_NAMES
 #define RunThreadsOn(n,p,f) { if (p) printf("%-20s ", #f ":"); RunThreadsOn(n,p,f); }
 #define RunThreadsOnIndividual(n,p,f) { if (p) printf("%-20s ", #f ":"); RunThreadsOnIndividual(n,p,f); }
+#define RunThreadsOnIndividualWithCost(n,p,f,c) { if (p) printf("%-20s ", #f ":"); RunThreadsOnIndividualWithCost(n,p,f,c); }
 #endif
 
 #endif // THREADS_H
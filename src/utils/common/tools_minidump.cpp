@@ -5,8 +5,12 @@
 // $NoKeywords: $
 //=============================================================================//
 
+#ifdef _WIN32
 #include <windows.h>
 #include <dbghelp.h>
+#else
+#include <signal.h>
+#endif
 #include "tier0/minidump.h"
 #include "tools_minidump.h"
 
@@ -18,6 +22,7 @@ static ToolsExceptionHandler g_pCustomExceptionHandler = NULL;
 // Internal helpers.
 // --------------------------------------------------------------------------------- //
 
+#ifdef _WIN32
 static LONG __stdcall ToolsExceptionFilter( struct _EXCEPTION_POINTERS *ExceptionInfo )
 {
 	// Non VMPI workers write a minidump and show a crash dialog like normal.
@@ -36,6 +41,19 @@ static LONG __stdcall ToolsExceptionFilter_Custom( struct _EXCEPTION_POINTERS *E
 	g_pCustomExceptionHandler( ExceptionInfo->ExceptionRecord->ExceptionCode, ExceptionInfo );
 	return EXCEPTION_EXECUTE_HANDLER; // (never gets here anyway)
 }
+#else
+static const int g_ToolsCrashSignals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+
+static void ToolsSignalHandler_Custom( int sig )
+{
+	// Restore the default action first so a crash inside the handler just kills the process.
+	for ( int i=0; i < (int)ARRAYSIZE( g_ToolsCrashSignals ); i++ )
+		signal( g_ToolsCrashSignals[i], SIG_DFL );
+
+	g_pCustomExceptionHandler( sig, NULL );
+	raise( sig );
+}
+#endif
 
 
 // --------------------------------------------------------------------------------- //
@@ -50,12 +68,21 @@ void EnableFullMinidumps( bool bFull )
 
 void SetupDefaultToolsMinidumpHandler()
 {
+#ifdef _WIN32
 	SetUnhandledExceptionFilter( ToolsExceptionFilter );
+#else
+	// No minidumps here; the default signal action leaves a core file if they're enabled.
+#endif
 }
 
 
 void SetupToolsMinidumpHandler( ToolsExceptionHandler fn )
 {
 	g_pCustomExceptionHandler = fn;
+#ifdef _WIN32
 	SetUnhandledExceptionFilter( ToolsExceptionFilter_Custom );
+#else
+	for ( int i=0; i < (int)ARRAYSIZE( g_ToolsCrashSignals ); i++ )
+		signal( g_ToolsCrashSignals[i], ToolsSignalHandler_Custom );
+#endif
 }
@@ -4,8 +4,13 @@
 //
 //=============================================================================//
 
+#ifdef _WIN32
 #include <windows.h>
 #include <dbghelp.h>
+#else
+#include <signal.h>
+#include <unistd.h>
+#endif
 #include "vmpi.h"
 #include "cmdlib.h"
 #include "vmpi_tools_shared.h"
@@ -13,6 +18,7 @@
 #include "mpi_stats.h"
 #include "iphelpers.h"
 #include "tier0/minidump.h"
+#include "tier0/threadtools.h"
 
 
 // ----------------------------------------------------------------------------- //
@@ -77,15 +83,23 @@ bool SharedDispatch( MessageBuffer *pBuf, int iSource, int iPacketID )
 					char const *szFolder = NULL;
 					if ( !szFolder ) szFolder = getenv( "TEMP" );
 					if ( !szFolder ) szFolder = getenv( "TMP" );
+#ifdef _WIN32
 					if ( !szFolder ) szFolder = "c:";
+#else
+					if ( !szFolder ) szFolder = "/tmp";
+#endif
 
 					// Base module name
 					char chModuleName[_MAX_PATH], *pModuleName = chModuleName;
+#ifdef _WIN32
 					::GetModuleFileName( NULL, chModuleName, sizeof( chModuleName ) / sizeof( chModuleName[0] ) );
+#else
+					Plat_GetExecutablePath( chModuleName, sizeof( chModuleName ) );
+#endif
 
 					if ( char *pch = strrchr( chModuleName, '.' ) )
 						*pch = 0;
-					if ( char *pch = strrchr( chModuleName, '\\' ) )
+					if ( char *pch = strrchr( chModuleName, CORRECT_PATH_SEPARATOR ) )
 						*pch = 0, pModuleName = pch + 1;
 
 					// Current time
@@ -98,8 +112,9 @@ bool SharedDispatch( MessageBuffer *pBuf, int iSource, int iPacketID )
 
 					// Prepare the filename
 					char chSaveFileName[ 2 * _MAX_PATH ] = { 0 };
-					sprintf( chSaveFileName, "%s\\vmpi_%s_on_%s_%d%.2d%2d%.2d%.2d%.2d_%d.mdmp",
+					sprintf( chSaveFileName, "%s%cvmpi_%s_on_%s_%d%.2d%2d%.2d%.2d%.2d_%d.mdmp",
 						szFolder,
+						CORRECT_PATH_SEPARATOR,
 						pModuleName,
 						VMPI_GetMachineName( iSource ),
 						pTime->tm_year + 1900,	/* Year less 2000 */
@@ -182,6 +197,7 @@ void RecvDBInfo( CDBInfo *pInfo, unsigned long *pJobPrimaryID )
 
 // If the file is successfully opened, read and sent returns the size of the file in bytes
 // otherwise returns 0 and nothing is sent
+#ifdef _WIN32
 int VMPI_SendFileChunk( const void *pvChunkPrefix, int lenPrefix, tchar const *ptchFileName )
 {
 	HANDLE hFile = NULL;
@@ -226,11 +242,39 @@ done:
 
 	return iResult;
 }
+#else
+int VMPI_SendFileChunk( const void *pvChunkPrefix, int lenPrefix, tchar const *ptchFileName )
+{
+	FILE *fp = fopen( ptchFileName, "rb" );
+	if ( !fp )
+		return 0;
+
+	fseek( fp, 0, SEEK_END );
+	int iFileSize = (int)ftell( fp );
+	fseek( fp, 0, SEEK_SET );
+
+	int iResult = 0;
+	CUtlVector<char> data;
+	data.SetSize( iFileSize );
+	if ( iFileSize > 0 && fread( data.Base(), 1, iFileSize, fp ) == (size_t)iFileSize )
+	{
+		if ( VMPI_Send3Chunks(
+			pvChunkPrefix, lenPrefix,
+			&iFileSize, sizeof( iFileSize ),
+			data.Base(), iFileSize,
+			VMPI_MASTER_ID ) )
+			iResult = iFileSize;
+	}
+
+	fclose( fp );
+	return iResult;
+}
+#endif
 
 void VMPI_HandleCrash( const char *pMessage, void *pvExceptionInfo, bool bAssert )
 {
-	static LONG crashHandlerCount = 0;
-	if ( InterlockedIncrement( &crashHandlerCount ) == 1 )
+	static int32 crashHandlerCount = 0;
+	if ( ThreadInterlockedIncrement( &crashHandlerCount ) == 1 )
 	{
 		Msg( "\nFAILURE: '%s' (assert: %d)\n", pMessage, bAssert );
 
@@ -244,6 +288,7 @@ void VMPI_HandleCrash( const char *pMessage, void *pvExceptionInfo, bool bAssert
 			strlen( pMessage ) + 1,
 			VMPI_MASTER_ID );
 
+#ifdef _WIN32
 		// Now attempt to create a minidump with the given exception information
 		if ( pvExceptionInfo )
 		{
@@ -263,15 +308,17 @@ void VMPI_HandleCrash( const char *pMessage, void *pvExceptionInfo, bool bAssert
 				::DeleteFile( tchMinidumpFileName );
 			}
 		}
+#endif
 
 		// Let the messages go out.
-		Sleep( 500 );
+		ThreadSleep( 500 );
 	}
 
-	InterlockedDecrement( &crashHandlerCount );
+	ThreadInterlockedDecrement( &crashHandlerCount );
 }
 
 
+#ifdef _WIN32
 // This is called if we crash inside our crash handler. It just terminates the process immediately.
 LONG __stdcall VMPI_SecondExceptionFilter( struct _EXCEPTION_POINTERS *ExceptionInfo )
 {
@@ -337,6 +384,44 @@ void VMPI_ExceptionFilter( unsigned long uCode, void *pvExceptionInfo )
 
 	TerminateProcess( GetCurrentProcess(), 1 );
 }
+#else
+void VMPI_ExceptionFilter( unsigned long uCode, void *pvExceptionInfo )
+{
+	// The tools signal handler has already restored the default action, so crashing
+	// inside here terminates the process immediately.
+	#define ERR_RECORD( name ) { name, #name }
+	struct
+	{
+		int code;
+		const char *pReason;
+	} errors[] =
+	{
+		ERR_RECORD( SIGSEGV ),
+		ERR_RECORD( SIGBUS ),
+		ERR_RECORD( SIGFPE ),
+		ERR_RECORD( SIGILL ),
+		ERR_RECORD( SIGABRT ),
+	};
+
+	const char *pchReason = NULL;
+	char chUnknownBuffer[32];
+	for ( int i=0; ( i < (int)ARRAYSIZE( errors ) ) && !pchReason; i++ )
+	{
+		if ( errors[i].code == (int)uCode )
+			pchReason = errors[i].pReason;
+	}
+
+	if ( !pchReason )
+	{
+		sprintf( chUnknownBuffer, "Signal %lu", uCode );
+		pchReason = chUnknownBuffer;
+	}
+
+	VMPI_HandleCrash( pchReason, pvExceptionInfo, true );
+
+	_exit( 1 );
+}
+#endif
 
 
 void HandleMPIDisconnect( int procID, const char *pReason )
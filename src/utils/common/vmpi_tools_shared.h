@@ -35,8 +35,8 @@ void RecvMulticastIP( CIPAddr *pAddr );
 void VMPI_HandleCrash( const char *pMessage, void *pvExceptionInfo, bool bAssert );
 
 // Call this from an exception handler (set by SetUnhandledExceptionHandler).
-// uCode			= ExceptionInfo->ExceptionRecord->ExceptionCode.
-// pvExceptionInfo	= ExceptionInfo
+// uCode			= ExceptionInfo->ExceptionRecord->ExceptionCode (the signal number on POSIX).
+// pvExceptionInfo	= ExceptionInfo (NULL on POSIX)
 void VMPI_ExceptionFilter( unsigned long uCode, void *pvExceptionInfo );
 
 void HandleMPIDisconnect( int procID, const char *pReason );
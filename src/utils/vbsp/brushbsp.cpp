@@ -7,11 +7,16 @@
 //=============================================================================//
 
 #include "vbsp.h"
+#include "tier1/utlrbtree.h"
+#include "chunkpool.h"
 
 
-int		c_nodes;
-int		c_nonvis;
-int		c_active_brushes;
+CInterlockedInt	c_nodes;
+CInterlockedInt	c_nonvis;
+CInterlockedInt	c_active_brushes;
+
+// Number of threads BrushBSP may use. vbsp runs everything else single threaded.
+int		g_nBSPThreads = 1;
 
 // if a brush just barely pokes onto the other side,
 // let it slide by without chopping
@@ -310,21 +315,39 @@ AllocNode
 */
 node_t *AllocNode (void)
 {
-	static int s_NodeCount = 0;
+	static CInterlockedInt s_NodeCount;
 
 	node_t	*node;
 
 	node = (node_t*)malloc(sizeof(*node));
 	memset (node, 0, sizeof(*node));
-	node->id = s_NodeCount;
+	node->id = s_NodeCount++;
 	node->diskId = -1;
 
-	s_NodeCount++;
-
 	return node;
 }
 
 
+// Brushes come from one chunk pool per side count. numsides can shrink after
+// the brush was allocated, so the side count it was allocated with is kept
+// in a small header in front of it.
+#define NUM_BRUSH_POOLS		(MAX_BRUSH_SIDES+2)
+#define BRUSH_HEADER_SIZE	16
+
+class CBrushPools
+{
+public:
+	CBrushPools()
+	{
+		for (int i=0 ; i<NUM_BRUSH_POOLS ; i++)
+			m_Pools[i].Init ("brush", BRUSH_HEADER_SIZE + offsetof(bspbrush_t, sides) + i*sizeof(side_t));
+	}
+
+	CChunkPool	m_Pools[NUM_BRUSH_POOLS];
+};
+
+static CBrushPools s_BrushPools;
+
 /*
 ================
 AllocBrush
@@ -332,17 +355,22 @@ AllocBrush
 */
 bspbrush_t *AllocBrush (int numsides)
 {
-	static int s_BrushId = 0;
+	static CInterlockedInt s_BrushId;
 
 	bspbrush_t	*bb;
+	byte		*header;
 	int			c;
 
-	c = (int)&(((bspbrush_t *)0)->sides[numsides]);
-	bb = (bspbrush_t*)malloc(c);
+	c = offsetof(bspbrush_t, sides) + numsides*sizeof(side_t);
+	if (numsides < NUM_BRUSH_POOLS)
+		header = (byte*)s_BrushPools.m_Pools[numsides].Alloc();
+	else
+		header = (byte*)malloc(BRUSH_HEADER_SIZE + c);
+	*(int*)header = numsides;
+	bb = (bspbrush_t*)(header + BRUSH_HEADER_SIZE);
 	memset (bb, 0, c);
 	bb->id = s_BrushId++;
-	if (numthreads == 1)
-		c_active_brushes++;
+	c_active_brushes++;
 	return bb;
 }
 
@@ -354,13 +382,44 @@ FreeBrush
 void FreeBrush (bspbrush_t *brushes)
 {
 	int			i;
+	byte		*header;
+	int			allocsides;
 
 	for (i=0 ; i<brushes->numsides ; i++)
 		if (brushes->sides[i].winding)
 			FreeWinding(brushes->sides[i].winding);
-	free (brushes);
-	if (numthreads == 1)
-		c_active_brushes--;
+
+	header = (byte*)brushes - BRUSH_HEADER_SIZE;
+	allocsides = *(int*)header;
+	if (allocsides < NUM_BRUSH_POOLS)
+		s_BrushPools.m_Pools[allocsides].Free (header);
+	else
+		free (header);
+	c_active_brushes--;
+}
+
+/*
+================
+ReleaseUnusedBrushes
+
+Gives the memory of freed brushes back to the system
+================
+*/
+void ReleaseUnusedBrushes (void)
+{
+	for (int i=0 ; i<NUM_BRUSH_POOLS ; i++)
+		s_BrushPools.m_Pools[i].ReleaseUnused();
+}
+
+void GetBrushPoolStats (ChunkPoolStats_t &stats)
+{
+	stats.Clear();
+	for (int i=0 ; i<NUM_BRUSH_POOLS ; i++)
+	{
+		ChunkPoolStats_t poolStats;
+		s_BrushPools.m_Pools[i].GetStats (poolStats);
+		stats.Add (poolStats);
+	}
 }
 
 
@@ -839,6 +898,102 @@ qboolean CheckPlaneAgainstVolume (int pnum, node_t *node)
 	return good;
 }
 
+/*
+================
+EvaluateSplitPlane
+
+Scores splitting the brushes with pnum. Returns false if the plane
+would produce a tiny volume. Only reads the brushes, so any number
+of planes can be scored at the same time.
+================
+*/
+static qboolean EvaluateSplitPlane (bspbrush_t *brushes, node_t *node, side_t *side, int pnum, int *pvalue)
+{
+	int			value;
+	bspbrush_t	*test;
+	int			s;
+	int			front, back, both, facing, splits;
+	int			bsplits;
+	int			epsilonbrush;
+	qboolean	hintsplit = false;
+
+	if (!CheckPlaneAgainstVolume (pnum, node))
+		return false;	// would produce a tiny volume
+
+	front = 0;
+	back = 0;
+	both = 0;
+	facing = 0;
+	splits = 0;
+	epsilonbrush = 0;
+
+	for (test = brushes ; test ; test=test->next)
+	{
+		s = TestBrushToPlanenum (test, pnum, &bsplits, &hintsplit, &epsilonbrush);
+
+		splits += bsplits;
+		if (bsplits && (s&PSIDE_FACING) )
+			Error ("PSIDE_FACING with splits");
+
+		if (s & PSIDE_FACING)
+			facing++;
+		if (s & PSIDE_FRONT)
+			front++;
+		if (s & PSIDE_BACK)
+			back++;
+		if (s == PSIDE_BOTH)
+			both++;
+	}
+
+	// give a value estimate for using this plane
+	value =  5*facing - 5*splits - abs(front-back);
+//	value =  -5*splits;
+//	value =  5*facing - 5*splits;
+	if (g_MainMap->mapplanes[pnum].type < 3)
+		value+=5;		// axial is better
+	value -= epsilonbrush*1000;	// avoid!
+
+	// trans should split last
+	if ( side->surf & SURF_TRANS )
+	{
+		value -= 500;
+	}
+
+	// never split a hint side except with another hint
+	if (hintsplit && !(side->surf & SURF_HINT) )
+		value = -9999999;
+
+	// water should split first
+	if (side->contents & (CONTENTS_WATER | CONTENTS_SLIME))
+		value = 9999999;
+
+	*pvalue = value;
+	return true;
+}
+
+
+struct splitcandidate_t
+{
+	side_t		*side;
+	int			pnum;
+	int			value;
+	qboolean	valid;
+};
+
+// Candidates being scored by ScoreSplitCandidate on all threads
+static bspbrush_t						*g_pScoreBrushes;
+static node_t							*g_pScoreNode;
+static CUtlVector<splitcandidate_t>		*g_pScoreCandidates;
+
+static void ScoreSplitCandidate (int iThread, int iCandidate)
+{
+	splitcandidate_t &candidate = (*g_pScoreCandidates)[iCandidate];
+	candidate.valid = EvaluateSplitPlane (g_pScoreBrushes, g_pScoreNode, candidate.side, candidate.pnum, &candidate.value);
+}
+
+// Below this many plane/brush tests a node isn't worth waking up the other threads for
+#define MIN_PARALLEL_SPLIT_TESTS	( 1 << 16 )
+
 /*
 ================
 SelectSplitSide
@@ -846,26 +1001,28 @@ SelectSplitSide
 Using a hueristic, choses one of the sides out of the brushlist
 to partition the brushes with.
 Returns NULL if there are no valid planes to split with..
+
+Each plane is only scored once even if several sides lie on it, and
+the first best scoring plane in brush/side order wins. With
+bParallel set, large brush lists score their planes on all threads.
 ================
 */
 
-side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
+side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node, bool bParallel)
 {
-	int			value, bestvalue;
 	bspbrush_t	*brush, *test;
 	side_t		*side, *bestside;
-	int			i, j, pass, numpasses;
+	int			i, pass, numpasses;
 	int			pnum;
-	int			s;
-	int			front, back, both, facing, splits;
-	int			bsplits;
-	int			bestsplits;
-	int			epsilonbrush;
-	qboolean	hintsplit = false;
+	int			bestvalue;
+	int			numbrushes;
+
+	CUtlVector<splitcandidate_t> candidates;
+	CUtlRBTree<int, int> tested( 0, 0, DefLessFunc( int ) );
 
+	numbrushes = CountBrushList (brushes);
 	bestside = NULL;
 	bestvalue = -99999;
-	bestsplits = 0;
 
 	// the search order goes: visible-structural, nonvisible-structural
 	// If any valid plane is available in a pass, no further
@@ -873,6 +1030,7 @@ side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
 	numpasses = 2;
 	for (pass = 0 ; pass < numpasses ; pass++)
 	{
+		candidates.RemoveAll();
 		for (brush = brushes ; brush ; brush=brush->next)
 		{
 			for (i=0 ; i<brush->numsides ; i++)
@@ -885,8 +1043,6 @@ side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
 					continue;	// nothing visible, so it can't split
 				if (side->texinfo == TEXINFO_NODE)
 					continue;	// allready a node splitter
-				if (side->tested)
-					continue;	// we allready have metrics for this plane
 				if (side->surf & SURF_SKIP)
 					continue;	// skip surfaces are never chosen
 				if ( side->visible ^ (pass<1) )
@@ -895,79 +1051,40 @@ side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
 				pnum = side->planenum;
 				pnum &= ~1;	// allways use positive facing plane
 
+				if (tested.Find (pnum) != tested.InvalidIndex())
+					continue;	// we allready have metrics for this plane
+				tested.Insert (pnum);
+
 				CheckPlaneAgainstParents (pnum, node);
 
-				if (!CheckPlaneAgainstVolume (pnum, node))
-					continue;	// would produce a tiny volume
-
-				front = 0;
-				back = 0;
-				both = 0;
-				facing = 0;
-				splits = 0;
-				epsilonbrush = 0;
-
-				for (test = brushes ; test ; test=test->next)
-				{
-					s = TestBrushToPlanenum (test, pnum, &bsplits, &hintsplit, &epsilonbrush);
-
-					splits += bsplits;
-					if (bsplits && (s&PSIDE_FACING) )
-						Error ("PSIDE_FACING with splits");
-
-					test->testside = s;
-					// if the brush shares this face, don't bother
-					// testing that facenum as a splitter again
-					if (s & PSIDE_FACING)
-					{
-						facing++;
-						for (j=0 ; j<test->numsides ; j++)
-						{
-							if ( (test->sides[j].planenum&~1) == pnum)
-								test->sides[j].tested = true;
-						}
-					}
-					if (s & PSIDE_FRONT)
-						front++;
-					if (s & PSIDE_BACK)
-						back++;
-					if (s == PSIDE_BOTH)
-						both++;
-				}
-
-				// give a value estimate for using this plane
-				value =  5*facing - 5*splits - abs(front-back);
-//					value =  -5*splits;
-//					value =  5*facing - 5*splits;
-				if (g_MainMap->mapplanes[pnum].type < 3)
-					value+=5;		// axial is better
-				value -= epsilonbrush*1000;	// avoid!
-
-				// trans should split last
-				if ( side->surf & SURF_TRANS )
-				{
-					value -= 500;
-				}
-
-				// never split a hint side except with another hint
-				if (hintsplit && !(side->surf & SURF_HINT) )
-					value = -9999999;
-
-				// water should split first
-				if (side->contents & (CONTENTS_WATER | CONTENTS_SLIME))
-					value = 9999999;
-
-				// save off the side test so we don't need
-				// to recalculate it when we actually seperate
-				// the brushes
-				if (value > bestvalue)
-				{
-					bestvalue = value;
-					bestside = side;
-					bestsplits = splits;
-					for (test = brushes ; test ; test=test->next)
-						test->side = test->testside;
-				}
+				int c = candidates.AddToTail();
+				candidates[c].side = side;
+				candidates[c].pnum = pnum;
+				candidates[c].valid = false;
+			}
+		}
+
+		if (bParallel && candidates.Count() * numbrushes >= MIN_PARALLEL_SPLIT_TESTS)
+		{
+			g_pScoreBrushes = brushes;
+			g_pScoreNode = node;
+			g_pScoreCandidates = &candidates;
+			RunThreadsOnIndividual (candidates.Count(), false, ScoreSplitCandidate);
+		}
+		else
+		{
+			for (i=0 ; i<candidates.Count() ; i++)
+			{
+				ScoreSplitCandidate (0, i);
+			}
+		}
+
+		for (i=0 ; i<candidates.Count() ; i++)
+		{
+			if (candidates[i].valid && candidates[i].value > bestvalue)
+			{
+				bestvalue = candidates[i].value;
+				bestside = candidates[i].side;
 			}
 		}
 
@@ -977,20 +1094,24 @@ side_t *SelectSplitSide (bspbrush_t *brushes, node_t *node)
 		{
 			if (pass > 0)
 			{
-				if (numthreads == 1)
-					c_nonvis++;
+				c_nonvis++;
 			}
 			break;
 		}
 	}
 
-	//
-	// clear all the tested flags we set
-	//
-	for (brush = brushes ; brush ; brush=brush->next)
+	// save off the side test so we don't need
+	// to recalculate it when we actually seperate
+	// the brushes
+	if (bestside)
 	{
-		for (i=0 ; i<brush->numsides ; i++)
-			brush->sides[i].tested = false;
+		int			bsplits;
+		int			epsilonbrush = 0;
+		qboolean	hintsplit;
+
+		pnum = bestside->planenum & ~1;
+		for (test = brushes ; test ; test=test->next)
+			test->side = TestBrushToPlanenum (test, pnum, &bsplits, &hintsplit, &epsilonbrush);
 	}
 
 	return bestside;
@@ -1330,19 +1451,45 @@ BuildTree_r
 ================
 */
 
+// When building threaded, nodes with at most this many brushes are left
+// for BuildSubtree_Thread to finish
+#define MIN_TASK_BRUSHES	64
 
-node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
+struct bsptask_t
+{
+	node_t		*node;
+	bspbrush_t	*brushes;
+	int			numbrushes;
+};
+
+static CUtlVector<bsptask_t>	g_BSPTasks;
+static int						g_nMaxTaskBrushes;
+
+static node_t *BuildTree_r (node_t *node, bspbrush_t *brushes, bool bTopLevel)
 {
 	node_t		*newnode;
 	side_t		*bestside;
 	int			i;
 	bspbrush_t	*children[2];
 
-	if (numthreads == 1)
-		c_nodes++;
+	// The top of the tree is built by the main thread; defer the rest
+	if (bTopLevel)
+	{
+		int numbrushes = CountBrushList (brushes);
+		if (numbrushes <= g_nMaxTaskBrushes)
+		{
+			int t = g_BSPTasks.AddToTail();
+			g_BSPTasks[t].node = node;
+			g_BSPTasks[t].brushes = brushes;
+			g_BSPTasks[t].numbrushes = numbrushes;
+			return node;
+		}
+	}
+
+	c_nodes++;
 
 	// find the best plane to use as a splitter
-	bestside = SelectSplitSide (brushes, node);
+	bestside = SelectSplitSide (brushes, node, bTopLevel);
 
 	if (!bestside)
 	{
@@ -1374,11 +1521,53 @@ node_t *BuildTree_r (node_t *node, bspbrush_t *brushes)
 	// recursively process children
 	for (i=0 ; i<2 ; i++)
 	{
-		node->children[i] = BuildTree_r (node->children[i], children[i]);
+		node->children[i] = BuildTree_r (node->children[i], children[i], bTopLevel);
 	}
 
 	return node;
 }
+
+static void BuildSubtree_Thread (int iThread, int iTask)
+{
+	BuildTree_r (g_BSPTasks[iTask].node, g_BSPTasks[iTask].brushes, false);
+}
+
+static float BuildSubtreeCost (int iTask)
+{
+	return g_BSPTasks[iTask].numbrushes;
+}
+
+/*
+================
+BuildTree
+
+Builds the top of the tree on this thread, scoring split planes of
+big nodes on all threads, then finishes the remaining subtrees in
+parallel. Subtrees only touch their own brushes and nodes, so the
+tree comes out the same as a single threaded build.
+================
+*/
+static node_t *BuildTree (node_t *node, bspbrush_t *brushes)
+{
+	if (g_nBSPThreads <= 1)
+		return BuildTree_r (node, brushes, false);
+
+	// Leave enough subtrees for the threads to balance out
+	int numbrushes = CountBrushList (brushes);
+	g_nMaxTaskBrushes = max (MIN_TASK_BRUSHES, numbrushes / (g_nBSPThreads * 16));
+
+	int nOldThreads = numthreads;
+	numthreads = g_nBSPThreads;
+
+	g_BSPTasks.RemoveAll();
+	node = BuildTree_r (node, brushes, true);
+	qprintf ("%5i subtrees\n", g_BSPTasks.Count());
+	RunThreadsOnIndividualWithCost (g_BSPTasks.Count(), false, BuildSubtree_Thread, BuildSubtreeCost);
+	g_BSPTasks.Purge();
+
+	numthreads = nOldThreads;
+	return node;
+}
 	  
 
 //===========================================================
@@ -1447,9 +1636,9 @@ tree_t *BrushBSP (bspbrush_t *brushlist, Vector& mins, Vector& maxs)
 
 	tree->headnode = node;
 
-	node = BuildTree_r (node, brushlist);
+	node = BuildTree (node, brushlist);
 	qprintf ("%5i visible nodes\n", c_nodes/2 - c_nonvis);
-	qprintf ("%5i nonvis nodes\n", c_nonvis);
+	qprintf ("%5i nonvis nodes\n", (int)c_nonvis);
 	qprintf ("%5i leafs\n", (c_nodes+1)/2);
 #if 0
 {	// debug code
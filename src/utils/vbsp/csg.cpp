@@ -651,12 +651,313 @@ qboolean BrushGE (bspbrush_t *b1, bspbrush_t *b2)
 	return false;
 }
 
+//-----------------------------------------------------------------------------
+// Uniform grid over the brush bounds used by ChopBrushes to find the brushes
+// that can touch a brush without testing the whole list. chopkey tracks the
+// list order: CullList reverses the list, which just flips m_nDir.
+//-----------------------------------------------------------------------------
+#define CHOPGRID_MAX_CELLS			64		// per axis
+#define CHOPGRID_MIN_CELL_SIZE		128.0f
+#define CHOPGRID_MAX_BRUSH_CELLS	64		// bigger brushes are kept on a separate list
+
+class CChopGrid
+{
+public:
+	void	Init( bspbrush_t *list );
+
+	// Adds a brush at the tail of the list
+	void	Insert( bspbrush_t *brush );
+	void	Remove( bspbrush_t *brush );
+
+	// The list was reversed
+	void	Reverse()	{ m_nDir = -m_nDir; }
+
+	bool	IsOversize( bspbrush_t *brush ) const;
+
+	// Brushes after b1 in the list whose bounds overlap it, in list order
+	void	GetCandidates( bspbrush_t *b1, CUtlVector<bspbrush_t*> &candidates ) const;
+
+private:
+	int		CellRange( bspbrush_t *brush, int mins[3], int maxs[3] ) const;
+	CUtlVector<bspbrush_t*> &Cell( int x, int y, int z )	{ return m_Cells[ ( z * m_nCells[1] + y ) * m_nCells[0] + x ]; }
+	const CUtlVector<bspbrush_t*> &Cell( int x, int y, int z ) const	{ return m_Cells[ ( z * m_nCells[1] + y ) * m_nCells[0] + x ]; }
+
+	Vector	m_Origin;
+	Vector	m_CellSize;
+	int		m_nCells[3];
+	CUtlVector< CUtlVector<bspbrush_t*> > m_Cells;
+	CUtlVector<bspbrush_t*> m_Oversize;
+
+	int		m_nDir;
+	int		m_nMinKey;
+	int		m_nMaxKey;
+};
+
+void CChopGrid::Init( bspbrush_t *list )
+{
+	Vector mins, maxs;
+	ClearBounds( mins, maxs );
+	for ( bspbrush_t *b = list; b; b = b->next )
+	{
+		if ( b->mins[0] <= b->maxs[0] )
+		{
+			AddPointToBounds( b->mins, mins, maxs );
+			AddPointToBounds( b->maxs, mins, maxs );
+		}
+	}
+	if ( mins[0] > maxs[0] )
+	{
+		mins.Init();
+		maxs.Init();
+	}
+
+	int nTotalCells = 1;
+	for ( int i = 0; i < 3; i++ )
+	{
+		float flSize = maxs[i] - mins[i];
+		m_CellSize[i] = max( CHOPGRID_MIN_CELL_SIZE, flSize / CHOPGRID_MAX_CELLS );
+		m_nCells[i] = clamp( (int)ceil( flSize / m_CellSize[i] ), 1, CHOPGRID_MAX_CELLS );
+		nTotalCells *= m_nCells[i];
+	}
+	m_Origin = mins;
+	m_Cells.SetCount( nTotalCells );
+
+	m_nDir = 1;
+	m_nMinKey = 0;
+	m_nMaxKey = -1;
+	for ( bspbrush_t *b = list; b; b = b->next )
+	{
+		Insert( b );
+	}
+}
+
+int CChopGrid::CellRange( bspbrush_t *brush, int mins[3], int maxs[3] ) const
+{
+	int nCells = 1;
+	for ( int i = 0; i < 3; i++ )
+	{
+		mins[i] = clamp( (int)floor( ( brush->mins[i] - m_Origin[i] ) / m_CellSize[i] ), 0, m_nCells[i] - 1 );
+		maxs[i] = clamp( (int)floor( ( brush->maxs[i] - m_Origin[i] ) / m_CellSize[i] ), 0, m_nCells[i] - 1 );
+		nCells *= max( maxs[i] - mins[i] + 1, 0 );
+	}
+	return nCells;
+}
+
+bool CChopGrid::IsOversize( bspbrush_t *brush ) const
+{
+	int mins[3], maxs[3];
+	return CellRange( brush, mins, maxs ) > CHOPGRID_MAX_BRUSH_CELLS;
+}
+
+void CChopGrid::Insert( bspbrush_t *brush )
+{
+	brush->chopkey = ( m_nDir > 0 ) ? ++m_nMaxKey : --m_nMinKey;
+
+	int mins[3], maxs[3];
+	if ( CellRange( brush, mins, maxs ) > CHOPGRID_MAX_BRUSH_CELLS )
+	{
+		m_Oversize.AddToTail( brush );
+		return;
+	}
+
+	for ( int z = mins[2]; z <= maxs[2]; z++ )
+		for ( int y = mins[1]; y <= maxs[1]; y++ )
+			for ( int x = mins[0]; x <= maxs[0]; x++ )
+				Cell( x, y, z ).AddToTail( brush );
+}
+
+void CChopGrid::Remove( bspbrush_t *brush )
+{
+	int mins[3], maxs[3];
+	if ( CellRange( brush, mins, maxs ) > CHOPGRID_MAX_BRUSH_CELLS )
+	{
+		m_Oversize.FindAndFastRemove( brush );
+		return;
+	}
+
+	for ( int z = mins[2]; z <= maxs[2]; z++ )
+		for ( int y = mins[1]; y <= maxs[1]; y++ )
+			for ( int x = mins[0]; x <= maxs[0]; x++ )
+				Cell( x, y, z ).FindAndFastRemove( brush );
+}
+
+static int ChopKeyCompare( bspbrush_t * const *a, bspbrush_t * const *b )
+{
+	return (*a)->chopkey - (*b)->chopkey;
+}
+
+void CChopGrid::GetCandidates( bspbrush_t *b1, CUtlVector<bspbrush_t*> &candidates ) const
+{
+	int mins[3], maxs[3];
+	int i, j;
+
+	candidates.RemoveAll();
+	CellRange( b1, mins, maxs );
+
+	for ( int z = mins[2]; z <= maxs[2]; z++ )
+		for ( int y = mins[1]; y <= maxs[1]; y++ )
+			for ( int x = mins[0]; x <= maxs[0]; x++ )
+			{
+				const CUtlVector<bspbrush_t*> &cell = Cell( x, y, z );
+				for ( i = 0; i < cell.Count(); i++ )
+					candidates.AddToTail( cell[i] );
+			}
+	candidates.AddVectorToTail( m_Oversize );
+
+	// Keep the brushes after b1 whose bounds overlap it, same as the box test in BrushesDisjoint
+	for ( i = candidates.Count() - 1; i >= 0; --i )
+	{
+		bspbrush_t *b2 = candidates[i];
+		bool bKeep = ( b2->chopkey - b1->chopkey ) * m_nDir > 0;
+		for ( j = 0; bKeep && j < 3; j++ )
+		{
+			if ( b1->mins[j] >= b2->maxs[j] || b1->maxs[j] <= b2->mins[j] )
+				bKeep = false;
+		}
+		if ( !bKeep )
+			candidates.FastRemove( i );
+	}
+
+	// List order, without the brushes found in several cells
+	candidates.Sort( ChopKeyCompare );
+	if ( m_nDir < 0 )
+	{
+		for ( i = 0, j = candidates.Count() - 1; i < j; i++, j-- )
+			V_swap( candidates[i], candidates[j] );
+	}
+	for ( i = candidates.Count() - 1; i > 0; --i )
+	{
+		if ( candidates[i] == candidates[i-1] )
+			candidates.Remove( i );
+	}
+}
+
+
+/*
+=================
+ChopBrushPair
+
+Lets b1 and b2 bite each other. Returns true if the list changed,
+in which case it has been rebuilt (and reversed) by CullList.
+=================
+*/
+static bool ChopBrushPair (bspbrush_t *b1, bspbrush_t *b2, bspbrush_t **head, bspbrush_t **tail, CChopGrid *grid)
+{
+	bspbrush_t	*sub, *sub2, *walk;
+	int			c1, c2;
+
+	if (BrushesDisjoint (b1, b2))
+		return false;
+
+	sub = NULL;
+	sub2 = NULL;
+	c1 = 999999;
+	c2 = 999999;
+
+	if ( BrushGE (b2, b1) )
+	{
+//		printf( "b2 bites b1\n" );
+		sub = SubtractBrush (b1, b2);
+		if (sub == b1)
+			return false;		// didn't really intersect
+		if (!sub)
+		{	// b1 is swallowed by b2
+			if (grid)
+			{
+				grid->Remove (b1);
+				grid->Reverse ();
+			}
+			*head = CullList (b1, b1);
+			return true;
+		}
+		c1 = CountBrushList (sub);
+	}
+
+	if ( BrushGE (b1, b2) )
+	{
+//		printf( "b1 bites b2\n" );
+		sub2 = SubtractBrush (b2, b1);
+		if (sub2 == b2)
+		{
+			FreeBrushList (sub);
+			return false;		// didn't really intersect
+		}
+		if (!sub2)
+		{	// b2 is swallowed by b1
+			FreeBrushList (sub);
+			if (grid)
+			{
+				grid->Remove (b2);
+				grid->Reverse ();
+			}
+			*head = CullList (b1, b2);
+			return true;
+		}
+		c2 = CountBrushList (sub2);
+	}
+
+	if (!sub && !sub2)
+		return false;		// neither one can bite
+
+	// only accept if it didn't fragment
+	// (commening this out allows full fragmentation)
+	if (c1 > 1 && c2 > 1)
+	{
+		const int contents1 = b1->original->contents;
+		const int contents2 = b2->original->contents;
+		// if both detail, allow fragmentation
+		if ( !((contents1&contents2) & CONTENTS_DETAIL) && !((contents1|contents2) & CONTENTS_AREAPORTAL) )
+		{
+			if (sub2)
+				FreeBrushList (sub2);
+			if (sub)
+				FreeBrushList (sub);
+			return false;
+		}
+	}
+
+	if (c1 < c2)
+	{
+		if (sub2)
+			FreeBrushList (sub2);
+		if (grid)
+		{
+			for (walk = sub ; walk ; walk = walk->next)
+				grid->Insert (walk);
+			grid->Remove (b1);
+			grid->Reverse ();
+		}
+		*tail = AddBrushListToTail (sub, *tail);
+		*head = CullList (b1, b1);
+	}
+	else
+	{
+		if (sub)
+			FreeBrushList (sub);
+		if (grid)
+		{
+			for (walk = sub2 ; walk ; walk = walk->next)
+				grid->Insert (walk);
+			grid->Remove (b2);
+			grid->Reverse ();
+		}
+		*tail = AddBrushListToTail (sub2, *tail);
+		*head = CullList (b1, b2);
+	}
+	return true;
+}
+
 /*
 =================
 ChopBrushes
 
 Carves any intersecting solid brushes into the minimum number
 of non-intersecting brushes. 
+
+Unless -nochopgrid is used, each brush is only tested against the
+brushes whose bounds overlap it, found with a grid. The pairs are
+visited in the same order as the full pairwise test, so the output
+is identical.
 =================
 */
 bspbrush_t *ChopBrushes (bspbrush_t *head)
@@ -664,18 +965,29 @@ bspbrush_t *ChopBrushes (bspbrush_t *head)
 	bspbrush_t	*b1, *b2, *next;
 	bspbrush_t	*tail;
 	bspbrush_t	*keep;
-	bspbrush_t	*sub, *sub2;
-	int			c1, c2;
+	CChopGrid	chopGrid;
+	CChopGrid	*grid = NULL;
+	CUtlVector<bspbrush_t*> candidates;
+	int			i;
+	double		start;
 
 	qprintf ("---- ChopBrushes ----\n");
 	qprintf ("original brushes: %i\n", CountBrushList (head));
 
+	start = Plat_FloatTime();
+
 #if DEBUG_BRUSHMODEL
 	if (entity_num == DEBUG_BRUSHMODEL)
 		WriteBrushList ("before.gl", head, false);
 #endif
 	keep = NULL;
 
+	if (!nochopgrid)
+	{
+		chopGrid.Init (head);
+		grid = &chopGrid;
+	}
+
 newlist:
 	// find tail
 	if (!head)
@@ -686,90 +998,35 @@ newlist:
 	for (b1=head ; b1 ; b1=next)
 	{
 		next = b1->next;
-		for (b2=b1->next ; b2 ; b2 = b2->next)
+		if (grid && !grid->IsOversize (b1))
 		{
-			if (BrushesDisjoint (b1, b2))
-				continue;
-
-			sub = NULL;
-			sub2 = NULL;
-			c1 = 999999;
-			c2 = 999999;
-
-			if ( BrushGE (b2, b1) )
+			b2 = NULL;
+			grid->GetCandidates (b1, candidates);
+			for (i=0 ; i<candidates.Count() ; i++)
 			{
-//				printf( "b2 bites b1\n" );
-				sub = SubtractBrush (b1, b2);
-				if (sub == b1)
-					continue;		// didn't really intersect
-				if (!sub)
-				{	// b1 is swallowed by b2
-					head = CullList (b1, b1);
+				if (ChopBrushPair (b1, candidates[i], &head, &tail, grid))
 					goto newlist;
-				}
-				c1 = CountBrushList (sub);
 			}
-
-			if ( BrushGE (b1, b2) )
+		}
+		else
+		{
+			for (b2=b1->next ; b2 ; b2 = b2->next)
 			{
-//				printf( "b1 bites b2\n" );
-				sub2 = SubtractBrush (b2, b1);
-				if (sub2 == b2)
-					continue;		// didn't really intersect
-				if (!sub2)
-				{	// b2 is swallowed by b1
-					FreeBrushList (sub);
-					head = CullList (b1, b2);
+				if (ChopBrushPair (b1, b2, &head, &tail, grid))
 					goto newlist;
-				}
-				c2 = CountBrushList (sub2);
-			}
-
-			if (!sub && !sub2)
-				continue;		// neither one can bite
-
-			// only accept if it didn't fragment
-			// (commening this out allows full fragmentation)
-			if (c1 > 1 && c2 > 1)
-			{
-				const int contents1 = b1->original->contents;
-				const int contents2 = b2->original->contents;
-				// if both detail, allow fragmentation
-				if ( !((contents1&contents2) & CONTENTS_DETAIL) && !((contents1|contents2) & CONTENTS_AREAPORTAL) )
-				{
-					if (sub2)
-						FreeBrushList (sub2);
-					if (sub)
-						FreeBrushList (sub);
-					continue;
-				}
-			}
-
-			if (c1 < c2)
-			{
-				if (sub2)
-					FreeBrushList (sub2);
-				tail = AddBrushListToTail (sub, tail);
-				head = CullList (b1, b1);
-				goto newlist;
-			}
-			else
-			{
-				if (sub)
-					FreeBrushList (sub);
-				tail = AddBrushListToTail (sub2, tail);
-				head = CullList (b1, b2);
-				goto newlist;
 			}
 		}
 
 		if (!b2)
 		{	// b1 is no longer intersecting anything, so keep it
+			if (grid)
+				grid->Remove (b1);
 			b1->next = keep;
 			keep = b1;
 		}
 	}
 
+	qprintf ("chop time: %.2f seconds\n", Plat_FloatTime() - start);
 	qprintf ("output brushes: %i\n", CountBrushList (keep));
 #if DEBUG_BRUSHMODEL
 	if ( entity_num == DEBUG_BRUSHMODEL )
@@ -14,6 +14,7 @@
 #include "mstristrip.h"
 #include "tier1/strtools.h"
 #include "materialpatch.h"
+#include "chunkpool.h"
 /*
 
   some faces will be removed before saving, but still form nodes:
@@ -789,13 +790,15 @@ face_t *FixTjuncs (node_t *headnode, face_t *pLeafFaceList)
 
 int		c_faces;
 
+static CChunkPool s_FacePool ("face", sizeof(face_t));
+
 face_t	*AllocFace (void)
 {
 	static int s_FaceId = 0;
 
 	face_t	*f;
 
-	f = (face_t*)malloc(sizeof(*f));
+	f = (face_t*)s_FacePool.Alloc();
 	memset (f, 0, sizeof(*f));
 	f->id = s_FaceId;
 	++s_FaceId;
@@ -821,10 +824,27 @@ void FreeFace (face_t *f)
 {
 	if (f->w)
 		FreeWinding (f->w);
-	free (f);
+	s_FacePool.Free (f);
 	c_faces--;
 }
 
+/*
+================
+ReleaseUnusedFaces
+
+Gives the memory of freed faces back to the system
+================
+*/
+void ReleaseUnusedFaces (void)
+{
+	s_FacePool.ReleaseUnused();
+}
+
+void GetFacePoolStats (ChunkPoolStats_t &stats)
+{
+	s_FacePool.GetStats (stats);
+}
+
 
 void FreeFaceList( face_t *pFaces )
 {
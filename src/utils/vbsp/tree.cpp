@@ -7,7 +7,7 @@
 //=============================================================================//
 #include "vbsp.h"
 
-extern	int	c_nodes;
+extern	CInterlockedInt	c_nodes;
 
 void RemovePortalFromNode (portal_t *portal, node_t *l);
 
@@ -19,6 +19,7 @@
 #include "loadcmdline.h"
 #include "byteswap.h"
 #include "worldvertextransitionfixup.h"
+#include "chunkpool.h"
 
 extern float		g_maxLightmapDimension;
 
@@ -38,6 +39,7 @@ qboolean	nomerge;
 qboolean	nomergewater = false;
 qboolean	nowater;
 qboolean	nocsg;
+qboolean	nochopgrid;
 qboolean	noweld;
 qboolean	noshare;
 qboolean	nosubdiv;
@@ -146,6 +148,33 @@ node_t	*BlockTree (int xl, int yl, int xh, int yh)
 	return node;
 }
 
+/*
+============
+EndAllocPhase
+
+Gives the brush, face and winding memory freed during a phase
+back to the system and prints the allocator stats with -verbose.
+============
+*/
+static void EndAllocPhase (const char *pPhaseName)
+{
+	ReleaseUnusedBrushes ();
+	ReleaseUnusedFaces ();
+	ReleaseUnusedWindings ();
+
+	if (!verbose)
+		return;
+
+	ChunkPoolStats_t stats;
+	qprintf ("--- memory after %s ---\n", pPhaseName);
+	GetBrushPoolStats (stats);
+	PrintChunkPoolStats ("brushes", stats);
+	GetFacePoolStats (stats);
+	PrintChunkPoolStats ("faces", stats);
+	GetWindingPoolStats (stats);
+	PrintChunkPoolStats ("windings", stats);
+}
+
 /*
 ============
 ProcessBlock_Thread
@@ -259,6 +288,7 @@ void ProcessWorldModel (void)
 
 		RunThreadsOnIndividual ((block_xh-block_xl+1)*(block_yh-block_yl+1),
 			!verbose, ProcessBlock_Thread);
+		EndAllocPhase ("CSG/BSP");
 
 		//
 		// build the division tree
@@ -326,6 +356,7 @@ void ProcessWorldModel (void)
 	// it also subdivides each face if necessary to fit max lightmap dimensions
 	MakeFaces (tree->headnode);
 	Msg("done (%d)\n", (int)(Plat_FloatTime() - start) );
+	EndAllocPhase ("face merge");
 
 	if (glview)
 	{
@@ -369,6 +400,7 @@ void ProcessWorldModel (void)
 
 	FreeTree( tree );
 	FreeLeafFaces( pLeafFaceList );
+	EndAllocPhase ("world model");
 }
 
 /*
@@ -428,6 +460,7 @@ void ProcessSubModel( )
 #endif
 
 	FreeTree (tree);
+	EndAllocPhase ("model");
 }
 
 
@@ -934,6 +967,11 @@ int RunVBSP( int argc, char **argv )
 			Msg ("nocsg = true\n");
 			nocsg = true;
 		}
+		else if (!Q_stricmp(argv[i], "-nochopgrid"))
+		{
+			Msg ("nochopgrid = true\n");
+			nochopgrid = true;
+		}
 		else if (!Q_stricmp(argv[i], "-noshare"))
 		{
 			Msg ("noshare = true\n");
@@ -1201,6 +1239,9 @@ int RunVBSP( int argc, char **argv )
 				"  -verboseentities: If -v is on, this disables verbose output for submodels.\n"
 				"  -noweld      : Don't join face vertices together.\n"
 				"  -nocsg       : Don't chop out intersecting brush areas.\n"
+				"  -nochopgrid  : Test every brush pair when chopping out intersecting brush\n"
+				"                 areas instead of only the ones that overlap. Same output,\n"
+				"                 for timing comparisons.\n"
 				"  -noshare     : Emit unique face edges instead of sharing them.\n"
 				"  -notjunc     : Don't fixup t-junctions.\n"
 				"  -noopt       : By default, vbsp removes the 'outer shell' of the map, which\n"
@@ -1277,6 +1318,7 @@ int RunVBSP( int argc, char **argv )
 	}
 
 	ThreadSetDefault ();
+	g_nBSPThreads = numthreads;	// BrushBSP builds subtrees in parallel
 	numthreads = 1;		// multiple threads aren't helping...
 
 	// Setup the logfile.
@@ -180,6 +180,7 @@ struct bspbrush_t
 	bspbrush_t			*next;
 	Vector	            mins, maxs;
 	int		            side, testside;		// side of node during construction
+	int					chopkey;			// list position during ChopBrushes
 	mapbrush_t	        *original;
 	int		            numsides;
 	side_t	            sides[6];			// variably sized
@@ -354,6 +355,7 @@ extern	qboolean	noweld;
 extern	qboolean	noshare;
 extern	qboolean	notjunc;
 extern	qboolean	nocsg;
+extern	qboolean	nochopgrid;
 extern	qboolean	noopt;
 extern  qboolean	dumpcollide;
 extern	qboolean	nodetailcuts;
@@ -474,6 +476,8 @@ node_t *AllocNode (void);
 bspbrush_t *AllocBrush (int numsides);
 int	CountBrushList (bspbrush_t *brushes);
 void FreeBrush (bspbrush_t *brushes);
+void ReleaseUnusedBrushes (void);
+void GetBrushPoolStats (ChunkPoolStats_t &stats);
 vec_t BrushVolume (bspbrush_t *brush);
 node_t *NodeForPoint (node_t *node, Vector& origin);
 
@@ -483,6 +487,8 @@ node_t	*PointInLeaf (node_t *node, Vector& point);
 
 tree_t *BrushBSP (bspbrush_t *brushlist, Vector& mins, Vector& maxs);
 
+extern int g_nBSPThreads;	// threads used by BrushBSP
+
 #define	PSIDE_FRONT			1
 #define	PSIDE_BACK			2
 #define	PSIDE_BOTH			(PSIDE_FRONT|PSIDE_BACK)
@@ -562,6 +568,8 @@ face_t *FixTjuncs( node_t *headnode, face_t *pLeafFaceList );
 face_t	*AllocFace (void);
 void FreeFace (face_t *f);
 void FreeFaceList( face_t *pFaces );
+void ReleaseUnusedFaces (void);
+void GetFacePoolStats (ChunkPoolStats_t &stats);
 
 void MergeFaceList(face_t **pFaceList);
 void SubdivideFaceList(face_t **pFaceList);
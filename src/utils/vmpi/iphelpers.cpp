@@ -6,10 +6,30 @@
 //
 //=============================================================================//
 
+#if defined( _WIN32 )
 #pragma warning (disable:4127)
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #pragma warning (default:4127)
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+typedef int SOCKET;
+typedef struct timeval TIMEVAL;
+#define INVALID_SOCKET	-1
+#define SOCKET_ERROR	-1
+#define closesocket		close
+#endif
 
 #include "iphelpers.h"
 #include "basetypes.h"
@@ -19,6 +39,7 @@
 #include "tier1/strtools.h"
 #include "tier0/fasttimer.h"
 
+#if defined( _WIN32 )
 // This automatically calls WSAStartup for the app at startup.
 class CIPStarter
 {
@@ -30,6 +51,7 @@ public:
 	}
 };
 static CIPStarter g_Starter;
+#endif
 
 
 unsigned long SampleMilliseconds()
@@ -269,8 +291,13 @@ public:
 
 		// Nonblocking please..
 		int status;
+#if defined( _WIN32 )
 		DWORD val = 1;
 		status = ioctlsocket( sock, FIONBIO, &val );
+#else
+		status = fcntl( sock, F_SETFL, fcntl( sock, F_GETFL, 0 ) | O_NONBLOCK );
+		status = ( status == -1 ) ? -1 : 0;
+#endif
 		if ( status != 0 )
 		{
 			assert( false );
@@ -352,7 +379,7 @@ public:
 		// Make sure we're setup to broadcast.
 		if ( !m_bSetupToBroadcast )
 		{
-			BOOL bBroadcast = true;
+			int bBroadcast = 1;
 			if ( setsockopt( m_Socket, SOL_SOCKET, SO_BROADCAST, (char*)&bBroadcast, sizeof( bBroadcast ) ) != 0 )
 			{
 				assert( false );
@@ -375,6 +402,7 @@ public:
 
 	virtual bool SendChunksTo( const CIPAddr *pAddr, void const * const *pChunks, const int *pChunkLengths, int nChunks )
 	{
+#if defined( _WIN32 )
 		WSABUF bufs[32];
 		if ( nChunks > 32 )
 		{
@@ -409,6 +437,37 @@ public:
 			);
 
 		return ret == 0 && (int)dwNumBytesSent == nTotalBytes;
+#else
+		struct iovec bufs[32];
+		if ( nChunks > 32 )
+		{
+			Error( "CIPSocket::SendChunksTo: too many chunks (%d).", nChunks );
+		}
+
+		int nTotalBytes = 0;
+		for ( int i=0; i < nChunks; i++ )
+		{
+			bufs[i].iov_len = pChunkLengths[i];
+			bufs[i].iov_base = (void*)pChunks[i];
+			nTotalBytes += pChunkLengths[i];
+		}
+
+		assert( m_Socket != INVALID_SOCKET );
+
+		// Translate the address.
+		sockaddr_in addr;
+		IPAddrToSockAddr( pAddr, &addr );
+
+		struct msghdr msg;
+		memset( &msg, 0, sizeof( msg ) );
+		msg.msg_name = &addr;
+		msg.msg_namelen = sizeof( addr );
+		msg.msg_iov = bufs;
+		msg.msg_iovlen = nChunks;
+
+		ssize_t nSent = sendmsg( m_Socket, &msg, 0 );
+		return nSent == nTotalBytes;
+#endif
 	}
 
 	virtual int		RecvFrom( void *pData, int maxDataLen, CIPAddr *pFrom )
@@ -416,19 +475,19 @@ public:
 		assert( m_Socket != INVALID_SOCKET );
 
 		fd_set readSet;
-		readSet.fd_count = 1;
-		readSet.fd_array[0] = m_Socket;
+		FD_ZERO( &readSet );
+		FD_SET( m_Socket, &readSet );
 
 		TIMEVAL timeVal = SetupTimeVal( 0 );
 
 		// See if it has a packet waiting.
-		int status = select( 0, &readSet, NULL, NULL, &timeVal );
+		int status = select( m_Socket + 1, &readSet, NULL, NULL, &timeVal );
 		if ( status == 0 || status == SOCKET_ERROR )
 			return -1;
 
 		// Get the data.
 		sockaddr_in sender;
-		int fromSize = sizeof( sockaddr_in );
+		socklen_t fromSize = sizeof( sockaddr_in );
 		status = recvfrom( m_Socket, (char*)pData, maxDataLen, 0, (struct sockaddr*)&sender, &fromSize );
 		if ( status == 0 || status == SOCKET_ERROR )
 		{
@@ -524,7 +583,7 @@ bool ConvertStringToIPAddr( const char *pStr, CIPAddr *pOut )
 	if ( pColon )
 	{
 		int toCopy = pColon - pStr;
-		if ( toCopy < 2 || toCopy > sizeof(ipStr)-1 )
+		if ( toCopy < 2 || toCopy > (int)sizeof(ipStr)-1 )
 		{
 			assert( false );
 			return false;
@@ -571,12 +630,9 @@ bool ConvertStringToIPAddr( const char *pStr, CIPAddr *pOut )
 bool ConvertIPAddrToString( const CIPAddr *pIn, char *pOut, int outLen )
 {
 	in_addr addr;
-	addr.S_un.S_un_b.s_b1 = pIn->ip[0];
-	addr.S_un.S_un_b.s_b2 = pIn->ip[1];
-	addr.S_un.S_un_b.s_b3 = pIn->ip[2];
-	addr.S_un.S_un_b.s_b4 = pIn->ip[3];
+	IPAddrToInAddr( pIn, &addr );
 
-	HOSTENT *pEnt = gethostbyaddr( (char*)&addr, sizeof( addr ), AF_INET );
+	struct hostent *pEnt = gethostbyaddr( (char*)&addr, sizeof( addr ), AF_INET );
 	if ( pEnt )
 	{
 		Q_strncpy( pOut, pEnt->h_name, outLen );
@@ -591,6 +647,9 @@ bool ConvertIPAddrToString( const CIPAddr *pIn, char *pOut, int outLen )
 
 void IP_GetLastErrorString( char *pStr, int maxLen )
 {
+#if !defined( _WIN32 )
+	Q_strncpy( pStr, strerror( errno ), maxLen );
+#else
 	char *lpMsgBuf;
 	FormatMessage( 
 		FORMAT_MESSAGE_ALLOCATE_BUFFER | 
@@ -606,5 +665,6 @@ void IP_GetLastErrorString( char *pStr, int maxLen )
 
 	Q_strncpy( pStr, lpMsgBuf, maxLen );
 	LocalFree( lpMsgBuf );	
+#endif
 }
 
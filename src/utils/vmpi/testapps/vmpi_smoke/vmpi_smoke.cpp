@@ -0,0 +1,102 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Runs a couple of DistributeWork passes over VMPI so the transport
+//			can be checked without a map.
+//
+//			vmpi_smoke -mpi_LocalWorkers 2
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+
+#include "tier0/platform.h"
+#include "tier0/dbg.h"
+#include "tier0/threadtools.h"
+#include "cmdlib.h"
+#include "threads.h"
+#include "vmpi.h"
+#include "vmpi_distribute_work.h"
+#include "messbuf.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define SMOKE_NUM_WORK_UNITS	2000
+#define SMOKE_NUM_PASSES		2
+
+
+static uint64 g_WorkUnitResults[SMOKE_NUM_WORK_UNITS];
+
+
+static uint64 CalcWorkUnitResult( uint64 iWorkUnit )
+{
+	return iWorkUnit * iWorkUnit + 7;
+}
+
+
+static void HandleMPIDisconnect( int procID, const char *pReason )
+{
+	// The workers can't do anything without the master.
+	if ( !g_bMPIMaster && procID == 0 )
+	{
+		Msg( "Master disconnected (%s).\n", pReason );
+		exit( 0 );
+	}
+}
+
+
+static void ProcessSmokeWorkUnit( int iThread, uint64 iWorkUnit, MessageBuffer *pBuf )
+{
+	// Take long enough that every worker gets some of the work units.
+	ThreadSleep( 1 );
+
+	uint64 result = CalcWorkUnitResult( iWorkUnit );
+	if ( pBuf )
+		pBuf->write( &result, sizeof( result ) );
+	else
+		g_WorkUnitResults[iWorkUnit] = result;
+}
+
+
+static void ReceiveSmokeWorkUnit( uint64 iWorkUnit, MessageBuffer *pBuf, int iWorker )
+{
+	if ( pBuf->getLen() - pBuf->getOffset() != sizeof( uint64 ) )
+		Error( "Invalid packet in ReceiveSmokeWorkUnit." );
+
+	pBuf->read( &g_WorkUnitResults[iWorkUnit], sizeof( uint64 ) );
+}
+
+
+int main( int argc, char **argv )
+{
+	ThreadSetDefault();
+
+	if ( !VMPI_Init( argc, argv, "dependency_info_vmpi_smoke.txt", HandleMPIDisconnect, VMPI_RUN_NETWORKED ) )
+	{
+		Error( "MPI_Init failed." );
+	}
+
+	int nBadPasses = 0;
+	for ( int iPass=0; iPass < SMOKE_NUM_PASSES; iPass++ )
+	{
+		memset( g_WorkUnitResults, 0, sizeof( g_WorkUnitResults ) );
+
+		double elapsed = DistributeWork( SMOKE_NUM_WORK_UNITS, ProcessSmokeWorkUnit, ReceiveSmokeWorkUnit );
+		if ( !g_bMPIMaster )
+			continue;
+
+		int nBadResults = 0;
+		for ( uint64 i=0; i < SMOKE_NUM_WORK_UNITS; i++ )
+		{
+			if ( g_WorkUnitResults[i] != CalcWorkUnitResult( i ) )
+				++nBadResults;
+		}
+
+		Msg( "Pass %d: %d work units in %.2f seconds, %d bad.\n", iPass, SMOKE_NUM_WORK_UNITS, elapsed, nBadResults );
+		if ( nBadResults )
+			++nBadPasses;
+	}
+
+	VMPI_Finalize();
+	return nBadPasses ? 1 : 0;
+}
@@ -5,9 +5,12 @@
 // $NoKeywords: $
 //=============================================================================//
 
+#if defined( _WIN32 )
 #include <windows.h>
+#endif
 #include "threadhelpers.h"
 #include "tier0/dbg.h"
+#include "tier0/threadtools.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -16,6 +19,8 @@
 // CVMPICriticalSection implementation.
 // -------------------------------------------------------------------------------- //
 
+#if defined( _WIN32 )
+
 CVMPICriticalSection::CVMPICriticalSection()
 {
 	Assert( sizeof( CRITICAL_SECTION ) == SIZEOF_CS );
@@ -69,6 +74,71 @@ void CVMPICriticalSection::Unlock()
 	LeaveCriticalSection( (CRITICAL_SECTION*)&m_CS );
 }
 
+#else
+
+// Critical sections are recursive on Windows, so the mutexes are too.
+static void InitRecursiveMutex( pthread_mutex_t *pMutex )
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init( &attr );
+	pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+	pthread_mutex_init( pMutex, &attr );
+	pthread_mutexattr_destroy( &attr );
+}
+
+
+CVMPICriticalSection::CVMPICriticalSection()
+{
+#if defined( _DEBUG )
+	InitRecursiveMutex( &m_DeadlockProtect );
+#endif
+
+	InitRecursiveMutex( &m_CS );
+}
+
+
+CVMPICriticalSection::~CVMPICriticalSection()
+{
+	pthread_mutex_destroy( &m_CS );
+
+#if defined( _DEBUG )
+	pthread_mutex_destroy( &m_DeadlockProtect );
+#endif
+}
+
+
+void CVMPICriticalSection::Lock()
+{
+#if defined( _DEBUG )
+	// Check if this one is already locked.
+	unsigned long id = (unsigned long)ThreadGetCurrentId();
+	pthread_mutex_lock( &m_DeadlockProtect );
+		Assert( m_Locks.Find( id ) == m_Locks.InvalidIndex() );
+		m_Locks.AddToTail( id );
+	pthread_mutex_unlock( &m_DeadlockProtect );
+#endif
+
+	pthread_mutex_lock( &m_CS );
+}
+
+
+void CVMPICriticalSection::Unlock()
+{
+#if defined( _DEBUG )
+	// Check if this one is already locked.
+	unsigned long id = (unsigned long)ThreadGetCurrentId();
+	pthread_mutex_lock( &m_DeadlockProtect );
+		int index = m_Locks.Find( id );
+		Assert( index != m_Locks.InvalidIndex() );
+		m_Locks.Remove( index );
+	pthread_mutex_unlock( &m_DeadlockProtect );
+#endif
+	
+	pthread_mutex_unlock( &m_CS );
+}
+
+#endif // _WIN32
+
 
 
 // -------------------------------------------------------------------------------- //
@@ -119,6 +189,8 @@ CEvent::~CEvent()
 	Term();
 }
 
+#if defined( _WIN32 )
+
 bool CEvent::Init( bool bManualReset, bool bInitialState )
 {
 	Term();
@@ -142,6 +214,12 @@ void* CEvent::GetEventHandle() const
 	return m_hEvent;
 }
 
+bool CEvent::Wait( unsigned long timeout )
+{
+	Assert( m_hEvent );
+	return WaitForSingleObject( (HANDLE)m_hEvent, timeout ) == WAIT_OBJECT_0;
+}
+
 bool CEvent::SetEvent()
 {
 	Assert( m_hEvent );
@@ -154,4 +232,54 @@ bool CEvent::ResetEvent()
 	return ::ResetEvent( (HANDLE)m_hEvent ) != 0;
 }
 
+#else
+
+// On POSIX the handle is a tier0 CThreadEvent.
+bool CEvent::Init( bool bManualReset, bool bInitialState )
+{
+	Term();
+
+	CThreadEvent *pEvent = new CThreadEvent( bManualReset );
+	if ( bInitialState )
+		pEvent->Set();
+
+	m_hEvent = pEvent;
+	return true;
+}
+
+void CEvent::Term()
+{
+	if ( m_hEvent )
+	{
+		delete (CThreadEvent*)m_hEvent;
+		m_hEvent = NULL;
+	}
+}
+
+void* CEvent::GetEventHandle() const
+{
+	Assert( m_hEvent );
+	return m_hEvent;
+}
+
+bool CEvent::Wait( unsigned long timeout )
+{
+	Assert( m_hEvent );
+	return ((CThreadEvent*)m_hEvent)->Wait( timeout );
+}
+
+bool CEvent::SetEvent()
+{
+	Assert( m_hEvent );
+	return ((CThreadEvent*)m_hEvent)->Set();
+}
+
+bool CEvent::ResetEvent()
+{
+	Assert( m_hEvent );
+	return ((CThreadEvent*)m_hEvent)->Reset();
+}
+
+#endif // _WIN32
+
 
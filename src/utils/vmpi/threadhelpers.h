@@ -14,10 +14,14 @@
 
 #include "tier1/utllinkedlist.h"
 
-#if PLATFORM_WINDOWS_PC64
-	#define SIZEOF_CS	40	// sizeof( CRITICAL_SECTION )
+#if defined( _WIN32 )
+	#if PLATFORM_WINDOWS_PC64
+		#define SIZEOF_CS	40	// sizeof( CRITICAL_SECTION )
+	#else
+		#define SIZEOF_CS	24	// sizeof( CRITICAL_SECTION )
+	#endif
 #else
-	#define SIZEOF_CS	24	// sizeof( CRITICAL_SECTION )
+	#include <pthread.h>
 #endif
 
 class CVMPICriticalSection
@@ -36,12 +40,20 @@ protected:
 
 
 public:
+#if defined( _WIN32 )
 	char	m_CS[SIZEOF_CS];
+#else
+	pthread_mutex_t	m_CS;
+#endif
 
 	// Used to protect against deadlock in debug mode.
 //#if defined( _DEBUG )
 	CUtlLinkedList<unsigned long,int>	m_Locks;
+#if defined( _WIN32 )
 	char								m_DeadlockProtect[SIZEOF_CS];
+#else
+	pthread_mutex_t						m_DeadlockProtect;
+#endif
 //#endif
 };
 
@@ -97,6 +109,9 @@ public:
 	
 	void* GetEventHandle() const;
 
+	// Returns true if the event was signalled before the timeout (in milliseconds) expired.
+	bool Wait( unsigned long timeout );
+
 	// Signal the event.
 	bool SetEvent();
 
@@ -1799,7 +1799,16 @@ bool InitMaster( int argc, char **argv, const char *pDependencyFilename, VMPIRun
 		{
 			Msg( "%s found. Spawning a local worker automatically.\n", VMPI_GetParamString( mpi_AutoLocalWorker ) );
 			SpawnLocalWorker( 1, argv, g_MasterBroadcaster.GetListenPort(), true );
-		}		
+		}
+
+		const char *pLocalWorkers = VMPI_FindArg( argc, argv, VMPI_GetParamString( mpi_LocalWorkers ), "1" );
+		if ( pLocalWorkers )
+		{
+			int nLocalWorkers = atoi( pLocalWorkers );
+			Msg( "%s found. Spawning %d local workers.\n", VMPI_GetParamString( mpi_LocalWorkers ), nLocalWorkers );
+			for ( int i=0; i < nLocalWorkers; i++ )
+				SpawnLocalWorker( argc, argv, g_MasterBroadcaster.GetListenPort(), false );
+		}
 
 		bRet = true;
 	}
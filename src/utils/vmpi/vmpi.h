@@ -120,8 +120,10 @@ inline bool VMPI_IsEnabled() { return g_bUseMPI; }
 inline bool VMPI_IsMaster() { return g_bMPIMaster; }
 inline bool VMPI_IsWorker() { return !VMPI_IsMaster(); }
 
+#ifdef _WIN32
 // Used when hosting a patch.
 void VMPI_Init_PatchMaster( int argc, char **argv );
+#endif
 
 void VMPI_Finalize();
 
@@ -226,6 +228,7 @@ bool VMPI_HandleAutoRestart();
 // Any worker can print a message on the master with this.
 void VMPI_PrintMsgOnMaster( PRINTF_FORMAT_STRING const char *pMessage, ... );
 
+#ifdef _WIN32
 struct VMPIWorkerInfo_t
 {
 	char machineName[256];
@@ -237,6 +240,7 @@ struct VMPIWorkerInfo_t
 
 // Ask the central VMPI registry server for a list of registered VMPI workers.
 void VMPI_QueryRegistryForWorkers( CUtlVector<VMPIWorkerInfo_t> &registeredWorkers );
+#endif
 
 // These are optional debug helpers. When VMPI_SuperSpew is enabled, VMPI can spit out messages
 // with strings for packet IDs instead of numbers.
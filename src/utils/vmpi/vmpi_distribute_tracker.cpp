@@ -4,9 +4,11 @@
 //
 //=============================================================================//
 
+#if defined( _WIN32 )
 #include <windows.h>
 #include <conio.h>
 #include <io.h>
+#endif
 #include "vmpi.h"
 #include "vmpi_distribute_work.h"
 #include "tier0/platform.h"
@@ -63,6 +65,8 @@ static int CountActiveWorkUnits()
 // Graphical functions.
 // ------------------------------------------------------------------------ //
 
+#if defined( _WIN32 )
+
 static bool g_bUseGraphics = false;
 static HWND g_hWnd = 0;
 
@@ -358,6 +362,22 @@ static void Graphical_End()
 	WaitForSingleObject( g_hDestroyWindowCompletedEvent, INFINITE );
 }
 
+#else
+
+// The work unit window is Windows only. -mpi_TrackEvents still works.
+static void Graphical_Start()
+{
+	if ( VMPI_IsParamUsed( mpi_Graphics ) )
+		Warning( "%s is not supported on this platform.\n", VMPI_GetParamString( mpi_Graphics ) );
+}
+
+static void Graphical_WorkUnitSentToWorker( int iWorkUnit ) {}
+static void Graphical_WorkUnitStarted( int iWorkUnit ) {}
+static void Graphical_WorkUnitCompleted( int iWorkUnit ) {}
+static void Graphical_End() {}
+
+#endif // _WIN32
+
 
 // ------------------------------------------------------------------------ //
 // Interface functions.
@@ -499,6 +519,7 @@ bool VMPITracker_WriteDebugFile( const char *pFilename )
 
 void VMPITracker_HandleDebugKeypresses()
 {
+#if defined( _WIN32 )
 	if ( !g_bTrackWorkUnitEvents )
 		return;
 	
@@ -574,6 +595,7 @@ void VMPITracker_HandleDebugKeypresses()
 			Warning( "\n\nExited menu.\n\n" );
 		}
 	}
+#endif
 }
 
 
@@ -4,7 +4,9 @@
 //
 //=============================================================================//
 
+#if defined( _WIN32 )
 #include <windows.h>
+#endif
 #include "vmpi.h"
 #include "vmpi_distribute_work.h"
 #include "tier0/platform.h"
@@ -111,7 +113,7 @@ int SortByWUCount( const void *elem1, const void *elem2 )
 
 void PrepareDistributeWorkHeader( MessageBuffer *pBuf, unsigned char cSubpacketID )
 {
-	char cPacketID[2] = { g_DSInfo.m_cPacketID, cSubpacketID };
+	char cPacketID[2] = { g_DSInfo.m_cPacketID, (char)cSubpacketID };
 	pBuf->write( cPacketID, 2 );
 	pBuf->write( &g_iCurDSInfo, sizeof( g_iCurDSInfo ) );
 }
@@ -134,11 +136,11 @@ void ShowMPIStats(
 
 		Msg( "\n\n--------------------------------------------------------------\n");
 		Msg( "Total Time       : %.2f\n", flTimeSpent );
-		Msg( "Total Bytes Sent : %dk (%.2fk/sec, %d messages)\n", (int)flKSent, flKSent / flTimeSpent, nMessagesSent );
-		Msg( "Total Bytes Recv : %dk (%.2fk/sec, %d messages)\n", (int)flKRecv, flKRecv / flTimeSpent, nMessagesReceived );
+		Msg( "Total Bytes Sent : %dk (%.2fk/sec, %lu messages)\n", (int)flKSent, flKSent / flTimeSpent, nMessagesSent );
+		Msg( "Total Bytes Recv : %dk (%.2fk/sec, %lu messages)\n", (int)flKRecv, flKRecv / flTimeSpent, nMessagesReceived );
 		if ( g_bMPIMaster )
 		{
-			Msg( "Duplicated WUs   : %I64u (%.1f%%)\n", g_nDuplicatedWUs, (float)g_nDuplicatedWUs * 100.0f / g_nWUs );
+			Msg( "Duplicated WUs   : %llu (%.1f%%)\n", (unsigned long long)g_nDuplicatedWUs, (float)g_nDuplicatedWUs * 100.0f / g_nWUs );
 
 			Msg( "\nWU count by proc:\n" );
 
@@ -164,7 +166,7 @@ void ShowMPIStats(
 				Msg( "%s", pMachineName );
 				
 				char formatStr[512];
-				Q_snprintf( formatStr, sizeof( formatStr ), "%%%ds %I64u\n", 30 - strlen( pMachineName ), g_wuCountByProcess[ sortedProcs[i] ] );
+				Q_snprintf( formatStr, sizeof( formatStr ), "%%%ds %llu\n", 30 - (int)strlen( pMachineName ), (unsigned long long)g_wuCountByProcess[ sortedProcs[i] ] );
 				Msg( formatStr, ":" );
 			}
 		}
@@ -290,7 +292,7 @@ bool DistributeWorkDispatch( MessageBuffer *pBuf, int iSource, int iPacketID )
 			pBuf->read( &iWorkUnit, sizeof( iWorkUnit ) );
 			if ( iWorkUnit >= pInfo->m_nWorkUnits )
 			{
-				Error( "DistributeWork: got an invalid work unit index (%I64u for WU count of %I64u).", iWorkUnit, pInfo->m_nWorkUnits );
+				Error( "DistributeWork: got an invalid work unit index (%llu for WU count of %llu).", (unsigned long long)iWorkUnit, (unsigned long long)pInfo->m_nWorkUnits );
 			}
 
 			HandleWorkUnitCompleted( pInfo, iSource, iWorkUnit, pBuf );
@@ -518,7 +520,7 @@ void DistributeWork_Worker( CDSInfo *pInfo, ProcessWorkUnitFn processFn )
 			VMPI_DispatchNextMessage( 300 );
 			
 			Msg( "\rThreads status: " );
-			for ( int i=0; i < ARRAYSIZE( g_ThreadWUs ); i++ )
+			for ( int i=0; i < (int)ARRAYSIZE( g_ThreadWUs ); i++ )
 			{
 				if ( g_ThreadWUs[i] != ~0ull )
 					Msg( "%d: WU %5d  ", i, (int)g_ThreadWUs[i] );
@@ -637,7 +639,7 @@ double DistributeWork(
 		);
 
 	// Mark that the threads aren't working on anything at the moment.
-	for ( int i=0; i < ARRAYSIZE( g_ThreadWUs ); i++ )
+	for ( int i=0; i < (int)ARRAYSIZE( g_ThreadWUs ); i++ )
 		g_ThreadWUs[i] = ~0ull;
 	
 	return flTimeSpent;
@@ -173,7 +173,7 @@ int CVMPIFile_Memory::Read( void* pOutput, int size )
 		// Perform crlf translation
 		while ( const char *crlf = ( const char * ) memchr( pData, '\r', len ) )
 		{
-			int canCopy = min( size, crlf - pData );
+			int canCopy = min( size, (int)( crlf - pData ) );
 			memcpy( pOutput, pData, canCopy );
 			
 			m_iCurPos += canCopy;
@@ -81,6 +81,8 @@ protected:
 class IVMPIFile
 {
 public:
+	virtual ~IVMPIFile() {}
+
 	virtual void Close() = 0;
 	virtual void Seek( int pos, FileSystemSeek_t seekType ) = 0;
 	virtual unsigned int Tell() = 0;
@@ -0,0 +1,511 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: VMPI filesystem for the POSIX transport in vmpi_posix.cpp.
+//
+// There is no multicast here. A worker asks the master for each file it opens
+// and the master sends the whole file back over the worker's TCP connection.
+// Both sides keep the files they've seen (and the ones that don't exist) so
+// each file is only read and sent once per worker.
+//
+//=============================================================================//
+
+#include "vmpi_filesystem_internal.h"
+#include "tier0/threadtools.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+static bool IsOpeningForWriteAccess( const char *pOptions )
+{
+	return strchr( pOptions, 'w' ) || strchr( pOptions, 'a' ) || strchr( pOptions, '+' );
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------ //
+// CPosixVMPIFile is a file that's been loaded on the master or received by a worker.
+// ------------------------------------------------------------------------------------------------------------------------ //
+
+class CPosixVMPIFile
+{
+public:
+	bool Equals( const char *pFilename, const char *pPathID )
+	{
+		return V_stricmp( pFilename, m_Filename.Get() ) == 0 &&
+		       V_stricmp( pPathID,   m_PathID.Get()   ) == 0;
+	}
+
+public:
+	CUtlString			m_Filename;
+	CUtlString			m_PathID;
+	bool				m_bExists;
+	CUtlVector<char>	m_Data;
+};
+
+
+// The files are never freed until the filesystem goes away, so the CVMPIFile_Memory handles can point into them.
+class CPosixVMPIFileList
+{
+public:
+	~CPosixVMPIFileList()
+	{
+		m_Files.PurgeAndDeleteElements();
+	}
+
+	CPosixVMPIFile* Find( const char *pFilename, const char *pPathID )
+	{
+		for ( int i=0; i < m_Files.Count(); i++ )
+		{
+			if ( m_Files[i]->Equals( pFilename, pPathID ) )
+				return m_Files[i];
+		}
+		return NULL;
+	}
+
+	CPosixVMPIFile* Add( const char *pFilename, const char *pPathID )
+	{
+		CPosixVMPIFile *pFile = new CPosixVMPIFile;
+		pFile->m_Filename = pFilename;
+		pFile->m_PathID = pPathID;
+		pFile->m_bExists = false;
+		m_Files.AddToTail( pFile );
+		return pFile;
+	}
+
+private:
+	CUtlVector<CPosixVMPIFile*> m_Files;
+};
+
+
+static FileHandle_t OpenMemoryFile( CPosixVMPIFile *pFile, const char *pOptions )
+{
+	CVMPIFile_Memory *pOut = new CVMPIFile_Memory;
+	pOut->Init( pFile->m_Data.Base(), pFile->m_Data.Count(), strchr( pOptions, 't' ) ? 't' : 'b' );
+	return (FileHandle_t)pOut;
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------ //
+// CVMPIFile_PassThru is used when the master opens a file for writing.
+// ------------------------------------------------------------------------------------------------------------------------ //
+
+class CVMPIFile_PassThru : public IVMPIFile
+{
+public:
+	void Init( IBaseFileSystem *pPassThru, FileHandle_t fp )
+	{
+		m_pPassThru = pPassThru;
+		m_fp = fp;
+	}
+
+	virtual void Close()
+	{
+		m_pPassThru->Close( m_fp );
+		delete this;
+	}
+
+	virtual void Seek( int pos, FileSystemSeek_t seekType )
+	{
+		m_pPassThru->Seek( m_fp, pos, seekType );
+	}
+
+	virtual unsigned int Tell()
+	{
+		return m_pPassThru->Tell( m_fp );
+	}
+
+	virtual unsigned int Size()
+	{
+		return m_pPassThru->Size( m_fp );
+	}
+
+	virtual void Flush()
+	{
+		m_pPassThru->Flush( m_fp );
+	}
+
+	virtual int Read( void* pOutput, int size )
+	{
+		return m_pPassThru->Read( pOutput, size, m_fp );
+	}
+
+	virtual int Write( void const* pInput, int size )
+	{
+		return m_pPassThru->Write( pInput, size, m_fp );
+	}
+
+
+private:
+	IBaseFileSystem *m_pPassThru;
+	FileHandle_t m_fp;
+};
+
+
+// ------------------------------------------------------------------------------------------------------------------------ //
+// CMasterVMPIFileSystem implementation.
+// ------------------------------------------------------------------------------------------------------------------------ //
+
+class CMasterVMPIFileSystem : public CBaseVMPIFileSystem
+{
+public:
+	bool Init( IFileSystem *pPassThru );
+
+	virtual FileHandle_t Open( const char *pFilename, const char *pOptions, const char *pathID );
+	virtual FileHandle_t OpenEx( const char *pFileName, const char *pOptions, unsigned flags = 0, const char *pathID = 0, char **ppszResolvedFilename = NULL ) { return Open( pFileName, pOptions, pathID ); } //pass thru to Open
+	virtual bool HandleFileSystemPacket( MessageBuffer *pBuf, int iSource, int iPacketID );
+
+	virtual void CreateVirtualFile( const char *pFilename, const void *pData, int fileLength );
+
+	virtual CSysModule 		*LoadModule( const char *pFileName, const char *pPathID, bool bValidatedDllOnly );
+	virtual void			UnloadModule( CSysModule *pModule );
+
+private:
+	// Loads the file the first time it's asked for. pPathID is never NULL.
+	CPosixVMPIFile* FindOrLoadFile( const char *pFilename, const char *pPathID );
+
+private:
+	IFileSystem *m_pMasterVMPIFileSystemPassThru;
+	CPosixVMPIFileList m_Files;
+};
+
+
+CBaseVMPIFileSystem* CreateMasterVMPIFileSystem( int maxMemoryUsage, IFileSystem *pPassThru )
+{
+	// maxMemoryUsage limits the multicast send queue on Windows. Here files are sent straight from m_Files.
+	CMasterVMPIFileSystem *pRet = new CMasterVMPIFileSystem;
+	g_pBaseVMPIFileSystem = pRet;
+	if ( pRet->Init( pPassThru ) )
+	{
+		return pRet;
+	}
+	else
+	{
+		delete pRet;
+		g_pBaseVMPIFileSystem = NULL;
+		return NULL;
+	}
+}
+
+
+bool CMasterVMPIFileSystem::Init( IFileSystem *pPassThru )
+{
+	// Only init the BASE filesystem passthru. Leave the IFileSystem passthru using NULL so it'll crash
+	// immediately if they try to use a function we don't support.
+	InitPassThru( pPassThru, false );
+	m_pMasterVMPIFileSystemPassThru = pPassThru;
+	m_MulticastIP.Init( 0, 0, 0, 0, 0 );
+	return true;
+}
+
+
+CPosixVMPIFile* CMasterVMPIFileSystem::FindOrLoadFile( const char *pFilename, const char *pPathID )
+{
+	CPosixVMPIFile *pFile = m_Files.Find( pFilename, pPathID );
+	if ( pFile )
+		return pFile;
+
+	pFile = m_Files.Add( pFilename, pPathID );
+
+	// When the worker originally asked for the path ID, they could pass NULL and it would come through as "".
+	// Now set it back to null for the filesystem we're passing the call to.
+	FileHandle_t fp = m_pBaseFileSystemPassThru->Open( pFilename, "rb", pPathID[0] == 0 ? NULL : pPathID );
+	if ( fp )
+	{
+		pFile->m_Data.SetSize( m_pBaseFileSystemPassThru->Size( fp ) );
+		m_pBaseFileSystemPassThru->Read( pFile->m_Data.Base(), pFile->m_Data.Count(), fp );
+		m_pBaseFileSystemPassThru->Close( fp );
+		pFile->m_bExists = true;
+	}
+
+	return pFile;
+}
+
+
+FileHandle_t CMasterVMPIFileSystem::Open( const char *pFilename, const char *pOptions, const char *pPathID )
+{
+	Assert( g_bUseMPI );
+
+	if ( g_bDisableFileAccess )
+		Error( "Open( %s, %s ) - file access has been disabled.", pFilename, pOptions );
+
+	// Use a stdio file if they want to write to it.
+	bool bWriteAccess = IsOpeningForWriteAccess( pOptions );
+	if ( bWriteAccess )
+	{
+		FileHandle_t fp = m_pBaseFileSystemPassThru->Open( pFilename, pOptions, pPathID );
+		if ( fp == FILESYSTEM_INVALID_HANDLE )
+			return FILESYSTEM_INVALID_HANDLE;
+
+		CVMPIFile_PassThru *pFile = new CVMPIFile_PassThru;
+		pFile->Init( m_pBaseFileSystemPassThru, fp );
+		return (FileHandle_t)pFile;
+	}
+
+	// Internally, we require path IDs to be non-null. We'll convert it back to null whenever we make filesystem calls though.
+	if ( !pPathID )
+		pPathID = "";
+
+	// Keep the data around so it's there when workers want it.
+	CPosixVMPIFile *pFile = FindOrLoadFile( pFilename, pPathID );
+	if ( !pFile->m_bExists )
+		return FILESYSTEM_INVALID_HANDLE;
+
+	return OpenMemoryFile( pFile, pOptions );
+}
+
+
+void CMasterVMPIFileSystem::CreateVirtualFile( const char *pFilename, const void *pData, int fileLength )
+{
+	const char *pPathID = VMPI_VIRTUAL_FILES_PATH_ID;
+
+	CPosixVMPIFile *pFile = m_Files.Find( pFilename, pPathID );
+	if ( pFile )
+		Error( "CMasterVMPIFileSystem::CreateVirtualFile( %s ) - file already exists!", pFilename );
+
+	pFile = m_Files.Add( pFilename, pPathID );
+	pFile->m_Data.CopyArray( (const char*)pData, fileLength );
+	pFile->m_bExists = true;
+}
+
+
+bool CMasterVMPIFileSystem::HandleFileSystemPacket( MessageBuffer *pBuf, int iSource, int iPacketID )
+{
+	// Handle this packet.
+	int subPacketID = pBuf->data[1];
+	switch( subPacketID )
+	{
+		case VMPI_FSPACKETID_FILE_REQUEST:
+		{
+			// Make sure both strings are terminated.
+			if ( pBuf->getLen() < 8 || pBuf->data[pBuf->getLen()-1] != 0 )
+				return false;
+
+			int requestID = *((int*)&pBuf->data[2]);
+			const char *pFilename = (const char*)&pBuf->data[6];
+			const char *pPathID = (const char*)pFilename + strlen( pFilename ) + 1;
+			if ( pPathID >= &pBuf->data[pBuf->getLen()] )
+				return false;
+
+			if ( g_iVMPIVerboseLevel >= 2 )
+				Msg( "Client %d requested '%s'\n", iSource, pFilename );
+
+			CPosixVMPIFile *pFile = FindOrLoadFile( pFilename, pPathID );
+			int fileSize = pFile->m_bExists ? pFile->m_Data.Count() : -1;
+
+			// Send back the whole file.
+			unsigned char cPacket[2] = { VMPI_PACKETID_FILESYSTEM, VMPI_FSPACKETID_FILE_RESPONSE };
+			const void *pChunks[4] = { cPacket, &requestID, &fileSize, pFile->m_Data.Base() };
+			int chunkLen[4] = { sizeof( cPacket ), sizeof( requestID ), sizeof( fileSize ), pFile->m_Data.Count() };
+
+			VMPI_SendChunks( pChunks, chunkLen, ARRAYSIZE( pChunks ), iSource );
+		}
+		return true;
+
+		default:
+			return false;
+	}
+}
+
+
+CSysModule* CMasterVMPIFileSystem::LoadModule( const char *pFileName, const char *pPathID, bool bValidatedDllOnly )
+{
+	return m_pMasterVMPIFileSystemPassThru->LoadModule( pFileName, pPathID, bValidatedDllOnly );
+}
+
+void CMasterVMPIFileSystem::UnloadModule( CSysModule *pModule )
+{
+	m_pMasterVMPIFileSystemPassThru->UnloadModule( pModule );
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------ //
+// CWorkerVMPIFileSystem implementation.
+// ------------------------------------------------------------------------------------------------------------------------ //
+
+class CWorkerVMPIFileSystem : public CBaseVMPIFileSystem
+{
+public:
+	CWorkerVMPIFileSystem();
+
+	virtual FileHandle_t Open( const char *pFilename, const char *pOptions, const char *pathID );
+	virtual bool HandleFileSystemPacket( MessageBuffer *pBuf, int iSource, int iPacketID );
+
+	virtual void CreateVirtualFile( const char *pFilename, const void *pData, int fileLength );
+	virtual long GetFileTime( const char *pFileName, const char *pathID );
+	virtual bool IsFileWritable( const char *pFileName, const char *pPathID );
+	virtual bool SetFileWritable( char const *pFileName, bool writable, const char *pPathID );
+
+	virtual CSysModule 		*LoadModule( const char *pFileName, const char *pPathID, bool bValidatedDllOnly );
+	virtual void			UnloadModule( CSysModule *pModule );
+
+private:
+	// Asks the master for the file and waits for its response.
+	void RequestFile( CPosixVMPIFile *pFile );
+
+private:
+	// Only one thread at a time goes to the master for files.
+	CThreadFastMutex m_OpenMutex;
+	CPosixVMPIFileList m_Files;
+
+	// The request Open() is waiting on. HandleFileSystemPacket is called on the VMPI receive thread
+	// and fills in the file when the response comes.
+	CThreadFastMutex m_RequestMutex;
+	CThreadEvent m_ResponseEvent;
+	int m_iRequestID;
+	CPosixVMPIFile *m_pRequestFile;
+};
+
+
+CBaseVMPIFileSystem* CreateWorkerVMPIFileSystem()
+{
+	CWorkerVMPIFileSystem *pRet = new CWorkerVMPIFileSystem;
+	g_pBaseVMPIFileSystem = pRet;
+	return pRet;
+}
+
+
+CWorkerVMPIFileSystem::CWorkerVMPIFileSystem()
+{
+	m_iRequestID = 0;
+	m_pRequestFile = NULL;
+	m_MulticastIP.Init( 0, 0, 0, 0, 0 );
+}
+
+
+void CWorkerVMPIFileSystem::RequestFile( CPosixVMPIFile *pFile )
+{
+	int requestID;
+	{
+		AUTO_LOCK( m_RequestMutex );
+		requestID = ++m_iRequestID;
+		m_pRequestFile = pFile;
+		m_ResponseEvent.Reset();
+	}
+
+	const char *pFilename = pFile->m_Filename.Get();
+	const char *pPathID = pFile->m_PathID.Get();
+
+	unsigned char cPacket[2] = { VMPI_PACKETID_FILESYSTEM, VMPI_FSPACKETID_FILE_REQUEST };
+	const void *pChunks[4] = { cPacket, &requestID, pFilename, pPathID };
+	int chunkLen[4] = { sizeof( cPacket ), sizeof( requestID ), V_strlen( pFilename ) + 1, V_strlen( pPathID ) + 1 };
+	VMPI_SendChunks( pChunks, chunkLen, ARRAYSIZE( pChunks ), VMPI_MASTER_ID );
+
+	while ( !m_ResponseEvent.Wait( 1000 ) )
+	{
+		if ( !VMPI_IsProcConnected( VMPI_MASTER_ID ) )
+			Plat_FatalError( "Open( %s ) - lost the connection to the master.", pFilename );
+	}
+
+	AUTO_LOCK( m_RequestMutex );
+	m_pRequestFile = NULL;
+}
+
+
+FileHandle_t CWorkerVMPIFileSystem::Open( const char *pFilename, const char *pOptions, const char *pathID )
+{
+	Assert( g_bUseMPI );
+
+	// When it finally asks the filesystem for a file, it'll pass NULL for pathID if it's "".
+	if ( !pathID )
+		pathID = "";
+
+	if ( g_bDisableFileAccess )
+		Plat_FatalError( "Open( %s, %s ) - file access has been disabled.", pFilename, pOptions );
+
+	// Workers can't open anything for write access.
+	bool bWriteAccess = (V_stristr( pOptions, "w" ) != 0);
+	if ( bWriteAccess )
+		return FILESYSTEM_INVALID_HANDLE;
+
+	// Don't let multiple threads on a single worker machine
+	//   get in here at the same time.
+	AUTO_LOCK( m_OpenMutex );
+
+	CPosixVMPIFile *pFile = m_Files.Find( pFilename, pathID );
+	if ( !pFile )
+	{
+		pFile = m_Files.Add( pFilename, pathID );
+		RequestFile( pFile );
+	}
+
+	// Have tried to load this file and failed?
+	if ( !pFile->m_bExists )
+		return FILESYSTEM_INVALID_HANDLE;
+
+	// Ok! Got the file. now setup a memory stream they can read out of it with.
+	return OpenMemoryFile( pFile, pOptions );
+}
+
+
+void CWorkerVMPIFileSystem::CreateVirtualFile( const char *pFilename, const void *pData, int fileLength )
+{
+	Plat_FatalError( "CreateVirtualFile not supported in VMPI worker filesystem." );
+}
+
+
+long CWorkerVMPIFileSystem::GetFileTime( const char *pFileName, const char *pathID )
+{
+	Plat_FatalError( "GetFileTime not supported in VMPI worker filesystem." );
+	return 0;
+}
+
+
+bool CWorkerVMPIFileSystem::IsFileWritable( const char *pFileName, const char *pPathID )
+{
+	Plat_FatalError( "IsFileWritable not supported in VMPI worker filesystem." );
+	return false;
+}
+
+
+bool CWorkerVMPIFileSystem::SetFileWritable( char const *pFileName, bool writable, const char *pPathID )
+{
+	Plat_FatalError( "SetFileWritable not supported in VMPI worker filesystem." );
+	return false;
+}
+
+
+bool CWorkerVMPIFileSystem::HandleFileSystemPacket( MessageBuffer *pBuf, int iSource, int iPacketID )
+{
+	// Handle this packet.
+	int subPacketID = pBuf->data[1];
+	switch( subPacketID )
+	{
+		case VMPI_FSPACKETID_FILE_RESPONSE:
+		{
+			if ( pBuf->getLen() < 10 )
+				return false;
+
+			int requestID = *((int*)&pBuf->data[2]);
+			int fileSize = *((int*)&pBuf->data[6]);
+
+			AUTO_LOCK( m_RequestMutex );
+
+			// Ignore responses that nobody is waiting for anymore.
+			if ( requestID != m_iRequestID || !m_pRequestFile )
+				return true;
+
+			if ( fileSize >= 0 && fileSize == pBuf->getLen() - 10 )
+			{
+				m_pRequestFile->m_Data.CopyArray( &pBuf->data[10], fileSize );
+				m_pRequestFile->m_bExists = true;
+			}
+
+			m_ResponseEvent.Set();
+		}
+		return true;
+
+		default:
+			return false;
+	}
+}
+
+
+CSysModule* CWorkerVMPIFileSystem::LoadModule( const char *pFileName, const char *pPathID, bool bValidatedDllOnly )
+{
+	return Sys_LoadModule( pFileName );
+}
+
+void CWorkerVMPIFileSystem::UnloadModule( CSysModule *pModule )
+{
+	Sys_UnloadModule( pModule );
+}
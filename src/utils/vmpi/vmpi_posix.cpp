@@ -0,0 +1,2026 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: POSIX implementation of the VMPI API in vmpi.h.
+//
+// vmpi.cpp is built on the Windows service, registry and ThreadedTCPSocket
+// code. This file talks plain TCP instead, with the same message, dispatch and
+// disconnect behavior, so DistributeWork and the VMPI filesystem work on
+// Linux machines too:
+//
+//		master:	vrad -mpi [-mpi_Port 23311] [-mpi_LocalWorkers 4] map
+//		worker:	vrad -mpi -mpi_Worker 1.2.3.4[:23311] map
+//
+// Each message goes over the socket as a 4 byte length and then the data.
+// One receive thread per process reads all the sockets and queues the
+// messages for VMPI_DispatchNextMessage. On workers, filesystem packets are
+// handled right on the receive thread, which is what wakes up a thread that
+// is waiting in Open() for a file from the master.
+//
+//=============================================================================//
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdio.h>
+#include "vmpi.h"
+#include "vmpi_distribute_work.h"
+#include "threadhelpers.h"
+#include "tier0/platform.h"
+#include "tier0/threadtools.h"
+#include "tier0/tslist.h"
+#include "tier0/icommandline.h"
+#include "tier1/strtools.h"
+#include "tier1/utlvector.h"
+#include "tier1/utllinkedlist.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+#ifndef MSG_NOSIGNAL
+	#define MSG_NOSIGNAL 0		// SIGPIPE is ignored in VMPI_InitGlobals instead.
+#endif
+
+#define DEFAULT_MAX_WORKERS	32	// Unless they specify -mpi_WorkerCount, it will stop accepting workers after it gets this many.
+int g_nMaxWorkerCount = DEFAULT_MAX_WORKERS;
+
+#define MAX_VMPI_CONNECTIONS	4096
+#define MAX_SEND_CHUNKS			32
+#define MAX_VMPI_MESSAGE_SIZE	(512*1024*1024)	// Anything bigger is treated as a protocol error.
+#define RECV_BLOCK_SIZE			(64*1024)
+
+// These match vmpi.cpp, except for the handshake that replaces the Windows broadcast/connect dance.
+#define VMPI_INTERNAL_PACKET_ID	27
+	#define VMPI_INTERNAL_SUBPACKET_MACHINE_NAME				1
+	#define VMPI_INTERNAL_SUBPACKET_COMMAND_LINE				2
+	#define VMPI_INTERNAL_SUBPACKET_WAITING_FOR_COMMAND_LINE	3
+	#define VMPI_INTERNAL_SUBPACKET_GROUPED_PACKET				4
+	#define VMPI_INTERNAL_SUBPACKET_TIMING_WAIT_DONE			5
+	#define VMPI_INTERNAL_SUBPACKET_VERIFY_EXE_NAME				6
+	#define VMPI_INTERNAL_SUBPACKET_PRINT_ON_MASTER				7
+	#define VMPI_INTERNAL_SUBPACKET_HANDSHAKE					8	// First message each way on a new connection.
+
+VMPI_REGISTER_PACKET_ID( VMPI_INTERNAL_PACKET_ID );
+VMPI_REGISTER_SUBPACKET_ID( VMPI_INTERNAL_PACKET_ID, VMPI_INTERNAL_SUBPACKET_MACHINE_NAME );
+VMPI_REGISTER_SUBPACKET_ID( VMPI_INTERNAL_PACKET_ID, VMPI_INTERNAL_SUBPACKET_COMMAND_LINE );
+VMPI_REGISTER_SUBPACKET_ID( VMPI_INTERNAL_PACKET_ID, VMPI_INTERNAL_SUBPACKET_WAITING_FOR_COMMAND_LINE );
+VMPI_REGISTER_SUBPACKET_ID( VMPI_INTERNAL_PACKET_ID, VMPI_INTERNAL_SUBPACKET_GROUPED_PACKET );
+VMPI_REGISTER_SUBPACKET_ID( VMPI_INTERNAL_PACKET_ID, VMPI_INTERNAL_SUBPACKET_TIMING_WAIT_DONE );
+VMPI_REGISTER_SUBPACKET_ID( VMPI_INTERNAL_PACKET_ID, VMPI_INTERNAL_SUBPACKET_VERIFY_EXE_NAME );
+VMPI_REGISTER_SUBPACKET_ID( VMPI_INTERNAL_PACKET_ID, VMPI_INTERNAL_SUBPACKET_PRINT_ON_MASTER );
+VMPI_REGISTER_SUBPACKET_ID( VMPI_INTERNAL_PACKET_ID, VMPI_INTERNAL_SUBPACKET_HANDSHAKE );
+
+
+// Command-line parameters list.
+#define VMPI_PARAM( paramName, paramFlags, helpText ) {paramName, paramFlags, "-"#paramName, helpText},
+class CVMPIParam
+{
+public:
+	EVMPICmdLineParam m_eParam;
+	int m_ParamFlags;
+	const char *m_pName;
+	const char *m_pHelpText;
+};
+static CVMPIParam g_VMPIParams[] =
+{
+	{k_eVMPICmdLineParam_FirstParam, 0, "k_eVMPICmdLineParam_FirstParam", "unused"},
+	{k_eVMPICmdLineParam_VMPIParam, 0, "mpi", "Enable VMPI."},
+#include "vmpi_parameters.h"
+};
+#undef VMPI_PARAM
+
+
+// ---------------------------------------------------------------------------------------- //
+// Classes.
+// ---------------------------------------------------------------------------------------- //
+
+class CVMPIConnection
+{
+public:
+	CVMPIConnection( int sock, const CIPAddr &remoteAddr )
+	{
+		m_Socket = sock;
+		m_RemoteAddr = remoteAddr;
+		m_iProc = -1;
+		m_JobWorkerID = 0xFFFFFFFF;
+		m_bNameSet = false;
+		m_nRecvBytes = 0;
+		V_snprintf( m_MachineName, sizeof( m_MachineName ), "%d.%d.%d.%d", remoteAddr.ip[0], remoteAddr.ip[1], remoteAddr.ip[2], remoteAddr.ip[3] );
+	}
+
+	void SetMachineName( const char *pName )
+	{
+		V_strncpy( m_MachineName, pName, sizeof( m_MachineName ) );
+		m_bNameSet = true;
+	}
+
+public:
+	// Only the receive thread closes the socket. It's -1 after that.
+	volatile int		m_Socket;
+	CThreadFastMutex	m_SendMutex;
+
+	CIPAddr				m_RemoteAddr;
+	int					m_iProc;		// -1 until the handshake is done.
+	char				m_MachineName[256];
+	bool				m_bNameSet;
+	unsigned long		m_JobWorkerID;
+
+	// Packets queued with k_eVMPISendFlags_GroupPackets. Protected by m_SendMutex.
+	CUtlVector<char>	m_GroupedPackets;
+
+	// Partially received messages. Only touched by the receive thread.
+	CUtlVector<char>	m_RecvBuf;
+	int					m_nRecvBytes;
+};
+
+
+// A message waiting to be dispatched.
+struct CVMPIMessage
+{
+	int		m_iSource;
+	int		m_Len;
+	char	m_Data[1];
+};
+
+
+struct CVMPIDisconnect
+{
+	int		m_iProc;
+	char	m_Reason[256];
+};
+
+
+typedef CUtlVector<char> PersistentPacket;
+
+
+// ---------------------------------------------------------------------------------------- //
+// Globals.
+// ---------------------------------------------------------------------------------------- //
+
+bool g_bUseMPI = false;
+bool g_bMPIMaster = false;
+int g_iVMPIVerboseLevel = 0;
+bool g_bMPI_Stats = false;
+bool g_bMPI_StatsTextOutput = false;
+bool g_bSetThreadPriorities = true;
+
+int g_nBytesSent = 0;
+int g_nMessagesSent = 0;
+int g_nBytesReceived = 0;
+int g_nMessagesReceived = 0;
+
+// There is no multicast on POSIX, these stay at zero.
+int g_nMulticastBytesSent = 0;
+int g_nMulticastBytesReceived = 0;
+
+static VMPIRunMode g_VMPIRunMode = VMPI_RUN_NETWORKED;
+static bool g_bVMPISDKMode = false;
+static bool g_bGroupPackets = false;
+static bool g_bTimingWaitDone = false;
+
+static VMPIDispatchFn g_VMPIDispatch[MAX_VMPI_PACKET_IDS];
+static CTSList<MessageBuffer*> g_DispatchBuffers;
+static CVMPIPacketIDReg *g_pVMPIPacketIDRegHead = NULL;
+static CUtlLinkedList<VMPI_Disconnect_Handler,int> g_DisconnectHandlers;
+
+// Connections never go away until VMPI_Finalize, so the pointers can be used without the mutex.
+// On the master, slot 0 is the master itself and stays NULL.
+static CThreadMutex g_ConnectionsMutex;
+static CVMPIConnection *g_Connections[MAX_VMPI_CONNECTIONS];
+static int g_nConnections = 0;
+
+static CThreadMutex g_PersistentPacketsMutex;
+static CUtlLinkedList<PersistentPacket*,int> g_PersistentPackets;
+
+// The receive thread fills these in and sets g_VMPIEvent (and g_DisconnectEvent for disconnects).
+static CThreadMutex g_VMPIMessagesMutex;
+static CUtlLinkedList<CVMPIMessage*,int> g_VMPIMessages;
+static CThreadMutex g_DisconnectsMutex;
+static CUtlVector<CVMPIDisconnect> g_Disconnects;
+static CEvent g_VMPIEvent;
+static CEvent g_DisconnectEvent;
+
+static ThreadHandle_t g_hReceiveThread = NULL;
+static volatile bool g_bReceiveThreadExit = false;
+static int g_WakePipe[2] = { -1, -1 };
+static int g_ListenSocket = -1;
+static int g_iListenPort = 0;
+
+static char g_Password[256] = "";
+static char g_ExeName[MAX_PATH] = "";
+static char g_MasterExeName[MAX_PATH];
+static bool g_bReceivedMasterExeName = false;
+
+static CUtlVector<char*> g_WorkerCommandLine;
+static bool g_bReceivedWorkerCommandLine = false;
+static CUtlVector<char*> g_OriginalCommandLineParameters;
+static CUtlVector<pid_t> g_LocalWorkerPIDs;
+
+static CThreadFastMutex g_CurrentStageMutex;
+static char g_CurrentStageString[128] = "";
+
+
+// ---------------------------------------------------------------------------------------- //
+// CDispatchReg / CVMPIPacketIDReg.
+// ---------------------------------------------------------------------------------------- //
+
+CDispatchReg::CDispatchReg( int iPacketID, VMPIDispatchFn fn )
+{
+	Assert( iPacketID >= 0 && iPacketID < MAX_VMPI_PACKET_IDS );
+	Assert( !g_VMPIDispatch[iPacketID] );
+	g_VMPIDispatch[iPacketID] = fn;
+}
+
+
+CVMPIPacketIDReg::CVMPIPacketIDReg( int nPacketID, int nSubPacketID, const char *pName )
+{
+	m_nPacketID = nPacketID;
+	m_nSubPacketID = nSubPacketID;
+	m_pName = pName;
+	m_pNext = g_pVMPIPacketIDRegHead;
+	g_pVMPIPacketIDRegHead = this;
+}
+
+void CVMPIPacketIDReg::Lookup( int nPacketID, int nSubPacketID, char *pPacketIDString, int nPacketIDStringSize, char *pSubPacketIDString, int nSubPacketIDStringSize )
+{
+	// First find the packet ID.
+	CVMPIPacketIDReg *pCur;
+	for ( pCur = g_pVMPIPacketIDRegHead; pCur; pCur = pCur->m_pNext )
+	{
+		if ( pCur->m_nPacketID == nPacketID && pCur->m_nSubPacketID == -1 )
+		{
+			V_strncpy( pPacketIDString, pCur->m_pName, nPacketIDStringSize );
+			break;
+		}
+	}
+
+	// Didn't find it? Just print the number.
+	if ( !pCur )
+	{
+		V_snprintf( pPacketIDString, nPacketIDStringSize, "(%d)", nPacketID );
+	}
+
+	// Now find the subpacket ID.
+	for ( pCur = g_pVMPIPacketIDRegHead; pCur; pCur = pCur->m_pNext )
+	{
+		if ( pCur->m_nPacketID == nPacketID && pCur->m_nSubPacketID == nSubPacketID )
+		{
+			V_strncpy( pSubPacketIDString, pCur->m_pName, nSubPacketIDStringSize );
+			break;
+		}
+	}
+
+	// Didn't find it? Just print the number.
+	if ( !pCur )
+	{
+		V_snprintf( pSubPacketIDString, nSubPacketIDStringSize, "(%d)", nSubPacketID );
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------- //
+// Helpers.
+// ---------------------------------------------------------------------------------------- //
+
+const char* VMPI_FindArg( int argc, char **argv, const char *pName, const char *pDefault )
+{
+	for ( int i=0; i < argc; i++ )
+	{
+		if ( V_stricmp( argv[i], pName ) == 0 )
+		{
+			if ( (i+1) < argc )
+				return argv[i+1];
+			else
+				return pDefault;
+		}
+	}
+	return NULL;
+}
+
+
+static void ParseOptions( int argc, char **argv )
+{
+	if ( VMPI_FindArg( argc, argv, VMPI_GetParamString( mpi_DontSetThreadPriorities ) ) )
+	{
+		Msg( "%s found.\n", VMPI_GetParamString( mpi_DontSetThreadPriorities ) );
+		g_bSetThreadPriorities = false;
+	}
+
+	if ( VMPI_FindArg( argc, argv, VMPI_GetParamString( mpi_GroupPackets ) ) )
+	{
+		Msg( "%s found.\n", VMPI_GetParamString( mpi_GroupPackets ) );
+		g_bGroupPackets = true;
+	}
+
+	const char *pVerbose = VMPI_FindArg( argc, argv, VMPI_GetParamString( mpi_Verbose ), "1" );
+	if ( pVerbose )
+	{
+		if ( pVerbose[0] == '1' )
+			g_iVMPIVerboseLevel = 1;
+		else if ( pVerbose[0] == '2' )
+			g_iVMPIVerboseLevel = 2;
+	}
+
+	if ( VMPI_FindArg( argc, argv, VMPI_GetParamString( mpi_Stats ) ) )
+		g_bMPI_Stats = true;
+
+	if ( VMPI_FindArg( argc, argv, VMPI_GetParamString( mpi_Stats_TextOutput ) ) )
+		g_bMPI_StatsTextOutput = true;
+
+	const char *pPassword = VMPI_FindArg( argc, argv, VMPI_GetParamString( mpi_pw ), "" );
+	if ( pPassword )
+		V_strncpy( g_Password, pPassword, sizeof( g_Password ) );
+}
+
+
+static char* CopyString( const char *pStr )
+{
+	int len = V_strlen( pStr ) + 1;
+	char *pArg = new char[len];
+	V_strncpy( pArg, pStr, len );
+	return pArg;
+}
+
+
+static void FreeStrings( CUtlVector<char*> &strings )
+{
+	for ( int i=0; i < strings.Count(); i++ )
+		delete [] strings[i];
+
+	strings.Purge();
+}
+
+
+// Sockets and pipes aren't inherited by the processes we spawn.
+static void SetCloseOnExec( int fd )
+{
+	fcntl( fd, F_SETFD, fcntl( fd, F_GETFD, 0 ) | FD_CLOEXEC );
+}
+
+
+static void SetupConnectedSocket( int sock )
+{
+	int one = 1;
+	setsockopt( sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+	setsockopt( sock, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof( one ) );
+	SetCloseOnExec( sock );
+}
+
+
+// Launches the process and returns its pid, or -1.
+static pid_t SpawnProcess( char **argv )
+{
+	pid_t pid = fork();
+	if ( pid == 0 )
+	{
+#if defined( PLATFORM_LINUX )
+		execv( "/proc/self/exe", argv );
+#endif
+		execvp( argv[0], argv );
+		_exit( 127 );
+	}
+
+	if ( pid < 0 )
+	{
+		char errStr[512];
+		IP_GetLastErrorString( errStr, sizeof( errStr ) );
+		Warning( " - ERROR in fork (%s)!\n", errStr );
+	}
+	return pid;
+}
+
+
+static void WakeReceiveThread()
+{
+	char c = 0;
+	if ( write( g_WakePipe[1], &c, 1 ) < 0 )
+	{
+		// The pipe is full, so the thread is awake anyway.
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------- //
+// Sending.
+// ---------------------------------------------------------------------------------------- //
+
+static bool SendAll( int sock, struct iovec *pIOV, int nIOV )
+{
+	while ( nIOV > 0 )
+	{
+		struct msghdr msg;
+		memset( &msg, 0, sizeof( msg ) );
+		msg.msg_iov = pIOV;
+		msg.msg_iovlen = nIOV;
+
+		ssize_t nSent = sendmsg( sock, &msg, MSG_NOSIGNAL );
+		if ( nSent < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			return false;
+		}
+
+		// Skip past whatever made it out.
+		while ( nIOV > 0 && (size_t)nSent >= pIOV->iov_len )
+		{
+			nSent -= pIOV->iov_len;
+			++pIOV;
+			--nIOV;
+		}
+		if ( nIOV > 0 )
+		{
+			pIOV->iov_base = (char*)pIOV->iov_base + nSent;
+			pIOV->iov_len -= nSent;
+		}
+	}
+	return true;
+}
+
+
+// Sends the chunks as one message. Safe to call from any thread.
+static bool SendMessage( CVMPIConnection *pConn, void const * const *pChunks, const int *pChunkLengths, int nChunks )
+{
+	if ( nChunks >= MAX_SEND_CHUNKS )
+		Error( "VMPI SendMessage: too many chunks (%d).", nChunks );
+
+	int nTotalLength = 0;
+	struct iovec iov[MAX_SEND_CHUNKS];
+	for ( int i=0; i < nChunks; i++ )
+	{
+		iov[i+1].iov_base = (void*)pChunks[i];
+		iov[i+1].iov_len = pChunkLengths[i];
+		nTotalLength += pChunkLengths[i];
+	}
+	iov[0].iov_base = &nTotalLength;
+	iov[0].iov_len = sizeof( nTotalLength );
+
+	AUTO_LOCK( pConn->m_SendMutex );
+
+	int sock = pConn->m_Socket;
+	if ( sock == -1 )
+		return false;
+
+	if ( !SendAll( sock, iov, nChunks + 1 ) )
+	{
+		// The receive thread will see the dead socket and report the disconnect.
+		shutdown( sock, SHUT_RDWR );
+		return false;
+	}
+
+	return true;
+}
+
+
+static void GroupPackets( CVMPIConnection *pConn, void const * const *pChunks, const int *pChunkLengths, int nChunks )
+{
+	AUTO_LOCK( pConn->m_SendMutex );
+
+	// First add the header.
+	CUtlVector<char> &grouped = pConn->m_GroupedPackets;
+	if ( grouped.Count() == 0 )
+	{
+		grouped.AddToTail( VMPI_INTERNAL_PACKET_ID );
+		grouped.AddToTail( VMPI_INTERNAL_SUBPACKET_GROUPED_PACKET );
+	}
+
+	// Then each packet with its length.
+	int nTotalLength = 0;
+	for ( int i=0; i < nChunks; i++ )
+		nTotalLength += pChunkLengths[i];
+
+	grouped.AddMultipleToTail( sizeof( nTotalLength ), (const char*)&nTotalLength );
+	for ( int i=0; i < nChunks; i++ )
+		grouped.AddMultipleToTail( pChunkLengths[i], (const char*)pChunks[i] );
+}
+
+
+// ---------------------------------------------------------------------------------------- //
+// The receive thread.
+// ---------------------------------------------------------------------------------------- //
+
+static void QueueMessage( int iSource, const char *pData, int len )
+{
+	CVMPIMessage *pMsg = (CVMPIMessage*)malloc( sizeof( CVMPIMessage ) + len - 1 );
+	pMsg->m_iSource = iSource;
+	pMsg->m_Len = len;
+	memcpy( pMsg->m_Data, pData, len );
+
+	AUTO_LOCK( g_VMPIMessagesMutex );
+	g_VMPIMessages.AddToTail( pMsg );
+	g_VMPIEvent.SetEvent();
+}
+
+
+static void DisconnectSocket( CVMPIConnection *pConn, const char *pReason )
+{
+	int sock = pConn->m_Socket;
+	if ( sock == -1 )
+		return;
+
+	// Wakes up anyone blocked sending to it, then close it once they're out.
+	shutdown( sock, SHUT_RDWR );
+	{
+		AUTO_LOCK( pConn->m_SendMutex );
+		close( sock );
+		pConn->m_Socket = -1;
+	}
+
+	// Connections that never finished the handshake just go away.
+	if ( pConn->m_iProc < 0 )
+		return;
+
+	if ( g_iVMPIVerboseLevel >= 1 )
+		Msg( "VMPI: lost connection %d (%s): %s\n", pConn->m_iProc, pConn->m_MachineName, pReason );
+
+	AUTO_LOCK( g_DisconnectsMutex );
+	CVMPIDisconnect &info = g_Disconnects[ g_Disconnects.AddToTail() ];
+	info.m_iProc = pConn->m_iProc;
+	V_strncpy( info.m_Reason, pReason, sizeof( info.m_Reason ) );
+	g_DisconnectEvent.SetEvent();
+	g_VMPIEvent.SetEvent();
+}
+
+
+static void SendHandshake( CVMPIConnection *pConn )
+{
+	MessageBuffer mb;
+	char cPacketHeader[2] = { VMPI_INTERNAL_PACKET_ID, VMPI_INTERNAL_SUBPACKET_HANDSHAKE };
+	int iVersion = VMPI_PROTOCOL_VERSION;
+	mb.write( cPacketHeader, sizeof( cPacketHeader ) );
+	mb.write( &iVersion, sizeof( iVersion ) );
+	mb.WriteString( g_Password );
+	mb.WriteString( VMPI_GetLocalMachineName() );
+
+	const void *pData = mb.data;
+	int len = mb.getLen();
+	SendMessage( pConn, &pData, &len, 1 );
+}
+
+
+// Handles the first message on a connection. Returns false if the connection was refused.
+static bool HandleHandshake( CVMPIConnection *pConn, char *pData, int len )
+{
+	if ( len < 2 + (int)sizeof( int ) + 2 ||
+		(unsigned char)pData[0] != VMPI_INTERNAL_PACKET_ID ||
+		(unsigned char)pData[1] != VMPI_INTERNAL_SUBPACKET_HANDSHAKE ||
+		pData[len-1] != 0 )
+	{
+		DisconnectSocket( pConn, "invalid handshake" );
+		return false;
+	}
+
+	int iVersion;
+	memcpy( &iVersion, &pData[2], sizeof( iVersion ) );
+	const char *pPassword = &pData[2 + sizeof( iVersion )];
+	const char *pMachineName = pPassword + V_strlen( pPassword ) + 1;
+	if ( pMachineName >= &pData[len] )
+	{
+		DisconnectSocket( pConn, "invalid handshake" );
+		return false;
+	}
+
+	if ( iVersion != VMPI_PROTOCOL_VERSION )
+	{
+		Warning( "VMPI: %s uses protocol version %d (expected %d).\n", pMachineName, iVersion, VMPI_PROTOCOL_VERSION );
+		DisconnectSocket( pConn, "wrong protocol version" );
+		return false;
+	}
+
+	pConn->SetMachineName( pMachineName );
+
+	if ( !g_bMPIMaster )
+	{
+		// This is the master accepting us.
+		pConn->m_iProc = VMPI_MASTER_ID;
+		return true;
+	}
+
+	if ( V_strcmp( pPassword, g_Password ) != 0 )
+	{
+		if ( g_iVMPIVerboseLevel >= 1 )
+			Msg( "VMPI: refused %s (wrong password).\n", pMachineName );
+		DisconnectSocket( pConn, "wrong password" );
+		return false;
+	}
+
+	AUTO_LOCK( g_ConnectionsMutex );
+
+	int nWorkers = 0;
+	for ( int i=0; i < g_nConnections; i++ )
+	{
+		if ( g_Connections[i] && g_Connections[i]->m_Socket != -1 )
+			++nWorkers;
+	}
+	if ( nWorkers >= g_nMaxWorkerCount || g_nConnections >= MAX_VMPI_CONNECTIONS )
+	{
+		if ( g_iVMPIVerboseLevel >= 1 )
+			Msg( "VMPI: refused %s (already have %d workers).\n", pMachineName, nWorkers );
+		DisconnectSocket( pConn, "too many workers" );
+		return false;
+	}
+
+	// Hold the persistent packets while adding the connection so it gets each of them exactly once.
+	AUTO_LOCK( g_PersistentPacketsMutex );
+
+	pConn->m_iProc = g_nConnections;
+	g_Connections[g_nConnections] = pConn;
+	++g_nConnections;
+
+	SendHandshake( pConn );
+	FOR_EACH_LL( g_PersistentPackets, i )
+	{
+		const void *pPacket = g_PersistentPackets[i]->Base();
+		int packetLen = g_PersistentPackets[i]->Count();
+		SendMessage( pConn, &pPacket, &packetLen, 1 );
+	}
+
+	Msg( "VMPI: worker %d (%s) connected.\n", pConn->m_iProc, pMachineName );
+	return true;
+}
+
+
+// Returns false if the connection went away.
+static bool HandleReceivedMessage( CVMPIConnection *pConn, char *pData, int len )
+{
+	if ( pConn->m_iProc < 0 )
+		return HandleHandshake( pConn, pData, len );
+
+	++g_nMessagesReceived;
+	g_nBytesReceived += len + 4;	// (4 bytes extra for the packet length)
+
+	if ( !g_bMPIMaster && (unsigned char)pData[0] == VMPI_PACKETID_FILESYSTEM )
+	{
+		// File responses don't wait for the main thread to dispatch them, since it's the
+		// one waiting for the file. The master's filesystem is only used on its main thread.
+		MessageBuffer mb;
+		mb.setLen( len );
+		memcpy( mb.data, pData, len );
+		if ( g_VMPIDispatch[VMPI_PACKETID_FILESYSTEM] )
+			g_VMPIDispatch[VMPI_PACKETID_FILESYSTEM]( &mb, pConn->m_iProc, VMPI_PACKETID_FILESYSTEM );
+	}
+	else if ( len >= 2 && (unsigned char)pData[0] == VMPI_INTERNAL_PACKET_ID && (unsigned char)pData[1] == VMPI_INTERNAL_SUBPACKET_GROUPED_PACKET )
+	{
+		// Split grouped packets back up.
+		int iCurOffset = 2;
+		while ( iCurOffset + 4 <= len )
+		{
+			int curPacketLen;
+			memcpy( &curPacketLen, &pData[iCurOffset], sizeof( curPacketLen ) );
+			iCurOffset += 4;
+			if ( curPacketLen <= 0 || iCurOffset + curPacketLen > len )
+			{
+				DisconnectSocket( pConn, "invalid grouped packet" );
+				return false;
+			}
+
+			QueueMessage( pConn->m_iProc, &pData[iCurOffset], curPacketLen );
+			iCurOffset += curPacketLen;
+		}
+	}
+	else
+	{
+		QueueMessage( pConn->m_iProc, pData, len );
+	}
+
+	return true;
+}
+
+
+static void ReadFromConnection( CVMPIConnection *pConn )
+{
+	CUtlVector<char> &buf = pConn->m_RecvBuf;
+	if ( buf.Count() - pConn->m_nRecvBytes < RECV_BLOCK_SIZE )
+		buf.SetCount( pConn->m_nRecvBytes + RECV_BLOCK_SIZE );
+
+	ssize_t nRead = recv( pConn->m_Socket, &buf[pConn->m_nRecvBytes], buf.Count() - pConn->m_nRecvBytes, 0 );
+	if ( nRead == 0 )
+	{
+		DisconnectSocket( pConn, "connection closed" );
+		return;
+	}
+	else if ( nRead < 0 )
+	{
+		if ( errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK )
+			return;
+
+		char errStr[256];
+		IP_GetLastErrorString( errStr, sizeof( errStr ) );
+		DisconnectSocket( pConn, errStr );
+		return;
+	}
+	pConn->m_nRecvBytes += nRead;
+
+	// Handle all the complete messages.
+	int iOffset = 0;
+	while ( pConn->m_nRecvBytes - iOffset >= 4 )
+	{
+		int len;
+		memcpy( &len, &buf[iOffset], sizeof( len ) );
+		if ( len <= 0 || len > MAX_VMPI_MESSAGE_SIZE )
+		{
+			DisconnectSocket( pConn, "invalid packet size" );
+			return;
+		}
+
+		if ( pConn->m_nRecvBytes - iOffset - 4 < len )
+			break;
+
+		if ( !HandleReceivedMessage( pConn, &buf[iOffset + 4], len ) )
+			return;
+
+		iOffset += 4 + len;
+	}
+
+	// Move the partial message to the front and make room for all of it.
+	if ( iOffset > 0 )
+	{
+		pConn->m_nRecvBytes -= iOffset;
+		memmove( buf.Base(), &buf[iOffset], pConn->m_nRecvBytes );
+	}
+	if ( pConn->m_nRecvBytes >= 4 )
+	{
+		int len;
+		memcpy( &len, buf.Base(), sizeof( len ) );
+		if ( 4 + len > buf.Count() )
+			buf.SetCount( 4 + len );
+	}
+}
+
+
+static void AcceptConnection( CUtlVector<CVMPIConnection*> &pending )
+{
+	sockaddr_in addr;
+	socklen_t addrLen = sizeof( addr );
+	int sock = accept( g_ListenSocket, (sockaddr*)&addr, &addrLen );
+	if ( sock < 0 )
+		return;
+
+	SetupConnectedSocket( sock );
+
+	CIPAddr remoteAddr;
+	SockAddrToIPAddr( &addr, &remoteAddr );
+	pending.AddToTail( new CVMPIConnection( sock, remoteAddr ) );
+}
+
+
+static uintp VMPI_ReceiveThread( void *pParam )
+{
+	// Accepted connections that haven't sent their handshake yet.
+	CUtlVector<CVMPIConnection*> pending;
+
+	CUtlVector<struct pollfd> fds;
+	CUtlVector<CVMPIConnection*> fdConnections;
+
+	while ( 1 )
+	{
+		fds.RemoveAll();
+		fdConnections.RemoveAll();
+
+		struct pollfd pfd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		pfd.fd = g_WakePipe[0];
+		fds.AddToTail( pfd );
+		fdConnections.AddToTail( NULL );
+
+		if ( g_ListenSocket != -1 )
+		{
+			pfd.fd = g_ListenSocket;
+			fds.AddToTail( pfd );
+			fdConnections.AddToTail( NULL );
+		}
+
+		{
+			AUTO_LOCK( g_ConnectionsMutex );
+			for ( int i=0; i < g_nConnections; i++ )
+			{
+				CVMPIConnection *pConn = g_Connections[i];
+				if ( pConn && pConn->m_Socket != -1 )
+				{
+					pfd.fd = pConn->m_Socket;
+					fds.AddToTail( pfd );
+					fdConnections.AddToTail( pConn );
+				}
+			}
+		}
+
+		for ( int i=0; i < pending.Count(); i++ )
+		{
+			pfd.fd = pending[i]->m_Socket;
+			fds.AddToTail( pfd );
+			fdConnections.AddToTail( pending[i] );
+		}
+
+		if ( poll( fds.Base(), fds.Count(), -1 ) < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			Error( "VMPI receive thread: poll() failed (%d).", errno );
+		}
+
+		if ( fds[0].revents )
+		{
+			char buf[64];
+			if ( read( g_WakePipe[0], buf, sizeof( buf ) ) < 0 )
+			{
+			}
+
+			if ( g_bReceiveThreadExit )
+				break;
+		}
+
+		for ( int i=1; i < fds.Count(); i++ )
+		{
+			if ( !fds[i].revents )
+				continue;
+
+			if ( fdConnections[i] )
+				ReadFromConnection( fdConnections[i] );
+			else
+				AcceptConnection( pending );
+		}
+
+		// Forget about connections that were accepted or refused.
+		for ( int i=pending.Count()-1; i >= 0; i-- )
+		{
+			if ( pending[i]->m_iProc >= 0 )
+			{
+				pending.Remove( i );
+			}
+			else if ( pending[i]->m_Socket == -1 )
+			{
+				delete pending[i];
+				pending.Remove( i );
+			}
+		}
+	}
+
+	for ( int i=0; i < pending.Count(); i++ )
+	{
+		DisconnectSocket( pending[i], "shutting down" );
+		delete pending[i];
+	}
+
+	return 0;
+}
+
+
+static void StartReceiveThread()
+{
+	if ( pipe( g_WakePipe ) != 0 )
+		Error( "VMPI: pipe() failed." );
+
+	SetCloseOnExec( g_WakePipe[0] );
+	SetCloseOnExec( g_WakePipe[1] );
+	fcntl( g_WakePipe[1], F_SETFL, fcntl( g_WakePipe[1], F_GETFL, 0 ) | O_NONBLOCK );
+
+	g_bReceiveThreadExit = false;
+	g_hReceiveThread = CreateSimpleThread( VMPI_ReceiveThread, NULL );
+	if ( !g_hReceiveThread )
+		Error( "VMPI: can't create the receive thread." );
+}
+
+
+static void StopReceiveThread()
+{
+	if ( !g_hReceiveThread )
+		return;
+
+	g_bReceiveThreadExit = true;
+	WakeReceiveThread();
+	ThreadJoin( g_hReceiveThread );
+	ReleaseThreadHandle( g_hReceiveThread );
+	g_hReceiveThread = NULL;
+
+	close( g_WakePipe[0] );
+	close( g_WakePipe[1] );
+	g_WakePipe[0] = g_WakePipe[1] = -1;
+}
+
+
+// ---------------------------------------------------------------------------------------- //
+// Internal VMPI dispatch..
+// ---------------------------------------------------------------------------------------- //
+
+void VMPI_SetMachineName( int iProc, const char *pName );
+
+
+static bool VMPI_InternalDispatchFn( MessageBuffer *pBuf, int iSource, int iPacketID )
+{
+	if ( pBuf->getLen() >= 2 )
+	{
+		if ( pBuf->data[1] == VMPI_INTERNAL_SUBPACKET_MACHINE_NAME )
+		{
+			if ( pBuf->getLen() >= 3 )
+			{
+				pBuf->data[pBuf->getLen() - 1] = 0;
+				VMPI_SetMachineName( iSource, &pBuf->data[2] );
+				return true;
+			}
+		}
+		else if ( pBuf->data[1] == VMPI_INTERNAL_SUBPACKET_WAITING_FOR_COMMAND_LINE )
+		{
+			if ( !VMPI_IsSDKMode() )
+			{
+				Warning( "Worker %d is running in SDK mode (and the master is not)!\n", iSource );
+			}
+			return true;
+		}
+		else if ( pBuf->data[1] == VMPI_INTERNAL_SUBPACKET_COMMAND_LINE )
+		{
+			pBuf->setOffset( 2 );
+
+			int nArgs;
+			pBuf->read( &nArgs, sizeof( nArgs ) );
+			for ( int i=0; i < nArgs; i++ )
+			{
+				char str[4096];
+				if ( pBuf->ReadString( str, sizeof( str ) ) == -1 )
+					Error( "Error in ReadString() while reading command line." );
+
+				g_WorkerCommandLine.AddToTail( CopyString( str ) );
+			}
+
+			g_bReceivedWorkerCommandLine = true;
+			return true;
+		}
+		else if ( pBuf->data[1] == VMPI_INTERNAL_SUBPACKET_VERIFY_EXE_NAME )
+		{
+			pBuf->setOffset( 2 );
+
+			if ( pBuf->ReadString( g_MasterExeName, sizeof( g_MasterExeName ) ) == -1 )
+				Error( "Error in ReadString() while reading VMPI_INTERNAL_SUBPACKET_VERIFY_EXE_NAME." );
+
+			g_bReceivedMasterExeName = true;
+			return true;
+		}
+		else if ( pBuf->data[1] == VMPI_INTERNAL_SUBPACKET_PRINT_ON_MASTER )
+		{
+			pBuf->setOffset( 2 );
+
+			char str[2048];
+			if ( pBuf->ReadString( str, sizeof( str ) ) == -1 )
+				Plat_FatalError( "Error in ReadString() while reading VMPI_INTERNAL_SUBPACKET_PRINT_ON_MASTER." );
+
+			Msg( "\nWorker %d (%s) message: %s\n", iSource, VMPI_GetMachineName( iSource ), str );
+			return true;
+		}
+		else if ( pBuf->data[1] == VMPI_INTERNAL_SUBPACKET_TIMING_WAIT_DONE )
+		{
+			g_bTimingWaitDone = true;
+			return true;
+		}
+	}
+
+	return false;
+}
+static CDispatchReg g_VMPIInternalDispatchReg( VMPI_INTERNAL_PACKET_ID, VMPI_InternalDispatchFn ); // register to handle the messages we want
+
+
+static void VMPI_SendCommandLine( int argc, char **argv )
+{
+	MessageBuffer mb;
+
+	char cPacketHeader[2] = {VMPI_INTERNAL_PACKET_ID, VMPI_INTERNAL_SUBPACKET_COMMAND_LINE};
+	mb.write( cPacketHeader, sizeof( cPacketHeader ) );
+	mb.write( &argc, sizeof( argc ) );
+	for ( int i=0; i < argc; i++ )
+		mb.WriteString( argv[i] );
+
+	VMPI_SendData( mb.data, mb.getLen(), VMPI_PERSISTENT );
+}
+
+
+static void VMPI_ReceiveCommandLine()
+{
+	// For verification purposes, tell the master we're trying to get the command line.
+	unsigned char chData[2] = {VMPI_INTERNAL_PACKET_ID, VMPI_INTERNAL_SUBPACKET_WAITING_FOR_COMMAND_LINE};
+	VMPI_SendData( chData, sizeof( chData ), VMPI_MASTER_ID );
+
+	double startTime = Plat_FloatTime();
+	while ( !g_bReceivedWorkerCommandLine )
+	{
+		if ( Plat_FloatTime() - startTime > 30 )
+			Error( "VMPI_ReceiveCommandLine: timeout. Is the master running in SDK mode?" );
+
+		VMPI_DispatchNextMessage( 10 * 1000 );
+	}
+}
+
+
+static void VMPI_SendExeName()
+{
+	MessageBuffer mb;
+
+	char cPacketHeader[2] = {VMPI_INTERNAL_PACKET_ID, VMPI_INTERNAL_SUBPACKET_VERIFY_EXE_NAME};
+	mb.write( cPacketHeader, sizeof( cPacketHeader ) );
+	mb.WriteString( g_ExeName );
+
+	VMPI_SendData( mb.data, mb.getLen(), VMPI_PERSISTENT );
+}
+
+
+static void VMPI_ReceiveExeName()
+{
+	double startTime = Plat_FloatTime();
+	while ( !g_bReceivedMasterExeName )
+	{
+		if ( !VMPI_IsProcConnected( VMPI_MASTER_ID ) )
+			Error( "VMPI_ReceiveExeName: the master closed the connection (wrong -mpi_pw or too many workers?)." );
+
+		if ( Plat_FloatTime() - startTime > 30 )
+			Error( "VMPI_ReceiveExeName: timeout." );
+
+		VMPI_DispatchNextMessage( 1000 );
+	}
+
+	// Now compare the exe name we got with our own.
+	if ( V_stricmp( g_ExeName, g_MasterExeName ) != 0 )
+	{
+		Error( "VMPI_ReceiveExeName: mismatched exe names (master: %s, me: %s).\nThis usually just means the master finished"
+			" a job like vvis really fast and started a vrad immediately, and an old vvis worker connected to the new vrad job.",
+			g_MasterExeName, g_ExeName );
+	}
+}
+
+
+static void VMPI_HandleTimingWait_Worker()
+{
+	if ( VMPI_IsParamUsed( mpi_TimingWait ) )
+	{
+		Msg( "-mpi_TimingWait specified. Waiting for master to start..." );
+
+		// Wait for the signal to go.
+		while ( !g_bTimingWaitDone )
+		{
+			VMPI_DispatchNextMessage( 50 );
+		}
+
+		Msg( "\n ");
+	}
+}
+
+
+static void VMPI_HandleTimingWait_Master()
+{
+	if ( VMPI_IsParamUsed( mpi_TimingWait ) )
+	{
+		Msg( "-mpi_TimingWait specified. Press enter to continue... " );
+		getchar();
+		Msg( "\n" );
+
+		unsigned char cPacket[2] = { VMPI_INTERNAL_PACKET_ID, VMPI_INTERNAL_SUBPACKET_TIMING_WAIT_DONE };
+		VMPI_SendData( cPacket, sizeof( cPacket ), VMPI_PERSISTENT );
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------- //
+// Init / shutdown.
+// ---------------------------------------------------------------------------------------- //
+
+static bool MPI_Init_Worker( int &argc, char **&argv, const CIPAddr &masterAddr )
+{
+	g_bMPIMaster = false;
+	ParseOptions( argc, argv );
+
+	sockaddr_in addr;
+	IPAddrToSockAddr( &masterAddr, &addr );
+
+	int nAttempts = 1;
+	int sock = -1;
+	while ( sock == -1 )
+	{
+		CWaitTimer wait( 3 );
+		while ( 1 )
+		{
+			sock = socket( AF_INET, SOCK_STREAM, 0 );
+			if ( sock < 0 )
+				Error( "MPI_Init_Worker: can't create a socket." );
+
+			if ( connect( sock, (sockaddr*)&addr, sizeof( addr ) ) == 0 )
+				break;
+
+			close( sock );
+			sock = -1;
+
+			if ( wait.ShouldKeepWaiting() )
+				ThreadSleep( 100 );
+			else
+				break;
+		}
+
+		if ( sock == -1 )
+		{
+			if ( !VMPI_IsParamUsed( mpi_Retry ) )
+			{
+				Warning( "MPI_Init_Worker() failed\n" );
+				return false;
+			}
+
+			Msg( "%s found. Retrying connection to %d.%d.%d.%d:%d (attempt %d).\n", VMPI_GetParamString( mpi_Retry ), EXPAND_ADDR( masterAddr ), nAttempts++ );
+		}
+	}
+
+	SetupConnectedSocket( sock );
+
+	// The master is proc 0. It becomes connected once it answers our handshake.
+	CVMPIConnection *pMaster = new CVMPIConnection( sock, masterAddr );
+	SendHandshake( pMaster );
+	g_Connections[VMPI_MASTER_ID] = pMaster;
+	g_nConnections = 1;
+
+	// Until then, the receive thread handles it like the master handles new workers.
+	pMaster->m_iProc = -1;
+	StartReceiveThread();
+
+	// Verify that the exe is correct.
+	VMPI_ReceiveExeName();
+
+	if ( g_bVMPISDKMode )
+	{
+		VMPI_ReceiveCommandLine();
+
+		CommandLine()->CreateCmdLine( g_WorkerCommandLine.Count(), g_WorkerCommandLine.Base() );
+		argc = g_WorkerCommandLine.Count();
+		argv = g_WorkerCommandLine.Base();
+		ParseOptions( argc, argv );
+	}
+
+	VMPI_HandleTimingWait_Worker();
+	return true;
+}
+
+
+static bool SpawnLocalWorker( int argc, char **argv )
+{
+	char workerAddr[64];
+	V_snprintf( workerAddr, sizeof( workerAddr ), "127.0.0.1:%d", g_iListenPort );
+
+	CUtlVector<char*> args;
+	args.AddToTail( argv[0] );
+	args.AddToTail( (char*)VMPI_GetParamString( mpi_Worker ) );
+	args.AddToTail( workerAddr );
+	for ( int i=1; i < argc; i++ )
+		args.AddToTail( argv[i] );
+	args.AddToTail( NULL );
+
+	pid_t pid = SpawnProcess( args.Base() );
+	if ( pid < 0 )
+		return false;
+
+	g_LocalWorkerPIDs.AddToTail( pid );
+	return true;
+}
+
+
+static bool InitMaster( int argc, char **argv, VMPIRunMode runMode )
+{
+	int nMaxWorkers = DEFAULT_MAX_WORKERS;
+	const char *pProcCount = VMPI_FindArg( argc, argv, VMPI_GetParamString( mpi_WorkerCount ) );
+	if ( pProcCount )
+	{
+		nMaxWorkers = atoi( pProcCount );
+		Warning( "%s: waiting for %d processes to join.\n", VMPI_GetParamString( mpi_WorkerCount ), nMaxWorkers );
+	}
+	nMaxWorkers = clamp( nMaxWorkers, 2, MAX_VMPI_CONNECTIONS - 1 );
+
+	g_bMPIMaster = true;
+	g_nMaxWorkerCount = nMaxWorkers;
+
+	if ( argc <= 0 )
+		Error( "MPI_Init_Master: argc <= 0!" );
+
+	ParseOptions( argc, argv );
+
+	// Slot 0 is us.
+	g_Connections[VMPI_MASTER_ID] = NULL;
+	g_nConnections = 1;
+
+	// Bind the listen socket.
+	int iFirstPort = VMPI_MASTER_FIRST_PORT, iLastPort = VMPI_MASTER_LAST_PORT;
+	const char *pPortStr = VMPI_FindArg( argc, argv, VMPI_GetParamString( mpi_Port ) );
+	if ( pPortStr )
+		iFirstPort = iLastPort = atoi( pPortStr );
+
+	for ( int iPort=iFirstPort; iPort <= iLastPort && g_ListenSocket == -1; iPort++ )
+	{
+		int sock = socket( AF_INET, SOCK_STREAM, 0 );
+		if ( sock < 0 )
+			break;
+
+		int one = 1;
+		setsockopt( sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+		SetCloseOnExec( sock );
+
+		CIPAddr bindAddr( 0, 0, 0, 0, iPort );
+		sockaddr_in addr;
+		IPAddrToSockAddr( &bindAddr, &addr );
+		if ( bind( sock, (sockaddr*)&addr, sizeof( addr ) ) == 0 && listen( sock, 64 ) == 0 )
+		{
+			g_ListenSocket = sock;
+			g_iListenPort = iPort;
+		}
+		else
+		{
+			close( sock );
+		}
+	}
+
+	if ( g_ListenSocket == -1 )
+		Error( "Can't bind a listen socket in port range [%d, %d].", iFirstPort, iLastPort );
+
+	Msg( "VMPI master listening on port %d.\n", g_iListenPort );
+	StartReceiveThread();
+
+	// Send the base filename of the exe we're running. Sometimes if we run vvis followed by vrad
+	// really quickly, the old vvis workers can connect to the vrad process and mess with it.
+	VMPI_SendExeName();
+
+	// In SDK mode, the master sends the command line to the workers since
+	// the workers weren't given a full command line.
+	if ( VMPI_IsSDKMode() )
+	{
+		VMPI_SendCommandLine( argc, argv );
+	}
+
+	bool bRet = true;
+	if ( runMode == VMPI_RUN_LOCAL )
+	{
+		bRet = SpawnLocalWorker( argc, argv );
+	}
+	else
+	{
+		if ( VMPI_FindArg( argc, argv, VMPI_GetParamString( mpi_AutoLocalWorker ), "" ) )
+		{
+			Msg( "%s found. Spawning a local worker automatically.\n", VMPI_GetParamString( mpi_AutoLocalWorker ) );
+			SpawnLocalWorker( argc, argv );
+		}
+
+		const char *pLocalWorkers = VMPI_FindArg( argc, argv, VMPI_GetParamString( mpi_LocalWorkers ), "1" );
+		if ( pLocalWorkers )
+		{
+			int nLocalWorkers = atoi( pLocalWorkers );
+			Msg( "%s found. Spawning %d local workers.\n", VMPI_GetParamString( mpi_LocalWorkers ), nLocalWorkers );
+			for ( int i=0; i < nLocalWorkers; i++ )
+				SpawnLocalWorker( argc, argv );
+		}
+	}
+
+	VMPI_HandleTimingWait_Master();
+	return bRet;
+}
+
+
+static void VMPI_InitGlobals( int argc, char **argv, VMPIRunMode runMode )
+{
+	g_bUseMPI = true;
+	g_VMPIRunMode = runMode;
+
+	g_VMPIEvent.Init( false, false );
+	g_DisconnectEvent.Init( false, false );
+
+	// Failed sends are handled through the return value.
+	signal( SIGPIPE, SIG_IGN );
+
+	V_FileBase( argv[0], g_ExeName, sizeof( g_ExeName ) );
+
+	// There is no SDK install to check for, so this only comes from the command line.
+	g_bVMPISDKMode = ( VMPI_FindArg( argc, argv, VMPI_GetParamString( mpi_SDKMode ), "" ) != NULL );
+	if ( g_bVMPISDKMode )
+		Msg( "VMPI running in SDK mode.\n" );
+}
+
+
+static void VMPI_SetupAutoRestartParameters( int argc, char **argv )
+{
+	if ( VMPI_FindArg( argc, argv, VMPI_GetParamString( mpi_AutoRestart ) ) )
+	{
+		g_OriginalCommandLineParameters.SetCount( argc );
+		for ( int i=0; i < argc; i++ )
+		{
+			g_OriginalCommandLineParameters[i] = CopyString( argv[i] );
+		}
+	}
+}
+
+
+bool VMPI_HandleAutoRestart()
+{
+	if ( g_OriginalCommandLineParameters.Count() == 0 )
+		return true;
+
+	Msg( "%s found. Auto-restarting.\n", VMPI_GetParamString( mpi_AutoRestart ) );
+
+	CUtlVector<char*> args;
+	args.AddMultipleToTail( g_OriginalCommandLineParameters.Count(), g_OriginalCommandLineParameters.Base() );
+	args.AddToTail( NULL );
+
+	if ( SpawnProcess( args.Base() ) < 0 )
+		return false;
+
+	FreeStrings( g_OriginalCommandLineParameters );
+	return true;
+}
+
+
+bool VMPI_Init(
+	int &argc,
+	char **&argv,
+	const char *pDependencyFilename,
+	VMPI_Disconnect_Handler handler,
+	VMPIRunMode runMode,
+	bool bConnectingAsService
+	)
+{
+	if ( handler )
+		VMPI_AddDisconnectHandler( handler );
+
+	VMPI_SetupAutoRestartParameters( argc, argv );
+	VMPI_InitGlobals( argc, argv, runMode );
+
+	// Were we launched as a worker?
+	const char *pMasterIP = VMPI_FindArg( argc, argv, VMPI_GetParamString( mpi_Worker ), NULL );
+	if ( pMasterIP )
+	{
+		CIPAddr addr;
+		addr.port = VMPI_MASTER_FIRST_PORT;
+		if ( !ConvertStringToIPAddr( pMasterIP, &addr ) )
+			Error( "Unable to parse or resolve master IP (%s).\n", pMasterIP );
+
+		return MPI_Init_Worker( argc, argv, addr );
+	}
+	else
+	{
+		// The dependency file lists the binaries to copy to worker machines, which only
+		// the Windows service does. We still want it so the tools behave the same.
+		if ( !pDependencyFilename )
+		{
+			Error( "VMPI started as master, but no dependency filename specified.\n" );
+			return false;
+		}
+
+		return InitMaster( argc, argv, runMode );
+	}
+}
+
+
+static void WaitForLocalWorkers()
+{
+	// They exit when they see the master's connection close.
+	double flStartTime = Plat_FloatTime();
+	while ( g_LocalWorkerPIDs.Count() > 0 )
+	{
+		for ( int i=g_LocalWorkerPIDs.Count()-1; i >= 0; i-- )
+		{
+			int status;
+			if ( waitpid( g_LocalWorkerPIDs[i], &status, WNOHANG ) != 0 )
+				g_LocalWorkerPIDs.Remove( i );
+		}
+
+		if ( g_LocalWorkerPIDs.Count() == 0 )
+			break;
+
+		if ( Plat_FloatTime() - flStartTime > 10 )
+		{
+			Warning( "VMPI: %d local workers didn't exit, killing them.\n", g_LocalWorkerPIDs.Count() );
+			for ( int i=0; i < g_LocalWorkerPIDs.Count(); i++ )
+			{
+				kill( g_LocalWorkerPIDs[i], SIGKILL );
+				waitpid( g_LocalWorkerPIDs[i], NULL, 0 );
+			}
+			g_LocalWorkerPIDs.Purge();
+			break;
+		}
+
+		ThreadSleep( 50 );
+	}
+}
+
+
+void VMPI_Finalize()
+{
+	DistributeWork_Cancel();
+
+	// Flush anything that was grouped, then shut the sockets.
+	VMPI_FlushGroupedPackets();
+	StopReceiveThread();
+
+	if ( g_ListenSocket != -1 )
+	{
+		close( g_ListenSocket );
+		g_ListenSocket = -1;
+	}
+
+	for ( int iConn=0; iConn < g_nConnections; iConn++ )
+	{
+		CVMPIConnection *pConn = g_Connections[iConn];
+		if ( pConn )
+		{
+			if ( pConn->m_Socket != -1 )
+				close( pConn->m_Socket );
+			delete pConn;
+			g_Connections[iConn] = NULL;
+		}
+	}
+	g_nConnections = 0;
+
+	WaitForLocalWorkers();
+
+	// Get rid of all the packets.
+	FOR_EACH_LL( g_VMPIMessages, i )
+	{
+		free( g_VMPIMessages[i] );
+	}
+	g_VMPIMessages.Purge();
+	g_PersistentPackets.PurgeAndDeleteElements();
+	g_Disconnects.Purge();
+
+	// Get rid of the message buffers
+	MessageBuffer *pBuf;
+	while ( g_DispatchBuffers.PopItem( &pBuf ) )
+		delete pBuf;
+
+	FreeStrings( g_WorkerCommandLine );
+
+	VMPI_HandleAutoRestart();
+}
+
+
+VMPIRunMode VMPI_GetRunMode()
+{
+	return g_VMPIRunMode;
+}
+
+
+VMPIFileSystemMode VMPI_GetFileSystemMode()
+{
+	return VMPI_FILESYSTEM_TCP;
+}
+
+
+int VMPI_GetCurrentNumberOfConnections()
+{
+	return g_nConnections;
+}
+
+
+// ---------------------------------------------------------------------------------------- //
+// Dispatching.
+// ---------------------------------------------------------------------------------------- //
+
+// Runs the disconnect handlers on this thread.
+static void InternalHandleSocketErrors()
+{
+	CUtlVector<CVMPIDisconnect> disconnects;
+	{
+		AUTO_LOCK( g_DisconnectsMutex );
+		disconnects.CopyArray( g_Disconnects.Base(), g_Disconnects.Count() );
+		g_Disconnects.RemoveAll();
+	}
+
+	for ( int i=0; i < disconnects.Count(); i++ )
+	{
+		FOR_EACH_LL( g_DisconnectHandlers, iHandler )
+			g_DisconnectHandlers[iHandler]( disconnects[i].m_iProc, disconnects[i].m_Reason );
+	}
+}
+
+
+void VMPI_HandleSocketErrors( unsigned long timeout )
+{
+	if ( timeout )
+		g_DisconnectEvent.Wait( timeout );
+
+	InternalHandleSocketErrors();
+}
+
+
+static bool VMPI_GetNextMessage( MessageBuffer *pBuf, int *pSource, unsigned long startTimeout )
+{
+	uint32 startTime = Plat_MSTime();
+
+	while ( 1 )
+	{
+		InternalHandleSocketErrors();
+
+		CVMPIMessage *pMsg = NULL;
+		{
+			AUTO_LOCK( g_VMPIMessagesMutex );
+			int iHead = g_VMPIMessages.Head();
+			if ( iHead != g_VMPIMessages.InvalidIndex() )
+			{
+				pMsg = g_VMPIMessages[iHead];
+				g_VMPIMessages.Remove( iHead );
+			}
+		}
+
+		if ( pMsg )
+		{
+			// Copy it into their message buffer.
+			pBuf->setLen( pMsg->m_Len );
+			memcpy( pBuf->data, pMsg->m_Data, pMsg->m_Len );
+			*pSource = pMsg->m_iSource;
+			free( pMsg );
+			return true;
+		}
+
+		unsigned long timeout = startTimeout;
+		if ( startTimeout != VMPI_TIMEOUT_INFINITE )
+		{
+			unsigned long delta = Plat_MSTime() - startTime;
+			if ( delta >= startTimeout )
+				return false;
+
+			timeout = startTimeout - delta;
+		}
+
+		g_VMPIEvent.Wait( timeout );
+	}
+}
+
+
+static bool VMPI_InternalDispatch( MessageBuffer *pBuf, int iSource )
+{
+	if ( pBuf->getLen() < 1 )
+		return false;
+
+	unsigned char packetID = (unsigned char)pBuf->data[0];
+	if ( packetID < MAX_VMPI_PACKET_IDS && g_VMPIDispatch[packetID] )
+	{
+		return g_VMPIDispatch[packetID]( pBuf, iSource, packetID );
+	}
+	else
+	{
+		return false;
+	}
+}
+
+
+bool VMPI_DispatchNextMessage( unsigned long timeout )
+{
+	MessageBuffer *pBuf = NULL;
+	if ( !g_DispatchBuffers.PopItem( &pBuf ) )
+	{
+		pBuf = new MessageBuffer();
+	}
+
+	bool bRetval = true;
+	while ( 1 )
+	{
+		int iSource;
+		if ( VMPI_GetNextMessage( pBuf, &iSource, timeout ) )
+		{
+			if ( VMPI_InternalDispatch( pBuf, iSource ) )
+			{
+				break;
+			}
+			else
+			{
+				// Oops! What is this packet?
+				Assert( false );
+			}
+		}
+		else
+		{
+			bRetval = false;
+			break;
+		}
+	}
+
+	g_DispatchBuffers.PushItem( pBuf );
+	return bRetval;
+}
+
+
+bool VMPI_DispatchUntil( MessageBuffer *pBuf, int *pSource, int packetID, int subPacketID, bool bWait )
+{
+	while ( 1 )
+	{
+		if ( !VMPI_GetNextMessage( pBuf, pSource, bWait ? VMPI_TIMEOUT_INFINITE : 0 ) )
+			return false;
+
+		if ( !VMPI_InternalDispatch( pBuf, *pSource ) )
+		{
+			if ( pBuf->getLen() >= 1 && (unsigned char)pBuf->data[0] == packetID )
+			{
+				if ( subPacketID == -1 )
+					return true;
+
+				if ( pBuf->getLen() >= 2 && (unsigned char)pBuf->data[1] == subPacketID )
+					return true;
+			}
+
+			// See the note in vmpi.cpp. Packets for an earlier stage get discarded here.
+		}
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------- //
+// Sending.
+// ---------------------------------------------------------------------------------------- //
+
+bool VMPI_SendData( void *pData, int nBytes, int iDest, int fVMPISendFlags )
+{
+	return VMPI_SendChunks( &pData, &nBytes, 1, iDest, fVMPISendFlags );
+}
+
+
+void VMPI_FlushGroupedPackets( unsigned long msInterval )
+{
+	static uint32 s_LastFlushGroupedPacketsTime = 0;
+	if ( msInterval != 0 )
+	{
+		uint32 curTime = Plat_MSTime();
+		if ( curTime - s_LastFlushGroupedPacketsTime < msInterval )
+			return;
+		s_LastFlushGroupedPacketsTime = curTime;
+	}
+
+	for ( int i=0; i < g_nConnections; i++ )
+	{
+		CVMPIConnection *pConn = g_Connections[i];
+		if ( !pConn )
+			continue;
+
+		AUTO_LOCK( pConn->m_SendMutex );
+		if ( pConn->m_GroupedPackets.Count() == 0 )
+			continue;
+
+		const void *pData = pConn->m_GroupedPackets.Base();
+		int len = pConn->m_GroupedPackets.Count();
+		SendMessage( pConn, &pData, &len, 1 );
+		pConn->m_GroupedPackets.RemoveAll();
+	}
+}
+
+
+bool VMPI_SendChunks( void const * const *pChunks, const int *pChunkLengths, int nChunks, int iDest, int fVMPISendFlags )
+{
+	if ( iDest == VMPI_SEND_TO_ALL )
+	{
+		// Don't want new connections while in here!
+		AUTO_LOCK( g_ConnectionsMutex );
+
+		for ( int i=0; i < g_nConnections; i++ )
+		{
+			if ( g_Connections[i] )
+				VMPI_SendChunks( pChunks, pChunkLengths, nChunks, i );
+		}
+
+		return true;
+	}
+	else if ( iDest == VMPI_PERSISTENT )
+	{
+		// Don't want new connections while in here!
+		AUTO_LOCK( g_ConnectionsMutex );
+		AUTO_LOCK( g_PersistentPacketsMutex );
+
+		// Send the packet to everyone.
+		for ( int i=0; i < g_nConnections; i++ )
+		{
+			if ( g_Connections[i] )
+				VMPI_SendChunks( pChunks, pChunkLengths, nChunks, i );
+		}
+
+		// Remember to send it to the new workers.
+		PersistentPacket *pNew = new PersistentPacket;
+		for ( int i=0; i < nChunks; i++ )
+			pNew->AddMultipleToTail( pChunkLengths[i], (const char*)pChunks[i] );
+
+		g_PersistentPackets.AddToTail( pNew );
+		return true;
+	}
+	else
+	{
+		if ( iDest < 0 || iDest >= g_nConnections )
+		{
+			Assert( false );
+			return false;
+		}
+
+		CVMPIConnection *pConnection = g_Connections[iDest];
+		if ( !pConnection )
+			return false;
+
+		g_nMessagesSent++;
+		g_nBytesSent += 4; // for message tag.
+		for ( int i=0; i < nChunks; i++ )
+			g_nBytesSent += pChunkLengths[i];
+
+		if ( g_bGroupPackets && (fVMPISendFlags & k_eVMPISendFlags_GroupPackets) )
+		{
+			GroupPackets( pConnection, pChunks, pChunkLengths, nChunks );
+			return true;
+		}
+		else
+		{
+			return SendMessage( pConnection, pChunks, pChunkLengths, nChunks );
+		}
+	}
+}
+
+
+bool VMPI_Send2Chunks( const void *pChunk1, int chunk1Len, const void *pChunk2, int chunk2Len, int iDest, int fVMPISendFlags )
+{
+	const void *pChunks[2] = { pChunk1, pChunk2 };
+	int len[2] = { chunk1Len, chunk2Len };
+	return VMPI_SendChunks( pChunks, len, ARRAYSIZE( pChunks ), iDest, fVMPISendFlags );
+}
+
+
+bool VMPI_Send3Chunks( const void *pChunk1, int chunk1Len, const void *pChunk2, int chunk2Len, const void *pChunk3, int chunk3Len, int iDest, int fVMPISendFlags )
+{
+	const void *pChunks[3] = { pChunk1, pChunk2, pChunk3 };
+	int len[3] = { chunk1Len, chunk2Len, chunk3Len };
+	return VMPI_SendChunks( pChunks, len, ARRAYSIZE( pChunks ), iDest, fVMPISendFlags );
+}
+
+
+// ---------------------------------------------------------------------------------------- //
+// Connection info.
+// ---------------------------------------------------------------------------------------- //
+
+void VMPI_AddDisconnectHandler( VMPI_Disconnect_Handler handler )
+{
+	g_DisconnectHandlers.AddToTail( handler );
+}
+
+
+static CVMPIConnection* GetConnection( int procID )
+{
+	Assert( procID >= 0 && procID < g_nConnections );
+	return g_Connections[procID];
+}
+
+
+bool VMPI_IsProcValid( int procID )
+{
+	if ( procID < 0 || procID >= g_nConnections )
+		return false;
+
+	return g_Connections[ procID ] != NULL;
+}
+
+
+bool VMPI_IsProcConnected( int procID )
+{
+	if ( procID < 0 || procID >= g_nConnections )
+	{
+		Assert( false );
+		return false;
+	}
+
+	CVMPIConnection *pConn = g_Connections[procID];
+	return pConn && pConn->m_Socket != -1;
+}
+
+
+bool VMPI_IsProcAService( int procID )
+{
+	// There is no service on POSIX; every connection is a real worker.
+	return false;
+}
+
+
+void VMPI_Sleep( unsigned long ms )
+{
+	ThreadSleep( ms );
+}
+
+
+const char* VMPI_GetMachineName( int iProc )
+{
+	if ( g_bMPIMaster && iProc == VMPI_MASTER_ID )
+		return VMPI_GetLocalMachineName();
+
+	if ( iProc < 0 || iProc >= g_nConnections )
+	{
+		Assert( false );
+		return "invalid index";
+	}
+
+	if ( g_Connections[iProc] == NULL )
+	{
+		return "invalid index";
+	}
+
+	return g_Connections[iProc]->m_MachineName;
+}
+
+
+void VMPI_SetMachineName( int iProc, const char *pName )
+{
+	if ( iProc < 0 || iProc >= g_nConnections )
+	{
+		Assert( false );
+		return;
+	}
+
+	if ( g_Connections[ iProc ] == NULL )
+	{
+		return;
+	}
+
+	g_Connections[iProc]->SetMachineName( pName );
+}
+
+
+bool VMPI_HasMachineNameBeenSet( int iProc )
+{
+	if ( iProc < 0 || iProc >= g_nConnections )
+	{
+		Assert( false );
+		return false;
+	}
+
+	if ( g_Connections[ iProc ] == NULL )
+	{
+		return false;
+	}
+
+	return g_Connections[iProc]->m_bNameSet;
+}
+
+
+const char* VMPI_GetLocalMachineName()
+{
+	static char cName[256];
+	if ( gethostname( cName, sizeof( cName ) ) == 0 )
+	{
+		cName[ sizeof( cName ) - 1 ] = 0;
+		return cName;
+	}
+	else
+	{
+		return "(error in gethostname)";
+	}
+}
+
+
+unsigned long VMPI_GetJobWorkerID( int iProc )
+{
+	return GetConnection( iProc )->m_JobWorkerID;
+}
+
+
+void VMPI_SetJobWorkerID( int iProc, unsigned long jobWorkerID )
+{
+	GetConnection( iProc )->m_JobWorkerID = jobWorkerID;
+}
+
+
+void VMPI_GetCurrentStage( char *pOut, int strLen )
+{
+	AUTO_LOCK( g_CurrentStageMutex );
+	V_strncpy( pOut, g_CurrentStageString, strLen );
+}
+
+
+void VMPI_SetCurrentStage( const char *pCurStage )
+{
+	AUTO_LOCK( g_CurrentStageMutex );
+	V_strncpy( g_CurrentStageString, pCurStage, sizeof( g_CurrentStageString ) );
+}
+
+
+void VMPI_InviteDebugWorkers()
+{
+	// Only allow workers with password set to debugworker, and let in some more of them.
+	AUTO_LOCK( g_ConnectionsMutex );
+	V_strncpy( g_Password, "debugworker", sizeof( g_Password ) );
+	g_nMaxWorkerCount += 25;
+}
+
+
+bool VMPI_IsSDKMode()
+{
+	return g_bVMPISDKMode;
+}
+
+
+const char* VMPI_GetParamString( EVMPICmdLineParam eParam )
+{
+	if ( eParam <= k_eVMPICmdLineParam_FirstParam || eParam >= k_eVMPICmdLineParam_LastParam )
+	{
+		Assert( false );
+		Warning( "Invalid call: VMPI_GetParamString( %d )\n", eParam );
+		return "unknown";
+	}
+	else
+	{
+		return g_VMPIParams[eParam].m_pName;
+	}
+}
+
+int VMPI_GetParamFlags( EVMPICmdLineParam eParam )
+{
+	if ( eParam <= k_eVMPICmdLineParam_FirstParam || eParam >= k_eVMPICmdLineParam_LastParam )
+	{
+		Assert( false );
+		Warning( "Invalid call: VMPI_GetParamString( %d )\n", eParam );
+		return 0;
+	}
+	else
+	{
+		return g_VMPIParams[eParam].m_ParamFlags;
+	}
+}
+
+bool VMPI_IsParamUsed( EVMPICmdLineParam eParam )
+{
+	int iParam = CommandLine()->FindParm( VMPI_GetParamString( eParam ) );
+	return iParam != 0;
+}
+
+const char* VMPI_GetParamHelpString( EVMPICmdLineParam eParam )
+{
+	if ( eParam <= k_eVMPICmdLineParam_FirstParam || eParam >= k_eVMPICmdLineParam_LastParam )
+	{
+		Assert( false );
+		Warning( "Invalid call: VMPI_GetParamHelpString( %d )\n", eParam );
+		return "unknown vmpi param";
+	}
+	else
+	{
+		return g_VMPIParams[eParam].m_pHelpText;
+	}
+}
+
+void VMPI_PrintMsgOnMaster( const char *pMessage, ... )
+{
+	char formatted[2048];
+	va_list marker;
+	va_start( marker, pMessage );
+	V_vsnprintf( formatted, sizeof( formatted ), pMessage, marker );
+	va_end( marker );
+
+	if ( VMPI_IsMaster() )
+	{
+		Msg( "%s\n", formatted );
+	}
+	else
+	{
+		MessageBuffer mb;
+
+		char cPacketHeader[2] = {VMPI_INTERNAL_PACKET_ID, VMPI_INTERNAL_SUBPACKET_PRINT_ON_MASTER};
+		mb.write( cPacketHeader, sizeof( cPacketHeader ) );
+		mb.WriteString( formatted );
+
+		VMPI_SendData( mb.data, mb.getLen(), VMPI_MASTER_ID );
+	}
+}
+
+
+bool VMPI_IsThisMyIP( CIPAddr testIP )
+{
+	// Loopback is always us.
+	if ( testIP.ip[0] == 127 )
+		return true;
+
+	struct ifaddrs *ifaces = NULL;
+	if ( getifaddrs( &ifaces ) != 0 )
+		return false;
+
+	bool bRet = false;
+	for ( struct ifaddrs *iface = ifaces; iface && !bRet; iface = iface->ifa_next )
+	{
+		if ( iface->ifa_addr && iface->ifa_addr->sa_family == AF_INET )
+		{
+			CIPAddr ifaceAddr;
+			SockAddrToIPAddr( (const sockaddr_in*)iface->ifa_addr, &ifaceAddr );
+			bRet = ( memcmp( ifaceAddr.ip, testIP.ip, sizeof( testIP.ip ) ) == 0 );
+		}
+	}
+
+	freeifaddrs( ifaces );
+	return bRet;
+}
+
+
+bool VMPI_IsThisWorkerRunningOnMasterMachine()
+{
+	if ( VMPI_IsMaster() )
+	{
+		return false;
+	}
+
+	if ( VMPI_IsProcValid( VMPI_MASTER_ID ) && VMPI_IsProcConnected( VMPI_MASTER_ID ) )
+	{
+		return VMPI_IsThisMyIP( GetConnection( VMPI_MASTER_ID )->m_RemoteAddr );
+	}
+
+	return false;
+}
+
@@ -311,9 +311,9 @@ void CIncremental::AddLightToFace(
 	{
 		bool bNew;
 		
-		EnterCriticalSection( &pLight->m_CS );
+		pLight->m_CS.Lock();
 			pFace = pLight->FindOrCreateLightFace( iFace, lmSize, &bNew );
-		LeaveCriticalSection( &pLight->m_CS );
+		pLight->m_CS.Unlock();
 
 		pLight->m_pCachedFaces[iThread] = pFace;
 
@@ -460,10 +460,10 @@ void CIncremental::FinishFace(
 		if( pFace->m_CompressedData.TellPut() == 0 )
 		{
 			// No contribution.. delete this face from the light.
-			EnterCriticalSection( &pLight->m_CS );
+			pLight->m_CS.Lock();
 				pLight->m_LightFaces.Remove( pFace->m_LightFacesIndex );
 				delete pFace;
-			LeaveCriticalSection( &pLight->m_CS );
+			pLight->m_CS.Unlock();
 		}
 		else
 		{
@@ -719,14 +719,12 @@ void CIncremental::LinkLightsToFaces( CUtlVector<CFaceLightList> &faceLights )
 CIncLight::CIncLight()
 {
 	memset( m_pCachedFaces, 0, sizeof(m_pCachedFaces) );
-	InitializeCriticalSection( &m_CS );
 }
 
 
 CIncLight::~CIncLight()
 {
 	m_LightFaces.PurgeAndDeleteElements();
-	DeleteCriticalSection( &m_CS );
 }
 
 
@@ -89,12 +89,24 @@ float Engine_WorldLightDistanceFalloff( const dworldlight_t *wl, const Vector& d
 }
 
 
-void AddEmitSurfaceLights( const Vector &vStart, Vector lightBoxColor[6] )
+// Ambient samples are lit by the emit_surface lights in groups of up to this many. The samples of
+// a group all lie in one leaf, so their rays to any one light are nearly parallel and trace well
+// as a single packet.
+#define EMIT_SURFACE_SAMPLE_GROUP 8
+
+void AddEmitSurfaceLights( int nSamples, const Vector *pStart, Vector (*pLightBoxColor)[6] )
 {
-	fltx4 fractionVisible;
+	Assert( nSamples > 0 && nSamples <= EMIT_SURFACE_SAMPLE_GROUP );
 
-	FourVectors vStart4, wlOrigin4;
-	vStart4.DuplicateVector ( vStart );
+	FourVectors vStart4[2], wlOrigin4[2];
+	for ( int i=0; i < 8; i++ )
+	{
+		// Unused rays repeat the last sample.
+		const Vector &vStart = pStart[ min( i, nSamples-1 ) ];
+		vStart4[i >> 2].X( i & 3 ) = vStart.x;
+		vStart4[i >> 2].Y( i & 3 ) = vStart.y;
+		vStart4[i >> 2].Z( i & 3 ) = vStart.z;
+	}
 
 	for ( int iLight=0; iLight < *pNumworldlights; iLight++ )
 	{
@@ -106,33 +118,50 @@ void AddEmitSurfaceLights( const Vector &vStart, Vector lightBoxColor[6] )
 
 		Assert( wl->type == emit_surface );
 
-		// Can this light see the point?
-		wlOrigin4.DuplicateVector ( wl->origin );
-		TestLine ( vStart4, wlOrigin4, &fractionVisible );
-		if ( !TestSignSIMD ( CmpGtSIMD ( fractionVisible, Four_Zeros ) ) )
-			continue;
-
-		// Add this light's contribution.
-		Vector vDelta = wl->origin - vStart;
-		float flDistanceScale = Engine_WorldLightDistanceFalloff( wl, vDelta );
+		// Falloff and facing first, they're much cheaper than the visibility test and
+		// cull most lights for samples behind or too far from them.
+		Vector vDeltaNorm[EMIT_SURFACE_SAMPLE_GROUP];
+		float flRatio[EMIT_SURFACE_SAMPLE_GROUP];
+		bool bAnyLit = false;
+		for ( int i=0; i < nSamples; i++ )
+		{
+			Vector vDelta = wl->origin - pStart[i];
+			float flDistanceScale = Engine_WorldLightDistanceFalloff( wl, vDelta );
 
-		Vector vDeltaNorm = vDelta;
-		VectorNormalize( vDeltaNorm );
-		float flAngleScale = Engine_WorldLightAngle( wl, wl->normal, vDeltaNorm, vDeltaNorm );
+			vDeltaNorm[i] = vDelta;
+			VectorNormalize( vDeltaNorm[i] );
+			float flAngleScale = Engine_WorldLightAngle( wl, wl->normal, vDeltaNorm[i], vDeltaNorm[i] );
 
-		float ratio = flDistanceScale * flAngleScale * SubFloat ( fractionVisible, 0 );
-		if ( ratio == 0 )
+			flRatio[i] = flDistanceScale * flAngleScale;
+			bAnyLit = bAnyLit || ( flRatio[i] != 0 );
+		}
+		if ( !bAnyLit )
 			continue;
 
-		for ( int i=0; i < 6; i++ )
+		// Can this light see the points?
+		wlOrigin4[0].DuplicateVector ( wl->origin );
+		wlOrigin4[1].DuplicateVector ( wl->origin );
+
+		fltx4 fractionVisible[2];
+		TestLine8 ( vStart4, wlOrigin4, fractionVisible );
+
+		// Add this light's contribution.
+		for ( int i=0; i < nSamples; i++ )
 		{
-			float t = DotProduct( g_BoxDirections[i], vDeltaNorm );
-			if ( t > 0 )
+			float ratio = flRatio[i] * SubFloat( fractionVisible[i >> 2], i & 3 );
+			if ( ratio == 0 )
+				continue;
+
+			for ( int j=0; j < 6; j++ )
 			{
-				lightBoxColor[i] += wl->intensity * (t * ratio);
+				float t = DotProduct( g_BoxDirections[j], vDeltaNorm[i] );
+				if ( t > 0 )
+				{
+					pLightBoxColor[i][j] += wl->intensity * (t * ratio);
+				}
 			}
 		}
-	}	
+	}
 }
 
 
@@ -173,10 +202,6 @@ void ComputeAmbientFromSphericalSamples( int iThread, const Vector &vStart, Vect
 		
 		lightBoxColor[j] *= 1/t;
 	}
-
-	// Now add direct light from the emit_surface lights. These go in the ambient cube because
-	// there are a ton of them and they are often so dim that they get filtered out by r_worldlightmin.
-	AddEmitSurfaceLights( vStart, lightBoxColor );
 }
 
 
@@ -550,15 +575,27 @@ void ComputeAmbientForLeaf( int iThread, int leafID, CUtlVector<ambientsample_t>
 		// NOTE: We copy the nearest non-solid leaf sample pointers into this leaf at the end
 		return;
 	}
-	Vector cube[6];
-	for ( int i = 0; i < sampleCount; i++ )
+	Vector samplePosition[EMIT_SURFACE_SAMPLE_GROUP];
+	Vector cube[EMIT_SURFACE_SAMPLE_GROUP][6];
+	for ( int i = 0; i < sampleCount; i += EMIT_SURFACE_SAMPLE_GROUP )
 	{
 		// compute each candidate sample and add to the list
-		Vector samplePosition;
-		sampler.GenerateLeafSamplePosition( leafID, leafPlanes, samplePosition );
-		ComputeAmbientFromSphericalSamples( iThread, samplePosition, cube );
+		int nGroup = min( sampleCount - i, EMIT_SURFACE_SAMPLE_GROUP );
+		for ( int j = 0; j < nGroup; j++ )
+		{
+			sampler.GenerateLeafSamplePosition( leafID, leafPlanes, samplePosition[j] );
+			ComputeAmbientFromSphericalSamples( iThread, samplePosition[j], cube[j] );
+		}
+
+		// Now add direct light from the emit_surface lights. These go in the ambient cube because
+		// there are a ton of them and they are often so dim that they get filtered out by r_worldlightmin.
+		AddEmitSurfaceLights( nGroup, samplePosition, cube );
+
 		// note this will remove the least valuable sample once the limit is reached
-		AddSampleToList( list, samplePosition, cube );
+		for ( int j = 0; j < nGroup; j++ )
+		{
+			AddSampleToList( list, samplePosition[j], cube[j] );
+		}
 	}
 
 	// remove any samples that can be reconstructed with the remaining data
@@ -0,0 +1,679 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Persistent per-face direct lighting cache ("-lightcache").
+//
+// The key of a face covers:
+//	- the compile settings that change direct lighting
+//	- the face's vertices, plane, smoothed normals, texinfo and lightmap extents
+//	- every light that can see one of the face's clusters, together with a hash
+//	  of all ray tracing triangles inside the region the light's shadow rays
+//	  for this face can travel through
+//
+// The region hashes come from a coarse grid over the ray tracing geometry.
+// Each triangle is hashed into every cell it overlaps and a 3D prefix-XOR
+// table over the cells answers "hash of everything inside this box" with 8
+// lookups, so moving a prop or brush only invalidates the faces whose shadow
+// rays could have hit it.
+//
+// Only direct lighting is cached. Bounce lighting couples every face with
+// every other face, so BuildPatchLights and the radiosity passes always run.
+// Displacements are never cached, and changes to the contents of alpha
+// tested textures (-textureshadows) are not tracked.
+//
+//=============================================================================//
+
+#include "vrad.h"
+#include "lightmap.h"
+#include "lightcache.h"
+#include "tier1/utlbuffer.h"
+#include "tier1/utlmap.h"
+
+
+#define LIGHTCACHE_MAGIC		( ( 'H' << 24 ) | ( 'C' << 16 ) | ( 'L' << 8 ) | 'V' )
+#define LIGHTCACHE_VERSION		1
+
+// Occluder grid resolution
+#define LIGHTCACHE_MIN_CELL_SIZE	256.0f
+#define LIGHTCACHE_MAX_CELLS		128
+
+// How far samples can sit off of the face they belong to
+#define LIGHTCACHE_FACE_EPSILON		4.0f
+
+bool g_bUseLightCache = false;
+
+
+//-----------------------------------------------------------------------------
+// 64-bit FNV-1a
+//-----------------------------------------------------------------------------
+static const uint64 FNV64_OFFSET_BASIS = 0xcbf29ce484222325ull;
+static const uint64 FNV64_PRIME = 0x100000001b3ull;
+
+static inline uint64 HashBytes( uint64 h, const void *pData, int nBytes )
+{
+	const uint8 *pBytes = ( const uint8 * )pData;
+	for ( int i = 0; i < nBytes; ++i )
+	{
+		h ^= pBytes[i];
+		h *= FNV64_PRIME;
+	}
+	return h;
+}
+
+template< class T >
+static inline uint64 HashValue( uint64 h, const T &value )
+{
+	return HashBytes( h, &value, sizeof( value ) );
+}
+
+// Scrambles a hash so that the same triangle XORed into two cells doesn't cancel out
+static inline uint64 MixHash( uint64 h )
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+
+//-----------------------------------------------------------------------------
+// Hashes of the ray tracing geometry, queryable by box
+//-----------------------------------------------------------------------------
+class COccluderGrid
+{
+public:
+	void Build( RayTracingEnvironment &env );
+	uint64 HashBox( const Vector &mins, const Vector &maxs ) const;
+	void Purge() { m_PrefixXor.Purge(); }
+
+	Vector m_vecMins;
+	Vector m_vecMaxs;
+
+private:
+	void CellRange( const Vector &mins, const Vector &maxs, int *pLo, int *pHi ) const;
+	int PrefixIndex( int x, int y, int z ) const
+	{
+		return ( z * ( m_nDims[1] + 1 ) + y ) * ( m_nDims[0] + 1 ) + x;
+	}
+
+	int m_nDims[3];
+	Vector m_vecCellSize;
+
+	// ( dims + 1 )^3 entries, with a zero border at index 0 of each axis
+	CUtlVector<uint64> m_PrefixXor;
+};
+
+void COccluderGrid::CellRange( const Vector &mins, const Vector &maxs, int *pLo, int *pHi ) const
+{
+	for ( int i = 0; i < 3; ++i )
+	{
+		pLo[i] = clamp( ( int )floor( ( mins[i] - m_vecMins[i] ) / m_vecCellSize[i] ), 0, m_nDims[i] - 1 );
+		pHi[i] = clamp( ( int )floor( ( maxs[i] - m_vecMins[i] ) / m_vecCellSize[i] ), 0, m_nDims[i] - 1 );
+	}
+}
+
+void COccluderGrid::Build( RayTracingEnvironment &env )
+{
+	int nTriangles = env.OptimizedTriangleList.Count();
+
+	m_vecMins.Init( 1.0e30, 1.0e30, 1.0e30 );
+	m_vecMaxs.Init( -1.0e30, -1.0e30, -1.0e30 );
+	for ( int i = 0; i < nTriangles; ++i )
+	{
+		for ( int v = 0; v < 3; ++v )
+		{
+			VectorMin( m_vecMins, env.OptimizedTriangleList[i].Vertex( v ), m_vecMins );
+			VectorMax( m_vecMaxs, env.OptimizedTriangleList[i].Vertex( v ), m_vecMaxs );
+		}
+	}
+	if ( !nTriangles )
+	{
+		m_vecMins.Init();
+		m_vecMaxs.Init();
+	}
+
+	for ( int i = 0; i < 3; ++i )
+	{
+		float flExtent = m_vecMaxs[i] - m_vecMins[i];
+		m_vecCellSize[i] = max( LIGHTCACHE_MIN_CELL_SIZE, flExtent / LIGHTCACHE_MAX_CELLS );
+		m_nDims[i] = clamp( ( int )ceil( flExtent / m_vecCellSize[i] ), 1, LIGHTCACHE_MAX_CELLS );
+	}
+
+	int nPrefixCount = ( m_nDims[0] + 1 ) * ( m_nDims[1] + 1 ) * ( m_nDims[2] + 1 );
+	m_PrefixXor.SetCount( nPrefixCount );
+	memset( m_PrefixXor.Base(), 0, nPrefixCount * sizeof( uint64 ) );
+
+	// Scatter triangle hashes into the cells, stored at ( x+1, y+1, z+1 )
+	for ( int i = 0; i < nTriangles; ++i )
+	{
+		const CacheOptimizedTriangle &tri = env.OptimizedTriangleList[i];
+		const TriGeometryData_t &geom = tri.m_Data.m_GeometryData;
+
+		uint64 h = FNV64_OFFSET_BASIS;
+		h = HashBytes( h, geom.m_VertexCoordData, sizeof( geom.m_VertexCoordData ) );
+		h = HashValue( h, geom.m_nTriangleID );
+		h = HashValue( h, geom.m_nFlags );
+		h = HashValue( h, env.TriangleMaterials[i] );
+		h = HashValue( h, env.TriangleColors[i] );
+
+		Vector mins, maxs;
+		ClearBounds( mins, maxs );
+		for ( int v = 0; v < 3; ++v )
+		{
+			AddPointToBounds( tri.Vertex( v ), mins, maxs );
+		}
+
+		int lo[3], hi[3];
+		CellRange( mins, maxs, lo, hi );
+		for ( int z = lo[2]; z <= hi[2]; ++z )
+		{
+			for ( int y = lo[1]; y <= hi[1]; ++y )
+			{
+				for ( int x = lo[0]; x <= hi[0]; ++x )
+				{
+					int nCell = PrefixIndex( x + 1, y + 1, z + 1 );
+					m_PrefixXor[nCell] ^= MixHash( h + ( uint64 )nCell * FNV64_PRIME );
+				}
+			}
+		}
+	}
+
+	// Turn the cells into a prefix table. XOR is its own inverse, so the usual
+	// inclusion-exclusion signs all drop out.
+	for ( int z = 1; z <= m_nDims[2]; ++z )
+	{
+		for ( int y = 1; y <= m_nDims[1]; ++y )
+		{
+			for ( int x = 1; x <= m_nDims[0]; ++x )
+			{
+				m_PrefixXor[PrefixIndex( x, y, z )] ^=
+					m_PrefixXor[PrefixIndex( x - 1, y, z )] ^
+					m_PrefixXor[PrefixIndex( x, y - 1, z )] ^
+					m_PrefixXor[PrefixIndex( x, y, z - 1 )] ^
+					m_PrefixXor[PrefixIndex( x - 1, y - 1, z )] ^
+					m_PrefixXor[PrefixIndex( x - 1, y, z - 1 )] ^
+					m_PrefixXor[PrefixIndex( x, y - 1, z - 1 )] ^
+					m_PrefixXor[PrefixIndex( x - 1, y - 1, z - 1 )];
+			}
+		}
+	}
+}
+
+uint64 COccluderGrid::HashBox( const Vector &mins, const Vector &maxs ) const
+{
+	int lo[3], hi[3];
+	CellRange( mins, maxs, lo, hi );
+
+	int x0 = lo[0], y0 = lo[1], z0 = lo[2];
+	int x1 = hi[0] + 1, y1 = hi[1] + 1, z1 = hi[2] + 1;
+	return m_PrefixXor[PrefixIndex( x1, y1, z1 )] ^
+		m_PrefixXor[PrefixIndex( x0, y1, z1 )] ^
+		m_PrefixXor[PrefixIndex( x1, y0, z1 )] ^
+		m_PrefixXor[PrefixIndex( x1, y1, z0 )] ^
+		m_PrefixXor[PrefixIndex( x0, y0, z1 )] ^
+		m_PrefixXor[PrefixIndex( x0, y1, z0 )] ^
+		m_PrefixXor[PrefixIndex( x1, y0, z0 )] ^
+		m_PrefixXor[PrefixIndex( x0, y0, z0 )];
+}
+
+
+//-----------------------------------------------------------------------------
+// Cache file layout: LightCacheHeader_t, then nEntries entries, each a
+// LightCacheEntry_t followed by its LightingValue_t samples, ordered by
+// style, then normal, then sample.
+//-----------------------------------------------------------------------------
+struct LightCacheHeader_t
+{
+	int		m_nMagic;
+	int		m_nVersion;
+	uint64	m_nSettingsHash;
+	int		m_nEntries;
+};
+
+struct LightCacheEntry_t
+{
+	uint64	m_nKey;
+	int		m_nSamples;
+	int		m_nNormalCount;
+	int		m_nStyleCount;
+	byte	m_Styles[MAXLIGHTMAPS];
+};
+
+enum LightCacheFaceState_t
+{
+	LIGHTCACHE_FACE_NONE = 0,
+	LIGHTCACHE_FACE_HIT,		// m_nOffset is the entry in the loaded file
+	LIGHTCACHE_FACE_STORED,		// m_pData holds a freshly computed entry
+};
+
+struct LightCacheFace_t
+{
+	uint64	m_nKey;
+	int		m_nState;
+	int		m_nOffset;
+	byte	*m_pData;
+	int		m_nDataSize;
+};
+
+static COccluderGrid g_OccluderGrid;
+static uint64 g_nSettingsHash;
+static char g_szCacheFile[MAX_PATH];
+
+static CUtlBuffer g_CacheFile;
+static CUtlMap<uint64, int> g_CacheEntries( DefLessFunc( uint64 ) );	// key -> offset into g_CacheFile
+static CUtlVector<LightCacheFace_t> g_CacheFaces;
+
+// Clusters of the leaves each face lives in, from dleaffaces
+static CUtlVector<int> g_FaceFirstCluster;
+static CUtlVector<int> g_FaceClusterCount;
+static CUtlVector<int> g_FaceClusters;
+
+
+static inline int EntryDataSize( const LightCacheEntry_t &entry )
+{
+	return sizeof( LightCacheEntry_t ) + entry.m_nStyleCount * entry.m_nNormalCount * entry.m_nSamples * sizeof( LightingValue_t );
+}
+
+static uint64 ComputeSettingsHash()
+{
+	uint64 h = FNV64_OFFSET_BASIS;
+	h = HashValue( h, LIGHTCACHE_VERSION );
+	h = HashValue( h, do_extra );
+	h = HashValue( h, extrapasses );
+	h = HashValue( h, do_fast );
+	h = HashValue( h, do_centersamples );
+	h = HashValue( h, smoothing_threshold );
+	h = HashValue( h, dlight_threshold );
+	h = HashValue( h, g_bTextureShadows );
+	h = HashValue( h, g_bStaticPropPolys );
+	h = HashValue( h, g_bDisablePropSelfShadowing );
+	h = HashValue( h, g_bLargeDispSampleRadius );
+	h = HashValue( h, g_SunAngularExtent );
+	h = HashValue( h, g_flSkySampleScale );
+	h = HashValue( h, g_bNoSkyRecurse );
+	h = HashValue( h, num_sky_cameras );
+	h = HashBytes( h, sky_cameras, num_sky_cameras * sizeof( sky_camera_t ) );
+	return h;
+}
+
+static void BuildFaceClusters()
+{
+	g_FaceFirstCluster.SetCount( numfaces );
+	g_FaceClusterCount.SetCount( numfaces );
+	memset( g_FaceClusterCount.Base(), 0, numfaces * sizeof( int ) );
+
+	for ( int iLeaf = 0; iLeaf < numleafs; ++iLeaf )
+	{
+		if ( dleafs[iLeaf].cluster < 0 )
+			continue;
+
+		for ( int i = 0; i < dleafs[iLeaf].numleaffaces; ++i )
+		{
+			++g_FaceClusterCount[ dleaffaces[ dleafs[iLeaf].firstleafface + i ] ];
+		}
+	}
+
+	int nTotal = 0;
+	for ( int i = 0; i < numfaces; ++i )
+	{
+		g_FaceFirstCluster[i] = nTotal;
+		nTotal += g_FaceClusterCount[i];
+		g_FaceClusterCount[i] = 0;
+	}
+
+	g_FaceClusters.SetCount( nTotal );
+	for ( int iLeaf = 0; iLeaf < numleafs; ++iLeaf )
+	{
+		if ( dleafs[iLeaf].cluster < 0 )
+			continue;
+
+		for ( int i = 0; i < dleafs[iLeaf].numleaffaces; ++i )
+		{
+			int iFace = dleaffaces[ dleafs[iLeaf].firstleafface + i ];
+			g_FaceClusters[ g_FaceFirstCluster[iFace] + g_FaceClusterCount[iFace]++ ] = dleafs[iLeaf].cluster;
+		}
+	}
+}
+
+static void GetFaceBounds( int facenum, Vector &mins, Vector &maxs )
+{
+	dface_t *f = &g_pFaces[facenum];
+
+	ClearBounds( mins, maxs );
+	for ( int i = 0; i < f->numedges; ++i )
+	{
+		int se = dsurfedges[f->firstedge + i];
+		int v = ( se < 0 ) ? dedges[-se].v[1] : dedges[se].v[0];
+		AddPointToBounds( dvertexes[v].point + face_offset[facenum], mins, maxs );
+	}
+
+	Vector vecEpsilon( LIGHTCACHE_FACE_EPSILON, LIGHTCACHE_FACE_EPSILON, LIGHTCACHE_FACE_EPSILON );
+	mins -= vecEpsilon;
+	maxs += vecEpsilon;
+}
+
+static uint64 HashFace( uint64 h, int facenum )
+{
+	dface_t *f = &g_pFaces[facenum];
+
+	h = HashValue( h, dplanes[f->planenum].normal );
+	h = HashValue( h, dplanes[f->planenum].dist );
+	h = HashValue( h, f->side );
+	h = HashValue( h, f->numedges );
+	h = HashValue( h, face_offset[facenum] );
+	for ( int i = 0; i < f->numedges; ++i )
+	{
+		int se = dsurfedges[f->firstedge + i];
+		int v = ( se < 0 ) ? dedges[-se].v[1] : dedges[se].v[0];
+		h = HashValue( h, dvertexes[v].point );
+	}
+
+	faceneighbor_t *fn = &faceneighbor[facenum];
+	if ( fn->normal )
+	{
+		h = HashBytes( h, fn->normal, f->numedges * sizeof( Vector ) );
+	}
+
+	h = HashValue( h, texinfo[f->texinfo] );
+	h = HashValue( h, f->m_LightmapTextureMinsInLuxels );
+	h = HashValue( h, f->m_LightmapTextureSizeInLuxels );
+	return h;
+}
+
+static bool LightReachesFace( directlight_t *dl, int facenum )
+{
+	int nClusters = g_FaceClusterCount[facenum];
+
+	// Brush model faces aren't in any leaf; assume everything can see them
+	if ( !nClusters )
+		return true;
+
+	const int *pClusters = &g_FaceClusters[ g_FaceFirstCluster[facenum] ];
+	for ( int i = 0; i < nClusters; ++i )
+	{
+		if ( PVSCheck( dl->pvs, pClusters[i] ) )
+			return true;
+	}
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// The box shadow rays from the face towards this light can pass through
+//-----------------------------------------------------------------------------
+static void GetLightRegion( directlight_t *dl, const Vector &faceMins, const Vector &faceMaxs, Vector &mins, Vector &maxs )
+{
+	const Vector &worldMins = g_OccluderGrid.m_vecMins;
+	const Vector &worldMaxs = g_OccluderGrid.m_vecMaxs;
+
+	switch ( dl->light.type )
+	{
+	case emit_skyambient:
+		mins = worldMins;
+		maxs = worldMaxs;
+		break;
+
+	case emit_skylight:
+		// Sky rays that recurse through a 3D skybox can end up anywhere
+		if ( num_sky_cameras && !g_bNoSkyRecurse )
+		{
+			mins = worldMins;
+			maxs = worldMaxs;
+		}
+		else
+		{
+			// Sweep the face towards the sun, widened by the sun's jitter cone
+			float flLength = worldMins.DistTo( worldMaxs );
+			Vector vecSweep = dl->light.normal * -flLength;
+			float flSpread = flLength * g_SunAngularExtent;
+			Vector vecSpread( flSpread, flSpread, flSpread );
+
+			mins = faceMins;
+			maxs = faceMaxs;
+			AddPointToBounds( faceMins + vecSweep, mins, maxs );
+			AddPointToBounds( faceMaxs + vecSweep, mins, maxs );
+			mins -= vecSpread;
+			maxs += vecSpread;
+		}
+		break;
+
+	default:
+		mins = faceMins;
+		maxs = faceMaxs;
+		AddPointToBounds( dl->light.origin, mins, maxs );
+		break;
+	}
+}
+
+static uint64 HashLight( directlight_t *dl )
+{
+	// Everything but the owner, which is just an entity index
+	uint64 h = HashBytes( FNV64_OFFSET_BASIS, &dl->light, offsetof( dworldlight_t, owner ) );
+	h = HashValue( h, dl->m_flStartFadeDistance );
+	h = HashValue( h, dl->m_flEndFadeDistance );
+	h = HashValue( h, dl->m_flCapDist );
+	return h;
+}
+
+static uint64 ComputeFaceKey( int facenum )
+{
+	uint64 h = HashFace( g_nSettingsHash, facenum );
+
+	Vector faceMins, faceMaxs;
+	GetFaceBounds( facenum, faceMins, faceMaxs );
+
+	for ( directlight_t *dl = activelights; dl != NULL; dl = dl->next )
+	{
+		if ( !LightReachesFace( dl, facenum ) )
+			continue;
+
+		Vector mins, maxs;
+		GetLightRegion( dl, faceMins, faceMaxs, mins, maxs );
+
+		h = HashValue( h, HashLight( dl ) );
+		h = HashValue( h, g_OccluderGrid.HashBox( mins, maxs ) );
+	}
+
+	return h;
+}
+
+
+//-----------------------------------------------------------------------------
+// Loads the cache and builds the occluder grid
+//-----------------------------------------------------------------------------
+void LightCache_Init( const char *pBSPFileName )
+{
+	if ( !g_bUseLightCache )
+		return;
+
+	double flStart = Plat_FloatTime();
+
+	Q_StripExtension( pBSPFileName, g_szCacheFile, sizeof( g_szCacheFile ) );
+	Q_strncat( g_szCacheFile, g_bHDR ? ".hdr.lightcache" : ".lightcache", sizeof( g_szCacheFile ), COPY_ALL_CHARACTERS );
+
+	g_nSettingsHash = ComputeSettingsHash();
+	g_OccluderGrid.Build( g_RtEnv );
+	BuildFaceClusters();
+
+	g_CacheFaces.SetCount( numfaces );
+	memset( g_CacheFaces.Base(), 0, numfaces * sizeof( LightCacheFace_t ) );
+
+	g_CacheEntries.RemoveAll();
+	g_CacheFile.Purge();
+	if ( !g_pFileSystem->FileExists( g_szCacheFile ) || !g_pFileSystem->ReadFile( g_szCacheFile, NULL, g_CacheFile ) )
+	{
+		Msg( "Light cache: %s not found, all faces will be lit\n", g_szCacheFile );
+		return;
+	}
+
+	LightCacheHeader_t header;
+	g_CacheFile.Get( &header, sizeof( header ) );
+	if ( !g_CacheFile.IsValid() || header.m_nMagic != LIGHTCACHE_MAGIC ||
+		 header.m_nVersion != LIGHTCACHE_VERSION || header.m_nSettingsHash != g_nSettingsHash )
+	{
+		Msg( "Light cache: %s is out of date, all faces will be lit\n", g_szCacheFile );
+		g_CacheFile.Purge();
+		return;
+	}
+
+	for ( int i = 0; i < header.m_nEntries; ++i )
+	{
+		int nOffset = g_CacheFile.TellGet();
+		if ( g_CacheFile.TellMaxPut() - nOffset < (int)sizeof( LightCacheEntry_t ) )
+			break;
+
+		const LightCacheEntry_t *pEntry = ( const LightCacheEntry_t * )g_CacheFile.PeekGet();
+		int nSize = EntryDataSize( *pEntry );
+		if ( g_CacheFile.TellMaxPut() - nOffset < nSize )
+			break;
+
+		g_CacheEntries.InsertOrReplace( pEntry->m_nKey, nOffset );
+		g_CacheFile.SeekGet( CUtlBuffer::SEEK_CURRENT, nSize );
+	}
+
+	Msg( "Light cache: loaded %d faces from %s (%.2f seconds)\n", g_CacheEntries.Count(),
+		g_szCacheFile, Plat_FloatTime() - flStart );
+}
+
+
+//-----------------------------------------------------------------------------
+// Restores a face's direct lighting. Called from worker threads; only touches
+// this face's slot.
+//-----------------------------------------------------------------------------
+bool LightCache_RestoreFace( int facenum, int nNormalCount )
+{
+	LightCacheFace_t &slot = g_CacheFaces[facenum];
+	slot.m_nState = LIGHTCACHE_FACE_NONE;
+
+	dface_t *f = &g_pFaces[facenum];
+	if ( ValidDispFace( f ) )
+		return false;
+
+	slot.m_nKey = ComputeFaceKey( facenum );
+
+	int i = g_CacheEntries.Find( slot.m_nKey );
+	if ( i == g_CacheEntries.InvalidIndex() )
+		return false;
+
+	facelight_t *fl = &facelight[facenum];
+	const byte *pData = ( const byte * )g_CacheFile.Base() + g_CacheEntries[i];
+	const LightCacheEntry_t *pEntry = ( const LightCacheEntry_t * )pData;
+	if ( pEntry->m_nSamples != fl->numsamples || pEntry->m_nNormalCount != nNormalCount ||
+		 pEntry->m_nStyleCount > MAXLIGHTMAPS )
+		return false;
+
+	const LightingValue_t *pSamples = ( const LightingValue_t * )( pData + sizeof( LightCacheEntry_t ) );
+	for ( int k = 0; k < pEntry->m_nStyleCount; ++k )
+	{
+		f->styles[k] = pEntry->m_Styles[k];
+		for ( int n = 0; n < nNormalCount; ++n )
+		{
+			fl->light[k][n] = ( LightingValue_t * )malloc( fl->numsamples * sizeof( LightingValue_t ) );
+			memcpy( fl->light[k][n], pSamples, fl->numsamples * sizeof( LightingValue_t ) );
+			pSamples += fl->numsamples;
+		}
+	}
+
+	slot.m_nState = LIGHTCACHE_FACE_HIT;
+	slot.m_nOffset = g_CacheEntries[i];
+	return true;
+}
+
+void LightCache_StoreFace( int facenum, int nNormalCount )
+{
+	LightCacheFace_t &slot = g_CacheFaces[facenum];
+	if ( ValidDispFace( &g_pFaces[facenum] ) )
+		return;
+
+	dface_t *f = &g_pFaces[facenum];
+	facelight_t *fl = &facelight[facenum];
+
+	LightCacheEntry_t entry;
+	entry.m_nKey = slot.m_nKey;
+	entry.m_nSamples = fl->numsamples;
+	entry.m_nNormalCount = nNormalCount;
+	entry.m_nStyleCount = 0;
+	while ( entry.m_nStyleCount < MAXLIGHTMAPS && f->styles[entry.m_nStyleCount] != 255 )
+	{
+		entry.m_Styles[entry.m_nStyleCount] = f->styles[entry.m_nStyleCount];
+		++entry.m_nStyleCount;
+	}
+	for ( int k = entry.m_nStyleCount; k < MAXLIGHTMAPS; ++k )
+	{
+		entry.m_Styles[k] = 255;
+	}
+
+	slot.m_nDataSize = EntryDataSize( entry );
+	slot.m_pData = ( byte * )malloc( slot.m_nDataSize );
+	memcpy( slot.m_pData, &entry, sizeof( entry ) );
+
+	LightingValue_t *pSamples = ( LightingValue_t * )( slot.m_pData + sizeof( entry ) );
+	for ( int k = 0; k < entry.m_nStyleCount; ++k )
+	{
+		for ( int n = 0; n < nNormalCount; ++n )
+		{
+			memcpy( pSamples, fl->light[k][n], fl->numsamples * sizeof( LightingValue_t ) );
+			pSamples += fl->numsamples;
+		}
+	}
+
+	slot.m_nState = LIGHTCACHE_FACE_STORED;
+}
+
+
+//-----------------------------------------------------------------------------
+// Writes the faces of this compile. Entries of faces that no longer exist are
+// dropped so the file doesn't grow without bound.
+//-----------------------------------------------------------------------------
+void LightCache_Save()
+{
+	if ( !g_bUseLightCache )
+		return;
+
+	CUtlBuffer buf;
+
+	LightCacheHeader_t header;
+	header.m_nMagic = LIGHTCACHE_MAGIC;
+	header.m_nVersion = LIGHTCACHE_VERSION;
+	header.m_nSettingsHash = g_nSettingsHash;
+	header.m_nEntries = 0;
+	buf.Put( &header, sizeof( header ) );
+
+	int nHits = 0;
+	int nLit = 0;
+	for ( int i = 0; i < g_CacheFaces.Count(); ++i )
+	{
+		LightCacheFace_t &slot = g_CacheFaces[i];
+		if ( slot.m_nState == LIGHTCACHE_FACE_HIT )
+		{
+			const LightCacheEntry_t *pEntry = ( const LightCacheEntry_t * )( ( const byte * )g_CacheFile.Base() + slot.m_nOffset );
+			buf.Put( pEntry, EntryDataSize( *pEntry ) );
+			++header.m_nEntries;
+			++nHits;
+		}
+		else if ( slot.m_nState == LIGHTCACHE_FACE_STORED )
+		{
+			buf.Put( slot.m_pData, slot.m_nDataSize );
+			++header.m_nEntries;
+			++nLit;
+			free( slot.m_pData );
+		}
+	}
+
+	// Patch in the entry count
+	memcpy( buf.Base(), &header, sizeof( header ) );
+
+	Msg( "Light cache: %d faces reused, %d faces relit\n", nHits, nLit );
+	if ( !g_pFileSystem->WriteFile( g_szCacheFile, NULL, buf ) )
+	{
+		Warning( "Light cache: unable to write %s\n", g_szCacheFile );
+	}
+
+	g_CacheFaces.Purge();
+	g_CacheEntries.RemoveAll();
+	g_CacheFile.Purge();
+	g_OccluderGrid.Purge();
+	g_FaceFirstCluster.Purge();
+	g_FaceClusterCount.Purge();
+	g_FaceClusters.Purge();
+}
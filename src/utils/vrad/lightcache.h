@@ -0,0 +1,38 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Persistent per-face direct lighting cache ("-lightcache").
+//
+// Every lit face gets a 64-bit key built from the face geometry, its texinfo,
+// the lights that can reach it and the ray tracing geometry between the face
+// and those lights. The direct lighting of faces whose key is unchanged since
+// the last compile is loaded from <map>.lightcache instead of being traced.
+//
+//=============================================================================//
+
+#ifndef LIGHTCACHE_H
+#define LIGHTCACHE_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+extern bool g_bUseLightCache;
+
+// Loads the cache file and hashes the ray tracing geometry. Must be called
+// after all triangles were added to g_RtEnv and before the acceleration
+// structure is built.
+void LightCache_Init( const char *pBSPFileName );
+
+// Called from BuildFacelights after the sample points were generated. If the
+// face is cached, allocates and fills in its lightstyles and light samples and
+// returns true.
+bool LightCache_RestoreFace( int facenum, int nNormalCount );
+
+// Records the freshly computed direct lighting of a face.
+void LightCache_StoreFace( int facenum, int nNormalCount );
+
+// Writes the entries for this compile and frees everything.
+void LightCache_Save();
+
+
+#endif // LIGHTCACHE_H
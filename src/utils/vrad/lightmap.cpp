@@ -22,6 +22,7 @@
 #include "mathlib/quantize.h"
 #include "bitmap/imageformat.h"
 #include "coordsize.h"
+#include "lightcache.h"
 
 enum
 {
@@ -90,7 +91,7 @@ int CNormalList::FindOrAddNormal( Vector const &vNormal )
 	for( int iDim=0; iDim < 3; iDim++ )
 	{
 		gi[iDim] = (int)( ((vNormal[iDim] + 1.0f) * 0.5f) * NUM_SUBDIVS - 0.000001f );
-		gi[iDim] = min( gi[iDim], NUM_SUBDIVS );
+		gi[iDim] = min( gi[iDim], (int)NUM_SUBDIVS );
 		gi[iDim] = max( gi[iDim], 0 );
 	}
 
@@ -1832,15 +1833,14 @@ void GatherSampleAmbientSkySSE( SSE_sampleLightOutput_t &out, directlight_t *dl,
 
 }
 
-// Helper function - gathers light from area lights, spot lights, and point lights
-void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
-								  FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
-								  int nLFlags, int static_prop_index_to_ignore,
-								  float flEpsilon )
+// Helper function - the part of GatherSampleStandardLightSSE before the visibility
+// trace. Returns false if the light can't reach any of the samples.
+static bool SetupSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl,
+										 FourVectors const& pos, FourVectors *pNormals, int nLFlags,
+										 FourVectors &src, FourVectors &delta, fltx4 &dot )
 {
 	bool bIgnoreNormals = ( nLFlags & GATHERLFLAGS_IGNORE_NORMALS ) != 0;
 
-	FourVectors src;
 	src.DuplicateVector( vec3_origin );
 
 	if (dl->facenum == -1)
@@ -1849,7 +1849,6 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 	}
 
 	// Find light vector
-	FourVectors delta;
 	delta = src;
 	delta -= pos;
 	fltx4 dist2 = delta.length2();
@@ -1858,7 +1857,7 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 	fltx4 dist = SqrtEstSIMD( dist2 );//delta.VectorNormalize();
 
 	// Compute dot
-	fltx4 dot = ReplicateX4( (float) CONSTANT_DOT );
+	dot = ReplicateX4( (float) CONSTANT_DOT );
 	if ( !bIgnoreNormals )
 		dot = delta * pNormals[0];
 	dot = MaxSIMD( Four_Zeros, dot );
@@ -1870,7 +1869,7 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 		fltx4 notPastFadeDist = CmpLeSIMD ( dist, ReplicateX4 ( dl->m_flEndFadeDistance ) );
 		dot = AndSIMD( dot, notPastFadeDist );  // dot = 0 if past fade distance
 		if ( !TestSignSIMD ( notPastFadeDist ) )
-			return;
+			return false;
 	}
 
 	dist = MaxSIMD( dist, Four_Ones );
@@ -1901,7 +1900,7 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 		// Light behind surface yields zero dot
 		dot2 = MaxSIMD( Four_Zeros, dot2 );
 		if ( TestSignSIMD( CmpEqSIMD( Four_Zeros, dot ) ) == 0xF )
-			return;
+			return false;
 
 		out.m_flFalloff = ReciprocalSIMD ( dist2 );
 		out.m_flFalloff = MulSIMD( out.m_flFalloff, dot2 );
@@ -1919,7 +1918,7 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 		// Affix dot2 to zero if outside light cone
 		inCone = CmpGtSIMD( dot2, ReplicateX4( dl->light.stopdot2 ) );
 		if ( !TestSignSIMD ( inCone ) )
-			return;
+			return false;
 		dot = AndSIMD( inCone, dot );
 
 		constant  = ReplicateX4( dl->light.constant_attn );
@@ -1976,9 +1975,15 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 		out.m_flFalloff = MulSIMD( mult, out.m_flFalloff );
 	}
 
-	// Raytrace for visibility function
-	fltx4 fractionVisible = Four_Ones;
-	TestLine( pos, src, &fractionVisible, static_prop_index_to_ignore);
+	return true;
+}
+
+// Helper function - the part of GatherSampleStandardLightSSE after the visibility trace
+static void FinishSampleStandardLightSSE( SSE_sampleLightOutput_t &out, FourVectors *pNormals, int normalCount, int nLFlags,
+										  FourVectors const& delta, fltx4 dot, fltx4 fractionVisible )
+{
+	bool bIgnoreNormals = ( nLFlags & GATHERLFLAGS_IGNORE_NORMALS ) != 0;
+
 	dot = MulSIMD( fractionVisible, dot );
 	out.m_flDot[0] = dot;
 
@@ -1994,6 +1999,38 @@ void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *
 	}
 }
 
+// Helper function - gathers light from area lights, spot lights, and point lights
+void GatherSampleStandardLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
+								  FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
+								  int nLFlags, int static_prop_index_to_ignore,
+								  float flEpsilon )
+{
+	FourVectors src, delta;
+	fltx4 dot;
+	if ( !SetupSampleStandardLightSSE( out, dl, pos, pNormals, nLFlags, src, delta, dot ) )
+		return;
+
+	// Raytrace for visibility function
+	fltx4 fractionVisible = Four_Ones;
+	TestLine( pos, src, &fractionVisible, static_prop_index_to_ignore);
+	FinishSampleStandardLightSSE( out, pNormals, normalCount, nLFlags, delta, dot, fractionVisible );
+}
+
+// NOTE: Notice here that if the light is on the back side of the face
+// (tested by checking the dot product of the face normal and the light position)
+// we don't want it to contribute to *any* of the bumped lightmaps. It glows
+// in disturbing ways if we don't do this.
+static void ClampSampleLightDotsSSE( SSE_sampleLightOutput_t &out, int normalCount )
+{
+	out.m_flDot[0] = MaxSIMD ( out.m_flDot[0], Four_Zeros );
+	fltx4 notZero = CmpGtSIMD( out.m_flDot[0], Four_Zeros );
+	for ( int n = 1; n < normalCount; n++ )
+	{
+		out.m_flDot[n] = MaxSIMD( out.m_flDot[n], Four_Zeros );
+		out.m_flDot[n] = AndSIMD( out.m_flDot[n], notZero );
+	}
+}
+
 // returns dot product with normal and delta
 // dl - light
 // pos - position of sample
@@ -2034,18 +2071,65 @@ void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int
 		return;
 	}
 
-	// NOTE: Notice here that if the light is on the back side of the face
-	// (tested by checking the dot product of the face normal and the light position)
-	// we don't want it to contribute to *any* of the bumped lightmaps. It glows
-	// in disturbing ways if we don't do this.
-	out.m_flDot[0] = MaxSIMD ( out.m_flDot[0], Four_Zeros );
-	fltx4 notZero = CmpGtSIMD( out.m_flDot[0], Four_Zeros );
-	for ( int n = 1; n < normalCount; n++ )
+	ClampSampleLightDotsSSE( out, normalCount );
+}
+
+// Same as GatherSampleLightSSE for two groups of 4 samples. Area lights, spot
+// lights, and point lights trace their visibility as one 8 ray packet; the
+// sky lights trace each group on its own.
+void GatherSampleLightSSE8( SSE_sampleLightOutput_t out[2], directlight_t *dl, int facenum, 
+							FourVectors const pos[2], FourVectors *pNormals[2], int normalCount, int iThread,
+							int nLFlags,
+							int static_prop_index_to_ignore,
+							float flEpsilon )
+{
+	if ( dl->light.type != emit_point && dl->light.type != emit_surface && dl->light.type != emit_spotlight )
 	{
-		out.m_flDot[n] = MaxSIMD( out.m_flDot[n], Four_Zeros );
-		out.m_flDot[n] = AndSIMD( out.m_flDot[n], notZero );
+		for ( int h = 0; h < 2; h++ )
+		{
+			GatherSampleLightSSE( out[h], dl, facenum, pos[h], pNormals[h], normalCount, iThread,
+			                      nLFlags, static_prop_index_to_ignore, flEpsilon );
+		}
+		return;
+	}
+
+	Assert( normalCount <= (NUM_BUMP_VECTS+1) );
+
+	FourVectors src[2], delta[2];
+	fltx4 dot[2];
+	bool bLit[2];
+	for ( int h = 0; h < 2; h++ )
+	{
+		for ( int b = 0; b < normalCount; b++ )
+			out[h].m_flDot[b] = Four_Zeros;
+		out[h].m_flFalloff = Four_Zeros;
+		out[h].m_flSunAmount = Four_Zeros;
+
+		bLit[h] = SetupSampleStandardLightSSE( out[h], dl, pos[h], pNormals[h], nLFlags, src[h], delta[h], dot[h] );
 	}
 
+	// Raytrace for visibility function
+	fltx4 fractionVisible[2] = { Four_Ones, Four_Ones };
+	if ( bLit[0] && bLit[1] )
+	{
+		TestLine8( pos, src, fractionVisible, static_prop_index_to_ignore );
+	}
+	else
+	{
+		for ( int h = 0; h < 2; h++ )
+		{
+			if ( bLit[h] )
+				TestLine( pos[h], src[h], &fractionVisible[h], static_prop_index_to_ignore );
+		}
+	}
+
+	for ( int h = 0; h < 2; h++ )
+	{
+		if ( bLit[h] )
+			FinishSampleStandardLightSSE( out[h], pNormals[h], normalCount, nLFlags, delta[h], dot[h], fractionVisible[h] );
+
+		ClampSampleLightDotsSSE( out[h], normalCount );
+	}
 }
 
 /*
@@ -2485,6 +2569,82 @@ static void ComputeIlluminationPointAndNormalsSSE( lightinfo_t const& l, FourVec
 		pInfo->m_Clusters[i] = ClusterFromPoint( pos.Vec( i ) );
 }
 
+//-----------------------------------------------------------------------------
+// Finds which of up to 4 sample points can see the light's cluster
+//-----------------------------------------------------------------------------
+static bool GetSampleLightPVSMask( SSE_SampleInfo_t& info, directlight_t *dl, int numSamples, fltx4 &dotMask )
+{
+	dotMask = Four_Zeros;
+	bool skipLight = true;
+	for( int s = 0; s < numSamples; s++ )
+	{
+		if( PVSCheck( dl->pvs, info.m_Clusters[s] ) )
+		{
+			dotMask = SetComponentSIMD( dotMask, s, 1.0f );
+			skipLight = false;
+		}
+	}
+	return !skipLight;
+}
+
+//-----------------------------------------------------------------------------
+// Adds one light's contribution to up to 4 sample points
+//-----------------------------------------------------------------------------
+static void AddSampleLightAt4Points( SSE_SampleInfo_t& info, directlight_t *dl, SSE_sampleLightOutput_t const& out,
+									 fltx4 dotMask, int sampleIdx, int numSamples )
+{
+	// Apply the PVS check filter and compute falloff x dot
+	fltx4 fxdot[NUM_BUMP_VECTS + 1];
+	bool skipLight = true;
+	for ( int b = 0; b < info.m_NormalCount; b++ )
+	{
+		fxdot[b] = MulSIMD( out.m_flDot[b], dotMask );
+		fxdot[b] = MulSIMD( fxdot[b], out.m_flFalloff );
+		if ( !IsAllZeros( fxdot[b] ) )
+		{
+			skipLight = false;
+		}
+	}
+	if ( skipLight )
+		return;
+
+	// Figure out the lightstyle for this particular sample
+	int lightStyleIndex = FindOrAllocateLightstyleSamples( info.m_pFace, info.m_pFaceLight, 
+		dl->light.style, info.m_NormalCount );
+	if (lightStyleIndex < 0)
+	{
+		if (info.m_WarnFace != info.m_FaceNum)
+		{
+			Warning ("\nWARNING: Too many light styles on a face at (%f, %f, %f)\n",
+				SubFloat( info.m_Points.x, 0 ), SubFloat( info.m_Points.y, 0 ), SubFloat( info.m_Points.z, 0 ) );
+			info.m_WarnFace = info.m_FaceNum;
+		}
+		return;
+	}
+
+	// pLightmaps is an array of the lightmaps for each normal direction,
+	// here's where the result of the sample gathering goes
+	LightingValue_t** pLightmaps = info.m_pFaceLight->light[lightStyleIndex];
+
+	// Incremental lighting only cares about lightstyle zero
+	if( g_pIncremental && (dl->light.style == 0) )
+	{
+		for ( int i = 0; i < numSamples; i++ )
+		{
+			g_pIncremental->AddLightToFace( dl->m_IncrementalID, info.m_FaceNum, sampleIdx + i, 
+				info.m_LightmapSize, SubFloat( fxdot[0], i ), info.m_iThread );
+		}
+	}
+
+	for( int n = 0; n < info.m_NormalCount; ++n )
+	{
+		for ( int i = 0; i < numSamples; i++ )
+		{
+			pLightmaps[n][sampleIdx + i].AddLight( SubFloat( fxdot[n], i ), dl->light.intensity, SubFloat( out.m_flSunAmount, i ) );
+		}
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Iterates over all lights and computes lighting at up to 4 sample points
 //-----------------------------------------------------------------------------
@@ -2496,70 +2656,59 @@ static void GatherSampleLightAt4Points( SSE_SampleInfo_t& info, int sampleIdx, i
 	for (directlight_t *dl = activelights; dl != NULL; dl = dl->next)
 	{	    
 		// is this lights cluster visible?
-		fltx4 dotMask = Four_Zeros;
-		bool skipLight = true;
-		for( int s = 0; s < numSamples; s++ )
-		{
-			if( PVSCheck( dl->pvs, info.m_Clusters[s] ) )
-			{
-				dotMask = SetComponentSIMD( dotMask, s, 1.0f );
-				skipLight = false;
-			}
-		}
-		if ( skipLight )
+		fltx4 dotMask;
+		if ( !GetSampleLightPVSMask( info, dl, numSamples, dotMask ) )
 			continue;
 
 		GatherSampleLightSSE( out, dl, info.m_FaceNum, info.m_Points, info.m_PointNormals, info.m_NormalCount, info.m_iThread );
-		
-		// Apply the PVS check filter and compute falloff x dot
-		fltx4 fxdot[NUM_BUMP_VECTS + 1];
-		skipLight = true;
-		for ( int b = 0; b < info.m_NormalCount; b++ )
+		AddSampleLightAt4Points( info, dl, out, dotMask, sampleIdx, numSamples );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Iterates over all lights and computes lighting at two groups of up to 4
+// sample points, the second group following the first's 4 samples. Lights
+// both groups can see are traced as one 8 ray packet.
+//-----------------------------------------------------------------------------
+static void GatherSampleLightAt8Points( SSE_SampleInfo_t info[2], int sampleIdx, int const numSamples[2] )
+{
+	SSE_sampleLightOutput_t out[2];
+	FourVectors pos[2] = { info[0].m_Points, info[1].m_Points };
+	FourVectors *pNormals[2] = { info[0].m_PointNormals, info[1].m_PointNormals };
+
+	// Iterate over all direct lights and add them to the particular samples
+	for (directlight_t *dl = activelights; dl != NULL; dl = dl->next)
+	{
+		// is this lights cluster visible?
+		fltx4 dotMask[2];
+		bool bVisible[2];
+		for ( int h = 0; h < 2; h++ )
 		{
-			fxdot[b] = MulSIMD( out.m_flDot[b], dotMask );
-			fxdot[b] = MulSIMD( fxdot[b], out.m_flFalloff );
-			if ( !IsAllZeros( fxdot[b] ) )
-			{
-				skipLight = false;
-			}
+			bVisible[h] = GetSampleLightPVSMask( info[h], dl, numSamples[h], dotMask[h] );
 		}
-		if ( skipLight )
-			continue;
 
-		// Figure out the lightstyle for this particular sample
-		int lightStyleIndex = FindOrAllocateLightstyleSamples( info.m_pFace, info.m_pFaceLight, 
-			dl->light.style, info.m_NormalCount );
-		if (lightStyleIndex < 0)
+		if ( bVisible[0] && bVisible[1] )
 		{
-			if (info.m_WarnFace != info.m_FaceNum)
-			{
-				Warning ("\nWARNING: Too many light styles on a face at (%f, %f, %f)\n",
-					info.m_Points.x.m128_f32[0], info.m_Points.y.m128_f32[0], info.m_Points.z.m128_f32[0] );
-				info.m_WarnFace = info.m_FaceNum;
-			}
-			continue;
+			GatherSampleLightSSE8( out, dl, info[0].m_FaceNum, pos, pNormals, info[0].m_NormalCount, info[0].m_iThread );
 		}
-
-		// pLightmaps is an array of the lightmaps for each normal direction,
-		// here's where the result of the sample gathering goes
-		LightingValue_t** pLightmaps = info.m_pFaceLight->light[lightStyleIndex];
-
-		// Incremental lighting only cares about lightstyle zero
-		if( g_pIncremental && (dl->light.style == 0) )
+		else
 		{
-			for ( int i = 0; i < numSamples; i++ )
+			for ( int h = 0; h < 2; h++ )
 			{
-				g_pIncremental->AddLightToFace( dl->m_IncrementalID, info.m_FaceNum, sampleIdx + i, 
-					info.m_LightmapSize, SubFloat( fxdot[0], i ), info.m_iThread );
+				if ( bVisible[h] )
+					GatherSampleLightSSE( out[h], dl, info[h].m_FaceNum, pos[h], pNormals[h], info[h].m_NormalCount, info[h].m_iThread );
 			}
 		}
 
-		for( int n = 0; n < info.m_NormalCount; ++n )
+		for ( int h = 0; h < 2; h++ )
 		{
-			for ( int i = 0; i < numSamples; i++ )
-			{
-				pLightmaps[n][sampleIdx + i].AddLight( SubFloat( fxdot[n], i ), dl->light.intensity, SubFloat( out.m_flSunAmount, i ) );
-			}
+			if ( !bVisible[h] )
+				continue;
+
+			// Only warn once about the face running out of lightstyles
+			info[h].m_WarnFace = info[0].m_WarnFace;
+			AddSampleLightAt4Points( info[h], dl, out[h], dotMask[h], sampleIdx + 4 * h, numSamples[h] );
+			info[0].m_WarnFace = info[h].m_WarnFace;
 		}
 	}
 }
@@ -3109,41 +3258,62 @@ void BuildFacelights (int iThread, int facenum)
 	// Allocate sample positions/normals to SSE
 	int numGroups = ( fl->numsamples & 0x3) ? ( fl->numsamples / 4 ) + 1 : ( fl->numsamples / 4 );
 
-	// always allocate style 0 lightmap
-	f->styles[0] = 0;
-	AllocateLightstyleSamples( fl, 0, sampleInfo.m_NormalCount );
+	// Faces whose lights and occluders are unchanged since the last compile
+	// still need their sample normals fixed up, but skip the light gathering
+	bool bCached = g_bUseLightCache && LightCache_RestoreFace( facenum, sampleInfo.m_NormalCount );
+	if ( !bCached )
+	{
+		// always allocate style 0 lightmap
+		f->styles[0] = 0;
+		AllocateLightstyleSamples( fl, 0, sampleInfo.m_NormalCount );
+	}
 
-	// sample the lights at each sample location
-	for ( int grp = 0; grp < numGroups; ++grp )
+	// sample the lights at each sample location, two groups of 4 at a time so
+	// the visibility traces can go out as 8 ray packets
+	SSE_SampleInfo_t groupInfo[2] = { sampleInfo, sampleInfo };
+	for ( int grp = 0; grp < numGroups; grp += 2 )
 	{
 		int nSample = 4 * grp;
+		int nGroups = min( 2, numGroups - grp );
+		int numSamples[2] = { 0, 0 };
 
-		sample_t *sample = sampleInfo.m_pFaceLight->sample + nSample;
-		int numSamples = min ( 4, sampleInfo.m_pFaceLight->numsamples - nSample );
+		for ( int h = 0; h < nGroups; h++ )
+		{
+			int nGroupSample = nSample + 4 * h;
+			sample_t *sample = sampleInfo.m_pFaceLight->sample + nGroupSample;
+			numSamples[h] = min ( 4, sampleInfo.m_pFaceLight->numsamples - nGroupSample );
 
-		FourVectors positions;
-		FourVectors normals;
+			FourVectors positions;
+			FourVectors normals;
 
-		for ( int i = 0; i < 4; i++ )
-		{
-			v[i] = ( i < numSamples ) ? sample[i].pos : sample[numSamples - 1].pos;
-			n[i] = ( i < numSamples ) ? sample[i].normal : sample[numSamples - 1].normal;
-		}
-		positions.LoadAndSwizzle( v[0], v[1], v[2], v[3] );
-		normals.LoadAndSwizzle( n[0], n[1], n[2], n[3] );
+			for ( int i = 0; i < 4; i++ )
+			{
+				v[i] = ( i < numSamples[h] ) ? sample[i].pos : sample[numSamples[h] - 1].pos;
+				n[i] = ( i < numSamples[h] ) ? sample[i].normal : sample[numSamples[h] - 1].normal;
+			}
+			positions.LoadAndSwizzle( v[0], v[1], v[2], v[3] );
+			normals.LoadAndSwizzle( n[0], n[1], n[2], n[3] );
 
-		ComputeIlluminationPointAndNormalsSSE( l, positions, normals, &sampleInfo, numSamples );
+			ComputeIlluminationPointAndNormalsSSE( l, positions, normals, &groupInfo[h], numSamples[h] );
 
-		// Fixup sample normals in case of smooth faces
-		if ( !l.isflat )
-		{
-			for ( int i = 0; i < numSamples; i++ )
-				sample[i].normal = sampleInfo.m_PointNormals[0].Vec( i );
+			// Fixup sample normals in case of smooth faces
+			if ( !l.isflat )
+			{
+				for ( int i = 0; i < numSamples[h]; i++ )
+					sample[i].normal = groupInfo[h].m_PointNormals[0].Vec( i );
+			}
 		}
 
-		// Iterate over all the lights and add their contribution to this group of spots
-		GatherSampleLightAt4Points( sampleInfo, nSample, numSamples );
+		// Iterate over all the lights and add their contribution to these groups of spots
+		if ( !bCached )
+		{
+			if ( nGroups == 2 )
+				GatherSampleLightAt8Points( groupInfo, nSample, numSamples );
+			else
+				GatherSampleLightAt4Points( groupInfo[0], nSample, numSamples[0] );
+		}
 	}
+	sampleInfo.m_WarnFace = groupInfo[0].m_WarnFace;
 	
 	// Tell the incremental light manager that we're done with this face.
 	if( g_pIncremental )
@@ -3161,7 +3331,7 @@ void BuildFacelights (int iThread, int facenum)
 	}
 
 	// get rid of the -extra functionality on displacement surfaces
-	if (do_extra && !sampleInfo.m_IsDispFace)
+	if (do_extra && !sampleInfo.m_IsDispFace && !bCached)
 	{
 		// For each lightstyle, perform a supersampling pass
 		for ( i = 0; i < MAXLIGHTMAPS; ++i )
@@ -3174,6 +3344,11 @@ void BuildFacelights (int iThread, int facenum)
 		}
 	}
 
+	if ( g_bUseLightCache && !bCached )
+	{
+		LightCache_StoreFace( facenum, sampleInfo.m_NormalCount );
+	}
+
 #ifdef MPI
 	if (!g_bUseMPI) 
 #endif
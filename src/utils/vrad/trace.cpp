@@ -11,7 +11,7 @@
 
 #include "vrad.h"
 #include "trace.h"
-#include "Cmodel.h"
+#include "cmodel.h"
 #include "mathlib/vmatrix.h"
 
 
@@ -133,7 +133,7 @@ public:
 			addedCoverage[s] = 0.0f;
 			if ( ( sign >> s) & 0x1 )
 			{
-				addedCoverage[s] = ComputeCoverageFromTexture( b0->m128_f32[s], b1->m128_f32[s], b2->m128_f32[s], hitID );
+				addedCoverage[s] = ComputeCoverageFromTexture( SubFloat( *b0, s ), SubFloat( *b1, s ), SubFloat( *b2, s ), hitID );
 			}
 		}
 		m_coverage = AddSIMD( m_coverage, LoadUnalignedSIMD( addedCoverage ) );
@@ -169,7 +169,7 @@ void TestLine( const FourVectors& start, const FourVectors& stop,
 	{
 		visibility[i] = 1.0f;
 		if ( ( rt_result.HitIds[i] != -1 ) &&
-		     ( rt_result.HitDistance.m128_f32[i] < len.m128_f32[i] ) )
+		     ( SubFloat( rt_result.HitDistance, i ) < SubFloat( len, i ) ) )
 		{
 			visibility[i] = 0.0f;
 		}
@@ -180,6 +180,46 @@ void TestLine( const FourVectors& start, const FourVectors& stop,
 }
 
 
+void TestLine8( FourVectors const start[2], FourVectors const stop[2],
+				fltx4 pFractionVisible[2], int static_prop_index_to_ignore )
+{
+	EightRays myrays;
+	fltx4 len[2];
+	fltx4 tmin[2] = { Four_Zeros, Four_Zeros };
+	for ( int h = 0; h < 2; h++ )
+	{
+		myrays.m_Rays[h].origin = start[h];
+		myrays.m_Rays[h].direction = stop[h];
+		myrays.m_Rays[h].direction -= myrays.m_Rays[h].origin;
+		len[h] = myrays.m_Rays[h].direction.length();
+		myrays.m_Rays[h].direction *= ReciprocalSIMD( len[h] );
+	}
+
+	RayTracingResult8 rt_result;
+	CCoverageCountTexture coverageCallbacks[2];
+	ITransparentTriangleCallback *pCallbacks[2] = { &coverageCallbacks[0], &coverageCallbacks[1] };
+
+	g_RtEnv.Trace8Rays( myrays, tmin, len, &rt_result, TRACE_ID_STATICPROP | static_prop_index_to_ignore, g_bTextureShadows ? pCallbacks : 0 );
+
+	// Assume we can see the targets unless we get hits
+	for ( int h = 0; h < 2; h++ )
+	{
+		float visibility[4];
+		for ( int i = 0; i < 4; i++ )
+		{
+			visibility[i] = 1.0f;
+			if ( ( rt_result.m_Results[h].HitIds[i] != -1 ) &&
+				 ( SubFloat( rt_result.m_Results[h].HitDistance, i ) < SubFloat( len[h], i ) ) )
+			{
+				visibility[i] = 0.0f;
+			}
+		}
+		pFractionVisible[h] = LoadUnalignedSIMD( visibility );
+		if ( g_bTextureShadows )
+			pFractionVisible[h] = MinSIMD( pFractionVisible[h], coverageCallbacks[h].GetFractionVisible() );
+	}
+}
+
 
 /*
 ================
@@ -373,7 +413,7 @@ void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
 	{
 		aOcclusion[i] = 0.0f;
 		if ( ( rt_result.HitIds[i] != -1 ) &&
-		     ( rt_result.HitDistance.m128_f32[i] < len.m128_f32[i] ) )
+		     ( SubFloat( rt_result.HitDistance, i ) < SubFloat( len, i ) ) )
 		{
 			int id = g_RtEnv.OptimizedTriangleList[rt_result.HitIds[i]].m_Data.m_IntersectData.m_nTriangleID;
 			if ( !( id & TRACE_ID_SKY ) )
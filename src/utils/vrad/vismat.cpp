@@ -175,7 +175,9 @@ void TestPatchToPatch( int ndxPatch1, int ndxPatch2, int head, transfer_t *trans
 		VectorSubtract( patch->origin, patch2->origin, tmp );
 		// SQRT( 1/4 )
 		// FIXME: should be based on form-factor (ie. include visible angle, etc)
-		if ( DotProduct(tmp, tmp) * 0.0625 < patch2->area )
+		// -coarsebounce keeps shooting from the parent patch down to half that distance
+		float flRefineScale = g_bCoarseBounce ? COARSE_BOUNCE_REFINE_SCALE : 0.0625f;
+		if ( DotProduct(tmp, tmp) * flRefineScale < patch2->area )
 		{
 			TestPatchToPatch( ndxPatch1, patch2->child1, head, transfers, transferMaker, iThread );
 			TestPatchToPatch( ndxPatch1, patch2->child2, head, transfers, transferMaker, iThread );
@@ -470,6 +472,12 @@ void BuildVisMatrix (void)
 #ifdef MPI
 	if ( g_bUseMPI )
 	{
+		// The workers send back plain transfer lists
+		if ( g_bCoarseBounce )
+		{
+			Warning( "-coarsebounce is not supported with vmpi; ignoring it.\n" );
+			g_bCoarseBounce = false;
+		}
 		RunMPIBuildVisLeafs();
 	}
 	else 
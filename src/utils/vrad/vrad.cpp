@@ -19,6 +19,8 @@
 #include "tools_minidump.h"
 #include "loadcmdline.h"
 #include "byteswap.h"
+#include "vstdlib/random.h"
+#include "lightcache.h"
 
 #define ALLOWDEBUGOPTIONS (0 || _DEBUG)
 
@@ -57,6 +59,9 @@ float		g_MaxDispPatchRadius = 1500.0f;			// Maximum radius allowed for displacem
 qboolean	g_bDumpPatches;
 bool	    bDumpNormals = false;
 bool		g_bDumpRtEnv = false;
+bool		g_bUseBVH = false;
+bool		g_bCoarseBounce = false;
+bool		g_bRayTraceBenchmark = false;
 bool		bRed2Black = true;
 bool		g_bFastAmbient = false;
 bool        g_bNoSkyRecurse = false;
@@ -94,7 +99,6 @@ bool g_bOnlyStaticProps = false;
 bool g_bShowStaticPropNormals = false;
 
 
-float		gamma = 0.5;
 float		indirect_sun = 1.0;
 float		reflectivityScale = 1.0;
 qboolean	do_extra = true;
@@ -363,7 +367,7 @@ MAKE FACES
 WindingFromFace
 =============
 */
-winding_t	*WindingFromFace (dface_t *f, Vector& origin )
+winding_t	*WindingFromFace (dface_t *f, const Vector& origin )
 {
 	int			i;
 	int			se;
@@ -1057,6 +1061,7 @@ MakeScales
 */
 int	total_transfer;
 int max_transfer;
+int total_compact_transfer_bytes;
 
 
 //-----------------------------------------------------------------------------
@@ -1199,6 +1204,81 @@ void MakeTransfer( int ndxPatch1, int ndxPatch2, transfer_t *all_transfers )
 }
 
 
+//-----------------------------------------------------------------------------
+// Sorts a patch's transfers by shooter, quantizes the form factors against the
+// largest one and packs both into patch->compactTransfers. Sorting keeps the
+// reads of the shooter arrays in GatherLight moving forward through memory.
+//-----------------------------------------------------------------------------
+static int __cdecl CompareTransferPatches( const void *pLeft, const void *pRight )
+{
+	return ( ( const transfer_t * )pLeft )->patch - ( ( const transfer_t * )pRight )->patch;
+}
+
+static void MakeCompactTransfers( CPatch *patch, transfer_t *all_transfers, float flNormalize )
+{
+	int nTransfers = patch->numtransfers;
+	qsort( all_transfers, nTransfers, sizeof( transfer_t ), CompareTransferPatches );
+
+	float flMax = 0.0f;
+	for ( int j = 0; j < nTransfers; j++ )
+	{
+		flMax = max( flMax, all_transfers[j].transfer );
+	}
+	float flQuantize = TRANSFER_FACTOR_MAX / flMax;
+
+	// Drop the transfers that quantize to nothing and count the escaped deltas
+	int nKept = 0;
+	int nEscapes = 0;
+	int nPrev = 0;
+	for ( int j = 0; j < nTransfers; j++ )
+	{
+		int nFactor = (int)( all_transfers[j].transfer * flQuantize + 0.5f );
+		if ( nFactor <= 0 )
+			continue;
+
+		if ( all_transfers[j].patch - nPrev >= TRANSFER_DELTA_ESCAPE )
+			++nEscapes;
+		nPrev = all_transfers[j].patch;
+
+		all_transfers[nKept].patch = all_transfers[j].patch;
+		all_transfers[nKept].transfer = min( nFactor, TRANSFER_FACTOR_MAX );
+		++nKept;
+	}
+
+	int nShorts = 2 * nKept + 2 * nEscapes;
+	unsigned short *pBlock = ( unsigned short * )malloc( nShorts * sizeof( unsigned short ) );
+	if ( !pBlock )
+		Error( "Memory allocation failure" );
+
+	unsigned short *pFactors = pBlock;
+	unsigned short *pDeltas = pBlock + nKept;
+	nPrev = 0;
+	for ( int j = 0; j < nKept; j++ )
+	{
+		int nPatch = all_transfers[j].patch;
+		pFactors[j] = (unsigned short)all_transfers[j].transfer;
+		if ( nPatch - nPrev >= TRANSFER_DELTA_ESCAPE )
+		{
+			*pDeltas++ = TRANSFER_DELTA_ESCAPE;
+			*pDeltas++ = (unsigned short)( nPatch & 0xFFFF );
+			*pDeltas++ = (unsigned short)( nPatch >> 16 );
+		}
+		else
+		{
+			*pDeltas++ = (unsigned short)( nPatch - nPrev );
+		}
+		nPrev = nPatch;
+	}
+
+	patch->numtransfers = nKept;
+	patch->compactTransfers = pBlock;
+	patch->compactTransferScale = flNormalize / flQuantize;
+
+	ThreadLock();
+	total_compact_transfer_bytes += nShorts * sizeof( unsigned short );
+	ThreadUnlock();
+}
+
 void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 {
 	int		j;
@@ -1219,10 +1299,6 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 		}
 
 
-		patch->transfers = ( transfer_t* )calloc (1, patch->numtransfers * sizeof(transfer_t));
-		if (!patch->transfers)
-			Error ("Memory allocation failure");
-
 		// get total transfer energy
 		t2 = all_transfers;
 
@@ -1238,12 +1314,23 @@ void MakeScales ( int ndxPatch, transfer_t *all_transfers )
 		else	
 			total = 1.0f/M_PI;
 
-		t = patch->transfers;
-		t2 = all_transfers;
-		for (j=0 ; j<patch->numtransfers ; j++, t++, t2++)
+		if ( g_bCoarseBounce )
+		{
+			MakeCompactTransfers( patch, all_transfers, total );
+		}
+		else
 		{
-			t->transfer = t2->transfer*total;
-			t->patch = t2->patch;
+			patch->transfers = ( transfer_t* )calloc (1, patch->numtransfers * sizeof(transfer_t));
+			if (!patch->transfers)
+				Error ("Memory allocation failure");
+
+			t = patch->transfers;
+			t2 = all_transfers;
+			for (j=0 ; j<patch->numtransfers ; j++, t++, t2++)
+			{
+				t->transfer = t2->transfer*total;
+				t->patch = t2->patch;
+			}
 		}
 		if (patch->numtransfers > max_transfer)
 		{
@@ -1334,6 +1421,97 @@ void WriteRTEnv (char *name)
 	g_pFileSystem->Close( out );
 }
 
+//-----------------------------------------------------------------------------
+// Builds both the kd-tree and the bvh over the world that was just added to g_RtEnv and
+// compares build times and ray throughput. Must be called before g_RtEnv is set up.
+//-----------------------------------------------------------------------------
+#define RT_BENCHMARK_RAYS	( 1 << 20 )
+
+static void RunRayTraceBenchmark( void )
+{
+	RayTracingEnvironment envs[2];
+	const char *pNames[2] = { "kd-tree", "bvh" };
+	envs[1].Flags |= RTE_FLAGS_USE_BVH;
+
+	for ( int e = 0; e < 2; e++ )
+	{
+		envs[e].MakeRoomForTriangles( g_RtEnv.OptimizedTriangleList.Count() );
+		for ( int i = 0; i < g_RtEnv.OptimizedTriangleList.Count(); i++ )
+		{
+			CacheOptimizedTriangle &tri = g_RtEnv.OptimizedTriangleList[i];
+			envs[e].AddTriangle( tri.m_Data.m_GeometryData.m_nTriangleID, tri.Vertex( 0 ), tri.Vertex( 1 ), tri.Vertex( 2 ),
+				g_RtEnv.GetTriangleColor( i ), tri.m_Data.m_GeometryData.m_nFlags, g_RtEnv.GetTriangleMaterial( i ) );
+		}
+	}
+
+	// random rays through the world bounds, the same set for both structures
+	Vector vMins, vMaxs;
+	int32 *pAllTris = new int32[g_RtEnv.OptimizedTriangleList.Count()];
+	for ( int i = 0; i < g_RtEnv.OptimizedTriangleList.Count(); i++ )
+		pAllTris[i] = i;
+	g_RtEnv.CalculateTriangleListBounds( pAllTris, g_RtEnv.OptimizedTriangleList.Count(), vMins, vMaxs );
+	delete[] pAllTris;
+
+	CUniformRandomStream random;
+	random.SetSeed( 1 );
+	CUtlVector< FourRays, CUtlMemoryAligned< FourRays, 16 > > rays;
+	rays.SetCount( RT_BENCHMARK_RAYS / 4 );
+	for ( int i = 0; i < RT_BENCHMARK_RAYS / 4; i++ )
+	{
+		for ( int r = 0; r < 4; r++ )
+		{
+			Vector vOrigin, vDir;
+			for ( int c = 0; c < 3; c++ )
+				vOrigin[c] = random.RandomFloat( vMins[c], vMaxs[c] );
+			do
+			{
+				vDir.Init( random.RandomFloat( -1, 1 ), random.RandomFloat( -1, 1 ), random.RandomFloat( -1, 1 ) );
+			} while ( VectorNormalize( vDir ) < 1.0e-3 );
+
+			rays[i].origin.X( r ) = vOrigin.x;
+			rays[i].origin.Y( r ) = vOrigin.y;
+			rays[i].origin.Z( r ) = vOrigin.z;
+			rays[i].direction.X( r ) = vDir.x;
+			rays[i].direction.Y( r ) = vDir.y;
+			rays[i].direction.Z( r ) = vDir.z;
+		}
+	}
+
+	CUtlVector<float> hitDistances[2];
+	for ( int e = 0; e < 2; e++ )
+	{
+		double flStart = Plat_FloatTime();
+		envs[e].SetupAccelerationStructure();
+		double flBuildTime = Plat_FloatTime() - flStart;
+
+		hitDistances[e].SetCount( RT_BENCHMARK_RAYS );
+		flStart = Plat_FloatTime();
+		for ( int i = 0; i < RT_BENCHMARK_RAYS / 4; i++ )
+		{
+			RayTracingResult result;
+			envs[e].Trace4Rays( rays[i], Four_Zeros, ReplicateX4( 1.0e6 ), &result );
+			for ( int r = 0; r < 4; r++ )
+				hitDistances[e][i * 4 + r] = SubFloat( result.HitDistance, r );
+		}
+		double flTraceTime = Plat_FloatTime() - flStart;
+
+		Msg( "%-8s: build %.2f seconds, %d nodes, %.2f Mrays/second\n", pNames[e], flBuildTime,
+			e ? envs[e].OptimizedBVH.Count() : envs[e].OptimizedKDTree.Count(),
+			RT_BENCHMARK_RAYS / ( 1.0e6 * max( flTraceTime, 1.0e-6 ) ) );
+	}
+
+	// ties on shared edges can legitimately pick different triangles, so compare distances
+	int nMismatches = 0;
+	for ( int i = 0; i < RT_BENCHMARK_RAYS; i++ )
+	{
+		float flDist0 = hitDistances[0][i];
+		float flDist1 = hitDistances[1][i];
+		if ( fabs( flDist0 - flDist1 ) > 0.01f * max( 1.0f, fabs( flDist0 ) ) )
+			nMismatches++;
+	}
+	Msg( "%d of %d rays differ between kd-tree and bvh\n", nMismatches, RT_BENCHMARK_RAYS );
+}
+
 void WriteWinding (FileHandle_t out, winding_t *w, Vector& color )
 {
 	int			i;
@@ -1532,6 +1710,114 @@ void PreGetBumpNormalsForDisp( texinfo_t *pTexinfo, Vector &vecU, Vector &vecV,
 	vecV = vecTexV;
 }
 
+static void GetPatchBumpNormals( CPatch *patch, Vector normals[NUM_BUMP_VECTS+1] )
+{
+	// Disps
+	bool bDisp = ( g_pFaces[patch->faceNumber].dispinfo != -1 ); 
+	if ( bDisp )
+	{
+		normals[0] = patch->normal;
+		texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
+		Vector vecTexU, vecTexV;
+		PreGetBumpNormalsForDisp( pTexinfo, vecTexU, vecTexV, normals[0] );
+
+		// use facenormal along with the smooth normal to build the three bump map vectors
+		GetBumpNormals( vecTexU, vecTexV, normals[0], normals[0], &normals[1] ); 
+	}
+	else
+	{
+		GetPhongNormal( patch->faceNumber, patch->origin, normals[0] );
+
+		texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
+		// use facenormal along with the smooth normal to build the three bump map vectors
+		GetBumpNormals( pTexinfo->textureVecsTexelsPerWorldUnits[0], 
+			pTexinfo->textureVecsTexelsPerWorldUnits[1], patch->normal, 
+			normals[0], &normals[1] );
+	}
+
+	// force the base lightmap to use the flat normal instead of the phong normal
+	// FIXME: why does the patch not use the phong normal?
+	normals[0] = patch->normal;
+}
+
+
+//-----------------------------------------------------------------------------
+// Shooter data for -coarsebounce, laid out so GatherLightCompact streams
+// through two small arrays instead of touching whole CPatch structs
+//-----------------------------------------------------------------------------
+static CUtlVector<Vector> s_ShooterOrigin;
+static CUtlVector<Vector> s_ShooterLight;		// emitlight * reflectivity, rebuilt every bounce
+
+static FORCEINLINE int NextCompactShooter( const unsigned short *&pDeltas, int nPrev )
+{
+	unsigned short nDelta = *pDeltas++;
+	if ( nDelta != TRANSFER_DELTA_ESCAPE )
+		return nPrev + nDelta;
+
+	int nPatch = pDeltas[0] | ( pDeltas[1] << 16 );
+	pDeltas += 2;
+	return nPatch;
+}
+
+static void GatherLightCompact( int ndxPatch, CPatch *patch )
+{
+	int num = patch->numtransfers;
+	const unsigned short *pFactors = patch->compactTransfers;
+	const unsigned short *pDeltas = pFactors + num;
+	float flScale = patch->compactTransferScale;
+	int nShooter = 0;
+
+	if ( patch->needsBumpmap )
+	{
+		Vector normals[NUM_BUMP_VECTS+1];
+		Vector bumpSum[NUM_BUMP_VECTS+1];
+		GetPatchBumpNormals( patch, normals );
+
+		for ( int i = 0; i < NUM_BUMP_VECTS+1; i++ )
+		{
+			VectorFill( bumpSum[i], 0 );
+		}
+
+		for ( int k = 0; k < num; k++ )
+		{
+			nShooter = NextCompactShooter( pDeltas, nShooter );
+
+			// get vector to other patch
+			Vector delta;
+			VectorSubtract( s_ShooterOrigin[nShooter], patch->origin, delta );
+			VectorNormalize( delta );
+
+			// remove normal already factored into transfer steradian
+			Vector v;
+			float scale = pFactors[k] * flScale / DotProduct( delta, patch->normal );
+			VectorScale( s_ShooterLight[nShooter], scale, v );
+
+			for ( int i = 0; i < NUM_BUMP_VECTS+1; i++ )
+			{
+				float dot = DotProduct( delta, normals[i] );
+				if ( dot <= 0 )
+					continue;
+				VectorMA( bumpSum[i], dot, v, bumpSum[i] );
+			}
+		}
+		for ( int i = 0; i < NUM_BUMP_VECTS+1; i++ )
+		{
+			VectorCopy( bumpSum[i], addlight[ndxPatch].light[i] );
+		}
+	}
+	else
+	{
+		Vector sum;
+		VectorFill( sum, 0 );
+		for ( int k = 0; k < num; k++ )
+		{
+			nShooter = NextCompactShooter( pDeltas, nShooter );
+			VectorMA( sum, pFactors[k] * flScale, s_ShooterLight[nShooter], sum );
+		}
+		VectorCopy( sum, addlight[ndxPatch].light[0] );
+	}
+}
+
 void GatherLight (int threadnum, void *pUserData)
 {
 	int			i, j, k;
@@ -1548,6 +1834,12 @@ void GatherLight (int threadnum, void *pUserData)
 
 		patch = &g_Patches[j];
 
+		if ( g_bCoarseBounce )
+		{
+			GatherLightCompact( j, patch );
+			continue;
+		}
+
 		trans = patch->transfers;
 		num = patch->numtransfers;
 		if ( patch->needsBumpmap )
@@ -1556,32 +1848,7 @@ void GatherLight (int threadnum, void *pUserData)
 			Vector bumpSum[NUM_BUMP_VECTS+1];
 			Vector normals[NUM_BUMP_VECTS+1];
 
-			// Disps
-			bool bDisp = ( g_pFaces[patch->faceNumber].dispinfo != -1 ); 
-			if ( bDisp )
-			{
-				normals[0] = patch->normal;
-				texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
-				Vector vecTexU, vecTexV;
-				PreGetBumpNormalsForDisp( pTexinfo, vecTexU, vecTexV, normals[0] );
-
-				// use facenormal along with the smooth normal to build the three bump map vectors
-				GetBumpNormals( vecTexU, vecTexV, normals[0], normals[0], &normals[1] ); 
-			}
-			else
-			{
-				GetPhongNormal( patch->faceNumber, patch->origin, normals[0] );
-
-				texinfo_t *pTexinfo = &texinfo[g_pFaces[patch->faceNumber].texinfo];
-				// use facenormal along with the smooth normal to build the three bump map vectors
-				GetBumpNormals( pTexinfo->textureVecsTexelsPerWorldUnits[0], 
-					pTexinfo->textureVecsTexelsPerWorldUnits[1], patch->normal, 
-					normals[0], &normals[1] );
-			}
-
-			// force the base lightmap to use the flat normal instead of the phong normal
-			// FIXME: why does the patch not use the phong normal?
-			normals[0] = patch->normal;
+			GetPatchBumpNormals( patch, normals );
 
 			for ( i = 0; i < NUM_BUMP_VECTS+1; i++ )
 			{
@@ -1700,12 +1967,29 @@ void BounceLight (void)
 	}
 #endif
 
+	if ( g_bCoarseBounce )
+	{
+		s_ShooterOrigin.SetCount( uiPatchCount );
+		s_ShooterLight.SetCount( uiPatchCount );
+		for ( i = 0; i < uiPatchCount; i++ )
+		{
+			s_ShooterOrigin[i] = g_Patches[i].origin;
+		}
+	}
+
 	i = 0;
 	while ( bouncing )
 	{
 		// transfer light from to the leaf patches from other patches via transfers
 		// this moves shooter->emitlight to receiver->addlight
 		unsigned int uiPatchCount = g_Patches.Size();
+		if ( g_bCoarseBounce )
+		{
+			for ( unsigned int iPatch = 0; iPatch < uiPatchCount; iPatch++ )
+			{
+				s_ShooterLight[iPatch] = emitlight[iPatch] * g_Patches[iPatch].reflectivity;
+			}
+		}
 		RunThreadsOn (uiPatchCount, true, GatherLight);
 		// move newly received light (addlight) to light to be sent out (emitlight)
 		// start at children and pull light up to parents
@@ -1724,6 +2008,9 @@ void BounceLight (void)
 			WriteWorld (name, 0);
 		}
 	}
+
+	s_ShooterOrigin.Purge();
+	s_ShooterLight.Purge();
 }
 
 
@@ -1932,8 +2219,17 @@ void MakeAllScales (void)
 
 	Msg("transfers %d, max %d\n", total_transfer, max_transfer );
 
-	qprintf ("transfer lists: %5.1f megs\n"
-		, (float)total_transfer * sizeof(transfer_t) / (1024*1024));
+	if ( g_bCoarseBounce )
+	{
+		qprintf ("transfer lists: %5.1f megs (compact, %5.1f megs uncompressed)\n"
+			, (float)total_compact_transfer_bytes / (1024*1024)
+			, (float)total_transfer * sizeof(transfer_t) / (1024*1024));
+	}
+	else
+	{
+		qprintf ("transfer lists: %5.1f megs\n"
+			, (float)total_transfer * sizeof(transfer_t) / (1024*1024));
+	}
 }
 
 
@@ -1998,6 +2294,17 @@ void MakeAllScales (void)
 #endif
 
 
+//-----------------------------------------------------------------------------
+// Per-face lighting cost scales with the luxel count. Used to start the biggest
+// faces first so they don't end up as the long tail of the pass.
+//-----------------------------------------------------------------------------
+static float FaceLightingCost( int iFace )
+{
+	dface_t *f = &g_pFaces[iFace];
+	return (float)( ( f->m_LightmapTextureSizeInLuxels[0] + 1 ) * ( f->m_LightmapTextureSizeInLuxels[1] + 1 ) );
+}
+
+
 bool RadWorld_Go()
 {
 	g_iCurFace = 0;
@@ -2029,9 +2336,11 @@ bool RadWorld_Go()
 	else 
 #endif
 	{
-		RunThreadsOnIndividual (numfaces, true, BuildFacelights);
+		RunThreadsOnIndividualWithCost (numfaces, true, BuildFacelights, FaceLightingCost);
 	}
 
+	LightCache_Save();
+
 	// Was the process interrupted?
 	if( g_pIncremental && (g_iCurFace != numfaces) )
 		return false;
@@ -2087,7 +2396,7 @@ bool RadWorld_Go()
 		if ( !g_bUseMPI || g_bMPIMaster )
 #endif
 		{
-			RunThreadsOnIndividual (numfaces, true, FinalLightFace);
+			RunThreadsOnIndividualWithCost (numfaces, true, FinalLightFace, FaceLightingCost);
 		}
 		
 		// Distribute the lighting data to workers.
@@ -2170,7 +2479,11 @@ void VRAD_LoadBSP( char const *pFilename )
 		// Otherwise, try looking in the BIN directory from which we were run from
 		Msg( "Could not find lights.rad in %s.\nTrying VRAD BIN directory instead...\n", 
 			    global_lights );
+#ifdef _WIN32
 		GetModuleFileName( NULL, global_lights, sizeof( global_lights ) );
+#else
+		Plat_GetExecutablePath( global_lights, sizeof( global_lights ) );
+#endif
 		Q_ExtractFilePath( global_lights, global_lights, sizeof( global_lights ) );
 		strcat( global_lights, "lights.rad" );
 	}
@@ -2282,7 +2595,29 @@ void VRAD_LoadBSP( char const *pFilename )
 	if ( g_bDumpRtEnv )
 		WriteRTEnv("trace.txt");
 
+	if ( g_bRayTraceBenchmark )
+		RunRayTraceBenchmark();
+
+	// The light cache hashes the triangles, so it has to look at them before
+	// they get converted into intersection format
+	if ( g_bUseLightCache )
+	{
+		bool bUseMPI = false;
+#ifdef MPI
+		bUseMPI = g_bUseMPI;
+#endif
+		if ( bUseMPI || g_pIncremental )
+		{
+			Warning( "-lightcache is not supported with vmpi or incremental lighting; ignoring it.\n" );
+			g_bUseLightCache = false;
+		}
+		LightCache_Init( source );
+	}
+
 	// Build acceleration structure
+	if ( g_bUseBVH )
+		g_RtEnv.Flags |= RTE_FLAGS_USE_BVH;
+
 	printf ( "Setting up ray-trace acceleration structure... ");
 	float start = Plat_FloatTime();
 	g_RtEnv.SetupAccelerationStructure();
@@ -2432,6 +2767,22 @@ int ParseCommandLine( int argc, char **argv, bool *onlydetail )
 		{
 			g_bDumpRtEnv = true;
 		}
+		else if ( !Q_stricmp( argv[i], "-bvh" ) )
+		{
+			g_bUseBVH = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-rtbenchmark" ) )
+		{
+			g_bRayTraceBenchmark = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-coarsebounce" ) )
+		{
+			g_bCoarseBounce = true;
+		}
+		else if ( !Q_stricmp( argv[i], "-lightcache" ) )
+		{
+			g_bUseLightCache = true;
+		}
 		else if ( !Q_stricmp( argv[i], "-LargeDispSampleRadius" ) )
 		{
 			g_bLargeDispSampleRadius = true;
@@ -2876,6 +3227,13 @@ void PrintUsage( int argc, char **argv )
 		"  -textureshadows : Allows texture alpha channels to block light - rays intersecting alpha surfaces will sample the texture\n"
 		"  -noskyboxrecurse : Turn off recursion into 3d skybox (skybox shadows on world)\n"
 		"  -nossprops      : Globally disable self-shadowing on static props\n"
+		"  -bvh            : Use a bounding volume hierarchy instead of a kd-tree for ray tracing.\n"
+		"                    Builds faster on maps with many static prop triangles.\n"
+		"  -rtbenchmark    : Compare build time and ray throughput of the kd-tree and bvh before lighting\n"
+		"  -coarsebounce   : Subdivide bounce light shooters less finely near receivers and store\n"
+		"                    transfers in a compact quantized format. Uses far less memory on large maps.\n"
+		"  -lightcache     : Keep direct lighting in <map>.lightcache and only relight faces whose\n"
+		"                    lights or nearby geometry changed since the last compile.\n"
 		"\n"
 #if 1 // Disabled for the initial SDK release with VMPI so we can get feedback from selected users.
 		);
@@ -24,9 +24,9 @@
 #include "polylib.h"
 #include "threads.h"
 #include "builddisp.h"
-#include "VRAD_DispColl.h"
-#include "UtlMemory.h"
-#include "UtlHash.h"
+#include "vrad_dispcoll.h"
+#include "utlmemory.h"
+#include "utlhash.h"
 #include "utlvector.h"
 #include "iincremental.h"
 #include "raytrace.h"
@@ -39,12 +39,16 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#ifdef _WIN32
 #pragma warning(disable: 4142 4028)
 #include <io.h>
 #pragma warning(default: 4142 4028)
+#endif
 
 #include <fcntl.h>
+#ifdef _WIN32
 #include <direct.h>
+#endif
 #include <ctype.h>
 
 
@@ -112,6 +116,21 @@ struct transfer_t
 	float	transfer;
 };
 
+//-----------------------------------------------------------------------------
+// Compact transfer lists used by -coarsebounce. Each receiving patch owns
+// one block of shorts: numtransfers quantized form factors, followed by the
+// shooter patch indices in ascending order, delta coded against the previous
+// index. A delta of TRANSFER_DELTA_ESCAPE is followed by the absolute index
+// in two shorts, low word first.
+//-----------------------------------------------------------------------------
+#define TRANSFER_DELTA_ESCAPE		0xFFFF
+#define TRANSFER_FACTOR_MAX			0xFFFF
+
+// Replaces the 1/16 factor of the refinement test in TestPatchToPatch under
+// -coarsebounce, so shooters stay merged in their parent patch down to
+// twice their size away instead of four times.
+#define COARSE_BOUNCE_REFINE_SCALE		0.25f
+
 
 struct LightingValue_t
 {
@@ -239,6 +258,9 @@ struct CPatch
 	int			numtransfers;
 	transfer_t	*transfers;
 
+	unsigned short *compactTransfers;	// -coarsebounce replacement for transfers
+	float		compactTransferScale;	// converts a quantized form factor back into a transfer
+
 	short		indices[3];				// displacement use these for subdivision
 };
 
@@ -290,6 +312,7 @@ extern bool g_bStaticPropPolys;
 extern bool g_bTextureShadows;
 extern bool g_bShowStaticPropNormals;
 extern bool g_bDisablePropSelfShadowing;
+extern bool g_bCoarseBounce;
 
 extern CUtlVector<char const *> g_NonShadowCastingMaterialStrings;
 extern void ForceTextureShadowsOnModel( const char *pModelName );
@@ -337,7 +360,6 @@ extern dface_t *g_pFaces;
 extern bool g_bMPIProps;
 
 extern	byte	nodehit[MAX_MAP_NODES];
-extern  float	gamma;
 extern	float	indirect_sun;
 extern	float	smoothing_threshold;
 extern	int		dlight_map;
@@ -386,6 +408,9 @@ inline byte PVSCheck( const byte *pvs, int iCluster )
 // outputs 1 in fractionVisible if no occlusion, 0 if full occlusion, and in-between values
 void TestLine( FourVectors const& start, FourVectors const& stop, fltx4 *pFractionVisible, int static_prop_index_to_ignore=-1);
 
+// same as TestLine, but traces 8 rays as one packet (two groups of 4)
+void TestLine8( FourVectors const start[2], FourVectors const stop[2], fltx4 pFractionVisible[2], int static_prop_index_to_ignore=-1);
+
 // returns 1 if the ray sees the sky, 0 if it doesn't, and in-between values for partial coverage
 void TestLine_DoesHitSky( FourVectors const& start, FourVectors const& stop,
                           fltx4 *pFractionVisible, bool canRecurse = true, int static_prop_to_skip=-1, bool bDoDebug = false );
@@ -416,7 +441,7 @@ bool RadWorld_Go();
 
 dleaf_t		*PointInLeaf (Vector const& point);
 int			ClusterFromPoint( Vector const& point );
-winding_t	*WindingFromFace (dface_t *f, Vector& origin );
+winding_t	*WindingFromFace (dface_t *f, const Vector& origin );
 
 void WriteWinding (FileHandle_t out, winding_t *w, Vector& color );
 void WriteNormal( FileHandle_t out, Vector const &nPos, Vector const &nDir, 
@@ -459,6 +484,11 @@ void GatherSampleLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int
 					   int nLFlags = 0,					// GATHERLFLAGS_xxx
 					   int static_prop_to_skip=-1,
 					   float flEpsilon = 0.0 );
+void GatherSampleLightSSE8( SSE_sampleLightOutput_t out[2], directlight_t *dl, int facenum, 
+							FourVectors const pos[2], FourVectors *pNormals[2], int normalCount, int iThread,
+							int nLFlags = 0,
+							int static_prop_to_skip=-1,
+							float flEpsilon = 0.0 );
 //void GatherSampleSkyLightSSE( SSE_sampleLightOutput_t &out, directlight_t *dl, int facenum, 
 //							 FourVectors const& pos, FourVectors *pNormals, int normalCount, int iThread,
 //							 int nLFlags = 0,
@@ -169,9 +169,9 @@ void CVRadDLL::GetBSPInfo( CBSPInfo *pInfo )
 
 bool CVRadDLL::DoIncrementalLight( char const *pVMFFile )
 {
-	char tempPath[MAX_PATH], tempFilename[MAX_PATH];
-	GetTempPath( sizeof( tempPath ), tempPath );
-	GetTempFileName( tempPath, "vmf_entities_", 0, tempFilename );
+	char tempFilename[MAX_PATH];
+	if ( !CmdLib_GetTempFileName( "vmf_entities_", tempFilename, sizeof( tempFilename ) ) )
+		return false;
 
 	FileHandle_t fp = g_pFileSystem->Open( tempFilename, "wb" );
 	if( !fp )
@@ -220,6 +220,110 @@ winding_t	*ChopWinding (winding_t *in, pstack_t *stack, plane_t *split)
 #pragma warning (default:4701)
 #endif
 
+/*
+==============
+FindSeperator
+
+Builds the candidate seperating plane through edge i of source and vertex j of
+pass, oriented so source is on the back side and pass on the front side.
+Returns false if the points don't make a seperating plane.
+==============
+*/
+static bool FindSeperator (winding_t *source, winding_t *pass, int i, int j, plane_t &plane)
+{
+	int			k, l;
+	Vector		v1, v2;
+	float		d;
+	vec_t		length;
+	int			counts[3];
+	bool		fliptest;
+
+	l = (i+1)%source->numpoints;
+	VectorSubtract (source->points[l] , source->points[i], v1);
+	VectorSubtract (pass->points[j], source->points[i], v2);
+
+	plane.normal[0] = v1[1]*v2[2] - v1[2]*v2[1];
+	plane.normal[1] = v1[2]*v2[0] - v1[0]*v2[2];
+	plane.normal[2] = v1[0]*v2[1] - v1[1]*v2[0];
+	
+// if points don't make a valid plane, skip it
+
+	length = plane.normal[0] * plane.normal[0]
+	+ plane.normal[1] * plane.normal[1]
+	+ plane.normal[2] * plane.normal[2];
+	
+	if (length < ON_VIS_EPSILON)
+		return false;
+
+	length = 1/sqrt(length);
+	
+	plane.normal[0] *= length;
+	plane.normal[1] *= length;
+	plane.normal[2] *= length;
+
+	plane.dist = DotProduct (pass->points[j], plane.normal);
+
+//
+// find out which side of the generated seperating plane has the
+// source portal
+//
+	fliptest = false;
+	for (k=0 ; k<source->numpoints ; k++)
+	{
+		if (k == i || k == l)
+			continue;
+		d = DotProduct (source->points[k], plane.normal) - plane.dist;
+		if (d < -ON_VIS_EPSILON)
+		{	// source is on the negative side, so we want all
+			// pass and target on the positive side
+			fliptest = false;
+			break;
+		}
+		else if (d > ON_VIS_EPSILON)
+		{	// source is on the positive side, so we want all
+			// pass and target on the negative side
+			fliptest = true;
+			break;
+		}
+	}
+	if (k == source->numpoints)
+		return false;		// planar with source portal
+
+//
+// flip the normal if the source portal is backwards
+//
+	if (fliptest)
+	{
+		VectorSubtract (vec3_origin, plane.normal, plane.normal);
+		plane.dist = -plane.dist;
+	}
+
+//
+// if all of the pass portal points are now on the positive side,
+// this is the seperating plane
+//
+	counts[0] = counts[1] = counts[2] = 0;
+	for (k=0 ; k<pass->numpoints ; k++)
+	{
+		if (k==j)
+			continue;
+		d = DotProduct (pass->points[k], plane.normal) - plane.dist;
+		if (d < -ON_VIS_EPSILON)
+			break;
+		else if (d > ON_VIS_EPSILON)
+			counts[0]++;
+		else
+			counts[2]++;
+	}
+	if (k != pass->numpoints)
+		return false;	// points on negative side, not a seperating plane
+		
+	if (!counts[0])
+		return false;	// planar with seperating plane
+
+	return true;
+}
+
 /*
 ==============
 ClipToSeperators
@@ -238,118 +342,20 @@ flipclip should be set.
 */
 winding_t	*ClipToSeperators (winding_t *source, winding_t *pass, winding_t *target, bool flipclip, pstack_t *stack)
 {
-	int			i, j, k, l;
+	int			i, j;
 	plane_t		plane;
-	Vector		v1, v2;
-	float		d;
-	vec_t		length;
-	int			counts[3];
-	bool		fliptest;
 
 // check all combinations	
 	for (i=0 ; i<source->numpoints ; i++)
 	{
-		l = (i+1)%source->numpoints;
-		VectorSubtract (source->points[l] , source->points[i], v1);
-
 	// fing a vertex of pass that makes a plane that puts all of the
 	// vertexes of pass on the front side and all of the vertexes of
 	// source on the back side
 		for (j=0 ; j<pass->numpoints ; j++)
 		{
-			VectorSubtract (pass->points[j], source->points[i], v2);
-
-			plane.normal[0] = v1[1]*v2[2] - v1[2]*v2[1];
-			plane.normal[1] = v1[2]*v2[0] - v1[0]*v2[2];
-			plane.normal[2] = v1[0]*v2[1] - v1[1]*v2[0];
-			
-		// if points don't make a valid plane, skip it
-
-			length = plane.normal[0] * plane.normal[0]
-			+ plane.normal[1] * plane.normal[1]
-			+ plane.normal[2] * plane.normal[2];
-			
-			if (length < ON_VIS_EPSILON)
+			if (!FindSeperator (source, pass, i, j, plane))
 				continue;
 
-			length = 1/sqrt(length);
-			
-			plane.normal[0] *= length;
-			plane.normal[1] *= length;
-			plane.normal[2] *= length;
-
-			plane.dist = DotProduct (pass->points[j], plane.normal);
-
-		//
-		// find out which side of the generated seperating plane has the
-		// source portal
-		//
-#if 1
-			fliptest = false;
-			for (k=0 ; k<source->numpoints ; k++)
-			{
-				if (k == i || k == l)
-					continue;
-				d = DotProduct (source->points[k], plane.normal) - plane.dist;
-				if (d < -ON_VIS_EPSILON)
-				{	// source is on the negative side, so we want all
-					// pass and target on the positive side
-					fliptest = false;
-					break;
-				}
-				else if (d > ON_VIS_EPSILON)
-				{	// source is on the positive side, so we want all
-					// pass and target on the negative side
-					fliptest = true;
-					break;
-				}
-			}
-			if (k == source->numpoints)
-				continue;		// planar with source portal
-#else
-			fliptest = flipclip;
-#endif
-		//
-		// flip the normal if the source portal is backwards
-		//
-			if (fliptest)
-			{
-				VectorSubtract (vec3_origin, plane.normal, plane.normal);
-				plane.dist = -plane.dist;
-			}
-#if 1
-		//
-		// if all of the pass portal points are now on the positive side,
-		// this is the seperating plane
-		//
-			counts[0] = counts[1] = counts[2] = 0;
-			for (k=0 ; k<pass->numpoints ; k++)
-			{
-				if (k==j)
-					continue;
-				d = DotProduct (pass->points[k], plane.normal) - plane.dist;
-				if (d < -ON_VIS_EPSILON)
-					break;
-				else if (d > ON_VIS_EPSILON)
-					counts[0]++;
-				else
-					counts[2]++;
-			}
-			if (k != pass->numpoints)
-				continue;	// points on negative side, not a seperating plane
-				
-			if (!counts[0])
-				continue;	// planar with seperating plane
-#else
-			k = (j+1)%pass->numpoints;
-			d = DotProduct (pass->points[k], plane.normal) - plane.dist;
-			if (d < -ON_VIS_EPSILON)
-				continue;
-			k = (j+pass->numpoints-1)%pass->numpoints;
-			d = DotProduct (pass->points[k], plane.normal) - plane.dist;
-			if (d < -ON_VIS_EPSILON)
-				continue;			
-#endif
 		//
 		// flip the normal if we want the back side
 		//
@@ -375,6 +381,157 @@ winding_t	*ClipToSeperators (winding_t *source, winding_t *pass, winding_t *targ
 }
 
 
+/*
+===============================================================================
+
+Seperator cache (-fast-exact)
+
+The seperating planes of two unclipped portal windings only depend on the pair
+of portals, and the same pairs come up over and over again as the flow walks
+different chains through the same leafs. Each thread looks the pair up in a
+shared open addressed table and only builds the planes on a miss. Slots are
+claimed with a compare and swap on the key and the plane list is published
+afterwards, so readers never block: a slot that's still being filled is
+treated as a miss.
+
+Pairs where either winding was clipped fall back to ClipToSeperators, so the
+result is identical to a normal full vis.
+
+===============================================================================
+*/
+
+bool g_bFastExact = false;
+
+#define SEPERATOR_CACHE_BITS		20
+#define SEPERATOR_CACHE_PROBES		8
+#define SEPERATOR_CACHE_MAX_BYTES	( 256 * 1024 * 1024 )
+
+struct seperatorlist_t
+{
+	int			numplanes;
+	plane_t		planes[1];			// variable sized
+};
+
+struct seperatorslot_t
+{
+	int64					key;	// ( source << 32 | pass ) + 1, 0 when empty
+	seperatorlist_t * volatile list;
+};
+
+static seperatorslot_t	*g_pSeperatorCache;
+static CInterlockedInt	g_nSeperatorCacheBytes;
+static CInterlockedInt	c_seperatorhits, c_seperatormisses;
+
+void InitSeperatorCache (void)
+{
+	g_pSeperatorCache = (seperatorslot_t *)calloc (1 << SEPERATOR_CACHE_BITS, sizeof(seperatorslot_t));
+	g_nSeperatorCacheBytes = 0;
+	c_seperatorhits = 0;
+	c_seperatormisses = 0;
+}
+
+void FreeSeperatorCache (void)
+{
+	if (!g_pSeperatorCache)
+		return;
+
+	Msg ("Seperator cache: %d hits, %d misses, %.1f MB\n", (int)c_seperatorhits, (int)c_seperatormisses,
+		(int)g_nSeperatorCacheBytes / (1024.0f * 1024.0f));
+
+	for (int i=0 ; i<(1 << SEPERATOR_CACHE_BITS) ; i++)
+	{
+		free (g_pSeperatorCache[i].list);
+	}
+	free (g_pSeperatorCache);
+	g_pSeperatorCache = NULL;
+}
+
+static seperatorlist_t *BuildSeperatorList (winding_t *source, winding_t *pass)
+{
+	int maxplanes = source->numpoints * pass->numpoints;
+	seperatorlist_t *list = (seperatorlist_t *)malloc (sizeof(seperatorlist_t) + (maxplanes - 1) * sizeof(plane_t));
+
+	list->numplanes = 0;
+	for (int i=0 ; i<source->numpoints ; i++)
+	{
+		for (int j=0 ; j<pass->numpoints ; j++)
+		{
+			if (FindSeperator (source, pass, i, j, list->planes[list->numplanes]))
+				list->numplanes++;
+		}
+	}
+	return list;
+}
+
+// Returns NULL if the pair isn't cached and couldn't be added
+static seperatorlist_t *FindSeperatorList (portal_t *source, portal_t *pass)
+{
+	int64 key = ( ( (int64)( source - portals ) << 32 ) | ( pass - portals ) ) + 1;
+	uint64 hash = (uint64)key * 0x9E3779B97F4A7C15ull;
+	int mask = ( 1 << SEPERATOR_CACHE_BITS ) - 1;
+	int slot = (int)( hash >> ( 64 - SEPERATOR_CACHE_BITS ) );
+
+	for (int probe=0 ; probe<SEPERATOR_CACHE_PROBES ; probe++, slot = ( slot + 1 ) & mask)
+	{
+		seperatorslot_t *s = &g_pSeperatorCache[slot];
+		if (s->key == key)
+		{
+			seperatorlist_t *list = s->list;
+			if (list)
+				++c_seperatorhits;
+			return list;
+		}
+
+		if (s->key != 0 || !ThreadInterlockedAssignIf64 (&s->key, key, 0))
+		{
+			// Somebody else may have just claimed it for this same pair
+			if (s->key == key)
+				return NULL;
+			continue;
+		}
+
+		// We own the slot, fill it in
+		++c_seperatormisses;
+		if (g_nSeperatorCacheBytes > SEPERATOR_CACHE_MAX_BYTES)
+			return NULL;
+
+		seperatorlist_t *list = BuildSeperatorList (source->winding, pass->winding);
+		g_nSeperatorCacheBytes += sizeof(seperatorlist_t) + list->numplanes * sizeof(plane_t);
+		ThreadMemoryBarrier ();
+		s->list = list;
+		return list;
+	}
+
+	return NULL;
+}
+
+winding_t *ClipToSeperatorsCached (portal_t *psource, winding_t *source, portal_t *ppass, winding_t *pass, winding_t *target, bool flipclip, pstack_t *stack)
+{
+	if (!g_pSeperatorCache || source != psource->winding || pass != ppass->winding)
+		return ClipToSeperators (source, pass, target, flipclip, stack);
+
+	seperatorlist_t *list = FindSeperatorList (psource, ppass);
+	if (!list)
+		return ClipToSeperators (source, pass, target, flipclip, stack);
+
+	for (int i=0 ; i<list->numplanes ; i++)
+	{
+		plane_t plane = list->planes[i];
+		if (flipclip)
+		{
+			VectorSubtract (vec3_origin, plane.normal, plane.normal);
+			plane.dist = -plane.dist;
+		}
+
+		target = ChopWinding (target, stack, &plane);
+		if (!target)
+			return NULL;		// target is not visible
+	}
+
+	return target;
+}
+
+
 class CPortalTrace
 {
 public:
@@ -604,11 +761,11 @@ void RecursiveLeafFlow (int leafnum, threaddata_t *thread, pstack_t *prevstack)
 			continue;
 		}
 
-		stack.pass = ClipToSeperators (stack.source, prevstack->pass, stack.pass, false, &stack);
+		stack.pass = ClipToSeperatorsCached (thread->base, stack.source, prevstack->portal, prevstack->pass, stack.pass, false, &stack);
 		if (!stack.pass)
 			continue;
 		
-		stack.pass = ClipToSeperators (prevstack->pass, stack.source, stack.pass, true, &stack);
+		stack.pass = ClipToSeperatorsCached (prevstack->portal, prevstack->pass, thread->base, stack.source, stack.pass, true, &stack);
 		if (!stack.pass)
 			continue;
 
@@ -6,7 +6,13 @@
 //
 //=============================================================================//
 
+#ifdef _WIN32
 #include <windows.h>
+#include <conio.h>
+#else
+#include <sys/select.h>
+#include <unistd.h>
+#endif
 #include "vis.h"
 #include "threads.h"
 #include "stdlib.h"
@@ -20,7 +26,6 @@
 #include "threadhelpers.h"
 #include "vstdlib/random.h"
 #include "vmpi_tools_shared.h"
-#include <conio.h>
 #include "scratchpad_helpers.h"
 #include "tier0/fasttimer.h"
 
@@ -53,9 +58,9 @@ CCycleCount g_CPUTime;
 ISocket *g_pPortalMCSocket = NULL;
 CIPAddr g_PortalMCAddr;
 bool g_bGotMCAddr = false;
-HANDLE g_hMCThread = NULL;
+ThreadHandle_t g_hMCThread = NULL;
 CEvent g_MCThreadExitEvent;
-unsigned long g_PortalMCThreadUniqueID = 0;
+uint32 g_PortalMCThreadUniqueID = 0;	// Fixed size so the packet layout in PortalMCThreadFn matches on every platform.
 int g_nMulticastPortalsReceived = 0;
 
 
@@ -114,8 +119,8 @@ void VMPI_DeletePortalMCSocket()
 	if ( g_hMCThread )
 	{
 		g_MCThreadExitEvent.SetEvent();
-		WaitForSingleObject( g_hMCThread, INFINITE );
-		CloseHandle( g_hMCThread );
+		ThreadJoin( g_hMCThread );
+		ReleaseThreadHandle( g_hMCThread );
 		g_hMCThread = NULL;
 	}
 
@@ -348,13 +353,13 @@ void ReceivePortalFlow( uint64 iWorkUnit, MessageBuffer *pBuf, int iWorker )
 }
 
 
-DWORD WINAPI PortalMCThreadFn( LPVOID p )
+static uintp PortalMCThreadFn( void *p )
 {
 	CUtlVector<char> data;
 	data.SetSize( portalbytes + 128 );
 
-	DWORD waitTime = 0;
-	while ( WaitForSingleObject( g_MCThreadExitEvent.GetEventHandle(), waitTime ) != WAIT_OBJECT_0 )
+	unsigned long waitTime = 0;
+	while ( !g_MCThreadExitEvent.Wait( waitTime ) )
 	{
 		CIPAddr ipFrom;
 		int len = g_pPortalMCSocket->RecvFrom( data.Base(), data.Count(), &ipFrom );
@@ -370,7 +375,7 @@ DWORD WINAPI PortalMCThreadFn( LPVOID p )
 				// Perform more validation...
 				if ( data[0] == VMPI_VVIS_PACKET_ID && data[1] == VMPI_PORTALFLOW_RESULTS )
 				{
-					if ( *((unsigned long*)&data[2]) == g_PortalMCThreadUniqueID )
+					if ( *((uint32*)&data[2]) == g_PortalMCThreadUniqueID )
 					{
 						int iWorkUnit = *((int*)&data[6]);
 						if ( iWorkUnit >= 0 && iWorkUnit < g_numportals*2 )
@@ -398,6 +403,40 @@ void MCThreadCleanupFn()
 {
 	g_MCThreadExitEvent.SetEvent();
 }
+
+
+// Non-blocking console input for the early-exit menu.
+#ifdef _WIN32
+static bool VVIS_KeyHit()
+{
+	return kbhit() != 0;
+}
+
+static int VVIS_GetKey()
+{
+	return getch();
+}
+#else
+static bool VVIS_KeyHit()
+{
+	fd_set readSet;
+	FD_ZERO( &readSet );
+	FD_SET( STDIN_FILENO, &readSet );
+
+	timeval tv = { 0, 0 };
+	return select( STDIN_FILENO + 1, &readSet, NULL, NULL, &tv ) > 0;
+}
+
+static int VVIS_GetKey()
+{
+	// The terminal is line buffered here, so keys arrive once they press enter.
+	char ch;
+	if ( read( STDIN_FILENO, &ch, 1 ) != 1 )
+		return 0;
+
+	return ch;
+}
+#endif
 		
 
 // --------------------------------------------------------------------------------- //
@@ -416,9 +455,9 @@ public:
 	
 	virtual bool Update()
 	{
-		if ( kbhit() )
+		if ( VVIS_KeyHit() )
 		{
-			int key = toupper( getch() );
+			int key = toupper( VVIS_GetKey() );
 			if ( m_iState == STATE_NONE )
 			{
 				if ( key == 'M' )
@@ -525,7 +564,7 @@ void RunMPIPortalFlow()
 		StartPacifier("");
 
 	// Workers wait until we get the MC socket address.
-	g_PortalMCThreadUniqueID = StatsDB_GetUniqueJobID();
+	g_PortalMCThreadUniqueID = (uint32)StatsDB_GetUniqueJobID();
 	if ( g_bMPIMaster )
 	{
 		CCycleCount cnt;
@@ -573,23 +612,15 @@ void RunMPIPortalFlow()
 		}
 
 		// Make a thread to listen for the data on the multicast socket.
-		DWORD dwDummy = 0;
 		g_MCThreadExitEvent.Init( false, false );
 
 		// Make sure we kill the MC thread if the app exits ungracefully.
 		CmdLib_AtCleanup( MCThreadCleanupFn );
 		
-		g_hMCThread = CreateThread( 
-			NULL,
-			0,
-			PortalMCThreadFn,
-			NULL,
-			0,
-			&dwDummy );
-
+		g_hMCThread = CreateSimpleThread( PortalMCThreadFn, NULL );
 		if ( !g_hMCThread )
 		{
-			Error( "RunMPIPortalFlow: CreateThread failed for multicast receive thread." );
+			Error( "RunMPIPortalFlow: CreateSimpleThread failed for multicast receive thread." );
 		}			
 	}
 
@@ -113,6 +113,10 @@ void LeafFlow (int leafnum);
 void BasePortalVis (int iThread, int portalnum);
 void BetterPortalVis (int portalnum);
 void PortalFlow (int iThread, int portalnum);
+
+extern bool g_bFastExact;			// share seperating planes of unclipped portal pairs between threads
+void InitSeperatorCache (void);
+void FreeSeperatorCache (void);
 void WritePortalTrace( const char *source );
 
 extern	portal_t	*sorted_portals[MAX_MAP_PORTALS*2];
@@ -7,7 +7,9 @@
 //=============================================================================//
 // vis.c
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include "vis.h"
 #include "threads.h"
 #include "stdlib.h"
@@ -84,7 +86,7 @@ winding_t *NewWinding (int points)
 	if (points > MAX_POINTS_ON_WINDING)
 		Error ("NewWinding: %i points, max %d", points, MAX_POINTS_ON_WINDING);
 	
-	size = (int)(&((winding_t *)0)->points[points]);
+	size = (int)( offsetof( winding_t, points ) + points * sizeof( Vector ) );
 	w = (winding_t*)malloc (size);
 	memset (w, 0, size);
 	
@@ -310,11 +312,24 @@ void CalcPortalVis (void)
 	else 
 #endif
 	{
+		if ( g_bFastExact )
+		{
+			InitSeperatorCache();
+		}
+
 		RunThreadsOnIndividual (g_numportals*2, true, PortalFlow);
+
+		FreeSeperatorCache();
 	}
 }
 
 
+static void PrintPassTime( const char *pPassName, double flStart )
+{
+	Msg( "%s: %.2f seconds\n", pPassName, Plat_FloatTime() - flStart );
+}
+
+
 void CalcVisTrace (void)
 {
     RunThreadsOnIndividual (g_numportals*2, true, BasePortalVis);
@@ -332,6 +347,7 @@ CalcVis
 void CalcVis (void)
 {
 	int		i;
+	double	flStart = Plat_FloatTime();
 
 #ifdef MPI
 	if (g_bUseMPI) 
@@ -343,10 +359,17 @@ void CalcVis (void)
 	{
 	    RunThreadsOnIndividual (g_numportals*2, true, BasePortalVis);
 	}
+	PrintPassTime( "BasePortalVis", flStart );
 
+	flStart = Plat_FloatTime();
 	SortPortals ();
+	PrintPassTime( "SortPortals", flStart );
 
+	flStart = Plat_FloatTime();
 	CalcPortalVis ();
+	PrintPassTime( "PortalFlow", flStart );
+
+	flStart = Plat_FloatTime();
 
 	//
 	// assemble the leaf vis lists by oring the portal lists
@@ -362,6 +385,7 @@ void CalcVis (void)
 	{
 		count += CompressAndCrosscheckClusterVis( i );
 	}
+	PrintPassTime( "ClusterMerge", flStart );
 
 		
 	Msg ("Optimized: %d visible clusters (%.2f%%)\n", count, count*100.0/totalvis);
@@ -423,15 +447,10 @@ void LoadPortals (char *name)
 	{
 		// If we're using MPI, copy off the file to a temporary first. This will download the file
 		// from the MPI master, then we get to use nice functions like fscanf on it.
-		char tempPath[MAX_PATH], tempFile[MAX_PATH];
-		if ( GetTempPath( sizeof( tempPath ), tempPath ) == 0 )
+		char tempFile[MAX_PATH];
+		if ( !CmdLib_GetTempFileName( "vvis_portal_", tempFile, sizeof( tempFile ) ) )
 		{
-			Error( "LoadPortals: GetTempPath failed.\n" );
-		}
-
-		if ( GetTempFileName( tempPath, "vvis_portal_", 0, tempFile ) == 0 )
-		{
-			Error( "LoadPortals: GetTempFileName failed.\n" );
+			Error( "LoadPortals: CmdLib_GetTempFileName failed.\n" );
 		}
 
 		// Read all the data from the network file into memory.
@@ -922,6 +941,11 @@ int ParseCommandLine( int argc, char **argv )
 			numthreads = atoi (argv[i+1]);
 			i++;
 		}
+		else if (!Q_stricmp(argv[i], "-fast-exact"))
+		{
+			Msg ("fast-exact = true\n");
+			g_bFastExact = true;
+		}
 		else if (!Q_stricmp(argv[i], "-fast"))
 		{
 			Msg ("fastvis = true\n");
@@ -1024,6 +1048,8 @@ void PrintUsage( int argc, char **argv )
 		"\n"
 		"  -v (or -verbose): Turn on verbose output (also shows more command\n"
 		"  -fast           : Only do first quick pass on vis calculations.\n"
+		"  -fast-exact     : Full vis, sharing seperating planes between threads. Same result\n"
+		"                    as a normal vis, but faster.\n"
 #ifdef MPI
 		"  -mpi            : Use VMPI to distribute computations.\n"
 #endif
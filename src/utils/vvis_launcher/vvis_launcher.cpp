@@ -8,8 +8,10 @@
 // vvis_launcher.cpp : Defines the entry point for the console application.
 //
 
-#include "stdafx.h"
+#include "StdAfx.h"
+#ifdef _WIN32
 #include <direct.h>
+#endif
 #include "tier1/strtools.h"
 #include "tier0/icommandline.h"
 #include "ilaunchabledll.h"
@@ -20,6 +22,7 @@ char* GetLastErrorString()
 {
 	static char err[2048];
 	
+#ifdef _WIN32
 	LPVOID lpMsgBuf;
 	FormatMessage( 
 		FORMAT_MESSAGE_ALLOCATE_BUFFER | 
@@ -35,6 +38,10 @@ char* GetLastErrorString()
 
 	strncpy( err, (char*)lpMsgBuf, sizeof( err ) );
 	LocalFree( lpMsgBuf );
+#else
+	const char *pError = dlerror();
+	strncpy( err, pError ? pError : "", sizeof( err ) );
+#endif
 
 	err[ sizeof( err ) - 1 ] = 0;
 